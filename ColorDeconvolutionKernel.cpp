@@ -23,8 +23,8 @@
  *=============================================================================*/
 
 #include "ColorDeconvolutionKernel.h"
-#include "ODConversion.h"
-#include "StainVectorMath.h"
+#include "ImagePixelAccess.h"
+#include "SharedConstantTiles.h"
 
 namespace sedeen {
 namespace image {
@@ -38,163 +38,136 @@ namespace tile {
 	ColorDeconvolution::ColorDeconvolution( DisplayOptions displayOption, 
         std::shared_ptr<StainProfile> theProfile, 
         bool applyThreshold, double threshold, bool stainQuantityOnly /*= false*/) :
-        m_applyThreshold(applyThreshold),
-		m_threshold(threshold),
-		m_DisplayOption(displayOption),
-        m_stainProfile(theProfile),
-        m_grayscaleQuantityOnly(stainQuantityOnly),
-        m_grayscaleNormFactor(100.0),
-        m_outputColorSpace(ColorModel::RGBA, ChannelType::UInt8) //initialize a default value
+        ColorDeconvolution(std::make_shared<const DeconvolutionPlan>(theProfile, 
+            static_cast<int>(displayOption), applyThreshold, threshold, stainQuantityOnly))
 	{
-        //If m_grayscaleQuantityOnly is true, set m_outputColorSpace to grayscale
-        if (GetGrayscaleQuantityOnly()) {
+	}//end constructor
+
+    ColorDeconvolution::ColorDeconvolution(std::shared_ptr<const DeconvolutionPlan> thePlan,
+        std::shared_ptr<TileCacheBudget> cacheBudget /*= nullptr*/) :
+        m_outputColorSpace(ColorModel::RGBA, ChannelType::UInt8), //initialize a default value
+        m_plan(thePlan),
+        m_cacheBudget(cacheBudget)
+    {
+        //If the plan outputs grayscale quantities only, set m_outputColorSpace to grayscale
+        if ((m_plan != nullptr) && m_plan->GetGrayscaleQuantityOnly()) {
             SetOutputColorSpace(GrayscaleColorSpace);
         }
         else {
             SetOutputColorSpace(RGBAColorSpace);
         }
-	}//end constructor
+    }//end plan constructor
+
+    ColorDeconvolution::ColorDeconvolution(std::shared_ptr<const DeconvolutionLUT> theLUT,
+        std::shared_ptr<TileCacheBudget> cacheBudget /*= nullptr*/) :
+        ColorDeconvolution((theLUT != nullptr) ? theLUT->GetPlan() : nullptr, cacheBudget)
+    {
+        //Only use tables that could be built for the plan
+        if ((theLUT != nullptr) && theLUT->IsValid()) {
+            m_lut = theLUT;
+        }
+    }//end lookup table constructor
 
     ColorDeconvolution::~ColorDeconvolution(void) {
     }//end destructor
 
-	RawImage ColorDeconvolution::separateStains(const RawImage &source, double (&stainVec_matrix)[9])
+	RawImage ColorDeconvolution::separateStains(const RawImage &source) const
 	{
         int scaleMax = 255;
-        // initialize 3 output color images and 3 grayscale images
-        sedeen::Size imageSize = source.size();
-        std::vector<RawImage> colorImages;
-        std::vector<RawImage> grayscaleImages;
-        for (int i = 0; i < 3; i++) {
-            //Color images: adjust pixel value, assign
-            colorImages.push_back(RawImage(imageSize, RGBAColorSpace));
-            colorImages[i].fill(ChannelValue(0)); //ChannelValue is a std::variant, so values can be retrieved as multiple types
-            //Grayscale images: adjust pixel value, assign
-            grayscaleImages.push_back(RawImage(imageSize, GrayscaleColorSpace));
-            grayscaleImages[i].fill(ChannelValue(0));
+        const DeconvolutionPlan &plan = *m_plan;
+        //Only the requested stain is computed, using its row of the inverse matrix
+        const int displayStain = plan.GetDisplayStain();
+        if ((displayStain < DisplayOptions::STAIN1) || (displayStain > DisplayOptions::STAIN3)) {
+            return source;
         }
+        const bool grayscaleOnly = plan.GetGrayscaleQuantityOnly();
+        sedeen::Size imageSize = source.size();
 
-        //The inverse can't be calculated if there is a row of zeros. Replace these values first.
-        //If there is a row of zeros, replace it. Use the default replacement row.
-        double noZeroRowsMatrix[9] = { 0.0 };
-        StainVectorMath::ConvertZeroRowsToUnitary(stainVec_matrix, noZeroRowsMatrix);
-
-        //Get the inverse of the noZeroRowsMatrix
-        double inverse_matrix[9] = { 0.0 };
-        StainVectorMath::Compute3x3MatrixInverse(noZeroRowsMatrix, inverse_matrix);
-
-        //Perform faster color -> OD conversion with a lookup table
-        std::shared_ptr<ODConversion> converter = std::make_shared<ODConversion>();
+        //Glass below the threshold: return the shared background tile without allocating
+        if (isInterleavedUInt8(source) && plan.IsBackground(rawPixels(source), source.colorSpace().channelCount(),
+            static_cast<long long>(imageSize.width()) * imageSize.height())) {
+            unsigned char background[4] = { 0, 0, 0, 0 };
+            plan.SeparateQuantity(0.0, background);
+            return SharedConstantTiles::Get(imageSize, m_outputColorSpace, background);
+        }
+
+        //Allocate only the one output image, every pixel of which is written below
+        RawImage outputImage(imageSize, m_outputColorSpace);
+
+        //Fast path: contiguous interleaved UInt8 rows, direct stores
+        if (isInterleavedUInt8(source)) {
+            const int width = imageSize.width();
+            const int srcChannels = source.colorSpace().channelCount();
+            const int outChannels = plan.GetOutputChannels();
+            const unsigned char *src = rawPixels(source);
+            unsigned char *dst = rawPixels(outputImage);
+            if (m_lut != nullptr) {
+                for (int y = 0; y < imageSize.height(); y++) {
+                    m_lut->SeparateRow(src + y * width * srcChannels, srcChannels, width, dst + y * width * outChannels);
+                }
+                return outputImage;
+            }
+            for (int y = 0; y < imageSize.height(); y++) {
+                plan.SeparateRow(src + y * width * srcChannels, srcChannels, width, dst + y * width * outChannels);
+            }
+            return outputImage;
+        }
 
-        //loop over all pixels in the given RawImage		
+        //Fallback for other channel types or layouts: loop over all pixels in the given RawImage		
 		int y = 0, x = 0;
         for (int j = 0; j < imageSize.width()*imageSize.height(); j++) {
 			x = j%imageSize.width();
 			y = j/imageSize.width();
 
 			// log transform the source RGB data
-            int R = source.at(x, y, 0).as<int>();
-            int G = source.at(x, y, 1).as<int>();
-            int B = source.at(x, y, 2).as<int>();
             double pixelOD[3]; //index is color channel
-            pixelOD[0] = converter->LookupRGBtoOD(R);
-            pixelOD[1] = converter->LookupRGBtoOD(G);
-            pixelOD[2] = converter->LookupRGBtoOD(B);
-
-            //The resulting RGB values for the three images
-            double RGB_sep[9] = { 0.0 };
-            double stainQuant[3] = { 0.0 };
-            GetSeparateColorsForPixel(pixelOD, RGB_sep, stainQuant, stainVec_matrix, inverse_matrix);
-
-            for (int i = 0; i < 3; i++) { //i index is stain
-                colorImages.at(i).setValue(x, y, 0, static_cast<int>(RGB_sep[i * 3    ]));
-                colorImages.at(i).setValue(x, y, 1, static_cast<int>(RGB_sep[i * 3 + 1]));
-                colorImages.at(i).setValue(x, y, 2, static_cast<int>(RGB_sep[i * 3 + 2]));
-                colorImages.at(i).setValue(x, y, 3, scaleMax);
-                int sq = static_cast<int>(stainQuant[i] * m_grayscaleNormFactor);
-                grayscaleImages.at(i).setValue(x, y, 0, sq);
-            }
-		}//end for each pixel
-
-        //Return the requested stain image
-        //Either colorImages, or if GrayscaleQuantityOnly is true, grayscaleImages
-		if( m_DisplayOption == DisplayOptions::STAIN1 ){
-			return GetGrayscaleQuantityOnly() ? grayscaleImages[0] : colorImages[0];
-        }
-		else if( m_DisplayOption == DisplayOptions::STAIN2 ){
-			return GetGrayscaleQuantityOnly() ? grayscaleImages[1] : colorImages[1];
-        }
-		else if( m_DisplayOption == DisplayOptions::STAIN3 ){
-			return GetGrayscaleQuantityOnly() ? grayscaleImages[2] : colorImages[2];
-        }
-        else {
-            return source;
-        }
-	}//end separateStains
-
-    void ColorDeconvolution::GetSeparateColorsForPixel(double(&pixelOD)[3], double(&RGB_sep)[9],
-        double(&stainVec_matrix)[9], double(&inverse_matrix)[9]) {
-        double quant[3] = { 0.0 }; //allocated but not accessible when using this overload
-        GetSeparateColorsForPixel(pixelOD, RGB_sep, quant, stainVec_matrix, inverse_matrix);
-    }//end GetSeparateColorsForPixel
-
-    void ColorDeconvolution::GetSeparateColorsForPixel(double (&pixelOD)[3], double (&RGB_sep)[9], 
-        double(&outQuant)[3], double (&stainVec_matrix)[9], double (&inverse_matrix)[9]) {
-        //Determine how much of each stain is present at a pixel
-        double stainQuantity[3] = { 0.0 }; //index is stain number
-        StainVectorMath::Multiply3x3MatrixAndVector(inverse_matrix, pixelOD, stainQuantity);
-
-        for (int i = 0; i < 3; i++) { //i index is stain
-            //Scale the stain's OD by the amount of stain at this pixel, get the RGB values
-            double OD_scaled[3]; //index is color channel
-
-            //Don't allow negative stain quantities
-            stainQuantity[i] = (stainQuantity[i] > 0.0) ? stainQuantity[i] : 0.0;
-
-            OD_scaled[0] = (stainQuantity[i]) * stainVec_matrix[i * 3];
-            OD_scaled[1] = (stainQuantity[i]) * stainVec_matrix[i * 3 + 1];
-            OD_scaled[2] = (stainQuantity[i]) * stainVec_matrix[i * 3 + 2];
-
-            double OD_sum = OD_scaled[0] + OD_scaled[1] + OD_scaled[2];
-            //Determine if the threshold should be applied to this stain's pixel value
-            bool isAboveThreshold;
-            if (m_applyThreshold) {
-                isAboveThreshold = (OD_sum > m_threshold) ? true : false;
+            pixelOD[0] = plan.LookupRGBtoOD(source.at(x, y, 0).as<int>());
+            pixelOD[1] = plan.LookupRGBtoOD(source.at(x, y, 1).as<int>());
+            pixelOD[2] = plan.LookupRGBtoOD(source.at(x, y, 2).as<int>());
+
+            //The resulting RGB values and quantity for the displayed stain
+            double RGB_sep[3] = { 0.0 };
+            double stainQuant = 0.0;
+            plan.SeparateStainForPixel(pixelOD, displayStain, RGB_sep, stainQuant);
+
+            if (grayscaleOnly) {
+                int sq = static_cast<int>(stainQuant * plan.GetGrayscaleNormFactor());
+                outputImage.setValue(x, y, 0, (sq > 255) ? 255 : sq);
             }
             else {
-                isAboveThreshold = true;
+                outputImage.setValue(x, y, 0, static_cast<int>(RGB_sep[0]));
+                outputImage.setValue(x, y, 1, static_cast<int>(RGB_sep[1]));
+                outputImage.setValue(x, y, 2, static_cast<int>(RGB_sep[2]));
+                outputImage.setValue(x, y, 3, scaleMax);
             }
+		}//end for each pixel
+        return outputImage;
+	}//end separateStains
 
-            if (isAboveThreshold) {
-                RGB_sep[i * 3    ] = ODConversion::ConvertODtoRGB(OD_scaled[0]);
-                RGB_sep[i * 3 + 1] = ODConversion::ConvertODtoRGB(OD_scaled[1]);
-                RGB_sep[i * 3 + 2] = ODConversion::ConvertODtoRGB(OD_scaled[2]);
-                outQuant[i] = stainQuantity[i];
-            }
-            else {
-                RGB_sep[i * 3    ] = 0.0;
-                RGB_sep[i * 3 + 1] = 0.0;
-                RGB_sep[i * 3 + 2] = 0.0;
-                outQuant[i] = 0.0;
-            }
-        }
-    }//end GetSeparateColorsForPixel
-
-    RawImage ColorDeconvolution::thresholdOnly(const RawImage &source) {
+    RawImage ColorDeconvolution::thresholdOnly(const RawImage &source) const {
         int scaleMax = 255;
-        // initialize 3 output images
+        const DeconvolutionPlan &plan = *m_plan;
+        //The three stain images of a single-stain profile are identical, so only one is built
+        const int displayStain = plan.GetDisplayStain();
+        if ((displayStain < DisplayOptions::STAIN1) || (displayStain > DisplayOptions::STAIN3)) {
+            return source;
+        }
         sedeen::Size imageSize = source.size();
-        std::vector<RawImage> colorImages;
-        for (int i = 0; i < 3; i++) {
-            //Color images: adjust pixel value, assign
-            colorImages.push_back(RawImage(imageSize, ColorSpace(ColorModel::RGBA, ChannelType::UInt8)));
-            colorImages[i].fill(ChannelValue(0)); //ChannelValue is a std::variant, allowing data to be multiple types
+        RawImage outputImage(imageSize, RGBAColorSpace);
+
+        //Fast path: contiguous interleaved UInt8 rows, direct stores
+        if (isInterleavedUInt8(source)) {
+            const int width = imageSize.width();
+            const int srcChannels = source.colorSpace().channelCount();
+            const unsigned char *src = rawPixels(source);
+            unsigned char *dst = rawPixels(outputImage);
+            for (int y = 0; y < imageSize.height(); y++) {
+                plan.ThresholdRow(src + y * width * srcChannels, srcChannels, width, dst + y * width * 4);
+            }
+            return outputImage;
         }
 
-        //Perform faster OD conversions using a lookup table
-        std::shared_ptr<ODConversion> converter = std::make_shared<ODConversion>();
-
-        //Calculate the OD sum to compare to the threshold
+        //Fallback for other channel types or layouts: calculate the OD sum to compare to the threshold
         int y = 0, x = 0;
         for (int j = 0; j < imageSize.width()*imageSize.height(); j++) {
             x = j % imageSize.width();
@@ -204,72 +177,43 @@ namespace tile {
             int R = source.at(x, y, 0).as<int>();
             int G = source.at(x, y, 1).as<int>();
             int B = source.at(x, y, 2).as<int>();
-            double pixelOD[3]; //index is color channel
-            pixelOD[0] = converter->LookupRGBtoOD(R);
-            pixelOD[1] = converter->LookupRGBtoOD(G);
-            pixelOD[2] = converter->LookupRGBtoOD(B);
             //Get the total OD at the pixel
-            double OD_sum = pixelOD[0] + pixelOD[1] + pixelOD[2];
+            double OD_sum = plan.LookupRGBtoOD(R) + plan.LookupRGBtoOD(G) + plan.LookupRGBtoOD(B);
 
-            bool isAboveThreshold;
-            if (m_applyThreshold) {
-                isAboveThreshold = (OD_sum > m_threshold) ? true : false;
+            //If the pixel was determined to be above threshold, add it to the image
+            if (plan.IsAboveThreshold(OD_sum)) {
+                outputImage.setValue(x, y, 0, R);
+                outputImage.setValue(x, y, 1, G);
+                outputImage.setValue(x, y, 2, B);
             }
             else {
-                isAboveThreshold = true;
+                outputImage.setValue(x, y, 0, 0);
+                outputImage.setValue(x, y, 1, 0);
+                outputImage.setValue(x, y, 2, 0);
             }
-
-            //If the pixel was determined to be above threshold, add it to the images
-            for (int i = 0; i < 3; i++) {
-                if (isAboveThreshold) {
-                    colorImages.at(i).setValue(x, y, 0, static_cast<int>(R));
-                    colorImages.at(i).setValue(x, y, 1, static_cast<int>(G));
-                    colorImages.at(i).setValue(x, y, 2, static_cast<int>(B));
-                    colorImages.at(i).setValue(x, y, 3, scaleMax);
-                }
-                else {
-                    colorImages.at(i).setValue(x, y, 0, 0);
-                    colorImages.at(i).setValue(x, y, 1, 0);
-                    colorImages.at(i).setValue(x, y, 2, 0);
-                    colorImages.at(i).setValue(x, y, 3, scaleMax);
-                }
-            }
-        }
-
-        //Return the requested stain image
-        if (m_DisplayOption == DisplayOptions::STAIN1) {
-            return colorImages[0];
-        }
-        else if (m_DisplayOption == DisplayOptions::STAIN2) {
-            return colorImages[1];
-        }
-        else if (m_DisplayOption == DisplayOptions::STAIN3) {
-            return colorImages[2];
-        }
-        else {
-            return source;
+            outputImage.setValue(x, y, 3, scaleMax);
         }
+        return outputImage;
     }//end thresholdOnly
 
 	RawImage ColorDeconvolution::doProcessData(const RawImage &source)
 	{
-        double stainVec_matrix[9] = { 0.0 };
-        //Fill stainVec_matrix with the stain vector profile values
-        bool checkResult = m_stainProfile->GetNormalizedProfilesAsDoubleArray(stainVec_matrix);
+        if (m_cacheBudget != nullptr) {
+            m_cacheBudget->ObserveTile(source.width(), source.height());
+        }
+        //The plan was compiled when the kernel was built; only read it here
+        if ((m_plan == nullptr) || !m_plan->IsValid()) {
+            return source;
+        }
         //Get the number of stains in the profile
-        int numStains = m_stainProfile->GetNumberOfStainComponents();
-        if (checkResult) {
-            //Is number of stains set to 1? Threshold only if so
-            if (numStains == 1) {
-                return thresholdOnly(source);
-            }
-            else if (numStains == 2 || numStains == 3) {
-                //Stain separation and thresholding
-                return separateStains(source, stainVec_matrix);
-            }
-            else {
-                return source;
-            }
+        int numStains = m_plan->GetNumberOfStains();
+        //Is number of stains set to 1? Threshold only if so
+        if (numStains == 1) {
+            return thresholdOnly(source);
+        }
+        else if (numStains == 2 || numStains == 3) {
+            //Stain separation and thresholding
+            return separateStains(source);
         }
         else {
             return source;
@@ -283,4 +227,4 @@ namespace tile {
 
 } // namespace tile
 } // namespace image
-} // namespace sedeen
\ No newline at end of file
+} // namespace sedeen
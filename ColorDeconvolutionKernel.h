@@ -34,10 +34,14 @@
 #include <cstdio>
 #include <sstream>
 #include <memory>
+#include <vector>
 #include <filesystem> //Requires C++17
 
 //Plugin includes
 #include "StainProfile.h"
+#include "DeconvolutionPlan.h"
+#include "DeconvolutionLUT.h"
+#include "TileCacheBudget.h"
 
 namespace sedeen {
 
@@ -67,46 +71,46 @@ namespace tile {
         explicit ColorDeconvolution(DisplayOptions displayOption, std::shared_ptr<StainProfile>, 
             bool applyThreshold, double threshold, bool stainQuantityOnly = false);
 
+        /// Creates a colour deconvolution Kernel from an already compiled plan,
+        /// which may be shared with other kernels. If a cache budget is given,
+        /// the size of every source tile is reported to it.
+        explicit ColorDeconvolution(std::shared_ptr<const DeconvolutionPlan> thePlan,
+            std::shared_ptr<TileCacheBudget> cacheBudget = nullptr);
+
+        /// Creates a colour deconvolution Kernel that reads its output from precomputed
+        /// lookup tables; the tables and their plan may be shared with other kernels
+        explicit ColorDeconvolution(std::shared_ptr<const DeconvolutionLUT> theLUT,
+            std::shared_ptr<TileCacheBudget> cacheBudget = nullptr);
+
 		virtual ~ColorDeconvolution();
 
+        ///Get the compiled deconvolution plan used by this kernel
+        std::shared_ptr<const DeconvolutionPlan> GetPlan() const { return m_plan; }
+        ///Get the lookup tables used by this kernel, or nullptr if it computes every pixel
+        std::shared_ptr<const DeconvolutionLUT> GetLUT() const { return m_lut; }
+
 	private:
 		/// \cond INTERNAL
 
 		virtual RawImage doProcessData(const RawImage &source);
 		virtual const ColorSpace& doGetColorSpace() const;
-        ///Given an input RGBA image and stain vectors, output either an RGBA or a Grayscale image
-		RawImage separateStains(const RawImage &source, double (&stainVec)[9]);
-
-        ///Apply threshold to source image, output RGB or averaged grayscale if stainQuantityOnly is false
-        RawImage thresholdOnly(const RawImage &source);
+        ///Given an input RGBA image, output either an RGBA or a Grayscale image of the displayed stain only
+		RawImage separateStains(const RawImage &source) const;
 
+        ///Apply threshold to source image, output the thresholded RGB image
+        RawImage thresholdOnly(const RawImage &source) const;
 
-        ///Arguments are: the 3 OD values, the 9-element RGB output, the 3-element stain quantity output, the stain vector matrix, and the inverse of the matrix
-        void GetSeparateColorsForPixel(double(&pixelOD)[3], double(&RGB_sep)[9],
-            double(&quant)[3], double(&stainVec_matrix)[9], double(&inverse_matrix)[9]);
-
-        ///Original argument list (overload)
-        void GetSeparateColorsForPixel(double (&pixelOD)[3], double (&RGB_sep)[9], 
-            double (&stainVec_matrix)[9], double (&inverse_matrix)[9]);
-
-        ///Get the boolean value of m_grayscaleQuanityOnly
-        const bool& GetGrayscaleQuantityOnly() const { return m_grayscaleQuantityOnly; }
         ///Set the output color space
         void SetOutputColorSpace(const ColorSpace& os) { m_outputColorSpace = os; }
 
-		// rows of matrix are stains, columns are color channels
-		ColorDeconvolution::DisplayOptions m_DisplayOption;	
-        bool m_grayscaleQuantityOnly;
-        bool m_applyThreshold;
-		double m_threshold;
-
-        //Normalization for grayscale stain quantities: -log_10(1/255) is 2.40, so set 2.55 to be channel 255 = norm factor 100
-        const double m_grayscaleNormFactor;
-
-        ///ColorSpace of the source (input) image
         ///ColorSpace of the output image
         ColorSpace m_outputColorSpace;
-        std::shared_ptr<StainProfile> m_stainProfile;
+        ///Matrices, threshold and display options, built once and only read per tile
+        std::shared_ptr<const DeconvolutionPlan> m_plan;
+        ///Optional precomputed output of m_plan for every RGB input
+        std::shared_ptr<const DeconvolutionLUT> m_lut;
+        ///Optional budget of the tile caches, told the size of the tiles
+        std::shared_ptr<TileCacheBudget> m_cacheBudget;
 		/// \endcond
 	};
 
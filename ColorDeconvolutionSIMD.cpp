@@ -0,0 +1,109 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "ColorDeconvolutionSIMD.h"
+#include "ColorDeconvolutionSIMDImpl.h"
+
+#if defined(STAIN_ANALYSIS_ENABLE_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+    ///Query CPUID (and XGETBV for operating system support of the vector registers)
+    ColorDeconvolutionSIMD::InstructionSet QueryInstructionSet() {
+#if !defined(STAIN_ANALYSIS_ENABLE_SIMD)
+        return ColorDeconvolutionSIMD::SCALAR;
+#elif defined(_MSC_VER)
+        int info[4] = { 0 };
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool sse41 = (info[2] & (1 << 19)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        //The OS must save the YMM (bits 1-2) and ZMM (bits 5-7) register state
+        const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        const bool ymmEnabled = (xcr0 & 0x6) == 0x6;
+        const bool zmmEnabled = (xcr0 & 0xE6) == 0xE6;
+        bool avx2 = false, avx512f = false;
+        if (maxLeaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+            avx512f = (info[1] & (1 << 16)) != 0;
+        }
+        if (avx512f && zmmEnabled) { return ColorDeconvolutionSIMD::AVX512; }
+        if (avx2 && ymmEnabled) { return ColorDeconvolutionSIMD::AVX2; }
+        if (sse41) { return ColorDeconvolutionSIMD::SSE41; }
+        return ColorDeconvolutionSIMD::SCALAR;
+#elif defined(__GNUC__)
+        //GCC and Clang also check operating system support of the register state
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) { return ColorDeconvolutionSIMD::AVX512; }
+        if (__builtin_cpu_supports("avx2")) { return ColorDeconvolutionSIMD::AVX2; }
+        if (__builtin_cpu_supports("sse4.1")) { return ColorDeconvolutionSIMD::SSE41; }
+        return ColorDeconvolutionSIMD::SCALAR;
+#else
+        return ColorDeconvolutionSIMD::SCALAR;
+#endif
+    }
+}
+
+ColorDeconvolutionSIMD::InstructionSet ColorDeconvolutionSIMD::DetectInstructionSet() {
+    //Detected once, the first time a plan is built
+    static const InstructionSet detected = QueryInstructionSet();
+    return detected;
+}//end DetectInstructionSet
+
+ColorDeconvolutionSIMD::RowFunction ColorDeconvolutionSIMD::GetRowFunction(const InstructionSet &is) {
+    switch (is) {
+    case AVX512:
+        return &ColorDeconvolutionSIMD::SeparateRowAVX512;
+    case AVX2:
+        return &ColorDeconvolutionSIMD::SeparateRowAVX2;
+    case SSE41:
+        return &ColorDeconvolutionSIMD::SeparateRowSSE41;
+    default:
+        return &ColorDeconvolutionSIMD::SeparateRowScalar;
+    }
+}//end GetRowFunction
+
+const char* ColorDeconvolutionSIMD::GetInstructionSetName(const InstructionSet &is) {
+    switch (is) {
+    case AVX512:
+        return "AVX-512";
+    case AVX2:
+        return "AVX2";
+    case SSE41:
+        return "SSE4.1";
+    default:
+        return "Scalar";
+    }
+}//end GetInstructionSetName
+
+void ColorDeconvolutionSIMD::SeparateRowScalar(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    const int outChannels = p.grayscaleOnly ? 1 : 4;
+    for (int x = 0; x < width; x++) {
+        ScalarSeparatePixel(p, src + x * srcChannels, dst + x * outChannels);
+    }
+}//end SeparateRowScalar
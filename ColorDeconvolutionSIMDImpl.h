@@ -0,0 +1,187 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+//Shared body of the vectorized row kernels. Included only by the ColorDeconvolutionSIMD_*.cpp
+//files, each compiled with its own instruction set flags. Everything here has internal linkage
+//so that code built for one instruction set is never linked into another variant.
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_COLORDECONVOLUTIONSIMDIMPL_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_COLORDECONVOLUTIONSIMDIMPL_H
+
+#include "ColorDeconvolutionSIMD.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+//Coefficients of 2^f for f in [-0.5, 0.5] (Taylor series in f*ln2, relative error below 2e-7)
+const float kExp2C1 = 0.693147180f;
+const float kExp2C2 = 0.240226507f;
+const float kExp2C3 = 0.0555041087f;
+const float kExp2C4 = 0.00961812911f;
+const float kExp2C5 = 0.00133335581f;
+const float kExp2C6 = 0.000154035304f;
+//Below this exponent every channel value truncates to 0
+const float kExp2Min = -60.0f;
+
+///Scalar 2^x with the same range reduction and polynomial as the vector kernels
+inline float ScalarExp2(float x) {
+    x = (x < kExp2Min) ? kExp2Min : x;
+    const float n = std::floor(x + 0.5f);
+    const float f = x - n;
+    float p = kExp2C6;
+    p = p * f + kExp2C5;
+    p = p * f + kExp2C4;
+    p = p * f + kExp2C3;
+    p = p * f + kExp2C2;
+    p = p * f + kExp2C1;
+    p = p * f + 1.0f;
+    const int bits = (static_cast<int>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(float));
+    return p * scale;
+}
+
+///Separate one pixel in float32, writing GetOutputChannels() bytes to dst
+inline void ScalarSeparatePixel(const ColorDeconvolutionSIMD::Params &p, const unsigned char *px, unsigned char *dst) {
+    const float od0 = p.odLookup[px[0]];
+    const float od1 = p.odLookup[px[1]];
+    const float od2 = p.odLookup[px[2]];
+    float q = p.inverseRow[0] * od0 + p.inverseRow[1] * od1 + p.inverseRow[2] * od2;
+    q = (q > 0.0f) ? q : 0.0f;
+    const float o0 = q * p.stainRow[0];
+    const float o1 = q * p.stainRow[1];
+    const float o2 = q * p.stainRow[2];
+    const bool above = p.applyThreshold ? ((o0 + o1 + o2) > p.threshold) : true;
+    if (p.grayscaleOnly) {
+        float g = q * p.grayscaleNormFactor;
+        g = (g < 255.0f) ? g : 255.0f;
+        dst[0] = above ? static_cast<unsigned char>(static_cast<int>(g)) : 0;
+    }
+    else {
+        dst[0] = above ? static_cast<unsigned char>(static_cast<int>(p.rgbScale * ScalarExp2(o0 * p.negLog2Base))) : 0;
+        dst[1] = above ? static_cast<unsigned char>(static_cast<int>(p.rgbScale * ScalarExp2(o1 * p.negLog2Base))) : 0;
+        dst[2] = above ? static_cast<unsigned char>(static_cast<int>(p.rgbScale * ScalarExp2(o2 * p.negLog2Base))) : 0;
+        dst[3] = 255;
+    }
+}
+
+///Vector 2^x using the operations of traits class V
+template<class V>
+inline typename V::Float VectorExp2(typename V::Float x) {
+    x = V::max(x, V::set1(kExp2Min));
+    const typename V::Float n = V::floor(V::add(x, V::set1(0.5f)));
+    const typename V::Float f = V::sub(x, n);
+    typename V::Float p = V::set1(kExp2C6);
+    p = V::add(V::mul(p, f), V::set1(kExp2C5));
+    p = V::add(V::mul(p, f), V::set1(kExp2C4));
+    p = V::add(V::mul(p, f), V::set1(kExp2C3));
+    p = V::add(V::mul(p, f), V::set1(kExp2C2));
+    p = V::add(V::mul(p, f), V::set1(kExp2C1));
+    p = V::add(V::mul(p, f), V::set1(1.0f));
+    //Build 2^n directly in the exponent bits
+    const typename V::Int bits = V::shiftLeft23(V::addInt(V::truncate(n), V::set1Int(127)));
+    return V::mul(p, V::castToFloat(bits));
+}
+
+///Row kernel: deinterleave V::Width pixels into structure-of-arrays form, separate, re-interleave
+template<class V>
+void SeparateRowVector(const ColorDeconvolutionSIMD::Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    typedef typename V::Float F;
+    const int W = V::Width;
+    alignas(64) int idx[3][V::Width];
+    alignas(64) int out[3][V::Width];
+    alignas(64) int aboveFlags[V::Width];
+
+    const F inv0 = V::set1(p.inverseRow[0]);
+    const F inv1 = V::set1(p.inverseRow[1]);
+    const F inv2 = V::set1(p.inverseRow[2]);
+    const F s0 = V::set1(p.stainRow[0]);
+    const F s1 = V::set1(p.stainRow[1]);
+    const F s2 = V::set1(p.stainRow[2]);
+    const F thr = V::set1(p.threshold);
+    const F zero = V::set1(0.0f);
+    const F gmax = V::set1(255.0f);
+    const F norm = V::set1(p.grayscaleNormFactor);
+    const F rgbScale = V::set1(p.rgbScale);
+    const F negLog2Base = V::set1(p.negLog2Base);
+    const int outChannels = p.grayscaleOnly ? 1 : 4;
+
+    int x = 0;
+    for (; x + W <= width; x += W) {
+        //Deinterleave the channel values
+        const unsigned char *px = src + x * srcChannels;
+        for (int l = 0; l < W; l++) {
+            idx[0][l] = px[l * srcChannels];
+            idx[1][l] = px[l * srcChannels + 1];
+            idx[2][l] = px[l * srcChannels + 2];
+        }
+        const F od0 = V::gather(p.odLookup, idx[0]);
+        const F od1 = V::gather(p.odLookup, idx[1]);
+        const F od2 = V::gather(p.odLookup, idx[2]);
+
+        //Stain quantity from one row of the inverse, no negative quantities
+        F q = V::add(V::add(V::mul(inv0, od0), V::mul(inv1, od1)), V::mul(inv2, od2));
+        q = V::max(q, zero);
+        const F o0 = V::mul(q, s0);
+        const F o1 = V::mul(q, s1);
+        const F o2 = V::mul(q, s2);
+        if (p.applyThreshold) {
+            V::storeMask(aboveFlags, V::greaterThan(V::add(V::add(o0, o1), o2), thr));
+        }
+        else {
+            for (int l = 0; l < W; l++) { aboveFlags[l] = -1; }
+        }
+
+        unsigned char *d = dst + x * outChannels;
+        if (p.grayscaleOnly) {
+            V::storeInt(out[0], V::truncate(V::min(V::mul(q, norm), gmax)));
+            for (int l = 0; l < W; l++) {
+                d[l] = aboveFlags[l] ? static_cast<unsigned char>(out[0][l]) : 0;
+            }
+        }
+        else {
+            V::storeInt(out[0], V::truncate(V::mul(rgbScale, VectorExp2<V>(V::mul(o0, negLog2Base)))));
+            V::storeInt(out[1], V::truncate(V::mul(rgbScale, VectorExp2<V>(V::mul(o1, negLog2Base)))));
+            V::storeInt(out[2], V::truncate(V::mul(rgbScale, VectorExp2<V>(V::mul(o2, negLog2Base)))));
+            for (int l = 0; l < W; l++) {
+                const bool above = (aboveFlags[l] != 0);
+                d[4 * l    ] = above ? static_cast<unsigned char>(out[0][l]) : 0;
+                d[4 * l + 1] = above ? static_cast<unsigned char>(out[1][l]) : 0;
+                d[4 * l + 2] = above ? static_cast<unsigned char>(out[2][l]) : 0;
+                d[4 * l + 3] = 255;
+            }
+        }
+    }
+    //Remaining pixels of the row
+    for (; x < width; x++) {
+        ScalarSeparatePixel(p, src + x * srcChannels, dst + x * outChannels);
+    }
+}
+
+} // namespace
+
+#endif
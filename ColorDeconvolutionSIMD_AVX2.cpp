@@ -0,0 +1,71 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+//Compiled with AVX2 enabled (see CMakeLists.txt); only called when CPUID reports AVX2
+#include "ColorDeconvolutionSIMD.h"
+
+#if defined(STAIN_ANALYSIS_ENABLE_SIMD)
+#include <immintrin.h>
+#include "ColorDeconvolutionSIMDImpl.h"
+
+namespace {
+    ///AVX2 operations used by SeparateRowVector, 8 pixels per vector
+    struct AVX2Ops {
+        typedef __m256 Float;
+        typedef __m256i Int;
+        static const int Width = 8;
+        static inline Float set1(float a) { return _mm256_set1_ps(a); }
+        static inline Int set1Int(int a) { return _mm256_set1_epi32(a); }
+        static inline Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+        static inline Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+        static inline Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+        static inline Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+        static inline Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+        static inline Float floor(Float a) { return _mm256_floor_ps(a); }
+        static inline Int truncate(Float a) { return _mm256_cvttps_epi32(a); }
+        static inline Int addInt(Int a, Int b) { return _mm256_add_epi32(a, b); }
+        static inline Int shiftLeft23(Int a) { return _mm256_slli_epi32(a, 23); }
+        static inline Float castToFloat(Int a) { return _mm256_castsi256_ps(a); }
+        static inline void storeInt(int *p, Int a) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), a); }
+        static inline Float greaterThan(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static inline void storeMask(int *p, Float m) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), _mm256_castps_si256(m)); }
+        static inline Float gather(const float *table, const int *idx) {
+            return _mm256_i32gather_ps(table, _mm256_load_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+        }
+    };
+}
+
+void ColorDeconvolutionSIMD::SeparateRowAVX2(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowVector<AVX2Ops>(p, src, srcChannels, width, dst);
+}//end SeparateRowAVX2
+
+#else
+
+void ColorDeconvolutionSIMD::SeparateRowAVX2(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowScalar(p, src, srcChannels, width, dst);
+}//end SeparateRowAVX2
+
+#endif
@@ -0,0 +1,71 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+//Compiled with AVX-512F enabled (see CMakeLists.txt); only called when CPUID reports AVX-512F
+#include "ColorDeconvolutionSIMD.h"
+
+#if defined(STAIN_ANALYSIS_ENABLE_SIMD)
+#include <immintrin.h>
+#include "ColorDeconvolutionSIMDImpl.h"
+
+namespace {
+    ///AVX-512 operations used by SeparateRowVector, 16 pixels per vector
+    struct AVX512Ops {
+        typedef __m512 Float;
+        typedef __m512i Int;
+        static const int Width = 16;
+        static inline Float set1(float a) { return _mm512_set1_ps(a); }
+        static inline Int set1Int(int a) { return _mm512_set1_epi32(a); }
+        static inline Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+        static inline Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+        static inline Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+        static inline Float max(Float a, Float b) { return _mm512_max_ps(a, b); }
+        static inline Float min(Float a, Float b) { return _mm512_min_ps(a, b); }
+        static inline Float floor(Float a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        static inline Int truncate(Float a) { return _mm512_cvttps_epi32(a); }
+        static inline Int addInt(Int a, Int b) { return _mm512_add_epi32(a, b); }
+        static inline Int shiftLeft23(Int a) { return _mm512_slli_epi32(a, 23); }
+        static inline Float castToFloat(Int a) { return _mm512_castsi512_ps(a); }
+        static inline void storeInt(int *p, Int a) { _mm512_store_si512(p, a); }
+        static inline __mmask16 greaterThan(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+        static inline void storeMask(int *p, __mmask16 m) { _mm512_store_si512(p, _mm512_maskz_set1_epi32(m, -1)); }
+        static inline Float gather(const float *table, const int *idx) {
+            return _mm512_i32gather_ps(_mm512_load_si512(idx), table, 4);
+        }
+    };
+}
+
+void ColorDeconvolutionSIMD::SeparateRowAVX512(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowVector<AVX512Ops>(p, src, srcChannels, width, dst);
+}//end SeparateRowAVX512
+
+#else
+
+void ColorDeconvolutionSIMD::SeparateRowAVX512(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowScalar(p, src, srcChannels, width, dst);
+}//end SeparateRowAVX512
+
+#endif
@@ -0,0 +1,72 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+//Compiled with SSE4.1 enabled (see CMakeLists.txt); only called when CPUID reports SSE4.1
+#include "ColorDeconvolutionSIMD.h"
+
+#if defined(STAIN_ANALYSIS_ENABLE_SIMD)
+#include <smmintrin.h>
+#include "ColorDeconvolutionSIMDImpl.h"
+
+namespace {
+    ///SSE4.1 operations used by SeparateRowVector, 4 pixels per vector
+    struct SSE41Ops {
+        typedef __m128 Float;
+        typedef __m128i Int;
+        static const int Width = 4;
+        static inline Float set1(float a) { return _mm_set1_ps(a); }
+        static inline Int set1Int(int a) { return _mm_set1_epi32(a); }
+        static inline Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+        static inline Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+        static inline Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+        static inline Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+        static inline Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+        static inline Float floor(Float a) { return _mm_floor_ps(a); }
+        static inline Int truncate(Float a) { return _mm_cvttps_epi32(a); }
+        static inline Int addInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+        static inline Int shiftLeft23(Int a) { return _mm_slli_epi32(a, 23); }
+        static inline Float castToFloat(Int a) { return _mm_castsi128_ps(a); }
+        static inline void storeInt(int *p, Int a) { _mm_store_si128(reinterpret_cast<__m128i*>(p), a); }
+        static inline Float greaterThan(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+        static inline void storeMask(int *p, Float m) { _mm_store_si128(reinterpret_cast<__m128i*>(p), _mm_castps_si128(m)); }
+        //No gather instruction before AVX2: load the table entries individually
+        static inline Float gather(const float *table, const int *idx) {
+            return _mm_setr_ps(table[idx[0]], table[idx[1]], table[idx[2]], table[idx[3]]);
+        }
+    };
+}
+
+void ColorDeconvolutionSIMD::SeparateRowSSE41(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowVector<SSE41Ops>(p, src, srcChannels, width, dst);
+}//end SeparateRowSSE41
+
+#else
+
+void ColorDeconvolutionSIMD::SeparateRowSSE41(const Params &p, const unsigned char *src,
+    int srcChannels, int width, unsigned char *dst) {
+    SeparateRowScalar(p, src, srcChannels, width, dst);
+}//end SeparateRowSSE41
+
+#endif
@@ -0,0 +1,141 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "DeconvolutionLUT.h"
+#include "ODConversion.h"
+
+DeconvolutionLUT::DeconvolutionLUT(std::shared_ptr<const DeconvolutionPlan> thePlan)
+    : m_isValid(false),
+    m_plan(thePlan),
+    m_quantityToEntry(0.0)
+{
+    if ((m_plan == nullptr) || !m_plan->IsValid()) {
+        return;
+    }
+    //Tables are only useful for stain separation, not for single-stain thresholding
+    const int numStains = m_plan->GetNumberOfStains();
+    const int displayStain = m_plan->GetDisplayStain();
+    if ((numStains < 2) || (numStains > 3) || (displayStain < 0) || (displayStain > 2)) {
+        return;
+    }
+    if (m_plan->GetGrayscaleQuantityOnly()) {
+        BuildGrayscaleCube();
+    }
+    else {
+        BuildColorTable();
+    }
+    m_isValid = true;
+}//end constructor
+
+DeconvolutionLUT::~DeconvolutionLUT() {
+}//end destructor
+
+size_t DeconvolutionLUT::GetSizeInBytes() const {
+    return m_grayscaleCube.size() * sizeof(unsigned char) + m_colorTable.size() * sizeof(float);
+}//end GetSizeInBytes
+
+void DeconvolutionLUT::BuildGrayscaleCube() {
+    const DeconvolutionPlan &plan = *m_plan;
+    m_grayscaleCube.resize(256 * 256 * 256);
+    unsigned char *cube = m_grayscaleCube.data();
+    //Each (R,G) pair is one row of 256 blue values, separated with the plan's own row kernel
+#pragma omp parallel for
+    for (int r = 0; r < 256; r++) {
+        unsigned char row[3 * 256];
+        for (int g = 0; g < 256; g++) {
+            for (int b = 0; b < 256; b++) {
+                row[3 * b    ] = static_cast<unsigned char>(r);
+                row[3 * b + 1] = static_cast<unsigned char>(g);
+                row[3 * b + 2] = static_cast<unsigned char>(b);
+            }
+            plan.SeparateRow(row, 3, 256, cube + CubeIndex(r, g, 0));
+        }
+    }
+}//end BuildGrayscaleCube
+
+void DeconvolutionLUT::BuildColorTable() {
+    const DeconvolutionPlan &plan = *m_plan;
+    const int stain = plan.GetDisplayStain();
+    const DeconvolutionPlan::Matrix9 &stainMatrix = plan.GetStainMatrix();
+    const double maxQuantity = plan.GetMaxStainQuantity(stain);
+    m_quantityToEntry = (maxQuantity > 0.0) ? ((ColorTableSize - 1) / maxQuantity) : 0.0;
+
+    //The table holds the stain colour without the threshold, which is applied exactly per pixel
+    m_colorTable.resize(3 * ColorTableSize);
+    float *table = m_colorTable.data();
+#pragma omp parallel for
+    for (int e = 0; e < ColorTableSize; e++) {
+        const double stainQuantity = (m_quantityToEntry > 0.0) ? (e / m_quantityToEntry) : 0.0;
+        for (int c = 0; c < 3; c++) {
+            table[3 * e + c] = static_cast<float>(ODConversion::ConvertODtoRGB(stainQuantity * stainMatrix[stain * 3 + c]));
+        }
+    }
+}//end BuildColorTable
+
+void DeconvolutionLUT::SeparateRow(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned char *dst) const {
+    if (!m_grayscaleCube.empty()) {
+        //One table read per pixel
+        const unsigned char *cube = m_grayscaleCube.data();
+        for (int x = 0; x < width; x++) {
+            const unsigned char *p = src + x * srcChannels;
+            dst[x] = cube[CubeIndex(p[0], p[1], p[2])];
+        }
+        return;
+    }
+
+    const DeconvolutionPlan &plan = *m_plan;
+    const int stain = plan.GetDisplayStain();
+    const DeconvolutionPlan::Matrix9 &stainMatrix = plan.GetStainMatrix();
+    const float *table = m_colorTable.data();
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        unsigned char *q = dst + 4 * x;
+        q[3] = 255;
+
+        //Threshold test on the exact stain quantity, so that the thresholded edge is not blurred
+        const double pixelOD[3] = { plan.LookupRGBtoOD(p[0]), plan.LookupRGBtoOD(p[1]), plan.LookupRGBtoOD(p[2]) };
+        const double stainQuantity = plan.GetStainQuantity(pixelOD, stain);
+        const double OD_sum = stainQuantity * stainMatrix[stain * 3]
+            + stainQuantity * stainMatrix[stain * 3 + 1]
+            + stainQuantity * stainMatrix[stain * 3 + 2];
+        if (!plan.IsAboveThreshold(OD_sum)) {
+            q[0] = 0;
+            q[1] = 0;
+            q[2] = 0;
+            continue;
+        }
+
+        //Linear interpolation between the two nearest tabulated quantities
+        const double t = stainQuantity * m_quantityToEntry;
+        int e = static_cast<int>(t);
+        e = (e > ColorTableSize - 2) ? ColorTableSize - 2 : e;
+        double w = t - e;
+        w = (w > 1.0) ? 1.0 : w;
+        const float *lo = table + 3 * e;
+        q[0] = static_cast<unsigned char>(static_cast<int>(lo[0] + w * (lo[3] - lo[0])));
+        q[1] = static_cast<unsigned char>(static_cast<int>(lo[1] + w * (lo[4] - lo[1])));
+        q[2] = static_cast<unsigned char>(static_cast<int>(lo[2] + w * (lo[5] - lo[2])));
+    }
+}//end SeparateRow
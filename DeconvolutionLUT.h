@@ -0,0 +1,85 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_DECONVOLUTIONLUT_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_DECONVOLUTIONLUT_H
+
+#include <memory>
+#include <vector>
+
+#include "DeconvolutionPlan.h"
+
+///The output of a DeconvolutionPlan for the displayed stain, precomputed for every RGB input.
+///Grayscale quantity output uses a full 256x256x256 cube (16 MB) that is exactly the plan's output.
+///RGBA output depends on the RGB input only through the stain quantity, so the quantity is computed
+///exactly (three table reads and one row of the inverse) and the stain colour is interpolated from a
+///table of ColorTableSize quantities; the threshold is tested on the exact quantity.
+///Immutable once built, so it can be shared by kernels, tiles and threads.
+class DeconvolutionLUT
+{
+public:
+    ///Number of stain quantities in the RGBA colour table
+    static const int ColorTableSize = 4096;
+
+public:
+    ///Build the tables for a plan (in parallel if OpenMP is available). Check IsValid() before use.
+    explicit DeconvolutionLUT(std::shared_ptr<const DeconvolutionPlan> thePlan);
+    ///destructor
+    ~DeconvolutionLUT();
+
+    ///True if the plan is valid and separates two or three stains
+    inline bool IsValid() const { return m_isValid; }
+    ///The plan the tables were built from
+    inline std::shared_ptr<const DeconvolutionPlan> GetPlan() const { return m_plan; }
+    ///Size of the tables in bytes
+    size_t GetSizeInBytes() const;
+
+    ///Separate the plan's displayed stain for a row of interleaved UInt8 pixels with srcChannels (3 or more) channels.
+    ///Writes the plan's GetOutputChannels() bytes per pixel to dst.
+    void SeparateRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *dst) const;
+
+private:
+    ///Evaluate the plan's row kernel for every RGB triple
+    void BuildGrayscaleCube();
+    ///Evaluate the un-thresholded stain colour at evenly spaced stain quantities
+    void BuildColorTable();
+
+    ///Index of a grayscale cube entry
+    inline static int CubeIndex(const int &r, const int &g, const int &b) {
+        return (r << 16) | (g << 8) | b;
+    }
+
+private:
+    bool m_isValid;
+    std::shared_ptr<const DeconvolutionPlan> m_plan;
+
+    ///Grayscale output for every RGB triple, indexed by CubeIndex
+    std::vector<unsigned char> m_grayscaleCube;
+    ///Un-thresholded RGB stain colour at each tabulated quantity, 3 values per entry
+    std::vector<float> m_colorTable;
+    ///Multiplier from stain quantity to (fractional) colour table entry
+    double m_quantityToEntry;
+};
+
+#endif
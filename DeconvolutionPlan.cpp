@@ -0,0 +1,361 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "DeconvolutionPlan.h"
+#include "ODConversion.h"
+#include "StainVectorMath.h"
+
+#include <cmath>
+
+DeconvolutionPlan::DeconvolutionPlan(std::shared_ptr<StainProfile> theProfile, int displayStain,
+    bool applyThreshold, double threshold, bool grayscaleQuantityOnly, bool useSIMD /*= true*/)
+    : m_isValid(false),
+    m_numStains(-1),
+    m_displayStain(displayStain),
+    m_applyThreshold(applyThreshold),
+    m_threshold(threshold),
+    m_grayscaleQuantityOnly(grayscaleQuantityOnly),
+    m_grayscaleNormFactor(100.0),
+    m_quantityScale(0.0),
+    m_backgroundCutoff(256),
+    m_instructionSet(ColorDeconvolutionSIMD::SCALAR),
+    m_simdRowFunction(nullptr)
+{
+    for (int i = 0; i < 9; i++) { m_stainMatrix[i] = 0.0; }
+    //Read the profile once: the XML document is not touched again by this plan
+    if (theProfile != nullptr) {
+        m_isValid = theProfile->GetNormalizedProfilesAsDoubleArray(m_stainMatrix);
+        m_numStains = theProfile->GetNumberOfStainComponents();
+    }
+    CompileMatrices();
+    CompileSIMD(useSIMD);
+}//end constructor
+
+DeconvolutionPlan::DeconvolutionPlan(const double (&normalizedMatrix)[9], int numStains, int displayStain,
+    bool applyThreshold, double threshold, bool grayscaleQuantityOnly, bool useSIMD /*= true*/)
+    : m_isValid(numStains > 0),
+    m_numStains(numStains),
+    m_displayStain(displayStain),
+    m_applyThreshold(applyThreshold),
+    m_threshold(threshold),
+    m_grayscaleQuantityOnly(grayscaleQuantityOnly),
+    m_grayscaleNormFactor(100.0),
+    m_quantityScale(0.0),
+    m_backgroundCutoff(256),
+    m_instructionSet(ColorDeconvolutionSIMD::SCALAR),
+    m_simdRowFunction(nullptr)
+{
+    for (int i = 0; i < 9; i++) { m_stainMatrix[i] = normalizedMatrix[i]; }
+    CompileMatrices();
+    CompileSIMD(useSIMD);
+}//end matrix constructor
+
+DeconvolutionPlan::~DeconvolutionPlan() {
+}//end destructor
+
+void DeconvolutionPlan::CompileMatrices() {
+    //The inverse can't be calculated if there is a row of zeros. Replace these values first.
+    //If there is a row of zeros, replace it. Use the default replacement row.
+    StainVectorMath::ConvertZeroRowsToUnitary(m_stainMatrix, m_noZeroRowsMatrix);
+    //Get the inverse of the noZeroRowsMatrix
+    StainVectorMath::Compute3x3MatrixInverse(m_noZeroRowsMatrix, m_inverseMatrix);
+
+    //Copy the colour -> OD lookup table so that the per-tile path needs no converter object
+    ODConversion converter;
+    for (int i = 0; i < 256; i++) {
+        m_odLookup[i] = converter.LookupRGBtoOD(i);
+    }
+
+    //Encode quantities of the displayed stain so that the largest possible one uses the full UInt16 range
+    if ((m_displayStain >= 0) && (m_displayStain < 3)) {
+        const double maxQuantity = GetMaxStainQuantity(m_displayStain);
+        m_quantityScale = (maxQuantity > 0.0) ? (MaxEncodedQuantity / maxQuantity) : 0.0;
+    }
+    CompileBackgroundCutoff();
+}//end CompileMatrices
+
+void DeconvolutionPlan::CompileBackgroundCutoff() {
+    m_backgroundCutoff = 256;
+    if (!m_applyThreshold || (m_displayStain < 0) || (m_displayStain > 2)) {
+        return;
+    }
+    const int stain = m_displayStain;
+    const double stainSum = m_stainMatrix[stain * 3] + m_stainMatrix[stain * 3 + 1] + m_stainMatrix[stain * 3 + 2];
+    //Lower the cutoff while every pixel with all channels at or above it is certainly below the threshold.
+    //The OD of each channel is then between minOD and maxOD, which bounds the stain quantity and its OD sum.
+    double minOD = m_odLookup[255], maxOD = m_odLookup[255];
+    for (int cutoff = 255; cutoff >= 0; cutoff--) {
+        minOD = (m_odLookup[cutoff] < minOD) ? m_odLookup[cutoff] : minOD;
+        maxOD = (m_odLookup[cutoff] > maxOD) ? m_odLookup[cutoff] : maxOD;
+        double maxQuantity = 0.0;
+        for (int c = 0; c < 3; c++) {
+            const double a = m_inverseMatrix[stain * 3 + c] * minOD;
+            const double b = m_inverseMatrix[stain * 3 + c] * maxOD;
+            maxQuantity += (a > b) ? a : b;
+        }
+        maxQuantity = (maxQuantity > 0.0) ? maxQuantity : 0.0;
+        double maxODSum = maxQuantity * stainSum;
+        maxODSum = (maxODSum > 0.0) ? maxODSum : 0.0;
+        //Leave a margin for the rounding of the float32 row kernels
+        if (IsAboveThreshold(maxODSum * (1.0 + 1e-4) + 1e-6)) {
+            return;
+        }
+        m_backgroundCutoff = cutoff;
+    }
+}//end CompileBackgroundCutoff
+
+bool DeconvolutionPlan::IsBackground(const unsigned char *src, const int &srcChannels, const long long &numPixels) const {
+    if ((m_backgroundCutoff > 255) || (srcChannels < 3)) {
+        return false;
+    }
+    const unsigned char cutoff = static_cast<unsigned char>(m_backgroundCutoff);
+    //The minimum of each block of bytes is a quick test; a block with a low extra (alpha) channel is checked per pixel
+    const long long blockPixels = 1024;
+    for (long long first = 0; first < numPixels; first += blockPixels) {
+        const long long count = ((numPixels - first) < blockPixels) ? (numPixels - first) : blockPixels;
+        const unsigned char *block = src + first * srcChannels;
+        unsigned char blockMin = 255;
+        for (long long i = 0; i < count * srcChannels; i++) {
+            blockMin = (block[i] < blockMin) ? block[i] : blockMin;
+        }
+        if (blockMin >= cutoff) {
+            continue;
+        }
+        if (srcChannels == 3) {
+            return false;
+        }
+        for (long long x = 0; x < count; x++) {
+            const unsigned char *p = block + x * srcChannels;
+            if ((p[0] < cutoff) || (p[1] < cutoff) || (p[2] < cutoff)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}//end IsBackground
+
+void DeconvolutionPlan::CompileSIMD(bool useSIMD) {
+    //The vector kernels evaluate RGB = scale * 2^(-k*OD); get scale and k from the reference conversion
+    const double rgbScale = ODConversion::ConvertODtoRGB(0.0);
+    const double rgbAtUnitOD = ODConversion::ConvertODtoRGB(1.0);
+    if (!useSIMD || !(rgbScale > 0.0) || !(rgbAtUnitOD > 0.0)) {
+        m_instructionSet = ColorDeconvolutionSIMD::SCALAR;
+        m_simdRowFunction = nullptr;
+        return;
+    }
+    for (int i = 0; i < 3; i++) { //i index is stain
+        ColorDeconvolutionSIMD::Params &p = m_simdParams[i];
+        for (int c = 0; c < 256; c++) {
+            p.odLookup[c] = static_cast<float>(m_odLookup[c]);
+        }
+        for (int c = 0; c < 3; c++) {
+            p.inverseRow[c] = static_cast<float>(m_inverseMatrix[i * 3 + c]);
+            p.stainRow[c] = static_cast<float>(m_stainMatrix[i * 3 + c]);
+        }
+        p.threshold = static_cast<float>(m_threshold);
+        p.grayscaleNormFactor = static_cast<float>(m_grayscaleNormFactor);
+        p.rgbScale = static_cast<float>(rgbScale);
+        p.negLog2Base = static_cast<float>(std::log2(rgbAtUnitOD / rgbScale));
+        p.applyThreshold = m_applyThreshold ? 1 : 0;
+        p.grayscaleOnly = m_grayscaleQuantityOnly ? 1 : 0;
+    }
+    m_instructionSet = ColorDeconvolutionSIMD::DetectInstructionSet();
+    m_simdRowFunction = ColorDeconvolutionSIMD::GetRowFunction(m_instructionSet);
+}//end CompileSIMD
+
+bool DeconvolutionPlan::IsEquivalentTo(const DeconvolutionPlan &other) const {
+    if ((m_isValid != other.m_isValid) || (m_numStains != other.m_numStains)
+        || (m_displayStain != other.m_displayStain)
+        || (m_applyThreshold != other.m_applyThreshold)
+        || (m_grayscaleQuantityOnly != other.m_grayscaleQuantityOnly)
+        || (m_instructionSet != other.m_instructionSet)) {
+        return false;
+    }
+    //The threshold value only matters if it is applied
+    if (m_applyThreshold && (m_threshold != other.m_threshold)) {
+        return false;
+    }
+    for (int i = 0; i < 9; i++) {
+        if (m_stainMatrix[i] != other.m_stainMatrix[i]) { return false; }
+    }
+    return true;
+}//end IsEquivalentTo
+
+bool DeconvolutionPlan::HasSameQuantitiesAs(const DeconvolutionPlan &other) const {
+    if ((m_isValid != other.m_isValid) || (m_numStains != other.m_numStains)
+        || (m_displayStain != other.m_displayStain)) {
+        return false;
+    }
+    for (int i = 0; i < 9; i++) {
+        if (m_stainMatrix[i] != other.m_stainMatrix[i]) { return false; }
+    }
+    return true;
+}//end HasSameQuantitiesAs
+
+double DeconvolutionPlan::GetMaxStainQuantity(const int &stain) const {
+    //The quantity is linear in OD, so its maximum is at a corner of the cube of possible OD values
+    double maxOD = 0.0;
+    for (int c = 0; c < 256; c++) {
+        maxOD = (m_odLookup[c] > maxOD) ? m_odLookup[c] : maxOD;
+    }
+    double maxQuantity = 0.0;
+    for (int corner = 0; corner < 8; corner++) {
+        const double cornerOD[3] = { (corner & 1) ? maxOD : 0.0, (corner & 2) ? maxOD : 0.0, (corner & 4) ? maxOD : 0.0 };
+        const double q = GetStainQuantity(cornerOD, stain);
+        maxQuantity = (q > maxQuantity) ? q : maxQuantity;
+    }
+    return maxQuantity;
+}//end GetMaxStainQuantity
+
+void DeconvolutionPlan::SeparateStainForPixel(const double (&pixelOD)[3], const int &stain,
+    double (&RGB_sep)[3], double &outQuant) const {
+    //Only the row of the inverse for the requested stain is needed
+    SeparateStainForQuantity(GetStainQuantity(pixelOD, stain), stain, RGB_sep, outQuant);
+}//end SeparateStainForPixel
+
+void DeconvolutionPlan::SeparateStainForQuantity(const double &stainQuantity, const int &stain,
+    double (&RGB_sep)[3], double &outQuant) const {
+    //Scale the stain's OD by the amount of stain at this pixel, get the RGB values
+    double OD_scaled[3]; //index is color channel
+    OD_scaled[0] = stainQuantity * m_stainMatrix[stain * 3];
+    OD_scaled[1] = stainQuantity * m_stainMatrix[stain * 3 + 1];
+    OD_scaled[2] = stainQuantity * m_stainMatrix[stain * 3 + 2];
+
+    double OD_sum = OD_scaled[0] + OD_scaled[1] + OD_scaled[2];
+    //Determine if the threshold should be applied to this stain's pixel value
+    if (IsAboveThreshold(OD_sum)) {
+        RGB_sep[0] = ODConversion::ConvertODtoRGB(OD_scaled[0]);
+        RGB_sep[1] = ODConversion::ConvertODtoRGB(OD_scaled[1]);
+        RGB_sep[2] = ODConversion::ConvertODtoRGB(OD_scaled[2]);
+        outQuant = stainQuantity;
+    }
+    else {
+        RGB_sep[0] = 0.0;
+        RGB_sep[1] = 0.0;
+        RGB_sep[2] = 0.0;
+        outQuant = 0.0;
+    }
+}//end SeparateStainForQuantity
+
+void DeconvolutionPlan::SeparateColorsForPixel(const double (&pixelOD)[3], double (&RGB_sep)[9],
+    double (&outQuant)[3]) const {
+    for (int i = 0; i < 3; i++) { //i index is stain
+        double RGB_stain[3] = { 0.0 };
+        SeparateStainForPixel(pixelOD, i, RGB_stain, outQuant[i]);
+        RGB_sep[i * 3    ] = RGB_stain[0];
+        RGB_sep[i * 3 + 1] = RGB_stain[1];
+        RGB_sep[i * 3 + 2] = RGB_stain[2];
+    }
+}//end SeparateColorsForPixel
+
+void DeconvolutionPlan::SeparateRow(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned char *dst) const {
+    const int stain = m_displayStain;
+    //Vectorized float32 path, see ColorDeconvolutionSIMD.h for its error bound
+    if ((m_simdRowFunction != nullptr) && (stain >= 0) && (stain < 3)) {
+        m_simdRowFunction(m_simdParams[stain], src, srcChannels, width, dst);
+        return;
+    }
+    const int outChannels = GetOutputChannels();
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        double pixelOD[3] = { m_odLookup[p[0]], m_odLookup[p[1]], m_odLookup[p[2]] };
+        double RGB_sep[3] = { 0.0 };
+        double stainQuant = 0.0;
+        SeparateStainForPixel(pixelOD, stain, RGB_sep, stainQuant);
+        WriteOutputPixel(RGB_sep, stainQuant, dst + x * outChannels);
+    }
+}//end SeparateRow
+
+void DeconvolutionPlan::SeparateRowAllStains(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned char *const (&dst)[3]) const {
+    const int numStains = (m_numStains < 3) ? m_numStains : 3;
+    //Vectorized float32 path: the source row stays in cache between the stains
+    if (m_simdRowFunction != nullptr) {
+        for (int i = 0; i < numStains; i++) {
+            m_simdRowFunction(m_simdParams[i], src, srcChannels, width, dst[i]);
+        }
+        return;
+    }
+    const int outChannels = GetOutputChannels();
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        double pixelOD[3] = { m_odLookup[p[0]], m_odLookup[p[1]], m_odLookup[p[2]] };
+        for (int i = 0; i < numStains; i++) { //i index is stain
+            double RGB_sep[3] = { 0.0 };
+            double stainQuant = 0.0;
+            SeparateStainForPixel(pixelOD, i, RGB_sep, stainQuant);
+            WriteOutputPixel(RGB_sep, stainQuant, dst[i] + x * outChannels);
+        }
+    }
+}//end SeparateRowAllStains
+
+void DeconvolutionPlan::QuantityRow(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned short *dst) const {
+    const int stain = m_displayStain;
+    if ((stain < 0) || (stain > 2)) {
+        for (int x = 0; x < width; x++) { dst[x] = 0; }
+        return;
+    }
+    const double scale = m_quantityScale;
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        const double pixelOD[3] = { m_odLookup[p[0]], m_odLookup[p[1]], m_odLookup[p[2]] };
+        const int encoded = static_cast<int>(GetStainQuantity(pixelOD, stain) * scale + 0.5);
+        dst[x] = static_cast<unsigned short>((encoded > MaxEncodedQuantity) ? MaxEncodedQuantity : encoded);
+    }
+}//end QuantityRow
+
+void DeconvolutionPlan::SeparateQuantity(const double &stainQuantity, unsigned char *dst) const {
+    double RGB_sep[3] = { 0.0 };
+    double quant = 0.0;
+    SeparateStainForQuantity(stainQuantity, m_displayStain, RGB_sep, quant);
+    WriteOutputPixel(RGB_sep, quant, dst);
+}//end SeparateQuantity
+
+void DeconvolutionPlan::ThresholdRow(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned char *dst) const {
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        unsigned char *q = dst + 4 * x;
+        //Get the total OD at the pixel
+        double OD_sum = m_odLookup[p[0]] + m_odLookup[p[1]] + m_odLookup[p[2]];
+        const bool above = IsAboveThreshold(OD_sum);
+        q[0] = above ? p[0] : 0;
+        q[1] = above ? p[1] : 0;
+        q[2] = above ? p[2] : 0;
+        q[3] = 255;
+    }
+}//end ThresholdRow
+
+void DeconvolutionPlan::DisplayRow(const unsigned char *src, const int &srcChannels,
+    const int &width, unsigned char *dst) const {
+    //Is number of stains set to 1? Threshold only if so
+    if (m_numStains == 1) {
+        ThresholdRow(src, srcChannels, width, dst);
+    }
+    else {
+        SeparateRow(src, srcChannels, width, dst);
+    }
+}//end DisplayRow
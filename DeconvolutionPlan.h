@@ -0,0 +1,194 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_DECONVOLUTIONPLAN_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_DECONVOLUTIONPLAN_H
+
+#include <memory>
+
+#include "StainProfile.h"
+#include "ColorDeconvolutionSIMD.h"
+
+///An immutable, precompiled colour deconvolution: the stain matrix, its inverse,
+///the threshold and the display options, derived once from a StainProfile.
+///Avoids invoking the Sedeen SDK, so it can be shared by kernels, tiles and threads.
+class DeconvolutionPlan
+{
+public:
+    ///A 3x3 matrix expressed as a 9-element array, rows are stains
+    typedef double Matrix9[9];
+    ///Largest encoded stain quantity written by QuantityRow
+    static const int MaxEncodedQuantity = 65535;
+
+public:
+    ///Build a plan from a stain profile and the display settings. Check IsValid() before use.
+    ///If useSIMD is true, single-stain rows use the float32 vector kernel selected by CPUID.
+    DeconvolutionPlan(std::shared_ptr<StainProfile> theProfile, int displayStain,
+        bool applyThreshold, double threshold, bool grayscaleQuantityOnly, bool useSIMD = true);
+    ///Build a plan directly from a normalized 9-element stain matrix and number of stains
+    DeconvolutionPlan(const double (&normalizedMatrix)[9], int numStains, int displayStain,
+        bool applyThreshold, double threshold, bool grayscaleQuantityOnly, bool useSIMD = true);
+    ///destructor
+    ~DeconvolutionPlan();
+
+    ///True if the stain profile could be read when the plan was built
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of stain components in the profile the plan was built from
+    inline int GetNumberOfStains() const { return m_numStains; }
+    ///Index (0-2) of the stain selected for display
+    inline int GetDisplayStain() const { return m_displayStain; }
+    ///Whether the OD threshold is applied
+    inline bool GetApplyThreshold() const { return m_applyThreshold; }
+    ///The OD threshold value
+    inline double GetThreshold() const { return m_threshold; }
+    ///Whether the output is a grayscale stain quantity (true) or an RGBA stain colour image (false)
+    inline bool GetGrayscaleQuantityOnly() const { return m_grayscaleQuantityOnly; }
+    ///Multiplier from stain quantity to grayscale channel value
+    inline double GetGrayscaleNormFactor() const { return m_grayscaleNormFactor; }
+
+    ///The normalized stain vector matrix (rows are stains)
+    inline const Matrix9& GetStainMatrix() const { return m_stainMatrix; }
+    ///The stain matrix with rows of zeros replaced by a unitary row
+    inline const Matrix9& GetNoZeroRowsMatrix() const { return m_noZeroRowsMatrix; }
+    ///The inverse used to get stain quantities from pixel OD values
+    inline const Matrix9& GetInverseMatrix() const { return m_inverseMatrix; }
+
+    ///True if the other plan produces the same output for every input pixel (same matrix, stain, threshold, output type and row kernel)
+    bool IsEquivalentTo(const DeconvolutionPlan &other) const;
+
+    ///True if the other plan gives the same stain quantities for every input pixel (same matrix and displayed stain),
+    ///whatever the threshold and output type
+    bool HasSameQuantitiesAs(const DeconvolutionPlan &other) const;
+
+    ///Upper bound of the quantity of a stain over all RGB inputs
+    double GetMaxStainQuantity(const int &stain) const;
+    ///Multiplier from the displayed stain's quantity to its UInt16 encoding in QuantityRow (0 if there is no displayed stain)
+    inline double GetQuantityScale() const { return m_quantityScale; }
+
+    ///Smallest channel value such that a pixel whose colour channels are all at least this value is below
+    ///the threshold, and so separated to the background output (SeparateQuantity of 0); 256 if there is none
+    inline int GetBackgroundCutoff() const { return m_backgroundCutoff; }
+    ///True if every pixel of a contiguous block of interleaved UInt8 pixels is separated to the background output,
+    ///judged from the lowest channel values only. A quick test for glass: most tissue tiles fail on the first pixels.
+    bool IsBackground(const unsigned char *src, const int &srcChannels, const long long &numPixels) const;
+
+    ///The instruction set used by SeparateRow and SeparateRowAllStains (SCALAR means the double precision reference)
+    inline ColorDeconvolutionSIMD::InstructionSet GetInstructionSet() const { return m_instructionSet; }
+    ///The float32 vector kernel parameters of a stain (0-2); filled only if the plan was built with useSIMD
+    inline const ColorDeconvolutionSIMD::Params& GetSIMDParams(const int &stain) const { return m_simdParams[stain]; }
+
+    ///Fast colour -> OD conversion, copied once from the ODConversion lookup table
+    inline double LookupRGBtoOD(const int &rgb) const { return m_odLookup[rgb]; }
+
+    ///Check whether an OD sum is above the threshold (always true if the threshold is not applied)
+    inline bool IsAboveThreshold(const double &OD_sum) const {
+        return m_applyThreshold ? (OD_sum > m_threshold) : true;
+    }
+
+    ///Get the (non-negative) quantity of a single stain at a pixel from its 3 OD values, using one row of the inverse
+    inline double GetStainQuantity(const double (&pixelOD)[3], const int &stain) const {
+        const double q = m_inverseMatrix[stain * 3] * pixelOD[0]
+            + m_inverseMatrix[stain * 3 + 1] * pixelOD[1]
+            + m_inverseMatrix[stain * 3 + 2] * pixelOD[2];
+        //Don't allow negative stain quantities
+        return (q > 0.0) ? q : 0.0;
+    }
+
+    ///Arguments are: the 3 OD values, the stain index, the 3-element RGB output, and the stain quantity output
+    void SeparateStainForPixel(const double (&pixelOD)[3], const int &stain, double (&RGB_sep)[3], double &quant) const;
+
+    ///Arguments are: the stain quantity, the stain index, the 3-element RGB output, and the thresholded stain quantity output
+    void SeparateStainForQuantity(const double &stainQuantity, const int &stain, double (&RGB_sep)[3], double &quant) const;
+
+    ///Arguments are: the 3 OD values, the 9-element RGB output, and the 3-element stain quantity output
+    void SeparateColorsForPixel(const double (&pixelOD)[3], double (&RGB_sep)[9], double (&quant)[3]) const;
+
+    ///Number of UInt8 channels written per output pixel: 1 for grayscale quantity, 4 for RGBA
+    inline int GetOutputChannels() const { return m_grayscaleQuantityOnly ? 1 : 4; }
+
+    ///Separate the displayed stain for a row of interleaved UInt8 pixels with srcChannels (3 or more) channels.
+    ///Writes GetOutputChannels() bytes per pixel to dst.
+    void SeparateRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *dst) const;
+    ///Separate all stains for a row of interleaved UInt8 pixels; dst holds one output row per stain component
+    void SeparateRowAllStains(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *const (&dst)[3]) const;
+    ///Encode the displayed stain's quantity for a row of interleaved UInt8 pixels as UInt16 values
+    ///(quantity * GetQuantityScale(), rounded). Depends only on the matrix and the displayed stain.
+    void QuantityRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned short *dst) const;
+    ///Write the output pixel (GetOutputChannels() bytes, thresholded) of the displayed stain for a stain quantity
+    void SeparateQuantity(const double &stainQuantity, unsigned char *dst) const;
+    ///Threshold a row of interleaved UInt8 pixels on the total OD, writing RGBA (4 bytes per pixel) to dst
+    void ThresholdRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *dst) const;
+
+    ///Number of UInt8 channels written per pixel by DisplayRow: 4 (RGBA) for a single-stain profile, else GetOutputChannels()
+    inline int GetDisplayRowChannels() const { return (m_numStains == 1) ? 4 : GetOutputChannels(); }
+    ///Write the displayed output for a row as the ColorDeconvolution kernel does: a single-stain profile is only
+    ///thresholded (ThresholdRow), two or three stains are separated (SeparateRow). Writes GetDisplayRowChannels() bytes per pixel.
+    void DisplayRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *dst) const;
+
+private:
+    ///Write one separated output pixel (grayscale or RGBA) to dst
+    inline void WriteOutputPixel(const double (&RGB_sep)[3], const double &quant, unsigned char *dst) const {
+        if (m_grayscaleQuantityOnly) {
+            //Saturate quantities above 2.55 to the channel maximum
+            int sq = static_cast<int>(quant * m_grayscaleNormFactor);
+            dst[0] = static_cast<unsigned char>((sq > 255) ? 255 : sq);
+        }
+        else {
+            dst[0] = static_cast<unsigned char>(static_cast<int>(RGB_sep[0]));
+            dst[1] = static_cast<unsigned char>(static_cast<int>(RGB_sep[1]));
+            dst[2] = static_cast<unsigned char>(static_cast<int>(RGB_sep[2]));
+            dst[3] = 255;
+        }
+    }
+
+    ///Derive the zero-row-repaired matrix, the inverse and the OD lookup table from m_stainMatrix
+    void CompileMatrices();
+    ///Find the lowest channel value for which the displayed stain is certainly below the threshold
+    void CompileBackgroundCutoff();
+    ///Fill the float32 vector kernel parameters for each stain and select the row kernel
+    void CompileSIMD(bool useSIMD);
+
+private:
+    bool m_isValid;
+    int m_numStains;
+    int m_displayStain;
+    bool m_applyThreshold;
+    double m_threshold;
+    bool m_grayscaleQuantityOnly;
+    //Normalization for grayscale stain quantities: -log_10(1/255) is 2.40, so set 2.55 to be channel 255 = norm factor 100
+    double m_grayscaleNormFactor;
+
+    Matrix9 m_stainMatrix;
+    Matrix9 m_noZeroRowsMatrix;
+    Matrix9 m_inverseMatrix;
+    double m_odLookup[256];
+    double m_quantityScale;
+    int m_backgroundCutoff;
+
+    ColorDeconvolutionSIMD::InstructionSet m_instructionSet;
+    ColorDeconvolutionSIMD::RowFunction m_simdRowFunction;
+    ColorDeconvolutionSIMD::Params m_simdParams[3];
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_IMAGEPIXELACCESS_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_IMAGEPIXELACCESS_H
+
+#include "Image.h"
+#include "global/ColorSpace.h"
+
+namespace sedeen {
+namespace image {
+
+///True if the image stores interleaved UInt8 channels (at least minChannels), so that rows can be read through a raw pointer
+inline bool isInterleavedUInt8(const RawImage &image, const int &minChannels = 3) {
+    const ColorSpace &cs = image.colorSpace();
+    return (cs.channelType() == ChannelType::UInt8) && (cs.channelCount() >= minChannels)
+        && (image.order() == Interleaved);
+}
+
+///True if the image stores interleaved UInt16 channels (at least minChannels), so that rows can be read through a raw pointer
+inline bool isInterleavedUInt16(const RawImage &image, const int &minChannels = 1) {
+    const ColorSpace &cs = image.colorSpace();
+    return (cs.channelType() == ChannelType::UInt16) && (cs.channelCount() >= minChannels)
+        && (image.order() == Interleaved);
+}
+
+///Pointer to the first byte of an interleaved UInt8 image; rows are width*channelCount bytes apart
+inline const unsigned char* rawPixels(const RawImage &image) {
+    return static_cast<const unsigned char*>(image.data().get());
+}
+
+///Writable pointer to the first byte of an image created by the caller
+inline unsigned char* rawPixels(RawImage &image) {
+    return static_cast<unsigned char*>(const_cast<void*>(static_cast<const void*>(image.data().get())));
+}
+
+} // namespace image
+} // namespace sedeen
+#endif
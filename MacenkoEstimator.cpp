@@ -0,0 +1,221 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "MacenkoEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double MacenkoEstimator::DefaultPercentile = 1.0;
+
+namespace {
+    ///Number of blocks the samples are summed in; partial sums are added in block order,
+    ///so the result does not depend on the number of threads
+    const int SumBlocks = 64;
+
+    ///Scale a 3-vector to unit length, pointing into the positive octant as far as possible
+    void NormalizeStainVector(std::array<double, 3> &v) {
+        const double norm = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        const double sign = (v[0] + v[1] + v[2] < 0.0) ? -1.0 : 1.0;
+        for (int c = 0; c < 3; c++) {
+            v[c] = (norm > 0.0) ? (sign * v[c] / norm) : 0.0;
+        }
+    }
+}
+
+MacenkoEstimator::MacenkoEstimator(const ODSampleReservoir &samples, const double &percentile /*= DefaultPercentile*/)
+    : m_isValid(false),
+    m_percentile((percentile < 0.0) ? 0.0 : ((percentile > 49.0) ? 49.0 : percentile)),
+    m_numSamples(0),
+    m_capacity(samples.GetCapacity()),
+    m_odThreshold(samples.GetODThreshold()),
+    m_eigenvalues({ 0.0, 0.0, 0.0 })
+{
+    m_stainVectors[0] = { 0.0, 0.0, 0.0 };
+    m_stainVectors[1] = { 0.0, 0.0, 0.0 };
+    std::vector<float> od;
+    samples.GetODSamples(od);
+    const long long n = static_cast<long long>(od.size() / 3);
+    m_numSamples = n;
+    if (n < 2) {
+        return;
+    }
+
+    //Second moment matrix of the OD samples: xx, xy, xz, yy, yz, zz
+    double blockSums[SumBlocks][6];
+#pragma omp parallel for
+    for (int b = 0; b < SumBlocks; b++) {
+        double sums[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+        for (long long i = n * b / SumBlocks; i < n * (b + 1) / SumBlocks; i++) {
+            const double x = od[3 * i], y = od[3 * i + 1], z = od[3 * i + 2];
+            sums[0] += x * x;
+            sums[1] += x * y;
+            sums[2] += x * z;
+            sums[3] += y * y;
+            sums[4] += y * z;
+            sums[5] += z * z;
+        }
+        std::copy(sums, sums + 6, blockSums[b]);
+    }
+    double moments[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    for (int b = 0; b < SumBlocks; b++) {
+        for (int k = 0; k < 6; k++) {
+            moments[k] += blockSums[b][k];
+        }
+    }
+    const double matrix[9] = { moments[0], moments[1], moments[2],
+                               moments[1], moments[3], moments[4],
+                               moments[2], moments[4], moments[5] };
+    double values[3], vectors[9];
+    SymmetricEigen3x3(matrix, values, vectors);
+    for (int k = 0; k < 3; k++) {
+        m_eigenvalues[k] = values[k] / n;
+    }
+    if (!(m_eigenvalues[1] > 0.0)) {
+        return;
+    }
+    std::array<double, 3> planeX = { vectors[0], vectors[1], vectors[2] };
+    std::array<double, 3> planeY = { vectors[3], vectors[4], vectors[5] };
+    NormalizeStainVector(planeX);
+    NormalizeStainVector(planeY);
+
+    //Angle of each sample projected onto the plane of the two largest eigenvectors
+    std::vector<double> angles(static_cast<size_t>(n));
+#pragma omp parallel for
+    for (long long i = 0; i < n; i++) {
+        const float *p = od.data() + 3 * i;
+        const double u = p[0] * planeX[0] + p[1] * planeX[1] + p[2] * planeX[2];
+        const double v = p[0] * planeY[0] + p[1] * planeY[1] + p[2] * planeY[2];
+        angles[i] = std::atan2(v, u);
+    }
+    const long long lowIndex = static_cast<long long>(std::floor(m_percentile / 100.0 * (n - 1)));
+    const long long highIndex = static_cast<long long>(std::ceil((100.0 - m_percentile) / 100.0 * (n - 1)));
+    std::nth_element(angles.begin(), angles.begin() + lowIndex, angles.end());
+    const double minAngle = angles[lowIndex];
+    std::nth_element(angles.begin(), angles.begin() + highIndex, angles.end());
+    const double maxAngle = angles[highIndex];
+    if (!(maxAngle > minAngle)) {
+        return;
+    }
+
+    //The extreme directions in the plane are the stains; the one with more red OD is first
+    std::array<double, 3> minVector, maxVector;
+    for (int c = 0; c < 3; c++) {
+        minVector[c] = std::cos(minAngle) * planeX[c] + std::sin(minAngle) * planeY[c];
+        maxVector[c] = std::cos(maxAngle) * planeX[c] + std::sin(maxAngle) * planeY[c];
+    }
+    NormalizeStainVector(minVector);
+    NormalizeStainVector(maxVector);
+    const bool minFirst = (minVector[0] > maxVector[0]);
+    m_stainVectors[0] = minFirst ? minVector : maxVector;
+    m_stainVectors[1] = minFirst ? maxVector : minVector;
+    m_isValid = true;
+}//end constructor
+
+MacenkoEstimator::~MacenkoEstimator() {
+}//end destructor
+
+double MacenkoEstimator::GetAngleBetweenStains() const {
+    double cosine = 0.0;
+    for (int c = 0; c < 3; c++) {
+        cosine += m_stainVectors[0][c] * m_stainVectors[1][c];
+    }
+    cosine = (cosine > 1.0) ? 1.0 : ((cosine < -1.0) ? -1.0 : cosine);
+    return std::acos(cosine);
+}//end GetAngleBetweenStains
+
+bool MacenkoEstimator::WriteToProfile(StainProfile &profile, const std::string &profileName,
+    const std::string &stainOneName /*= "Hematoxylin"*/, const std::string &stainTwoName /*= "Eosin"*/) const {
+    if (!m_isValid) {
+        return false;
+    }
+    //Parameters of a previous algorithm do not apply
+    profile.ClearAllSeparationAlgorithmParameters();
+    return profile.SetNameOfStainProfile(profileName)
+        && profile.SetNumberOfStainComponents(2)
+        && profile.SetNameOfStainOne(stainOneName)
+        && profile.SetNameOfStainTwo(stainTwoName)
+        && profile.SetNameOfStainThree("")
+        && profile.SetStainOneRGB(m_stainVectors[0])
+        && profile.SetStainTwoRGB(m_stainVectors[1])
+        && profile.SetStainThreeRGB(0.0, 0.0, 0.0)
+        && profile.SetNameOfStainAnalysisModel(profile.GetStainAnalysisModelName(0))
+        && profile.SetNameOfStainSeparationAlgorithm("Macenko Decomposition")
+        && profile.SetSeparationAlgorithmNumPixelsParameter(static_cast<long int>(m_capacity))
+        && profile.SetSeparationAlgorithmThresholdParameter(m_odThreshold)
+        && profile.SetSeparationAlgorithmPercentileParameter(m_percentile);
+}//end WriteToProfile
+
+void MacenkoEstimator::SymmetricEigen3x3(const double (&matrix)[9], double (&values)[3], double (&vectors)[9]) {
+    double a[3][3], v[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            a[i][j] = matrix[3 * i + j];
+            v[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+    }
+    //Cyclic Jacobi: rotate away each off-diagonal element in turn until they are negligible
+    for (int sweep = 0; sweep < 50; sweep++) {
+        const double offDiagonal = std::fabs(a[0][1]) + std::fabs(a[0][2]) + std::fabs(a[1][2]);
+        const double diagonal = std::fabs(a[0][0]) + std::fabs(a[1][1]) + std::fabs(a[2][2]);
+        if (offDiagonal <= 1e-15 * diagonal) {
+            break;
+        }
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (a[p][q] == 0.0) {
+                    continue;
+                }
+                const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                const double t = ((theta < 0.0) ? -1.0 : 1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    const double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    const double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    const double vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    //Columns of v are the eigenvectors; return them as rows, largest eigenvalue first
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [&](int i, int j) { return a[i][i] > a[j][j]; });
+    for (int k = 0; k < 3; k++) {
+        values[k] = a[order[k]][order[k]];
+        for (int c = 0; c < 3; c++) {
+            vectors[3 * k + c] = v[c][order[k]];
+        }
+    }
+}//end SymmetricEigen3x3
@@ -0,0 +1,85 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_MACENKOESTIMATOR_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_MACENKOESTIMATOR_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "ODSampleReservoir.h"
+#include "StainProfile.h"
+
+///Estimates two stain vectors from a sample of pixel optical densities, with the method of:
+///Macenko M, et al. A method for normalizing histology slides for quantitative analysis.
+///IEEE International Symposium on Biomedical Imaging 2009; 1107-1110.
+///
+///The OD samples are projected onto the plane of the two largest eigenvectors of their 3x3 second
+///moment matrix, and the stain vectors are the directions at a low and a high percentile of the angle
+///of the projected samples in that plane. The stain with the larger red OD (hematoxylin, in H&E) is first.
+class MacenkoEstimator
+{
+public:
+    ///Default percentile of the angles taken as the extreme stain directions (and 100 minus it)
+    static const double DefaultPercentile;
+
+public:
+    ///Estimate the stain vectors of the pixels in a sample
+    explicit MacenkoEstimator(const ODSampleReservoir &samples, const double &percentile = DefaultPercentile);
+    ///destructor
+    ~MacenkoEstimator();
+
+    ///True if there were enough samples, not all in one direction, to estimate two stain vectors
+    inline bool IsValid() const { return m_isValid; }
+    ///Unit OD vector of a stain (0 or 1), in R, G, B order
+    inline const std::array<double, 3>& GetStainVector(const int &stain) const { return m_stainVectors.at(stain); }
+    ///Eigenvalues of the second moment matrix of the samples, largest first
+    inline const std::array<double, 3>& GetEigenvalues() const { return m_eigenvalues; }
+    ///Angle in radians between the two stain vectors
+    double GetAngleBetweenStains() const;
+    ///Number of OD samples the vectors were estimated from
+    inline long long GetNumberOfSamples() const { return m_numSamples; }
+    ///Percentile of the angles used for the stain directions
+    inline double GetPercentile() const { return m_percentile; }
+
+    ///Write the stain vectors to a two-stain profile, with the Macenko algorithm and its parameters
+    bool WriteToProfile(StainProfile &profile, const std::string &profileName, 
+        const std::string &stainOneName = "Hematoxylin", const std::string &stainTwoName = "Eosin") const;
+
+    ///Eigenvalues (in decreasing order) and unit eigenvectors (rows of vectors, in the same order) of a
+    ///symmetric 3x3 matrix, by Jacobi rotations
+    static void SymmetricEigen3x3(const double (&matrix)[9], double (&values)[3], double (&vectors)[9]);
+
+private:
+    bool m_isValid;
+    double m_percentile;
+    long long m_numSamples;
+    long long m_capacity;
+    double m_odThreshold;
+    std::array<double, 3> m_eigenvalues;
+    std::array<std::array<double, 3>, 2> m_stainVectors;
+};
+
+#endif
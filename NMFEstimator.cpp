@@ -0,0 +1,321 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "NMFEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int NMFEstimator::DefaultMaxIterations;
+const double NMFEstimator::DefaultSparsity = 0.01;
+const double NMFEstimator::DefaultTolerance = 1e-5;
+
+namespace {
+    ///Sums over one block of samples for the update of the stain vectors, and its part of the objective
+    struct BlockSums {
+        double vh[3][3]; //sum of v h^T: [channel][stain]
+        double hh[3][3]; //sum of h h^T: [stain][stain]
+        double objective;
+    };
+
+    ///Invert the submatrix of a symmetric matrix on the stains in a bit mask, by Gauss-Jordan elimination;
+    ///elements outside the submatrix are zero. Returns false if the submatrix is singular.
+    bool InvertSubmatrix(const double (&G)[3][3], const int &mask, double (&inverse)[3][3]) {
+        int index[3], size = 0;
+        for (int k = 0; k < 3; k++) {
+            if (mask & (1 << k)) {
+                index[size++] = k;
+            }
+        }
+        double a[3][6] = { { 0.0 } };
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < size; j++) {
+                a[i][j] = G[index[i]][index[j]];
+            }
+            a[i][size + i] = 1.0;
+        }
+        for (int col = 0; col < size; col++) {
+            int pivot = col;
+            for (int i = col + 1; i < size; i++) {
+                pivot = (std::fabs(a[i][col]) > std::fabs(a[pivot][col])) ? i : pivot;
+            }
+            if (std::fabs(a[pivot][col]) < 1e-12) {
+                return false;
+            }
+            for (int j = 0; j < 2 * size; j++) {
+                std::swap(a[col][j], a[pivot][j]);
+            }
+            const double p = a[col][col];
+            for (int j = 0; j < 2 * size; j++) {
+                a[col][j] /= p;
+            }
+            for (int i = 0; i < size; i++) {
+                if (i != col) {
+                    const double f = a[i][col];
+                    for (int j = 0; j < 2 * size; j++) {
+                        a[i][j] -= f * a[col][j];
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                inverse[i][j] = 0.0;
+            }
+        }
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < size; j++) {
+                inverse[index[i]][index[j]] = a[i][size + j];
+            }
+        }
+        return true;
+    }
+
+    ///Number of block coordinate descent sweeps over the stain vectors per iteration
+    const int StainVectorSweeps = 3;
+}
+
+NMFEstimator::NMFEstimator(const ODSampleReservoir &samples, const std::vector<std::array<double, 3>> &initialVectors,
+    const double &sparsity /*= DefaultSparsity*/, const int &maxIterations /*= DefaultMaxIterations*/,
+    const double &tolerance /*= DefaultTolerance*/)
+    : m_isValid(false),
+    m_numStains(static_cast<int>(initialVectors.size())),
+    m_sparsity((sparsity > 0.0) ? sparsity : 0.0),
+    m_maxIterations((maxIterations > 0) ? maxIterations : 1),
+    m_tolerance((tolerance > 0.0) ? tolerance : 0.0),
+    m_iterations(0),
+    m_converged(false),
+    m_objective(0.0),
+    m_numSamples(0),
+    m_capacity(samples.GetCapacity()),
+    m_odThreshold(samples.GetODThreshold()),
+    m_workingSize(0),
+    m_stainVectors(initialVectors)
+{
+    const int r = m_numStains;
+    if ((r < 2) || (r > 3)) {
+        return;
+    }
+    std::vector<float> od;
+    samples.GetODSamples(od);
+    const long long n = static_cast<long long>(od.size() / 3);
+    m_numSamples = n;
+    m_workingSize = od.size() * sizeof(float);
+    if (n < r) {
+        return;
+    }
+
+    //W, one non-negative unit column per stain
+    double W[3][3] = { { 0.0 } };
+    for (int k = 0; k < r; k++) {
+        double norm = 0.0;
+        for (int c = 0; c < 3; c++) {
+            W[c][k] = std::max(initialVectors[k][c], 0.0);
+            norm += W[c][k] * W[c][k];
+        }
+        if (!(norm > 0.0)) {
+            return;
+        }
+        norm = std::sqrt(norm);
+        for (int c = 0; c < 3; c++) {
+            W[c][k] /= norm;
+        }
+    }
+
+    const int numSubsets = 1 << r;
+    const long long numBlocks = (n + BlockSize - 1) / BlockSize;
+    std::vector<BlockSums> blockSums(static_cast<size_t>(numBlocks));
+    const double lambda = m_sparsity;
+    double previousObjective = 0.0;
+
+    for (int iteration = 0; iteration < m_maxIterations; iteration++) {
+        //The Gram matrix W^T W, and the inverse of its submatrix for each set of non-zero stains
+        double G[3][3] = { { 0.0 } };
+        for (int k = 0; k < r; k++) {
+            for (int j = 0; j < r; j++) {
+                for (int c = 0; c < 3; c++) {
+                    G[k][j] += W[c][k] * W[c][j];
+                }
+            }
+        }
+        double inverses[8][3][3];
+        bool invertible[8] = { false };
+        for (int mask = 1; mask < numSubsets; mask++) {
+            invertible[mask] = InvertSubmatrix(G, mask, inverses[mask]);
+        }
+        //Larger sets first; the empty set last
+        int subsets[8], numTested = 0;
+        for (int size = r; size >= 0; size--) {
+            for (int mask = 0; mask < numSubsets; mask++) {
+                int bits = 0;
+                for (int k = 0; k < r; k++) {
+                    bits += (mask >> k) & 1;
+                }
+                if ((bits == size) && ((mask == 0) || invertible[mask])) {
+                    subsets[numTested++] = mask;
+                }
+            }
+        }
+
+        //The quantities of each sample given W, and the sums for the update of W, one block at a time
+#pragma omp parallel for schedule(static)
+        for (long long b = 0; b < numBlocks; b++) {
+            BlockSums sums = { { { 0.0 } }, { { 0.0 } }, 0.0 };
+            const long long end = std::min(n, (b + 1) * BlockSize);
+            for (long long i = b * BlockSize; i < end; i++) {
+                const float *v = od.data() + 3 * i;
+                //Minimize 0.5 h^T G h - h^T (W^T v - lambda) over h >= 0: the first set of non-zero
+                //stains whose solution is positive, and whose gradient is non-negative off the set
+                double target[3] = { 0.0, 0.0, 0.0 };
+                for (int k = 0; k < r; k++) {
+                    target[k] = W[0][k] * v[0] + W[1][k] * v[1] + W[2][k] * v[2] - lambda;
+                }
+                double h[3] = { 0.0, 0.0, 0.0 };
+                for (int t = 0; t < numTested; t++) {
+                    const int mask = subsets[t];
+                    bool optimal = true;
+                    for (int k = 0; (k < r) && optimal; k++) {
+                        h[k] = 0.0;
+                        if (mask & (1 << k)) {
+                            for (int j = 0; j < r; j++) {
+                                h[k] += inverses[mask][k][j] * target[j];
+                            }
+                            optimal = (h[k] > 0.0);
+                        }
+                    }
+                    for (int k = 0; (k < r) && optimal; k++) {
+                        if (!(mask & (1 << k))) {
+                            double gradient = -target[k];
+                            for (int j = 0; j < r; j++) {
+                                gradient += G[k][j] * h[j];
+                            }
+                            optimal = (gradient >= 0.0);
+                        }
+                    }
+                    if (optimal) {
+                        break;
+                    }
+                    h[0] = h[1] = h[2] = 0.0;
+                }
+
+                double residual = 0.0, l1 = 0.0;
+                for (int c = 0; c < 3; c++) {
+                    double e = v[c];
+                    for (int k = 0; k < r; k++) {
+                        e -= W[c][k] * h[k];
+                        sums.vh[c][k] += v[c] * h[k];
+                    }
+                    residual += e * e;
+                }
+                for (int k = 0; k < r; k++) {
+                    l1 += h[k];
+                    for (int j = 0; j < r; j++) {
+                        sums.hh[k][j] += h[k] * h[j];
+                    }
+                }
+                sums.objective += 0.5 * residual + lambda * l1;
+            }
+            blockSums[b] = sums;
+        }
+        BlockSums total = { { { 0.0 } }, { { 0.0 } }, 0.0 };
+        for (long long b = 0; b < numBlocks; b++) {
+            for (int c = 0; c < 3; c++) {
+                for (int k = 0; k < 3; k++) {
+                    total.vh[c][k] += blockSums[b].vh[c][k];
+                    total.hh[c][k] += blockSums[b].hh[c][k];
+                }
+            }
+            total.objective += blockSums[b].objective;
+        }
+        m_objective = total.objective / n;
+        m_iterations = iteration + 1;
+
+        //Block coordinate descent on the columns of W given H, each kept non-negative and within the unit ball
+        for (int sweep = 0; sweep < StainVectorSweeps; sweep++) {
+            for (int k = 0; k < r; k++) {
+                if (!(total.hh[k][k] > 0.0)) {
+                    continue;
+                }
+                double u[3], norm = 0.0;
+                for (int c = 0; c < 3; c++) {
+                    double Wa = 0.0;
+                    for (int j = 0; j < r; j++) {
+                        Wa += W[c][j] * total.hh[j][k];
+                    }
+                    u[c] = std::max(W[c][k] + (total.vh[c][k] - Wa) / total.hh[k][k], 0.0);
+                    norm += u[c] * u[c];
+                }
+                norm = std::sqrt(norm);
+                for (int c = 0; c < 3; c++) {
+                    W[c][k] = (norm > 1.0) ? (u[c] / norm) : u[c];
+                }
+            }
+        }
+
+        if ((iteration > 0) && (previousObjective - m_objective <= m_tolerance * previousObjective)) {
+            m_converged = true;
+            break;
+        }
+        previousObjective = m_objective;
+    }
+
+    //Unit stain vectors
+    for (int k = 0; k < r; k++) {
+        const double norm = std::sqrt(W[0][k] * W[0][k] + W[1][k] * W[1][k] + W[2][k] * W[2][k]);
+        if (!(norm > 0.0)) {
+            return;
+        }
+        for (int c = 0; c < 3; c++) {
+            m_stainVectors[k][c] = W[c][k] / norm;
+        }
+    }
+    m_isValid = true;
+}//end constructor
+
+NMFEstimator::~NMFEstimator() {
+}//end destructor
+
+bool NMFEstimator::WriteToProfile(StainProfile &profile, const std::string &profileName, 
+    const std::vector<std::string> &stainNames) const {
+    if (!m_isValid) {
+        return false;
+    }
+    auto name = [&](int s) { return (s < static_cast<int>(stainNames.size())) ? stainNames[s] : std::string(); };
+    //Parameters of a previous algorithm do not apply
+    profile.ClearAllSeparationAlgorithmParameters();
+    return profile.SetNameOfStainProfile(profileName)
+        && profile.SetNumberOfStainComponents(m_numStains)
+        && profile.SetNameOfStainOne(name(0))
+        && profile.SetNameOfStainTwo(name(1))
+        && profile.SetNameOfStainThree((m_numStains > 2) ? name(2) : std::string())
+        && profile.SetStainOneRGB(m_stainVectors[0])
+        && profile.SetStainTwoRGB(m_stainVectors[1])
+        && ((m_numStains > 2) ? profile.SetStainThreeRGB(m_stainVectors[2]) : profile.SetStainThreeRGB(0.0, 0.0, 0.0))
+        && profile.SetNameOfStainAnalysisModel(profile.GetStainAnalysisModelName(0))
+        && profile.SetNameOfStainSeparationAlgorithm("Non-Negative Matrix Factorization")
+        && profile.SetSeparationAlgorithmNumPixelsParameter(static_cast<long int>(m_capacity))
+        && profile.SetSeparationAlgorithmThresholdParameter(m_odThreshold)
+        && profile.SetSeparationAlgorithmSparsityParameter(m_sparsity)
+        && profile.SetSeparationAlgorithmIterationsParameter(m_maxIterations);
+}//end WriteToProfile
@@ -0,0 +1,107 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_NMFESTIMATOR_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_NMFESTIMATOR_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "ODSampleReservoir.h"
+#include "StainProfile.h"
+
+///Estimates two or three stain vectors from a sample of pixel optical densities by sparse non-negative
+///matrix factorization, as in:
+///Vahadane A, et al. Structure-preserving color normalization and sparse stain separation for
+///histological images. IEEE Transactions on Medical Imaging 2016; 35(8): 1962-1971.
+///
+///The OD samples V (3 x n) are factored as W H, with W (3 x stains) the stain vectors and H (stains x n)
+///the non-negative stain quantities, minimizing 0.5 |V - W H|^2 + sparsity * |H|_1 by alternating
+///least squares, starting from initial stain vectors so that the stains keep their order. Given W,
+///the quantities of each sample are found exactly (a non-negative lasso over at most three stains,
+///solved by testing each set of non-zero stains); given H, the columns of W are updated by block
+///coordinate descent, kept non-negative and within the unit ball. Each iteration is one pass over the
+///samples in fixed blocks, run in parallel, and the block sums are added in block order, so the
+///result does not depend on the number of threads. H is not stored: only the samples are kept in
+///memory. Iterations stop when the objective decreases by less than the tolerance, relative to its value.
+class NMFEstimator
+{
+public:
+    ///Default weight of the L1 penalty on the stain quantities
+    static const double DefaultSparsity;
+    ///Default maximum number of iterations
+    static const int DefaultMaxIterations = 200;
+    ///Default relative change of the objective below which the iterations stop
+    static const double DefaultTolerance;
+    ///Number of samples in each block of a pass
+    static const int BlockSize = 4096;
+
+public:
+    ///Factor the OD samples into numStains (2 or 3) stains, starting from the given unit stain vectors
+    NMFEstimator(const ODSampleReservoir &samples, const std::vector<std::array<double, 3>> &initialVectors,
+        const double &sparsity = DefaultSparsity, const int &maxIterations = DefaultMaxIterations, 
+        const double &tolerance = DefaultTolerance);
+    ///destructor
+    ~NMFEstimator();
+
+    ///True if there were samples and initial vectors for two or three stains
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of stains estimated
+    inline int GetNumberOfStains() const { return m_numStains; }
+    ///Unit OD vector of a stain, in R, G, B order
+    inline const std::array<double, 3>& GetStainVector(const int &stain) const { return m_stainVectors.at(stain); }
+    ///Number of iterations run
+    inline int GetIterations() const { return m_iterations; }
+    ///True if the iterations stopped because the objective changed by less than the tolerance
+    inline bool HasConverged() const { return m_converged; }
+    ///Mean objective per sample after the last iteration: half the squared residual plus sparsity times the quantity sum
+    inline double GetObjective() const { return m_objective; }
+    ///Number of OD samples the vectors were estimated from
+    inline long long GetNumberOfSamples() const { return m_numSamples; }
+    ///Weight of the L1 penalty on the stain quantities
+    inline double GetSparsity() const { return m_sparsity; }
+    ///Memory used for the samples while factoring, in bytes
+    inline size_t GetWorkingSizeInBytes() const { return m_workingSize; }
+
+    ///Write the stain vectors to a profile with the given stain names, with the NMF algorithm and its parameters
+    bool WriteToProfile(StainProfile &profile, const std::string &profileName, const std::vector<std::string> &stainNames) const;
+
+private:
+    bool m_isValid;
+    int m_numStains;
+    double m_sparsity;
+    int m_maxIterations;
+    double m_tolerance;
+    int m_iterations;
+    bool m_converged;
+    double m_objective;
+    long long m_numSamples;
+    long long m_capacity;
+    double m_odThreshold;
+    size_t m_workingSize;
+    std::vector<std::array<double, 3>> m_stainVectors;
+};
+
+#endif
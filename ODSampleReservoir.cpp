@@ -0,0 +1,122 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "ODSampleReservoir.h"
+#include "ODConversion.h"
+
+#include <algorithm>
+
+const long long ODSampleReservoir::DefaultCapacity;
+const double ODSampleReservoir::DefaultODThreshold = 0.15;
+
+namespace {
+    ///Bits of a sample value holding the RGB colour of the pixel; the key is in the bits above them
+    const int ColourBits = 24;
+    const unsigned long long ColourMask = (1ULL << ColourBits) - 1;
+
+    ///Finalizer of the splitmix64 generator, spreading the bits of a row hash over the key
+    inline unsigned long long MixBits(unsigned long long h) {
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+    }
+}
+
+ODSampleReservoir::ODSampleReservoir(const long long &capacity /*= DefaultCapacity*/, 
+    const double &odThreshold /*= DefaultODThreshold*/)
+    : m_capacity((capacity > 0) ? capacity : 0),
+    m_odThreshold(odThreshold),
+    m_pixelCount(0),
+    m_candidateCount(0)
+{
+    ODConversion converter;
+    for (int i = 0; i < 256; i++) {
+        m_lookupOD[i] = static_cast<float>(converter.LookupRGBtoOD(i));
+    }
+}//end constructor
+
+ODSampleReservoir::~ODSampleReservoir() {
+}//end destructor
+
+void ODSampleReservoir::AddRow(const unsigned char *src, const int &srcChannels, const int &width,
+    const unsigned char *mask /*= nullptr*/) {
+    const float *lookupOD = m_lookupOD;
+    const float threshold = static_cast<float>(m_odThreshold);
+    //The hash of each pixel includes every pixel before it in the row, so that equal colours get different keys
+    unsigned long long rowHash = 0x9E3779B97F4A7C15ULL;
+    for (int x = 0; x < width; x++) {
+        const unsigned char *p = src + x * srcChannels;
+        const unsigned long long colour = p[0] | (static_cast<unsigned long long>(p[1]) << 8) 
+            | (static_cast<unsigned long long>(p[2]) << 16);
+        rowHash = (rowHash ^ colour) * 0x9E3779B97F4A7C15ULL;
+        if ((mask != nullptr) && (mask[x] == 0)) {
+            continue;
+        }
+        m_pixelCount++;
+        if (lookupOD[p[0]] + lookupOD[p[1]] + lookupOD[p[2]] < threshold) {
+            continue;
+        }
+        m_candidateCount++;
+        Insert((MixBits(rowHash) & ~ColourMask) | colour);
+    }
+}//end AddRow
+
+void ODSampleReservoir::Merge(const ODSampleReservoir &other) {
+    m_pixelCount += other.m_pixelCount;
+    m_candidateCount += other.m_candidateCount;
+    for (auto it = other.m_samples.begin(); it != other.m_samples.end(); ++it) {
+        Insert(*it);
+    }
+}//end Merge
+
+void ODSampleReservoir::Insert(const unsigned long long &sample) {
+    if (static_cast<long long>(m_samples.size()) < m_capacity) {
+        //Every candidate is kept until the sample is full, and only then ordered by key
+        m_samples.push_back(sample);
+        if (static_cast<long long>(m_samples.size()) == m_capacity) {
+            std::make_heap(m_samples.begin(), m_samples.end());
+        }
+    }
+    else if ((m_capacity > 0) && (sample < m_samples.front())) {
+        //Replace the largest key
+        std::pop_heap(m_samples.begin(), m_samples.end());
+        m_samples.back() = sample;
+        std::push_heap(m_samples.begin(), m_samples.end());
+    }
+}//end Insert
+
+void ODSampleReservoir::GetODSamples(std::vector<float> &od) const {
+    //The heap order depends on the order of insertion; sorted values do not
+    std::vector<unsigned long long> sorted(m_samples);
+    std::sort(sorted.begin(), sorted.end());
+    const long long n = static_cast<long long>(sorted.size());
+    od.resize(3 * sorted.size());
+#pragma omp parallel for
+    for (long long i = 0; i < n; i++) {
+        const unsigned long long colour = sorted[i] & ColourMask;
+        od[3 * i    ] = m_lookupOD[colour & 0xFF];
+        od[3 * i + 1] = m_lookupOD[(colour >> 8) & 0xFF];
+        od[3 * i + 2] = m_lookupOD[(colour >> 16) & 0xFF];
+    }
+}//end GetODSamples
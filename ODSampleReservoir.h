@@ -0,0 +1,91 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_ODSAMPLERESERVOIR_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_ODSAMPLERESERVOIR_H
+
+#include <cstddef>
+#include <vector>
+
+///A uniform random sample of at most a fixed number of pixels, from those added to it whose optical
+///density (summed over the R, G and B channels) is at least a threshold, for estimating stain vectors
+///from a whole slide.
+///
+///Each candidate pixel is given a pseudo-random key, hashed from its colour and the pixels before it
+///in its row, and the pixels with the smallest keys are kept (priority reservoir sampling). Keeping the
+///smallest keys of the union is also how two samples are merged, so samples of parts of an image (for
+///example, one per thread) can be merged in any order and always give the same pixels.
+class ODSampleReservoir
+{
+public:
+    ///Default number of pixels kept
+    static const long long DefaultCapacity = 200000;
+    ///Default OD sum threshold of a candidate pixel, as in TissueMask
+    static const double DefaultODThreshold;
+
+public:
+    ///Keep at most capacity pixels whose OD sum is at least odThreshold
+    explicit ODSampleReservoir(const long long &capacity = DefaultCapacity, const double &odThreshold = DefaultODThreshold);
+    ///destructor
+    ~ODSampleReservoir();
+
+    ///Maximum number of pixels kept
+    inline long long GetCapacity() const { return m_capacity; }
+    ///OD sum threshold of a candidate pixel
+    inline double GetODThreshold() const { return m_odThreshold; }
+    ///Number of pixels added, including those below the threshold
+    inline long long GetPixelCount() const { return m_pixelCount; }
+    ///Number of pixels added that were at or above the threshold
+    inline long long GetCandidateCount() const { return m_candidateCount; }
+    ///Number of pixels in the sample: the candidate count, up to the capacity
+    inline long long GetNumberOfSamples() const { return static_cast<long long>(m_samples.size()); }
+    ///Memory used by the sample
+    inline size_t GetSizeInBytes() const { return m_samples.capacity() * sizeof(unsigned long long); }
+
+    ///Add a row of interleaved UInt8 pixels with srcChannels (3 or more) channels;
+    ///if mask is not null, only pixels where it is non-zero are added
+    void AddRow(const unsigned char *src, const int &srcChannels, const int &width, const unsigned char *mask = nullptr);
+    ///Add the pixels of another sample with the same capacity and threshold
+    void Merge(const ODSampleReservoir &other);
+
+    ///The OD of the R, G and B channels of each pixel in the sample, interleaved, in an order that
+    ///depends only on the pixels
+    void GetODSamples(std::vector<float> &od) const;
+
+private:
+    ///Add a sample value (key in the high bits, RGB in the low 24 bits) if its key is among the smallest
+    void Insert(const unsigned long long &sample);
+
+private:
+    long long m_capacity;
+    double m_odThreshold;
+    long long m_pixelCount;
+    long long m_candidateCount;
+    ///OD of each 8-bit value
+    float m_lookupOD[256];
+    ///The kept values; a max-heap ordered by key once the sample is full
+    std::vector<unsigned long long> m_samples;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "QuantileSketch.h"
+
+#include <cmath>
+
+const double QuantileSketch::MinValue = std::ldexp(1.0, QuantileSketch::MinExponent);
+const double QuantileSketch::MaxValue = std::ldexp(1.0, QuantileSketch::MaxExponent);
+
+QuantileSketch::QuantileSketch()
+    : m_counts(NumBuckets, 0),
+    m_count(0),
+    m_minimum(std::numeric_limits<double>::max()),
+    m_maximum(std::numeric_limits<double>::lowest())
+{
+}//end constructor
+
+QuantileSketch::~QuantileSketch() {
+}//end destructor
+
+void QuantileSketch::Merge(const QuantileSketch &other) {
+    for (int b = 0; b < NumBuckets; b++) {
+        m_counts[b] += other.m_counts[b];
+    }
+    m_count += other.m_count;
+    m_minimum = (other.m_minimum < m_minimum) ? other.m_minimum : m_minimum;
+    m_maximum = (other.m_maximum > m_maximum) ? other.m_maximum : m_maximum;
+}//end Merge
+
+double QuantileSketch::BucketValue(const int &bucket) const {
+    if (bucket <= 0) {
+        return 0.0;
+    }
+    if (bucket == 1) {
+        return MinValue / 2.0;
+    }
+    if (bucket >= NumBuckets - 1) {
+        return m_maximum;
+    }
+    const std::uint32_t lowerBits = MinValueBits + (static_cast<std::uint32_t>(bucket - 2) << (23 - SubBucketBits));
+    const std::uint32_t upperBits = lowerBits + (1u << (23 - SubBucketBits));
+    float lower, upper;
+    std::memcpy(&lower, &lowerBits, sizeof(lower));
+    std::memcpy(&upper, &upperBits, sizeof(upper));
+    return (static_cast<double>(lower) + static_cast<double>(upper)) / 2.0;
+}//end BucketValue
+
+double QuantileSketch::GetQuantile(const double &quantile) const {
+    if (m_count == 0) {
+        return 0.0;
+    }
+    //The count at or below the quantile, rounded up, and at least one value
+    const double fraction = (quantile < 0.0) ? 0.0 : ((quantile > 1.0) ? 1.0 : quantile);
+    long long target = static_cast<long long>(std::ceil(fraction * m_count));
+    target = (target < 1) ? 1 : target;
+    long long cumulative = 0;
+    int bucket = 0;
+    for (; bucket < NumBuckets - 1; bucket++) {
+        cumulative += m_counts[bucket];
+        if (cumulative >= target) {
+            break;
+        }
+    }
+    const double value = BucketValue(bucket);
+    return (value < m_minimum) ? m_minimum : ((value > m_maximum) ? m_maximum : value);
+}//end GetQuantile
+
+double QuantileSketch::GetPercentile(const double &percent) const {
+    return GetQuantile(percent / 100.0);
+}//end GetPercentile
+
+std::vector<long long> QuantileSketch::GetHistogram(const int &numBins, const double &maxValue) const {
+    const int bins = (numBins < 1) ? 1 : numBins;
+    std::vector<long long> histogram(bins + 1, 0);
+    const double binsPerValue = (maxValue > 0.0) ? (bins / maxValue) : 0.0;
+    for (int b = 0; b < NumBuckets; b++) {
+        if (m_counts[b] == 0) {
+            continue;
+        }
+        const double position = std::ceil(BucketValue(b) * binsPerValue);
+        const int bin = (b == 0) ? 0 : ((position < 1.0) ? 1 : ((position >= bins) ? bins : static_cast<int>(position)));
+        histogram[bin] += m_counts[b];
+    }
+    return histogram;
+}//end GetHistogram
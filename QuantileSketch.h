@@ -0,0 +1,129 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_QUANTILESKETCH_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_QUANTILESKETCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+///A streaming histogram of values (such as optical densities) from which quantiles and fixed-bin
+///histograms are read after one pass, in memory that does not depend on the number of values.
+///
+///Values are counted in log-linear buckets: each power of two from MinValue to MaxValue is split into
+///2^SubBucketBits buckets of equal width, found from the bits of the value without a logarithm.
+///Counts are exact integers, so the rank of a quantile is exact, and sketches of parts of an image
+///merge in any order (for example, one per thread or tile) to exactly the sketch of the whole.
+///
+///Error bounds, for the nearest-rank quantile x of the values added:
+/// - MinValue <= x < MaxValue: the value returned is within x * GetRelativeError() (1/128) of x;
+/// - 0 < x < MinValue: within MinValue / 2 (about 0.0005) of x;
+/// - x <= 0: 0 is returned; x >= MaxValue: the largest value added is returned.
+///Results are always within the smallest and largest values added, which are kept exactly.
+class QuantileSketch
+{
+public:
+    ///Buckets per power of two are 2^SubBucketBits
+    static const int SubBucketBits = 6;
+    ///Smallest and largest powers of two with their own buckets: values from 2^-10 to 2^4
+    static const int MinExponent = -10;
+    static const int MaxExponent = 4;
+    ///Buckets: values at or below 0, values between 0 and MinValue, the log-linear buckets, values at or above MaxValue
+    static const int NumBuckets = 2 + (MaxExponent - MinExponent) * (1 << SubBucketBits) + 1;
+    ///Smallest value counted in a log-linear bucket
+    static const double MinValue;
+    ///Values at or above this are counted together
+    static const double MaxValue;
+
+public:
+    ///An empty sketch
+    QuantileSketch();
+    ///destructor
+    ~QuantileSketch();
+
+    ///Count a value
+    inline void Add(const double &value) {
+        m_counts[BucketIndex(value)]++;
+        m_count++;
+        m_minimum = (value < m_minimum) ? value : m_minimum;
+        m_maximum = (value > m_maximum) ? value : m_maximum;
+    }
+    ///Add the counts of another sketch
+    void Merge(const QuantileSketch &other);
+
+    ///Number of values added
+    inline long long GetCount() const { return m_count; }
+    ///Smallest value added (0 if none)
+    inline double GetMinimum() const { return (m_count > 0) ? m_minimum : 0.0; }
+    ///Largest value added (0 if none)
+    inline double GetMaximum() const { return (m_count > 0) ? m_maximum : 0.0; }
+    ///Largest error of a quantile, relative to its value, between MinValue and MaxValue
+    static inline double GetRelativeError() { return 1.0 / (1 << (SubBucketBits + 1)); }
+    ///Memory used by the counts
+    inline size_t GetSizeInBytes() const { return m_counts.size() * sizeof(long long); }
+
+    ///Value of the given quantile (0 to 1): the smallest value at or below which at least that fraction
+    ///of the values are (nearest rank), within the error bounds above (0 if no values were added)
+    double GetQuantile(const double &quantile) const;
+    ///Value of the given percentile (0 to 100), as GetQuantile
+    double GetPercentile(const double &percent) const;
+    ///Counts of numBins + 1 fixed bins: bin 0 holds the values at or below 0, bin k the values in
+    ///((k-1)*w, k*w] with w = maxValue/numBins, and the last bin also the values above maxValue.
+    ///A value within GetRelativeError() of a bin edge may be counted in the bin next to it.
+    std::vector<long long> GetHistogram(const int &numBins, const double &maxValue) const;
+
+private:
+    ///Bucket of a value
+    static inline int BucketIndex(const double &value) {
+        if (!(value > 0.0)) {
+            return 0;
+        }
+        if (value < MinValue) {
+            return 1;
+        }
+        if (value >= MaxValue) {
+            return NumBuckets - 1;
+        }
+        //The exponent and leading mantissa bits of a positive float increase with its value
+        const float f = static_cast<float>(value);
+        std::uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return 2 + static_cast<int>((bits - MinValueBits) >> (23 - SubBucketBits));
+    }
+    ///Value reported for the values in a bucket: the middle of a log-linear bucket
+    double BucketValue(const int &bucket) const;
+
+private:
+    ///Bits of the float MinValue
+    static const std::uint32_t MinValueBits = static_cast<std::uint32_t>(127 + MinExponent) << 23;
+
+    std::vector<long long> m_counts;
+    long long m_count;
+    double m_minimum;
+    double m_maximum;
+};
+
+#endif
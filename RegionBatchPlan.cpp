@@ -0,0 +1,95 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "RegionBatchPlan.h"
+
+#include <algorithm>
+#include <map>
+
+RegionBatchPlan::RegionBatchPlan(const std::vector<Box> &regions, const int &chunkSize)
+    : m_regions(regions),
+    m_separateChunkCount(0)
+{
+    if (chunkSize < 1) {
+        return;
+    }
+    //The regions overlapping each chunk of the shared grid, keyed by the Z order of the chunk
+    std::map<unsigned long long, Chunk> chunks;
+    for (int r = 0; r < static_cast<int>(m_regions.size()); r++) {
+        const Box &region = m_regions[r];
+        const long long x0 = std::max(region.x, 0LL);
+        const long long y0 = std::max(region.y, 0LL);
+        const long long x1 = region.x + region.width;
+        const long long y1 = region.y + region.height;
+        if ((x1 <= x0) || (y1 <= y0)) {
+            continue;
+        }
+        //On its own grid, the region would be read in ceil(size / chunkSize) chunks each way
+        m_separateChunkCount += ((region.width + chunkSize - 1) / chunkSize) * ((region.height + chunkSize - 1) / chunkSize);
+        for (long long row = y0 / chunkSize; row * chunkSize < y1; row++) {
+            for (long long col = x0 / chunkSize; col * chunkSize < x1; col++) {
+                Chunk &chunk = chunks[MortonCode(static_cast<unsigned int>(col), static_cast<unsigned int>(row))];
+                if (chunk.regions.empty()) {
+                    chunk.box.x = col * chunkSize;
+                    chunk.box.y = row * chunkSize;
+                    chunk.box.width = chunkSize;
+                    chunk.box.height = chunkSize;
+                }
+                chunk.regions.push_back(r);
+            }
+        }
+    }
+    //Each chunk is trimmed to the part of its grid cell covered by the bounding boxes of its regions
+    m_chunks.reserve(chunks.size());
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        Chunk chunk = it->second;
+        long long x0 = chunk.box.x + chunk.box.width, y0 = chunk.box.y + chunk.box.height;
+        long long x1 = chunk.box.x, y1 = chunk.box.y;
+        for (auto r = chunk.regions.begin(); r != chunk.regions.end(); ++r) {
+            const Box &region = m_regions[*r];
+            x0 = std::min(x0, std::max(region.x, chunk.box.x));
+            y0 = std::min(y0, std::max(region.y, chunk.box.y));
+            x1 = std::max(x1, std::min(region.x + region.width, chunk.box.x + chunk.box.width));
+            y1 = std::max(y1, std::min(region.y + region.height, chunk.box.y + chunk.box.height));
+        }
+        chunk.box.x = x0;
+        chunk.box.y = y0;
+        chunk.box.width = x1 - x0;
+        chunk.box.height = y1 - y0;
+        m_chunks.push_back(chunk);
+    }
+}//end constructor
+
+RegionBatchPlan::~RegionBatchPlan() {
+}//end destructor
+
+unsigned long long RegionBatchPlan::MortonCode(const unsigned int &col, const unsigned int &row) {
+    unsigned long long code = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        code |= ((static_cast<unsigned long long>(col) >> bit) & 1ULL) << (2 * bit);
+        code |= ((static_cast<unsigned long long>(row) >> bit) & 1ULL) << (2 * bit + 1);
+    }
+    return code;
+}//end MortonCode
@@ -0,0 +1,77 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONBATCHPLAN_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONBATCHPLAN_H
+
+#include <vector>
+
+///The chunks of a slide to read to measure many regions (for example, the cores of a tissue
+///microarray) in one traversal. Chunks are on a grid of the slide shared by all the regions,
+///so a chunk overlapping several regions is read once, and each chunk lists the regions whose
+///bounding box overlaps it. No chunk extends outside the bounding boxes of the regions. Chunks
+///are in Z order (Morton order of their grid position), so that neighbouring chunks, which share
+///source tiles, are read close together in time.
+class RegionBatchPlan
+{
+public:
+    ///A rectangle in full resolution pixels
+    struct Box {
+        long long x;
+        long long y;
+        long long width;
+        long long height;
+    };
+    ///A chunk of the grid, trimmed to the bounding boxes of the regions it overlaps, and those regions
+    struct Chunk {
+        Box box;
+        std::vector<int> regions;
+    };
+
+public:
+    ///Plan the chunks, chunkSize full resolution pixels wide, for the bounding boxes of the regions
+    RegionBatchPlan(const std::vector<Box> &regions, const int &chunkSize);
+    ///destructor
+    ~RegionBatchPlan();
+
+    ///Number of regions
+    inline int GetNumberOfRegions() const { return static_cast<int>(m_regions.size()); }
+    ///Bounding box of a region
+    inline const Box& GetRegion(const int &region) const { return m_regions.at(region); }
+    ///Chunks to read, in Z order
+    inline const std::vector<Chunk>& GetChunks() const { return m_chunks; }
+    ///Number of chunk reads if each region were measured on its own, with its own grid
+    inline long long GetSeparateChunkCount() const { return m_separateChunkCount; }
+
+    ///Interleave the bits of a grid column and row, giving the position of a chunk in Z order
+    static unsigned long long MortonCode(const unsigned int &col, const unsigned int &row);
+
+private:
+    std::vector<Box> m_regions;
+    std::vector<Chunk> m_chunks;
+    long long m_separateChunkCount;
+};
+
+#endif
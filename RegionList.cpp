@@ -0,0 +1,175 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "RegionList.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    ///Split a CSV line into its fields, without the spaces around them
+    std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::istringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ',')) {
+            const size_t first = field.find_first_not_of(" \t\r");
+            const size_t last = field.find_last_not_of(" \t\r");
+            fields.push_back((first == std::string::npos) ? std::string() : field.substr(first, last - first + 1));
+        }
+        return fields;
+    }//end splitFields
+
+    ///Read a number that is the whole of a field; return false if it is not one
+    bool parseNumber(const std::string &field, double &value) {
+        if (field.empty()) {
+            return false;
+        }
+        char *end = nullptr;
+        value = std::strtod(field.c_str(), &end);
+        return (end == field.c_str() + field.size()) && std::isfinite(value);
+    }//end parseNumber
+}
+
+RegionList::RegionList(const std::string &path)
+    : m_isValid(false),
+    m_errorLine(0)
+{
+    std::ifstream file(path);
+    if (file.is_open()) {
+        Read(file);
+    }
+}//end file constructor
+
+RegionList::RegionList(std::istream &stream)
+    : m_isValid(false),
+    m_errorLine(0)
+{
+    Read(stream);
+}//end stream constructor
+
+RegionList::~RegionList() {
+}//end destructor
+
+void RegionList::Read(std::istream &stream) {
+    std::string line;
+    int lineNumber = 0;
+    bool firstLine = true;
+    while (std::getline(stream, line)) {
+        lineNumber++;
+        const std::vector<std::string> fields = splitFields(line);
+        if (fields.empty() || ((fields.size() == 1) && fields[0].empty()) || (fields[0].compare(0, 1, "#") == 0)) {
+            continue;
+        }
+        //The first line may be a header naming the columns
+        double value = 0.0;
+        const bool header = firstLine && ((fields.size() < 2) || !parseNumber(fields[1], value));
+        firstLine = false;
+        if (header) {
+            continue;
+        }
+        //A label and at least two vertices
+        Region region;
+        region.label = fields[0];
+        bool valid = (fields.size() >= 5) && ((fields.size() % 2) == 1);
+        for (size_t i = 1; valid && (i + 1 < fields.size()); i += 2) {
+            Vertex v = { 0.0, 0.0 };
+            valid = parseNumber(fields[i], v.x) && parseNumber(fields[i + 1], v.y);
+            region.vertices.push_back(v);
+        }
+        if (!valid) {
+            m_regions.clear();
+            m_errorLine = lineNumber;
+            return;
+        }
+        //Two vertices are the opposite corners of a rectangle
+        if (region.vertices.size() == 2) {
+            const Vertex a = region.vertices[0];
+            const Vertex b = region.vertices[1];
+            region.vertices = { { a.x, a.y }, { b.x, a.y }, { b.x, b.y }, { a.x, b.y } };
+        }
+        double minX = region.vertices[0].x, maxX = minX, minY = region.vertices[0].y, maxY = minY;
+        for (auto v = region.vertices.begin(); v != region.vertices.end(); ++v) {
+            minX = std::min(minX, v->x);
+            maxX = std::max(maxX, v->x);
+            minY = std::min(minY, v->y);
+            maxY = std::max(maxY, v->y);
+        }
+        region.box.x = static_cast<long long>(std::floor(minX));
+        region.box.y = static_cast<long long>(std::floor(minY));
+        region.box.width = static_cast<long long>(std::ceil(maxX)) - region.box.x;
+        region.box.height = static_cast<long long>(std::ceil(maxY)) - region.box.y;
+        m_regions.push_back(region);
+    }
+    m_isValid = true;
+}//end Read
+
+std::vector<RegionBatchPlan::Box> RegionList::GetBoundingBoxes() const {
+    std::vector<RegionBatchPlan::Box> boxes;
+    for (auto r = m_regions.begin(); r != m_regions.end(); ++r) {
+        boxes.push_back(r->box);
+    }
+    return boxes;
+}//end GetBoundingBoxes
+
+bool RegionList::ClearOutside(const int &region, const double &x, const double &y, const int &width, const int &height,
+    const double &scaleX, const double &scaleY, unsigned char *mask) const {
+    const std::vector<Vertex> &vertices = m_regions.at(region).vertices;
+    const size_t numVertices = vertices.size();
+    bool any = false;
+    std::vector<double> crossings;
+    for (int j = 0; j < height; j++) {
+        unsigned char *m = mask + static_cast<long long>(j) * width;
+        //Where the row of pixel centres crosses the edges of the polygon; inside is between pairs of crossings
+        const double sampleY = y + (j + 0.5) * scaleY;
+        crossings.clear();
+        for (size_t v = 0; v < numVertices; v++) {
+            const Vertex &a = vertices[v];
+            const Vertex &b = vertices[(v + 1) % numVertices];
+            if ((a.y <= sampleY) != (b.y <= sampleY)) {
+                crossings.push_back(a.x + (sampleY - a.y) * (b.x - a.x) / (b.y - a.y));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        //Pixels whose centre is in [crossings[k], crossings[k + 1]) are kept, the others cleared
+        int next = 0;
+        for (size_t k = 0; k + 1 < crossings.size(); k += 2) {
+            const double first = std::ceil((crossings[k] - x) / scaleX - 0.5);
+            const double last = std::ceil((crossings[k + 1] - x) / scaleX - 0.5);
+            const int start = static_cast<int>(std::min(std::max(first, static_cast<double>(next)), static_cast<double>(width)));
+            const int end = static_cast<int>(std::min(std::max(last, static_cast<double>(start)), static_cast<double>(width)));
+            std::fill(m + next, m + start, static_cast<unsigned char>(0));
+            for (int i = start; (i < end) && !any; i++) {
+                any = (m[i] != 0);
+            }
+            next = end;
+        }
+        std::fill(m + next, m + width, static_cast<unsigned char>(0));
+    }
+    return any;
+}//end ClearOutside
@@ -0,0 +1,93 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONLIST_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONLIST_H
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "RegionBatchPlan.h"
+
+///A list of labelled regions of a slide, read from a CSV file with one region per line:
+///a label, then the x and y of each vertex in full resolution pixels. Two vertices are the
+///opposite corners of a rectangle; three or more are a polygon. Blank lines, lines starting
+///with # and a header line (one whose second field is not a number) are skipped.
+///
+///There is no limit on the number of regions, so the cores of a tissue microarray or the
+///regions of many stains can be listed in one file. Immutable once read.
+class RegionList
+{
+public:
+    ///A vertex in full resolution pixels
+    struct Vertex {
+        double x;
+        double y;
+    };
+    ///A region: its label, the vertices of its polygon and its bounding box
+    struct Region {
+        std::string label;
+        std::vector<Vertex> vertices;
+        RegionBatchPlan::Box box;
+    };
+
+public:
+    ///Read the regions of a file. Check IsValid() before use.
+    explicit RegionList(const std::string &path);
+    ///Read the regions of a stream. Check IsValid() before use.
+    explicit RegionList(std::istream &stream);
+    ///destructor
+    ~RegionList();
+
+    ///True if the file could be read and every line was a region
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of the first line that is not a region, or 0 if the file could not be opened or is valid
+    inline int GetErrorLine() const { return m_errorLine; }
+    ///Number of regions
+    inline int GetNumberOfRegions() const { return static_cast<int>(m_regions.size()); }
+    ///A region, in the order of the file
+    inline const Region& GetRegion(const int &region) const { return m_regions.at(region); }
+    ///Bounding boxes of all the regions, in the order of the file
+    std::vector<RegionBatchPlan::Box> GetBoundingBoxes() const;
+
+    ///Clear to 0 the pixels of a width x height tile mask that are outside a region, and return
+    ///true if any non-zero pixel is left. The top-left pixel of the tile is at full resolution
+    ///(x, y), its pixels are scaleX x scaleY full resolution pixels, and a pixel is inside if its
+    ///centre is.
+    bool ClearOutside(const int &region, const double &x, const double &y, const int &width, const int &height,
+        const double &scaleX, const double &scaleY, unsigned char *mask) const;
+
+private:
+    ///Read the regions, one per line
+    void Read(std::istream &stream);
+
+private:
+    bool m_isValid;
+    int m_errorLine;
+    std::vector<Region> m_regions;
+};
+
+#endif
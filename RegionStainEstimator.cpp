@@ -0,0 +1,141 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "RegionStainEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+const double RegionStainEstimator::DefaultTrimFraction = 0.1;
+
+namespace {
+    ///Scale a 3-vector to unit length; a zero vector is unchanged
+    std::array<double, 3> UnitVector(const double (&v)[3]) {
+        const double norm = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        std::array<double, 3> unit = { 0.0, 0.0, 0.0 };
+        for (int c = 0; (c < 3) && (norm > 0.0); c++) {
+            unit[c] = v[c] / norm;
+        }
+        return unit;
+    }
+}
+
+RegionStainEstimator::RegionStainEstimator(const std::vector<ODSampleReservoir> &stainSamples, 
+    const double &trimFraction /*= DefaultTrimFraction*/)
+    : m_isValid(false),
+    m_trimFraction((trimFraction < 0.0) ? 0.0 : ((trimFraction > 0.9) ? 0.9 : trimFraction)),
+    m_capacity(stainSamples.empty() ? 0 : stainSamples.front().GetCapacity()),
+    m_odThreshold(stainSamples.empty() ? 0.0 : stainSamples.front().GetODThreshold())
+{
+    const int numStains = static_cast<int>(stainSamples.size());
+    m_numSamples.assign(numStains, 0);
+    m_stainVectors.assign(numStains, { 0.0, 0.0, 0.0 });
+    if ((numStains < 2) || (numStains > 3)) {
+        return;
+    }
+    bool allStains = true;
+    for (int s = 0; s < numStains; s++) {
+        std::vector<float> od;
+        stainSamples[s].GetODSamples(od);
+        m_numSamples[s] = static_cast<long long>(od.size() / 3);
+        allStains = allStains && (m_numSamples[s] > 0);
+        m_stainVectors[s] = RobustMeanDirection(od);
+    }
+    m_isValid = allStains;
+}//end constructor
+
+RegionStainEstimator::~RegionStainEstimator() {
+}//end destructor
+
+std::array<double, 3> RegionStainEstimator::RobustMeanDirection(const std::vector<float> &od) const {
+    const long long n = static_cast<long long>(od.size() / 3);
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    for (long long i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+            mean[c] += od[3 * i + c];
+        }
+    }
+    std::array<double, 3> direction = UnitVector(mean);
+    const long long numKept = n - static_cast<long long>(std::floor(m_trimFraction * n));
+    if ((n == 0) || (numKept == n)) {
+        return direction;
+    }
+
+    //Keep the pixels closest in direction to the mean; ties are kept in sample order
+    std::vector<std::pair<double, long long>> distance(static_cast<size_t>(n));
+#pragma omp parallel for
+    for (long long i = 0; i < n; i++) {
+        const float *v = od.data() + 3 * i;
+        const double norm = std::sqrt(static_cast<double>(v[0]) * v[0] + static_cast<double>(v[1]) * v[1] + static_cast<double>(v[2]) * v[2]);
+        const double cosine = (norm > 0.0) ? ((v[0] * direction[0] + v[1] * direction[1] + v[2] * direction[2]) / norm) : -1.0;
+        distance[i] = std::make_pair(-cosine, i);
+    }
+    std::nth_element(distance.begin(), distance.begin() + (numKept - 1), distance.end());
+    double trimmedMean[3] = { 0.0, 0.0, 0.0 };
+    std::sort(distance.begin(), distance.begin() + numKept, 
+        [](const std::pair<double, long long> &a, const std::pair<double, long long> &b) { return a.second < b.second; });
+    for (long long k = 0; k < numKept; k++) {
+        const long long i = distance[k].second;
+        for (int c = 0; c < 3; c++) {
+            trimmedMean[c] += od[3 * i + c];
+        }
+    }
+    return UnitVector(trimmedMean);
+}//end RobustMeanDirection
+
+bool RegionStainEstimator::WriteToProfile(StainProfile &profile, const std::string &profileName,
+    const std::vector<std::string> &stainNames) const {
+    if (!m_isValid) {
+        return false;
+    }
+    const int numStains = GetNumberOfStains();
+    auto name = [&](int s) { return (s < static_cast<int>(stainNames.size())) ? stainNames[s] : std::string(); };
+    //Parameters of a previous algorithm do not apply
+    profile.ClearAllSeparationAlgorithmParameters();
+    return profile.SetNameOfStainProfile(profileName)
+        && profile.SetNumberOfStainComponents(numStains)
+        && profile.SetNameOfStainOne(name(0))
+        && profile.SetNameOfStainTwo(name(1))
+        && profile.SetNameOfStainThree((numStains > 2) ? name(2) : std::string())
+        && profile.SetStainOneRGB(m_stainVectors[0])
+        && profile.SetStainTwoRGB(m_stainVectors[1])
+        && ((numStains > 2) ? profile.SetStainThreeRGB(m_stainVectors[2]) : profile.SetStainThreeRGB(0.0, 0.0, 0.0))
+        && profile.SetNameOfStainAnalysisModel(profile.GetStainAnalysisModelName(0))
+        && profile.SetNameOfStainSeparationAlgorithm("Region-of-Interest Selection")
+        && profile.SetSeparationAlgorithmNumPixelsParameter(static_cast<long int>(m_capacity))
+        && profile.SetSeparationAlgorithmThresholdParameter(m_odThreshold);
+}//end WriteToProfile
+
+std::string RegionStainEstimator::GetCSVRow() const {
+    std::ostringstream ss;
+    ss << "RegionOfInterest" << std::fixed << std::setprecision(8);
+    for (int s = 0; s < 3; s++) {
+        for (int c = 0; c < 3; c++) {
+            ss << "; " << ((s < GetNumberOfStains()) ? m_stainVectors[s][c] : 0.0);
+        }
+    }
+    return ss.str();
+}//end GetCSVRow
@@ -0,0 +1,83 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONSTAINESTIMATOR_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_REGIONSTAINESTIMATOR_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "ODSampleReservoir.h"
+#include "StainProfile.h"
+
+///Estimates the vector of each stain from the pixels of regions stained with only that stain, as in:
+///Ruifrok AC, Johnston DA. Quantification of histochemical staining by color deconvolution.
+///Analytical & Quantitative Cytology & Histology 2001; 23: 291-299.
+///
+///The vector of a stain is the mean OD of a sample of the pixels of its regions, made robust to
+///pixels of other stains and of the background: the pixels whose OD direction is farthest from the
+///mean direction (the trim fraction of them) are left out, and the mean is taken again.
+class RegionStainEstimator
+{
+public:
+    ///Default fraction of the pixels of each stain left out as outliers
+    static const double DefaultTrimFraction;
+
+public:
+    ///Estimate a vector per stain (2 or 3) from a sample of the pixels of the regions of that stain
+    explicit RegionStainEstimator(const std::vector<ODSampleReservoir> &stainSamples, const double &trimFraction = DefaultTrimFraction);
+    ///destructor
+    ~RegionStainEstimator();
+
+    ///True if every stain had pixels above the OD threshold
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of stains estimated
+    inline int GetNumberOfStains() const { return static_cast<int>(m_stainVectors.size()); }
+    ///Unit OD vector of a stain, in R, G, B order
+    inline const std::array<double, 3>& GetStainVector(const int &stain) const { return m_stainVectors.at(stain); }
+    ///Number of sampled pixels of a stain, before the outliers were left out
+    inline long long GetNumberOfSamples(const int &stain) const { return m_numSamples.at(stain); }
+    ///Fraction of the pixels of each stain left out as outliers
+    inline double GetTrimFraction() const { return m_trimFraction; }
+
+    ///Write the stain vectors to a profile with the given stain names, with the region-of-interest algorithm
+    bool WriteToProfile(StainProfile &profile, const std::string &profileName, const std::vector<std::string> &stainNames) const;
+    ///The stain vectors as a row of a stains CSV file: RegionOfInterest; then nine values, zero for a missing third stain
+    std::string GetCSVRow() const;
+
+private:
+    ///Trimmed mean OD direction of interleaved OD samples
+    std::array<double, 3> RobustMeanDirection(const std::vector<float> &od) const;
+
+private:
+    bool m_isValid;
+    double m_trimFraction;
+    long long m_capacity;
+    double m_odThreshold;
+    std::vector<long long> m_numSamples;
+    std::vector<std::array<double, 3>> m_stainVectors;
+};
+
+#endif
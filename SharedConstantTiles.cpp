@@ -0,0 +1,83 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "SharedConstantTiles.h"
+#include "ImagePixelAccess.h"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    namespace {
+        ///Most distinct tiles kept; edge tiles of different sizes are the only reason for more than a few
+        const size_t MaxSharedTiles = 64;
+
+        std::mutex& registryMutex() {
+            static std::mutex theMutex;
+            return theMutex;
+        }
+
+        std::map<std::string, RawImage>& registry() {
+            static std::map<std::string, RawImage> theRegistry;
+            return theRegistry;
+        }
+    }
+
+    RawImage SharedConstantTiles::Get(const Size &size, const ColorSpace &colorSpace, const unsigned char *pixel) {
+        const int channels = colorSpace.channelCount();
+        std::ostringstream key;
+        key << size.width() << "x" << size.height() << "x" << channels;
+        for (int c = 0; c < channels; c++) {
+            key << ":" << static_cast<int>(pixel[c]);
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &tiles = registry();
+        auto found = tiles.find(key.str());
+        if (found != tiles.end()) {
+            return found->second;
+        }
+        //Tiles already handed out stay valid, they are just no longer shared with new tiles
+        if (tiles.size() >= MaxSharedTiles) {
+            tiles.clear();
+        }
+        RawImage tile(size, colorSpace);
+        unsigned char *dst = rawPixels(tile);
+        const long long numPixels = static_cast<long long>(size.width()) * size.height();
+        for (long long i = 0; i < numPixels; i++) {
+            std::memcpy(dst + i * channels, pixel, channels);
+        }
+        tiles[key.str()] = tile;
+        return tile;
+    }//end Get
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
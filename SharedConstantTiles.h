@@ -0,0 +1,52 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_SHAREDCONSTANTTILES_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_SHAREDCONSTANTTILES_H
+
+#include "Global.h"
+#include "Geometry.h"
+#include "Image.h"
+#include "global/ColorSpace.h"
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    /// Tiles with every pixel the same, such as the thresholded output of glass, created once
+    /// and then returned by kernels for every such tile. Copies of a RawImage share its pixels,
+    /// so no tile is allocated or filled again, and the caches hold one copy. Like any cached
+    /// tile, a shared tile must not be modified.
+    class SharedConstantTiles {
+    public:
+        /// The tile of the given size and interleaved UInt8 colour space with every pixel set
+        /// to pixel (one byte per channel)
+        static RawImage Get(const Size &size, const ColorSpace &colorSpace, const unsigned char *pixel);
+    };
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
+#endif
@@ -0,0 +1,178 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_SMALLMATRIX3X3_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_SMALLMATRIX3X3_H
+
+#include <array>
+#include <cmath>
+
+///Header-only operations on 3x3 matrices stored as row-major 9-element arrays (one stain vector per row)
+///and on 3-element vectors. Nothing is allocated on the heap, and everything except what needs a square
+///root is constexpr. Sums are taken left to right, in the same order as std::accumulate and
+///std::inner_product, so results match a loop over the elements exactly. MultiplyBatch multiplies one
+///matrix by many vectors held as structure-of-arrays buffers, one buffer per component.
+class SmallMatrix3x3
+{
+public:
+    ///Absolute value
+    template <class T>
+    static constexpr T Abs(const T &a) {
+        return (a < T{}) ? -a : a;
+    }
+
+    ///Sum of the elements of a row
+    template <class T>
+    static constexpr T RowSum(const T (&m)[9], const int &row) {
+        return m[3 * row] + m[3 * row + 1] + m[3 * row + 2];
+    }
+
+    ///Sum of the squares of the elements of a row
+    template <class T>
+    static constexpr T RowSquaredNorm(const T (&m)[9], const int &row) {
+        return m[3 * row] * m[3 * row] + m[3 * row + 1] * m[3 * row + 1] + m[3 * row + 2] * m[3 * row + 2];
+    }
+
+    ///Length of a row
+    template <class T>
+    static inline T RowNorm(const T (&m)[9], const int &row) {
+        return static_cast<T>(std::sqrt(RowSquaredNorm(m, row)));
+    }
+
+    ///Dot product of a row and a vector
+    template <class T, class U>
+    static constexpr T RowDot(const T (&m)[9], const int &row, const U (&v)[3]) {
+        return m[3 * row] * v[0] + m[3 * row + 1] * v[1] + m[3 * row + 2] * v[2];
+    }
+
+    ///Copy a row of one matrix to a row of another
+    template <class T>
+    static constexpr void CopyRow(const T (&src)[9], const int &srcRow, T (&dst)[9], const int &dstRow) {
+        for (int c = 0; c < 3; c++) {
+            dst[3 * dstRow + c] = src[3 * srcRow + c];
+        }
+    }
+
+    ///Product of a matrix and a vector
+    template <class T, class U>
+    static constexpr void MultiplyVector(const T (&m)[9], const U (&v)[3], U (&out)[3]) {
+        const U result[3] = { static_cast<U>(RowDot(m, 0, v)), static_cast<U>(RowDot(m, 1, v)), static_cast<U>(RowDot(m, 2, v)) };
+        for (int r = 0; r < 3; r++) {
+            out[r] = result[r];
+        }
+    }
+
+    ///Product of a matrix and n vectors, with component c of vector i in in[c][i] (structure of arrays);
+    ///component r of product i is written to out[r][i]. The output buffers must not overlap the input.
+    template <class T, class U>
+    static constexpr void MultiplyBatch(const T (&m)[9], const U *const (&in)[3], U *const (&out)[3], const int &n) {
+        const U m00 = static_cast<U>(m[0]), m01 = static_cast<U>(m[1]), m02 = static_cast<U>(m[2]);
+        const U m10 = static_cast<U>(m[3]), m11 = static_cast<U>(m[4]), m12 = static_cast<U>(m[5]);
+        const U m20 = static_cast<U>(m[6]), m21 = static_cast<U>(m[7]), m22 = static_cast<U>(m[8]);
+        const U *x = in[0];
+        const U *y = in[1];
+        const U *z = in[2];
+        U *o0 = out[0];
+        U *o1 = out[1];
+        U *o2 = out[2];
+        //Independent iterations over contiguous buffers, which the compiler vectorizes
+        for (int i = 0; i < n; i++) {
+            o0[i] = m00 * x[i] + m01 * y[i] + m02 * z[i];
+            o1[i] = m10 * x[i] + m11 * y[i] + m12 * z[i];
+            o2[i] = m20 * x[i] + m21 * y[i] + m22 * z[i];
+        }
+    }
+
+    ///Determinant of a matrix
+    template <class T>
+    static constexpr T Determinant(const T (&m)[9]) {
+        return m[0] * (m[4] * m[8] - m[5] * m[7]) - m[1] * (m[3] * m[8] - m[5] * m[6]) + m[2] * (m[3] * m[7] - m[4] * m[6]);
+    }
+
+    ///Divide each row by its length, except rows shorter than minNorm, which are copied unchanged
+    template <class T>
+    static inline void ScaleRowsToUnitLength(const T (&m)[9], T (&out)[9], const T &minNorm) {
+        for (int r = 0; r < 3; r++) {
+            const T norm = RowNorm(m, r);
+            for (int c = 0; c < 3; c++) {
+                out[3 * r + c] = (norm < minNorm) ? m[3 * r + c] : (m[3 * r + c] / norm);
+            }
+        }
+    }
+
+    ///Replace the rows shorter than minNorm with the replacement row; other rows are copied unchanged
+    template <class T>
+    static inline void ReplaceShortRows(const T (&m)[9], T (&out)[9], const T (&replacement)[3], const T &minNorm) {
+        for (int r = 0; r < 3; r++) {
+            const bool shortRow = (RowNorm(m, r) < minNorm);
+            for (int c = 0; c < 3; c++) {
+                out[3 * r + c] = shortRow ? replacement[c] : m[3 * r + c];
+            }
+        }
+    }
+
+    ///For each row, true if its sum is within tolerance of zero but its elements are not all zero
+    template <class T>
+    static constexpr std::array<bool, 3> RowSumsNearZero(const T (&m)[9], const T &tolerance) {
+        std::array<bool, 3> result = { false, false, false };
+        for (int r = 0; r < 3; r++) {
+            result[r] = (Abs(RowSum(m, r)) < tolerance) && (RowSquaredNorm(m, r) > T{});
+        }
+        return result;
+    }
+
+    ///Sort the rows with a comparison of two rows (each a pointer to 3 elements) that returns true if the
+    ///first goes before the second. This is the insertion sort std::sort uses for so few elements, step for
+    ///step, so rows compared equal within a tolerance end in the same order as with std::sort.
+    template <class T, class Compare>
+    static constexpr void SortRows(const T (&m)[9], T (&out)[9], Compare before) {
+        T rows[9] = {};
+        for (int k = 0; k < 9; k++) {
+            rows[k] = m[k];
+        }
+        for (int i = 1; i < 3; i++) {
+            const T row[3] = { rows[3 * i], rows[3 * i + 1], rows[3 * i + 2] };
+            int j = i;
+            if (before(row, rows)) {
+                //Goes first: shift all the rows before it
+                for (; j > 0; j--) {
+                    CopyRow(rows, j - 1, rows, j);
+                }
+            }
+            else {
+                for (; before(row, rows + 3 * (j - 1)); j--) {
+                    CopyRow(rows, j - 1, rows, j);
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                rows[3 * j + c] = row[c];
+            }
+        }
+        for (int k = 0; k < 9; k++) {
+            out[k] = rows[k];
+        }
+    }
+};
+
+#endif
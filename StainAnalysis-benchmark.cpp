@@ -0,0 +1,547 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+///Single-threaded micro-benchmarks of the colour deconvolution hot path, without the Sedeen SDK.
+///Synthetic tiles are generated (with a fixed seed) from the default stain profiles embedded in
+///the plugin, and each benchmark reports Mpixel/s and heap allocations per tile as JSON, so that
+///results can be compared across versions.
+
+#include "StainProfile.h"
+#include "StainVectorMath.h"
+#include "SmallMatrix3x3.h"
+#include "DeconvolutionPlan.h"
+#include "DeconvolutionLUT.h"
+#include "StainQuantityMap.h"
+#include "ThresholdSweep.h"
+#include "StainStatistics.h"
+#include "QuantileSketch.h"
+#include "ODSampleReservoir.h"
+#include "MacenkoEstimator.h"
+#include "NMFEstimator.h"
+#include "RegionStainEstimator.h"
+#include "ColorDeconvolutionSIMD.h"
+#include "ODConversion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cmrc/cmrc.hpp>
+CMRC_DECLARE(stain);
+
+//Count every heap allocation made by the process, to report allocations per tile
+namespace {
+    std::atomic<long long> allocationCount(0);
+    std::atomic<long long> allocatedBytes(0);
+}
+
+void* operator new(std::size_t size) {
+    allocationCount++;
+    allocatedBytes += static_cast<long long>(size);
+    void *p = std::malloc((size > 0) ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    ///Settings of a benchmark run, from the command line
+    struct BenchmarkSettings {
+        int tileSize = 512;
+        double minTime = 0.5;
+        std::string filter;
+        std::string outputFile;
+    };
+
+    ///Measurements of one benchmark
+    struct BenchmarkResult {
+        std::string name;
+        std::string profile;
+        long long pixelsPerIteration = 0;
+        long long iterations = 0;
+        double seconds = 0.0;
+        double allocationsPerIteration = 0.0;
+        double bytesAllocatedPerIteration = 0.0;
+    };
+
+    ///A synthetic tile of interleaved RGB pixels
+    struct Tile {
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;
+    };
+
+    ///Default profiles embedded in the plugin, benchmarked in this order
+    const std::vector<std::string> ProfileFiles = {
+        "defaultprofiles/HematoxylinPEosinFromRJ.xml",
+        "defaultprofiles/HematoxylinPDABFromRJ.xml",
+        "defaultprofiles/HematoxylinPEosinPDABFromRJ.xml" };
+
+    ///Short names of the profiles, used in the results
+    const std::vector<std::string> ProfileNames = { "H&E", "H-DAB", "H&E-DAB" };
+
+    ///Read a stain profile embedded in the resources; returns nullptr on failure
+    std::shared_ptr<StainProfile> loadEmbeddedProfile(const std::string &path) {
+        auto const fs = cmrc::stain::get_filesystem();
+        if (!fs.is_file(path)) {
+            return nullptr;
+        }
+        auto const file = fs.open(path);
+        auto theProfile = std::make_shared<StainProfile>();
+        return theProfile->readStainProfile(file.begin(), file.size()) ? theProfile : nullptr;
+    }//end loadEmbeddedProfile
+
+    ///Generate a tile by mixing the profile's stains with random quantities (fixed seed).
+    ///About a quarter of the pixels are unstained background, with a little noise.
+    Tile makeSyntheticTile(std::shared_ptr<StainProfile> theProfile, const int &tileSize) {
+        Tile tile = { tileSize, tileSize, std::vector<unsigned char>(3 * tileSize * tileSize) };
+        double stainMatrix[9] = { 0.0 };
+        theProfile->GetNormalizedProfilesAsDoubleArray(stainMatrix);
+        const int numStains = theProfile->GetNumberOfStainComponents();
+
+        std::mt19937 generator(12345);
+        std::uniform_real_distribution<double> quantity(0.0, 1.2);
+        std::uniform_real_distribution<double> noise(0.0, 0.03);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for (int p = 0; p < tileSize * tileSize; p++) {
+            double stainQuant[3] = { 0.0, 0.0, 0.0 };
+            if (unit(generator) > 0.25) {
+                for (int s = 0; s < numStains; s++) {
+                    //Each stained pixel is dominated by one stain, with some of the others
+                    stainQuant[s] = quantity(generator) * ((unit(generator) > 0.5) ? 1.0 : 0.2);
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                double OD = noise(generator);
+                for (int s = 0; s < numStains; s++) {
+                    OD += stainQuant[s] * stainMatrix[s * 3 + c];
+                }
+                tile.pixels[3 * p + c] = static_cast<unsigned char>(ODConversion::ConvertODtoRGB(OD));
+            }
+        }
+        return tile;
+    }//end makeSyntheticTile
+
+    ///Generate a tile of glass: bright, slightly noisy pixels with no stain (fixed seed)
+    Tile makeGlassTile(const int &tileSize) {
+        Tile tile = { tileSize, tileSize, std::vector<unsigned char>(3 * tileSize * tileSize) };
+        std::mt19937 generator(54321);
+        std::uniform_int_distribution<int> brightness(236, 255);
+        for (size_t i = 0; i < tile.pixels.size(); i++) {
+            tile.pixels[i] = static_cast<unsigned char>(brightness(generator));
+        }
+        return tile;
+    }//end makeGlassTile
+
+    ///Run body (one tile per call) once to warm up, then repeatedly until minTime has passed and at least three times
+    BenchmarkResult runBenchmark(const std::string &name, const std::string &profile, const long long &pixelsPerIteration,
+        const double &minTime, const std::function<void()> &body) {
+        BenchmarkResult result;
+        result.name = name;
+        result.profile = profile;
+        result.pixelsPerIteration = pixelsPerIteration;
+        body();
+
+        const long long allocationsBefore = allocationCount.load();
+        const long long bytesBefore = allocatedBytes.load();
+        const auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+        while ((elapsed < minTime) || (result.iterations < 3)) {
+            body();
+            result.iterations++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        result.seconds = elapsed;
+        result.allocationsPerIteration = static_cast<double>(allocationCount.load() - allocationsBefore) / result.iterations;
+        result.bytesAllocatedPerIteration = static_cast<double>(allocatedBytes.load() - bytesBefore) / result.iterations;
+        return result;
+    }//end runBenchmark
+
+    ///Count the pixels of a separated RGBA tile with a non-zero colour, as the pixel fraction report does
+    long long countCoveredPixels(const std::vector<unsigned char> &rgba) {
+        long long covered = 0;
+        const size_t numPixels = rgba.size() / 4;
+        for (size_t i = 0; i < numPixels; i++) {
+            covered += ((rgba[4 * i] | rgba[4 * i + 1] | rgba[4 * i + 2]) != 0);
+        }
+        return covered;
+    }//end countCoveredPixels
+
+    ///Escape a string for a JSON string value
+    std::string jsonString(const std::string &s) {
+        std::string out("\"");
+        for (auto it = s.begin(); it != s.end(); ++it) {
+            if ((*it == '"') || (*it == '\\')) {
+                out.push_back('\\');
+            }
+            out.push_back(*it);
+        }
+        out.push_back('"');
+        return out;
+    }//end jsonString
+
+    ///Write the run settings and all results as one JSON object
+    void writeJSON(std::ostream &out, const BenchmarkSettings &settings, const std::vector<BenchmarkResult> &results) {
+        const std::time_t now = std::time(nullptr);
+        char timestamp[32] = { 0 };
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        out << "{" << std::endl
+            << "  \"format_version\": 1," << std::endl
+            << "  \"timestamp\": " << jsonString(timestamp) << "," << std::endl
+            << "  \"instruction_set\": " << jsonString(ColorDeconvolutionSIMD::GetInstructionSetName(
+                ColorDeconvolutionSIMD::DetectInstructionSet())) << "," << std::endl
+            << "  \"tile_size\": " << settings.tileSize << "," << std::endl
+            << "  \"min_time_seconds\": " << settings.minTime << "," << std::endl
+            << "  \"results\": [" << std::endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchmarkResult &r = results[i];
+            const double mpixelsPerSecond = (r.seconds > 0.0)
+                ? (static_cast<double>(r.pixelsPerIteration) * r.iterations / r.seconds / 1e6) : 0.0;
+            out << "    { \"name\": " << jsonString(r.name)
+                << ", \"profile\": " << jsonString(r.profile)
+                << ", \"pixels_per_tile\": " << r.pixelsPerIteration
+                << ", \"tiles\": " << r.iterations
+                << std::fixed << std::setprecision(6)
+                << ", \"seconds\": " << r.seconds
+                << ", \"microseconds_per_tile\": " << (r.seconds * 1e6 / r.iterations)
+                << std::setprecision(3)
+                << ", \"mpixels_per_second\": " << mpixelsPerSecond
+                << ", \"allocations_per_tile\": " << r.allocationsPerIteration
+                << ", \"bytes_allocated_per_tile\": " << r.bytesAllocatedPerIteration
+                << std::defaultfloat << " }" << ((i + 1 < results.size()) ? "," : "") << std::endl;
+        }
+        out << "  ]" << std::endl << "}" << std::endl;
+    }//end writeJSON
+
+    void printUsage(const char *program) {
+        std::cerr << "Usage: " << program << " [--tile-size <pixels>] [--min-time <seconds>] [--filter <text>] [--output <file.json>]" << std::endl
+            << "Runs each benchmark whose name contains the filter text, and writes the results as JSON (default: to stdout)." << std::endl;
+    }//end printUsage
+
+    ///Parse the command line. Returns false if the arguments are not usable.
+    bool parseArguments(int argc, char *argv[], BenchmarkSettings &settings) {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg(argv[i]);
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const std::string value(argv[++i]);
+            if (arg == "--tile-size") {
+                settings.tileSize = std::atoi(value.c_str());
+            }
+            else if (arg == "--min-time") {
+                settings.minTime = std::atof(value.c_str());
+            }
+            else if (arg == "--filter") {
+                settings.filter = value;
+            }
+            else if (arg == "--output") {
+                settings.outputFile = value;
+            }
+            else {
+                return false;
+            }
+        }
+        return (settings.tileSize > 0) && (settings.minTime >= 0.0);
+    }//end parseArguments
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const int tileSize = settings.tileSize;
+    const long long tilePixels = static_cast<long long>(tileSize) * tileSize;
+    const double threshold = 0.20;
+    std::vector<BenchmarkResult> results;
+    auto run = [&](const std::string &name, const std::string &profile, const long long &pixels, const std::function<void()> &body) {
+        if (!settings.filter.empty() && (name.find(settings.filter) == std::string::npos)) {
+            return;
+        }
+        results.push_back(runBenchmark(name, profile, pixels, settings.minTime, body));
+        const BenchmarkResult &r = results.back();
+        std::cerr << std::left << std::setw(32) << name << std::setw(10) << profile << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10) << (static_cast<double>(r.pixelsPerIteration) * r.iterations / r.seconds / 1e6)
+            << " Mpixel/s" << std::setw(10) << (r.seconds * 1e6 / r.iterations) << " us/tile" << std::setprecision(2) << std::setw(8) << r.allocationsPerIteration << " allocations/tile"
+            << std::defaultfloat << std::endl;
+    };
+
+    for (size_t p = 0; p < ProfileFiles.size(); p++) {
+        const std::string &profileName = ProfileNames[p];
+        std::shared_ptr<StainProfile> theProfile = loadEmbeddedProfile(ProfileFiles[p]);
+        if (theProfile == nullptr) {
+            std::cerr << "Could not read the embedded profile " << ProfileFiles[p] << std::endl;
+            return 1;
+        }
+        const Tile tile = makeSyntheticTile(theProfile, tileSize);
+        const unsigned char *src = tile.pixels.data();
+        const int rowBytes = 3 * tileSize;
+
+        //Plans as the kernel builds them: the first stain, thresholded, as stain colour or grayscale quantity
+        auto scalarPlan = std::make_shared<const DeconvolutionPlan>(theProfile, 0, true, threshold, false, false);
+        auto simdPlan = std::make_shared<const DeconvolutionPlan>(theProfile, 0, true, threshold, false, true);
+        auto grayscalePlan = std::make_shared<const DeconvolutionPlan>(theProfile, 0, true, threshold, true, true);
+        auto lut = std::make_shared<const DeconvolutionLUT>(simdPlan);
+        const int numStains = simdPlan->GetNumberOfStains();
+
+        //Each tile allocates its output, as the kernel allocates an output RawImage per tile
+        run("separate_tile_scalar", profileName, tilePixels, [&]() {
+            std::vector<unsigned char> out(4 * tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                scalarPlan->SeparateRow(src + y * rowBytes, 3, tileSize, out.data() + 4 * y * tileSize);
+            }
+        });
+        run("separate_tile_simd", profileName, tilePixels, [&]() {
+            std::vector<unsigned char> out(4 * tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                simdPlan->SeparateRow(src + y * rowBytes, 3, tileSize, out.data() + 4 * y * tileSize);
+            }
+        });
+        if (lut->IsValid()) {
+            run("separate_tile_lut", profileName, tilePixels, [&]() {
+                std::vector<unsigned char> out(4 * tilePixels);
+                for (int y = 0; y < tileSize; y++) {
+                    lut->SeparateRow(src + y * rowBytes, 3, tileSize, out.data() + 4 * y * tileSize);
+                }
+            });
+        }
+        run("separate_tile_grayscale", profileName, tilePixels, [&]() {
+            std::vector<unsigned char> out(tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                grayscalePlan->SeparateRow(src + y * rowBytes, 3, tileSize, out.data() + y * tileSize);
+            }
+        });
+        run("separate_tile_all_stains", profileName, tilePixels, [&]() {
+            std::vector<std::vector<unsigned char>> out(numStains, std::vector<unsigned char>(4 * tilePixels));
+            for (int y = 0; y < tileSize; y++) {
+                unsigned char *const dst[3] = { out[0].data() + 4 * y * tileSize,
+                    (numStains > 1) ? out[1].data() + 4 * y * tileSize : nullptr,
+                    (numStains > 2) ? out[2].data() + 4 * y * tileSize : nullptr };
+                scalarPlan->SeparateRowAllStains(src + y * rowBytes, 3, tileSize, dst);
+            }
+        });
+        //The two stages of the cached pipeline: quantities from RGB, then quantities to the thresholded output
+        auto quantityMap = std::make_shared<const StainQuantityMap>(simdPlan);
+        std::vector<unsigned short> quantities(tilePixels);
+        for (int y = 0; y < tileSize; y++) {
+            simdPlan->QuantityRow(src + y * rowBytes, 3, tileSize, quantities.data() + y * tileSize);
+        }
+        run("stain_quantity_tile", profileName, tilePixels, [&]() {
+            std::vector<unsigned short> out(tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                simdPlan->QuantityRow(src + y * rowBytes, 3, tileSize, out.data() + y * tileSize);
+            }
+        });
+        if (quantityMap->IsValid()) {
+            run("map_quantity_tile", profileName, tilePixels, [&]() {
+                std::vector<unsigned char> out(4 * tilePixels);
+                for (int y = 0; y < tileSize; y++) {
+                    quantityMap->MapRow(quantities.data() + y * tileSize, tileSize, out.data() + 4 * y * tileSize);
+                }
+            });
+        }
+        run("threshold_tile", profileName, tilePixels, [&]() {
+            std::vector<unsigned char> out(4 * tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                scalarPlan->ThresholdRow(src + y * rowBytes, 3, tileSize, out.data() + 4 * y * tileSize);
+            }
+        });
+
+        //Glass: separating it, and the per-tile test that lets the kernels return a shared background tile instead
+        const Tile glass = makeGlassTile(tileSize);
+        run("separate_glass_tile_simd", profileName, tilePixels, [&]() {
+            std::vector<unsigned char> out(4 * tilePixels);
+            for (int y = 0; y < tileSize; y++) {
+                simdPlan->SeparateRow(glass.pixels.data() + y * rowBytes, 3, tileSize, out.data() + 4 * y * tileSize);
+            }
+        });
+        volatile bool backgroundSink = false;
+        run("background_test_tile", profileName, tilePixels, [&]() {
+            backgroundSink = simdPlan->IsBackground(glass.pixels.data(), 3, tilePixels);
+        });
+
+        //Pixel fraction counting on an already separated tile
+        std::vector<unsigned char> separated(4 * tilePixels);
+        for (int y = 0; y < tileSize; y++) {
+            simdPlan->SeparateRow(src + y * rowBytes, 3, tileSize, separated.data() + 4 * y * tileSize);
+        }
+        volatile long long coveredSink = 0;
+        run("pixel_fraction_tile", profileName, tilePixels, [&]() {
+            coveredSink = coveredSink + countCoveredPixels(separated);
+        });
+
+        //OD histograms of every stain, from which the pixel fraction at every threshold is read
+        volatile long long sweepSink = 0;
+        run("threshold_sweep_tile", profileName, tilePixels, [&]() {
+            ThresholdSweep sweep(scalarPlan);
+            for (int y = 0; y < tileSize; y++) {
+                sweep.AddRow(src + y * rowBytes, 3, tileSize);
+            }
+            sweepSink = sweepSink + sweep.GetCountAbove(0, 0.2);
+        });
+
+        //Histograms, quantile sketches, fixed point OD sums and intensity classes of every stain
+        volatile double statisticsSink = 0.0;
+        run("stain_statistics_tile", profileName, tilePixels, [&]() {
+            StainStatistics statistics(scalarPlan);
+            for (int y = 0; y < tileSize; y++) {
+                statistics.AddRow(src + y * rowBytes, 3, tileSize);
+            }
+            statisticsSink = statisticsSink + statistics.GetMeanOD(0);
+        });
+        //Quantile sketch of the OD of one channel of every pixel, then a percentile read from it
+        volatile double sketchSink = 0.0;
+        run("quantile_sketch_tile", profileName, tilePixels, [&]() {
+            QuantileSketch sketch;
+            for (long long i = 0; i < tilePixels; i++) {
+                sketch.Add(scalarPlan->LookupRGBtoOD(src[3 * i]));
+            }
+            sketchSink = sketchSink + sketch.GetPercentile(95.0);
+        });
+
+        //Priority reservoir sampling of the OD of the tissue pixels, and the Macenko estimate from the sample
+        ODSampleReservoir tileSample;
+        for (int y = 0; y < tileSize; y++) {
+            tileSample.AddRow(src + y * rowBytes, 3, tileSize);
+        }
+        volatile long long reservoirSink = 0;
+        run("od_sample_reservoir_tile", profileName, tilePixels, [&]() {
+            ODSampleReservoir reservoir;
+            for (int y = 0; y < tileSize; y++) {
+                reservoir.AddRow(src + y * rowBytes, 3, tileSize);
+            }
+            reservoirSink = reservoirSink + reservoir.GetNumberOfSamples();
+        });
+        volatile double macenkoSink = 0.0;
+        run("macenko_estimate", profileName, tileSample.GetNumberOfSamples(), [&]() {
+            MacenkoEstimator estimator(tileSample);
+            macenkoSink = macenkoSink + estimator.GetStainVector(0)[0];
+        });
+        //Sparse NMF from the same sample, starting from the stains of the profile
+        std::vector<std::array<double, 3>> profileVectors;
+        for (int s = 0; s < scalarPlan->GetNumberOfStains(); s++) {
+            const DeconvolutionPlan::Matrix9 &stainMatrix = scalarPlan->GetStainMatrix();
+            profileVectors.push_back({ stainMatrix[3 * s], stainMatrix[3 * s + 1], stainMatrix[3 * s + 2] });
+        }
+        volatile double nmfSink = 0.0;
+        run("nmf_estimate", profileName, tileSample.GetNumberOfSamples(), [&]() {
+            NMFEstimator estimator(tileSample, profileVectors);
+            nmfSink = nmfSink + estimator.GetStainVector(0)[0];
+        });
+        //Trimmed mean vectors, with the same sample standing in for the ROIs of each of two stains
+        const std::vector<ODSampleReservoir> stainSamples(2, tileSample);
+        volatile double regionSink = 0.0;
+        run("region_stain_estimate", profileName, 2 * tileSample.GetNumberOfSamples(), [&]() {
+            RegionStainEstimator estimator(stainSamples);
+            regionSink = regionSink + estimator.GetStainVector(0)[0];
+        });
+
+        //The per-pixel double precision reference: OD lookup, matrix-vector product and colours of every stain
+        volatile double pixelSink = 0.0;
+        run("separate_colors_for_pixel", profileName, tilePixels, [&]() {
+            const DeconvolutionPlan &plan = *scalarPlan;
+            double sum = 0.0;
+            for (long long i = 0; i < tilePixels; i++) {
+                const unsigned char *q = src + 3 * i;
+                const double pixelOD[3] = { plan.LookupRGBtoOD(q[0]), plan.LookupRGBtoOD(q[1]), plan.LookupRGBtoOD(q[2]) };
+                double RGB_sep[9] = { 0.0 };
+                double stainQuant[3] = { 0.0 };
+                plan.SeparateColorsForPixel(pixelOD, RGB_sep, stainQuant);
+                sum += RGB_sep[0] + stainQuant[0];
+            }
+            pixelSink = pixelSink + sum;
+        });
+        run("multiply_3x3_matrix_and_vector", profileName, tilePixels, [&]() {
+            const DeconvolutionPlan::Matrix9 &inverse = scalarPlan->GetInverseMatrix();
+            double sum = 0.0;
+            for (long long i = 0; i < tilePixels; i++) {
+                const unsigned char *q = src + 3 * i;
+                const double pixelOD[3] = { scalarPlan->LookupRGBtoOD(q[0]), scalarPlan->LookupRGBtoOD(q[1]), scalarPlan->LookupRGBtoOD(q[2]) };
+                double stainQuant[3] = { 0.0 };
+                StainVectorMath::Multiply3x3MatrixAndVector(inverse, pixelOD, stainQuant);
+                sum += stainQuant[0];
+            }
+            pixelSink = pixelSink + sum;
+        });
+        //The same products, batched over the tile held as one OD buffer per channel
+        std::vector<double> odBuffers[3], quantityBuffers[3];
+        for (int c = 0; c < 3; c++) {
+            odBuffers[c].resize(static_cast<size_t>(tilePixels));
+            quantityBuffers[c].resize(static_cast<size_t>(tilePixels));
+            for (long long i = 0; i < tilePixels; i++) {
+                odBuffers[c][i] = scalarPlan->LookupRGBtoOD(src[3 * i + c]);
+            }
+        }
+        run("multiply_3x3_batch", profileName, tilePixels, [&]() {
+            const double *in[3] = { odBuffers[0].data(), odBuffers[1].data(), odBuffers[2].data() };
+            double *out[3] = { quantityBuffers[0].data(), quantityBuffers[1].data(), quantityBuffers[2].data() };
+            SmallMatrix3x3::MultiplyBatch(scalarPlan->GetInverseMatrix(), in, out, static_cast<int>(tilePixels));
+            pixelSink = pixelSink + quantityBuffers[0][0];
+        });
+
+        //Profile parsing, from the embedded XML; each "tile" is one parse, with no pixels
+        auto const fs = cmrc::stain::get_filesystem();
+        auto const file = fs.open(ProfileFiles[p]);
+        run("parse_profile", profileName, 0, [&]() {
+            StainProfile parsed;
+            parsed.readStainProfile(file.begin(), file.size());
+        });
+    }
+
+    if (settings.outputFile.empty()) {
+        writeJSON(std::cout, settings, results);
+    }
+    else {
+        std::ofstream out(settings.outputFile.c_str());
+        writeJSON(out, settings, results);
+        if (!out.good()) {
+            std::cerr << "Could not write " << settings.outputFile << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}//end main
@@ -0,0 +1,508 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+///Command-line batch driver for stain separation, built without the Sedeen SDK.
+///Separates the stains of a profile in every input image, saves the separated images,
+///and writes the pixel fraction of each image to a CSV report, and optionally the statistics
+///of every stain of each image to a second CSV report. Images are processed
+///concurrently by a pool of worker threads sharing one immutable DeconvolutionPlan.
+
+#include "StainProfile.h"
+#include "DeconvolutionPlan.h"
+#include "DeconvolutionLUT.h"
+#include "StainStatistics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem> //Requires C++17
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace {
+    namespace fs = std::filesystem; //an alias
+
+    ///Settings of a batch run, from the command line
+    struct BatchSettings {
+        std::string profileFile;
+        std::vector<std::string> inputPaths;
+        std::string outputDirectory;
+        std::string outputExtension = ".png";
+        std::string reportFile;
+        std::string statisticsFile;
+        int stainToDisplay = 0;
+        bool applyThreshold = false;
+        double threshold = 0.20;
+        bool grayscaleQuantityOnly = false;
+        bool saveAllStains = false;
+        bool useLookupTable = false;
+        int numberOfWorkers = 0;
+    };
+
+    ///Outcome of processing one input image
+    struct BatchResult {
+        std::string inputPath;
+        std::vector<std::string> outputPaths;
+        long long coveredPixels = 0;
+        long long totalPixels = 0;
+        std::shared_ptr<StainStatistics> statistics;
+        bool success = false;
+        std::string message;
+    };
+
+    ///Image file extensions read from an input directory (lower case)
+    const std::vector<std::string> InputExtensions = { ".png", ".jpg", ".jpeg", ".tif", ".tiff", ".bmp" };
+
+    void printUsage(const char *program) {
+        std::cout << "Usage: " << program << " --profile <file.xml> --input <image or directory> [options]" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  --profile <file>     Stain vector profile (XML), as saved by the Stain Analysis plugin" << std::endl
+            << "  --input <path>       Input image, or directory of images; may be repeated" << std::endl
+            << "  --output <dir>       Directory for the separated images and the report (default: current directory)" << std::endl
+            << "  --stain <1-3>        Stain to display and count (default: 1)" << std::endl
+            << "  --threshold <OD>     Apply an OD threshold to the displayed stain (e.g. 0.2)" << std::endl
+            << "  --grayscale          Save stain quantities as grayscale images instead of stain colour images" << std::endl
+            << "  --all-stains         Save every stain of the profile, each to its own file" << std::endl
+            << "  --lookup-table       Use precomputed lookup tables for the separation" << std::endl
+            << "  --format <ext>       Output image format: png, tif, jpg or bmp (default: png)" << std::endl
+            << "  --report <file>      Pixel fraction report, CSV (default: <output>/pixel_fraction_report.csv)" << std::endl
+            << "  --statistics <file>  Also write the OD statistics and H-score of every stain of each image, CSV" << std::endl
+            << "  --workers <n>        Number of images processed concurrently (default: number of hardware threads)" << std::endl
+            << "  --help               Show this message" << std::endl;
+    }//end printUsage
+
+    ///Parse the command line. Returns false, after printing an error, if the arguments are not usable.
+    bool parseArguments(int argc, char *argv[], BatchSettings &settings) {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg(argv[i]);
+            //Every option except the flags takes one value
+            auto nextValue = [&](std::string &value) -> bool {
+                if (i + 1 >= argc) {
+                    std::cerr << "Missing value for " << arg << std::endl;
+                    return false;
+                }
+                value = argv[++i];
+                return true;
+            };
+            std::string value;
+            if (arg == "--profile") {
+                if (!nextValue(settings.profileFile)) { return false; }
+            }
+            else if (arg == "--input") {
+                if (!nextValue(value)) { return false; }
+                settings.inputPaths.push_back(value);
+            }
+            else if (arg == "--output") {
+                if (!nextValue(settings.outputDirectory)) { return false; }
+            }
+            else if (arg == "--report") {
+                if (!nextValue(settings.reportFile)) { return false; }
+            }
+            else if (arg == "--statistics") {
+                if (!nextValue(settings.statisticsFile)) { return false; }
+            }
+            else if (arg == "--stain") {
+                if (!nextValue(value)) { return false; }
+                settings.stainToDisplay = std::atoi(value.c_str()) - 1;
+                if ((settings.stainToDisplay < 0) || (settings.stainToDisplay > 2)) {
+                    std::cerr << "The stain must be 1, 2 or 3" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--threshold") {
+                if (!nextValue(value)) { return false; }
+                settings.applyThreshold = true;
+                settings.threshold = std::atof(value.c_str());
+            }
+            else if (arg == "--format") {
+                if (!nextValue(value)) { return false; }
+                std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                settings.outputExtension = (!value.empty() && (value.front() == '.')) ? value : ("." + value);
+            }
+            else if (arg == "--workers") {
+                if (!nextValue(value)) { return false; }
+                settings.numberOfWorkers = std::atoi(value.c_str());
+                if (settings.numberOfWorkers < 1) {
+                    std::cerr << "The number of workers must be at least 1" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--grayscale") {
+                settings.grayscaleQuantityOnly = true;
+            }
+            else if (arg == "--all-stains") {
+                settings.saveAllStains = true;
+            }
+            else if (arg == "--lookup-table") {
+                settings.useLookupTable = true;
+            }
+            else if ((arg == "--help") || (arg == "-h")) {
+                return false;
+            }
+            else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+                return false;
+            }
+        }
+        if (settings.profileFile.empty() || settings.inputPaths.empty()) {
+            std::cerr << "A stain profile and at least one input are required" << std::endl;
+            return false;
+        }
+        if (settings.outputDirectory.empty()) {
+            settings.outputDirectory = fs::current_path().string();
+        }
+        if (settings.reportFile.empty()) {
+            settings.reportFile = (fs::path(settings.outputDirectory) / "pixel_fraction_report.csv").string();
+        }
+        if (settings.numberOfWorkers < 1) {
+            const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            settings.numberOfWorkers = (hardwareThreads > 0) ? static_cast<int>(hardwareThreads) : 1;
+        }
+        return true;
+    }//end parseArguments
+
+    ///Expand the input paths to a sorted list of image files; directories are searched (not recursively) for image extensions
+    std::vector<std::string> collectInputFiles(const std::vector<std::string> &inputPaths) {
+        std::vector<std::string> files;
+        for (auto it = inputPaths.begin(); it != inputPaths.end(); ++it) {
+            const fs::path inputPath(*it);
+            if (!fs::is_directory(inputPath)) {
+                files.push_back(inputPath.string());
+                continue;
+            }
+            std::vector<std::string> directoryFiles;
+            for (const auto &entry : fs::directory_iterator(inputPath)) {
+                if (!entry.is_regular_file()) {
+                    continue;
+                }
+                std::string ext = entry.path().extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                if (std::find(InputExtensions.begin(), InputExtensions.end(), ext) != InputExtensions.end()) {
+                    directoryFiles.push_back(entry.path().string());
+                }
+            }
+            std::sort(directoryFiles.begin(), directoryFiles.end());
+            files.insert(files.end(), directoryFiles.begin(), directoryFiles.end());
+        }
+        return files;
+    }//end collectInputFiles
+
+    ///Output file name stems: the input file stem, or the whole file name if two inputs share a stem
+    std::vector<std::string> getOutputStems(const std::vector<std::string> &inputFiles) {
+        std::map<std::string, int> stemCounts;
+        for (auto it = inputFiles.begin(); it != inputFiles.end(); ++it) {
+            stemCounts[fs::path(*it).stem().string()]++;
+        }
+        std::vector<std::string> stems;
+        for (auto it = inputFiles.begin(); it != inputFiles.end(); ++it) {
+            const fs::path inputPath(*it);
+            std::string stem = inputPath.stem().string();
+            if (stemCounts[stem] > 1) {
+                stem = inputPath.filename().string();
+                std::replace(stem.begin(), stem.end(), '.', '_');
+            }
+            stems.push_back(stem);
+        }
+        return stems;
+    }//end getOutputStems
+
+    ///The name of a stain in the profile, keeping only characters that are safe in a file name
+    std::string getStainFileSuffix(std::shared_ptr<StainProfile> theProfile, const int &stain) {
+        const std::string stainName = (stain == 0) ? theProfile->GetNameOfStainOne()
+            : (stain == 1) ? theProfile->GetNameOfStainTwo() : theProfile->GetNameOfStainThree();
+        std::string suffix;
+        for (auto it = stainName.begin(); it != stainName.end(); ++it) {
+            suffix.push_back(std::isalnum(static_cast<unsigned char>(*it)) ? (*it) : '_');
+        }
+        return suffix.empty() ? ("stain" + std::to_string(stain + 1)) : suffix;
+    }//end getStainFileSuffix
+
+    ///Count the pixels of a separated row with a non-zero colour, as the plugin's pixel fraction report does
+    long long countCoveredPixels(const unsigned char *row, const int &outChannels, const int &width) {
+        long long covered = 0;
+        for (int x = 0; x < width; x++) {
+            const unsigned char *p = row + x * outChannels;
+            covered += (outChannels == 1) ? (p[0] != 0) : ((p[0] | p[1] | p[2]) != 0);
+        }
+        return covered;
+    }//end countCoveredPixels
+
+    ///Copy a separated row (1 or 4 channels, RGBA) to a row of an output image (1 or 3 channels, BGR as OpenCV expects)
+    void copyToOutputRow(const unsigned char *src, const int &outChannels, const int &width, unsigned char *dst) {
+        if (outChannels == 1) {
+            std::copy(src, src + width, dst);
+            return;
+        }
+        for (int x = 0; x < width; x++) {
+            dst[3 * x    ] = src[4 * x + 2];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x    ];
+        }
+    }//end copyToOutputRow
+
+    ///Separate the stains of one image, save the separated images and count the pixel fraction of the displayed stain.
+    ///If emptyStatistics is not null, a copy of it accumulates the statistics of every stain in the same pass.
+    BatchResult processImage(const std::string &inputPath, const std::string &outputStem, const DeconvolutionPlan &plan, 
+        const DeconvolutionLUT *lut, const StainStatistics *emptyStatistics, const std::vector<std::string> &stainSuffixes, 
+        const BatchSettings &settings) {
+        BatchResult result;
+        result.inputPath = inputPath;
+        if (emptyStatistics != nullptr) {
+            result.statistics = std::make_shared<StainStatistics>(*emptyStatistics);
+        }
+
+        //OpenCV reads 8-bit BGR; other depths and alpha are converted on reading
+        cv::Mat source = cv::imread(inputPath, cv::IMREAD_COLOR);
+        if (source.empty() || (source.type() != CV_8UC3)) {
+            result.message = "could not read the image";
+            return result;
+        }
+        const int width = source.cols;
+        const int height = source.rows;
+        const int numStains = plan.GetNumberOfStains();
+        const int displayStain = plan.GetDisplayStain();
+        //A single-stain profile is thresholded to RGBA whatever the output type, as in the plugin
+        const int outChannels = plan.GetDisplayRowChannels();
+        const bool allStains = settings.saveAllStains && (numStains > 1);
+
+        //One output image per saved stain: the displayed stain first, or every stain in order
+        std::vector<int> savedStains;
+        if (allStains) {
+            for (int s = 0; s < numStains; s++) {
+                savedStains.push_back(s);
+            }
+        }
+        else {
+            savedStains.push_back(displayStain);
+        }
+        std::vector<cv::Mat> outputs;
+        for (size_t k = 0; k < savedStains.size(); k++) {
+            outputs.push_back(cv::Mat(height, width, (outChannels == 1) ? CV_8UC1 : CV_8UC3));
+        }
+
+        //Row buffers: the source in RGB order, and the separated output of each stain
+        std::vector<unsigned char> rgbRow(3 * width);
+        std::vector<std::vector<unsigned char>> stainRows(3, std::vector<unsigned char>(outChannels * width));
+        for (int y = 0; y < height; y++) {
+            const unsigned char *bgr = source.ptr<unsigned char>(y);
+            for (int x = 0; x < width; x++) {
+                rgbRow[3 * x    ] = bgr[3 * x + 2];
+                rgbRow[3 * x + 1] = bgr[3 * x + 1];
+                rgbRow[3 * x + 2] = bgr[3 * x    ];
+            }
+            if (allStains) {
+                unsigned char *const dstRows[3] = { stainRows[0].data(), stainRows[1].data(), stainRows[2].data() };
+                plan.SeparateRowAllStains(rgbRow.data(), 3, width, dstRows);
+            }
+            else if (lut != nullptr) {
+                lut->SeparateRow(rgbRow.data(), 3, width, stainRows[displayStain].data());
+            }
+            else {
+                plan.DisplayRow(rgbRow.data(), 3, width, stainRows[displayStain].data());
+            }
+            result.coveredPixels += countCoveredPixels(stainRows[displayStain].data(), outChannels, width);
+            if (result.statistics != nullptr) {
+                result.statistics->AddRow(rgbRow.data(), 3, width);
+            }
+            for (size_t k = 0; k < savedStains.size(); k++) {
+                copyToOutputRow(stainRows[savedStains[k]].data(), outChannels, width, outputs[k].ptr<unsigned char>(y));
+            }
+        }
+        result.totalPixels = static_cast<long long>(width) * static_cast<long long>(height);
+
+        //Output files are named after the input file and the stain
+        for (size_t k = 0; k < savedStains.size(); k++) {
+            const fs::path outputPath = fs::path(settings.outputDirectory)
+                / (outputStem + "_" + stainSuffixes.at(savedStains[k]) + settings.outputExtension);
+            bool written = false;
+            try {
+                written = cv::imwrite(outputPath.string(), outputs[k]);
+            }
+            catch (const cv::Exception &e) {
+                result.message = e.what();
+            }
+            if (!written) {
+                result.message = "could not write " + outputPath.string() + (result.message.empty() ? "" : (": " + result.message));
+                return result;
+            }
+            result.outputPaths.push_back(outputPath.string());
+        }
+        result.success = true;
+        return result;
+    }//end processImage
+
+    ///Write the pixel fraction of every image, in input order, as CSV
+    bool writeReport(const std::string &reportFile, const std::vector<BatchResult> &results,
+        const std::string &stainName, const BatchSettings &settings) {
+        std::ofstream report(reportFile.c_str());
+        if (!report.good()) {
+            return false;
+        }
+        report << "image,stain,threshold,stained_pixels,total_pixels,percent_stained,status" << std::endl;
+        for (auto it = results.begin(); it != results.end(); ++it) {
+            const double coveredFraction = (it->totalPixels > 0)
+                ? static_cast<double>(it->coveredPixels) / static_cast<double>(it->totalPixels) : 0.0;
+            report << "\"" << it->inputPath << "\"," << stainName << ",";
+            if (settings.applyThreshold) {
+                report << settings.threshold;
+            }
+            report << "," << it->coveredPixels << "," << it->totalPixels << ","
+                << std::fixed << std::setprecision(3) << coveredFraction * 100 << std::defaultfloat << ","
+                << (it->success ? "ok" : it->message) << std::endl;
+        }
+        return report.good();
+    }//end writeReport
+
+    ///Write the statistics of every stain of every image, in input order, as CSV
+    bool writeStatisticsReport(const std::string &statisticsFile, const std::vector<BatchResult> &results,
+        const std::vector<std::string> &stainSuffixes) {
+        std::ofstream report(statisticsFile.c_str());
+        if (!report.good()) {
+            return false;
+        }
+        const double percentiles[5] = { 5.0, 25.0, 50.0, 75.0, 95.0 };
+        report << "image,stain,pixels,mean_od,integrated_od,p5_od,p25_od,p50_od,p75_od,p95_od,"
+            << "percent_negative,percent_weak,percent_moderate,percent_strong,h_score" << std::endl;
+        for (auto it = results.begin(); it != results.end(); ++it) {
+            if (!it->success || (it->statistics == nullptr)) {
+                continue;
+            }
+            const StainStatistics &statistics = *(it->statistics);
+            for (int s = 0; s < statistics.GetNumberOfStains(); s++) {
+                report << "\"" << it->inputPath << "\"," << stainSuffixes.at(s) << "," << statistics.GetPixelCount() << ","
+                    << std::fixed << std::setprecision(4) << statistics.GetMeanOD(s) << ","
+                    << std::setprecision(1) << statistics.GetIntegratedOD(s);
+                for (int p = 0; p < 5; p++) {
+                    report << "," << std::setprecision(3) << statistics.GetPercentile(s, percentiles[p]);
+                }
+                for (int i = StainStatistics::NEGATIVE; i < StainStatistics::NUM_INTENSITY_CLASSES; i++) {
+                    report << "," << std::setprecision(3) << statistics.GetIntensityPercent(s, static_cast<StainStatistics::IntensityClass>(i));
+                }
+                report << "," << std::setprecision(1) << statistics.GetHScore(s) << std::defaultfloat << std::endl;
+            }
+        }
+        return report.good();
+    }//end writeStatisticsReport
+}
+
+int main(int argc, char *argv[]) {
+    BatchSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    auto theProfile = std::make_shared<StainProfile>();
+    if (!theProfile->readStainProfile(settings.profileFile)) {
+        std::cerr << "Could not read the stain profile " << settings.profileFile << std::endl;
+        return 1;
+    }
+    //The plan (and the lookup tables, if used) are built once and shared by all workers
+    auto plan = std::make_shared<const DeconvolutionPlan>(theProfile, settings.stainToDisplay,
+        settings.applyThreshold, settings.threshold, settings.grayscaleQuantityOnly);
+    if (!plan->IsValid() || (settings.stainToDisplay >= plan->GetNumberOfStains())) {
+        std::cerr << "The stain profile is not valid, or does not have stain " << settings.stainToDisplay + 1 << std::endl;
+        return 1;
+    }
+    std::shared_ptr<const DeconvolutionLUT> lut;
+    //The table separates stains; a single-stain profile is only thresholded
+    if (settings.useLookupTable && (plan->GetNumberOfStains() > 1) && !settings.saveAllStains) {
+        lut = std::make_shared<const DeconvolutionLUT>(plan);
+        if (!lut->IsValid()) {
+            lut.reset();
+        }
+    }
+
+    //Statistics are accumulated in fixed point, so each image's result does not depend on how its rows are read
+    std::shared_ptr<const StainStatistics> emptyStatistics;
+    if (!settings.statisticsFile.empty()) {
+        emptyStatistics = std::make_shared<const StainStatistics>(plan);
+    }
+
+    std::error_code ec;
+    fs::create_directories(settings.outputDirectory, ec);
+    if (!fs::is_directory(settings.outputDirectory)) {
+        std::cerr << "Could not create the output directory " << settings.outputDirectory << std::endl;
+        return 1;
+    }
+    const std::vector<std::string> inputFiles = collectInputFiles(settings.inputPaths);
+    if (inputFiles.empty()) {
+        std::cerr << "No input images found" << std::endl;
+        return 1;
+    }
+    const std::vector<std::string> outputStems = getOutputStems(inputFiles);
+    std::vector<std::string> stainSuffixes;
+    for (int s = 0; s < 3; s++) {
+        stainSuffixes.push_back(getStainFileSuffix(theProfile, s));
+    }
+
+    //Each worker takes the next unprocessed image until none are left
+    const int numberOfWorkers = std::min(settings.numberOfWorkers, static_cast<int>(inputFiles.size()));
+    std::vector<BatchResult> results(inputFiles.size());
+    std::atomic<size_t> nextImage(0);
+    std::atomic<size_t> imagesDone(0);
+    std::mutex outputMutex;
+    auto worker = [&]() {
+        for (size_t i = nextImage++; i < inputFiles.size(); i = nextImage++) {
+            results[i] = processImage(inputFiles[i], outputStems[i], *plan, lut.get(), emptyStatistics.get(), stainSuffixes, settings);
+            const size_t done = ++imagesDone;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << "[" << done << "/" << inputFiles.size() << "] " << inputFiles[i]
+                << (results[i].success ? "" : (": " + results[i].message)) << std::endl;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int w = 0; w < numberOfWorkers; w++) {
+        workers.push_back(std::thread(worker));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+
+    if (!writeReport(settings.reportFile, results, stainSuffixes.at(settings.stainToDisplay), settings)) {
+        std::cerr << "Could not write the report " << settings.reportFile << std::endl;
+        return 1;
+    }
+    if (!settings.statisticsFile.empty() && !writeStatisticsReport(settings.statisticsFile, results, stainSuffixes)) {
+        std::cerr << "Could not write the statistics report " << settings.statisticsFile << std::endl;
+        return 1;
+    }
+    const long long failures = std::count_if(results.begin(), results.end(), [](const BatchResult &r) { return !r.success; });
+    std::cout << "Processed " << results.size() - failures << " of " << results.size() << " images. Report saved as "
+        << settings.reportFile << std::endl;
+    return (failures == 0) ? 0 : 2;
+}//end main
@@ -26,12 +26,18 @@
 //
 #include "StainAnalysis-plugin.h"
 #include "ODConversion.h"
+#include "ImagePixelAccess.h"
+#include "TiledTIFFWriter.h"
 
 #include <sstream>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <algorithm>
 #include <vector>
 
 // Sedeen headers
@@ -58,28 +64,204 @@ POCO_END_MANIFEST
 namespace sedeen {
 namespace algorithm {
 
+namespace {
+    ///Copy the colour channels (1 or 3) of a composited tile to a buffer with the given row stride.
+    ///If a mask tile is given, pixels where the mask is zero are cleared.
+    bool copyTileToBuffer(const image::RawImage &tile, const image::RawImage *mask, const int &width, const int &height,
+        const int &channels, unsigned char *dst, const int &rowStride) {
+        if ((tile.width() < width) || (tile.height() < height)
+            || ((mask != nullptr) && ((mask->width() < width) || (mask->height() < height)))) {
+            return false;
+        }
+        //Fast path: contiguous interleaved UInt8 rows
+        if (image::isInterleavedUInt8(tile, channels)) {
+            const int tileChannels = tile.colorSpace().channelCount();
+            const unsigned char *src = image::rawPixels(tile);
+            for (int j = 0; j < height; j++) {
+                const unsigned char *s = src + j * tile.width() * tileChannels;
+                unsigned char *d = dst + j * rowStride;
+                for (int i = 0; i < width; i++) {
+                    for (int c = 0; c < channels; c++) {
+                        d[i * channels + c] = s[i * tileChannels + c];
+                    }
+                }
+            }
+        }
+        else {
+            //Fallback for other channel types or layouts
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    for (int c = 0; c < channels; c++) {
+                        dst[j * rowStride + i * channels + c] = static_cast<unsigned char>(tile.at(i, j, c).as<int>());
+                    }
+                }
+            }
+        }
+        if (mask != nullptr) {
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    if (mask->at(i, j, 0).as<int>() == 0) {
+                        for (int c = 0; c < channels; c++) {
+                            dst[j * rowStride + i * channels + c] = 0;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }//end copyTileToBuffer
+
+    ///Clear the pixels of a level 0 tile in a buffer that are not tissue. A tile of glass is cleared entirely.
+    void clearGlass(const TissueMask &tissue, const Rect &tileRect, const int &channels, unsigned char *dst, const int &rowStride) {
+        const int width = tileRect.width();
+        const int height = tileRect.height();
+        std::vector<unsigned char> tileMask(static_cast<size_t>(width) * height);
+        tissue.GetTileMask(tileRect.x(), tileRect.y(), width, height, 1.0, 1.0, tileMask.data());
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                if (tileMask[j * width + i] == 0) {
+                    std::memset(dst + j * rowStride + i * channels, 0, channels);
+                }
+            }
+        }
+    }//end clearGlass
+
+    ///Clear the pixels of an image of the full resolution rectangle rect that are not tissue
+    void clearGlass(const TissueMask &tissue, const Rect &rect, image::RawImage &outputImage) {
+        const int width = outputImage.width();
+        const int height = outputImage.height();
+        if ((width < 1) || (height < 1)) {
+            return;
+        }
+        std::vector<unsigned char> tileMask(static_cast<size_t>(width) * height);
+        tissue.GetTileMask(rect.x(), rect.y(), width, height, 
+            static_cast<double>(rect.width()) / width, static_cast<double>(rect.height()) / height, tileMask.data());
+        const int channelCount = outputImage.colorSpace().channelCount();
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                if (tileMask[y * width + x] == 0) {
+                    for (int c = 0; c < channelCount; c++) {
+                        outputImage.setValue(x, y, c, 0);
+                    }
+                }
+            }
+        }
+    }//end clearGlass
+
+    ///Composite a full resolution rectangle in chunks, in parallel, skipping the chunks of glass.
+    ///Pixels that are not tissue are zero.
+    image::RawImage compositeTissue(std::shared_ptr<image::tile::Factory> factory, const Rect &rect, const TissueMask &tissue) {
+        const int chunkSize = 512;
+        image::RawImage outputImage(Size(rect.width(), rect.height()), factory->getColorSpace());
+        outputImage.fill(0);
+        const int channelCount = outputImage.colorSpace().channelCount();
+        const bool fastCopy = image::isInterleavedUInt8(outputImage, 1);
+        unsigned char *outputPixels = fastCopy ? image::rawPixels(outputImage) : nullptr;
+        const int chunkColumns = (rect.width() + chunkSize - 1) / chunkSize;
+        const int chunkRows = (rect.height() + chunkSize - 1) / chunkSize;
+        const int numChunks = chunkColumns * chunkRows;
+#pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < numChunks; c++) {
+            const int x = (c % chunkColumns) * chunkSize;
+            const int y = (c / chunkColumns) * chunkSize;
+            const int w = std::min(chunkSize, rect.width() - x);
+            const int h = std::min(chunkSize, rect.height() - y);
+            if (!tissue.IntersectsTissue(rect.x() + x, rect.y() + y, w, h)) {
+                continue;
+            }
+            image::RawImage tile = image::tile::Compositor(factory).getImage(0, Rect(Point(rect.x() + x, rect.y() + y), Size(w, h)));
+            const int tw = std::min(w, tile.width());
+            const int th = std::min(h, tile.height());
+            if (fastCopy && image::isInterleavedUInt8(tile, channelCount) && (tile.colorSpace().channelCount() == channelCount)) {
+                const unsigned char *src = image::rawPixels(tile);
+                for (int j = 0; j < th; j++) {
+                    std::memcpy(outputPixels + (static_cast<size_t>(y + j) * rect.width() + x) * channelCount,
+                        src + static_cast<size_t>(j) * tile.width() * channelCount, static_cast<size_t>(tw) * channelCount);
+                }
+            }
+            else {
+                //Fallback for other channel types or layouts
+#pragma omp critical
+                for (int j = 0; j < th; j++) {
+                    for (int i = 0; i < tw; i++) {
+                        for (int k = 0; k < channelCount; k++) {
+                            outputImage.setValue(x + i, y + j, k, tile.at(i, j, k).as<int>());
+                        }
+                    }
+                }
+            }
+        }
+        clearGlass(tissue, rect, outputImage);
+        return outputImage;
+    }//end compositeTissue
+
+    ///The measurements of one batch region: the stained fraction at any threshold, and the stain statistics
+    struct RegionMeasurements {
+        ThresholdSweep sweep;
+        StainStatistics statistics;
+
+        explicit RegionMeasurements(std::shared_ptr<const DeconvolutionPlan> plan) : sweep(plan), statistics(plan) {}
+        void AddRow(const unsigned char *src, const int &srcChannels, const int &width, const unsigned char *mask) {
+            sweep.AddRow(src, srcChannels, width, mask);
+            statistics.AddRow(src, srcChannels, width, mask);
+        }
+        void Merge(const RegionMeasurements &other) {
+            sweep.Merge(other.sweep);
+            statistics.Merge(other.statistics);
+        }
+    };
+}
+
 StainAnalysis::StainAnalysis()
 	: m_displayArea(),
     m_openProfile(),
     m_stainSeparationAlgorithm(),
     m_stainVectorProfile(),
     m_regionToProcess(),
+    m_batchRegionFile(),
     m_stainResultType(),
     m_stainToDisplay(),
     m_applyDisplayThreshold(),
     m_displayThreshold(),
+    m_thresholdSweep(),
+    m_stainStatistics(),
+    m_useLookupTable(),
+    m_restrictToTissue(),
     m_saveSeparatedImage(),
     m_saveFileFormat(),
+    m_saveAllStains(),
     m_saveFileAs(),
+    m_estimateStainVectors(),
+    m_saveEstimatedProfileAs(),
+    m_stainRegionFile(),
     m_result(),
     m_outputText(),
     m_report(""),
+    m_estimationReport(""),
+    m_estimationSaveReport(""),
+    m_estimatedProfile(),
+    m_estimatedCSVRow(""),
     m_displayThresholdDefaultVal(0.20),
     m_displayThresholdMaxVal(3.0),
     m_thresholdStepSizeVal(0.01),
     m_pixelWarningThreshold(1e8), //100,000,000 pixels, ~400 MB
-    m_colorDeconvolution_factory(nullptr)
+    m_colorDeconvolution_factory(nullptr),
+    m_colorDeconvolution_kernel(nullptr),
+    m_stainQuantity_factory(nullptr),
+    m_stainQuantityPlan(nullptr),
+    m_stainQuantityMap(nullptr),
+    m_stainOutput_factory(nullptr),
+    m_deconvolutionLUT(nullptr),
+    m_tileCacheBudget(TileCacheBudget::FromEnvironment()),
+    m_cacheTileSize({ 0, 0 }),
+    m_viewportPredictor(nullptr),
+    m_tilePrefetcher(),
+    m_tissueMask(nullptr),
+    m_tissueMaskLevel(0)
 {
+    m_stageBuildCount.fill(0);
+    m_stageRetainCount.fill(0);
+
     // Build the list of stain vector file names
     m_stainProfileFullPathNames.push_back("");  // Leave a blank place for the loaded file
     // HematoxylinPEosinSample
@@ -135,11 +317,21 @@ StainAnalysis::StainAnalysis()
     m_stainToDisplayOptions.push_back("Stain 2");
     m_stainToDisplayOptions.push_back("Stain 3");
 
+    //Report the stained fraction for many thresholds, from one pass over the region
+    m_thresholdSweepOptions.push_back("None");
+    m_thresholdSweepOptions.push_back("OD thresholds 0.05 to 1.00");
+    m_thresholdSweepOptions.push_back("Every OD threshold (0.01 steps)");
+
+    //Methods to estimate stain vectors from the image, named as in the profile's separation algorithm list
+    m_estimateStainVectorsOptions.push_back("None");
+    m_estimateStainVectorsOptions.push_back("Macenko Decomposition");
+    m_estimateStainVectorsOptions.push_back("Non-Negative Matrix Factorization");
+    m_estimateStainVectorsOptions.push_back("Region-of-Interest Selection");
+
     //Choose what format to write the separated images in
     //Define the list of possible save types (flat image vs whole slide image)
     m_saveFileFormatOptions.push_back("Flat image (tif/png/bmp/gif/jpg)");
-    //TODO: enable saving a whole slide image
-    //m_saveFileFormatOptions.push_back("Whole Slide Image (.svs)");
+    m_saveFileFormatOptions.push_back("Whole Slide Image (tiled pyramidal tif)");
 
     //List the actual extensions that should be included in the save dialog window
     m_saveFileExtensionText.push_back("tif");
@@ -147,8 +339,6 @@ StainAnalysis::StainAnalysis()
     m_saveFileExtensionText.push_back("bmp");
     m_saveFileExtensionText.push_back("gif");
     m_saveFileExtensionText.push_back("jpg");
-    //TODO: enable saving a whole slide image
-    //m_saveFileExtensionText.push_back("svs");
 
 }//end constructor
 
@@ -177,6 +367,12 @@ void StainAnalysis::init(const image::ImageHandle& image) {
         "Choose a Region of Interest on which to apply the stain separation algorithm. Choosing no ROI will apply the stain separation to the whole slide image.",
         true); //optional. None means apply to whole slide
 
+    //Many regions can be measured in one pass over the slide
+    m_batchRegionFile = createOpenFileDialogParameter(*this, "Batch ROI File (e.g. TMA cores)",
+        "Choose a CSV file listing the regions to measure together, one per line: a label, then the x and y of each vertex in full resolution pixels (two vertices for a rectangle). "
+        "Each tile of the slide is read once for all of them, and a table of the stained percentage and stain statistics of every region is added to the report.",
+        defineRegionFileDialogOptions("Open batch region list: "), true); //optional
+
     //List of result types to display (re-coloured with stain vectors or grayscale quantity)
     m_stainResultType = createOptionParameter(*this, "Result Type",
         "Choose the type of separated image to display (RGB colours from stain vectors or grayscale stain quantity",
@@ -203,33 +399,114 @@ void StainAnalysis::init(const image::ImageHandle& image) {
         m_thresholdStepSizeVal,
         false);
 
+    //Histograms of the OD of each stain give the stained fraction at every threshold
+    m_thresholdSweep = createOptionParameter(*this, "Threshold Sweep",
+        "Report the percentage of the processed region above each of a list of OD thresholds, for every stain, with suggested thresholds. The region is read once for all thresholds.",
+        0, m_thresholdSweepOptions, false);
+
+    //Quantitative statistics of the stain quantities, before the threshold
+    m_stainStatistics = createBoolParameter(*this, "Stain Statistics",
+        "If checked, the mean and integrated OD, percentiles, intensity classes and H-score of every stain over the processed region are added to the report.",
+        false, false); //default value, optional
+
+    //Precomputing the output for every RGB colour takes a moment, but makes each tile much faster
+    m_useLookupTable = createBoolParameter(*this, "Use Lookup Table",
+        "If checked, the separated output is precomputed for every RGB colour when the stain, threshold or result type changes, which makes panning and saving faster. Stain RGB colours are interpolated and may differ by 1 in a channel.",
+        false, false); //default value, optional
+
+    //Tissue is detected once per slide, on a low resolution level
+    m_restrictToTissue = createBoolParameter(*this, "Restrict to Tissue",
+        "If checked, tissue is detected on a low resolution level of the slide. Areas of glass are not separated when saving images, and are saved as zero; the stained percentage is reported as a fraction of the tissue area.",
+        false, false); //default value, optional
+
     //Allow the user to write separated images to file
     m_saveSeparatedImage = createBoolParameter(*this, "Save Separated Image",
         "If checked, the final image will be saved to an output file, of the type chosen in the Save File Format list.",
         false, false);
 
     m_saveFileFormat = createOptionParameter(*this, "Save File Format",
-        "Output image files can be saved as one of five flat image types.",
+        "Output image files can be saved as one of five flat image types, or as a tiled pyramidal BigTIFF (.tif) whole slide image of the region of interest or the full slide.",
         0, m_saveFileFormatOptions, false);
 
+    //Separate the source once and save each stain to its own file
+    m_saveAllStains = createBoolParameter(*this, "Save All Stains",
+        "If checked, every stain of the profile is saved in one pass, each to its own file named with the stain name after the chosen file name.",
+        false, false);
+
     //Allow the user to choose where to save the image files
     sedeen::file::FileDialogOptions saveFileDialogOptions = defineSaveFileDialogOptions();
     m_saveFileAs = createSaveFileDialogParameter(*this, "Save As...",
         "The output image will be saved to this file name. If the file name includes an extension of type TIF/PNG/BMP/GIF/JPG, it will override the Save File Format choice.",
         saveFileDialogOptions, true);
 
+    //Stain vectors can be estimated from a sample of the pixels of the ROI or whole slide
+    m_estimateStainVectors = createOptionParameter(*this, "Estimate Stain Vectors",
+        "Estimate stain vectors from a sample of the pixels of the ROI, or of the whole slide if no ROI is chosen. Macenko finds two stains (hematoxylin first); sparse NMF refines the stains of the chosen profile; Region-of-Interest Selection measures each stain of the chosen profile in the Stain ROIs chosen for it. The algorithm parameters are taken from the chosen stain profile if it has them.",
+        0, m_estimateStainVectorsOptions, false);
+
+    sedeen::file::FileDialogOptions profileSaveFileDialogOptions = defineProfileSaveFileDialogOptions();
+    m_saveEstimatedProfileAs = createSaveFileDialogParameter(*this, "Save Estimated Profile As...",
+        "The estimated stain vectors will be saved as a stain profile to this file, which can then be opened as the Stain Profile File.",
+        profileSaveFileDialogOptions, true);
+
+    //Each stain's vector can be measured in regions stained with only that stain, listed in the same kind of file as the batch regions
+    m_stainRegionFile = createOpenFileDialogParameter(*this, "Stain ROI File",
+        "Choose a CSV file listing regions stained with only one stain of the chosen profile, for Region-of-Interest Selection, in the format of the Batch ROI File. "
+        "The label of each region is the number (1, 2 or 3) or the name of its stain in the chosen profile. Any number of regions can be listed for each stain.",
+        defineRegionFileDialogOptions("Open stain region list: "), true); //optional
+
+    //A new image needs its own tissue mask and stain vector estimate
+    m_tissueMask.reset();
+    m_estimationReport.clear();
+    m_estimationSaveReport.clear();
+    m_estimatedProfile.reset();
+    m_estimatedCSVRow.clear();
+
     // Bind result
     m_outputText = createTextResult(*this, "Text Result");
     m_result = createImageResult(*this, "StainAnalysisResult");
-      
+
+    //Predict the next viewports from the resolution levels of the image
+    auto fullDimensions = getDimensions(image, 0);
+    std::vector<double> levelDownsamples;
+    for (int level = 0; level < getNumResolutionLevels(image); level++) {
+        auto levelDimensions = getDimensions(image, level);
+        levelDownsamples.push_back((levelDimensions.width() > 0) 
+            ? static_cast<double>(fullDimensions.width()) / levelDimensions.width() : 1.0);
+    }
+    m_viewportPredictor = std::make_shared<ViewportPredictor>(fullDimensions.width(), fullDimensions.height(),
+        levelDownsamples, 512, ViewportPredictor::LookaheadFromEnvironment());
 }//end init
 
 void StainAnalysis::run() {
+    //Prefetching yields to the tiles requested now
+    m_tilePrefetcher.Stop();
+
     //These have to be checked before the parameters are used
     //Check if the stain profile has changed
     bool stainProfile_changed = m_stainVectorProfile.isChanged();
     //Check whether the stain profile file has changed
     bool loadedFile_changed = m_openProfile.isChanged();
+    //Estimation reads the slide again, so it is only repeated when its inputs change, not on pan or zoom.
+    //This is checked before any early return, so that a change is not lost if this run stops
+    bool stainRegions_changed = m_stainRegionFile.isChanged();
+    if (m_estimateStainVectors.isChanged() || m_regionToProcess.isChanged() || stainRegions_changed
+        || m_restrictToTissue.isChanged() || stainProfile_changed || loadedFile_changed) {
+        m_estimationReport.clear();
+    }
+    //A new file for the last estimate only needs it saved again
+    if (m_saveEstimatedProfileAs.isChanged()) {
+        m_estimationSaveReport.clear();
+    }
+    //The Stain ROIs are read once, and kept while the file is unchanged
+    if (stainRegions_changed) {
+        std::string regionFileError;
+        m_stainRegionList = LoadRegionListFromFileDialog(m_stainRegionFile, regionFileError);
+        if (!regionFileError.empty()) {
+            m_outputText.sendText("The Stain ROI File cannot be read: " + regionFileError);
+            return;
+        }
+    }
 
     //Get which of the stain vector profiles has been selected by the user
     int chosenProfileNum = m_stainVectorProfile;
@@ -245,6 +522,23 @@ void StainAnalysis::run() {
 
     // Has display area changed
     bool display_changed = m_displayArea.isChanged();
+    //Has a batch region file been chosen, changed or cleared?
+    bool batch_changed = m_batchRegionFile.isChanged();
+    //Have the file saving options changed? These do not change the pipeline
+    bool output_changed = m_saveSeparatedImage.isChanged() || m_saveFileFormat.isChanged()
+        || m_saveAllStains.isChanged() || m_saveFileAs.isChanged() || m_restrictToTissue.isChanged() || m_thresholdSweep.isChanged()
+        || m_stainStatistics.isChanged() || batch_changed || m_estimateStainVectors.isChanged()
+        || m_saveEstimatedProfileAs.isChanged() || stainRegions_changed;
+
+    //The batch regions are read once, and kept while the file is unchanged
+    if (batch_changed) {
+        std::string regionFileError;
+        m_batchRegionList = LoadRegionListFromFileDialog(m_batchRegionFile, regionFileError);
+        if (!regionFileError.empty()) {
+            m_outputText.sendText("The Batch ROI File cannot be read: " + regionFileError);
+            return;
+        }
+    }
 
     //Get the stain profile that should be used
     //Use the vector::at operator to do bounds checking
@@ -275,7 +569,7 @@ void StainAnalysis::run() {
     bool pipeline_changed = buildPipeline(chosenStainProfile, (stainProfile_changed || loadedFile_changed));
 
 	// Update results
-	if ( pipeline_changed || display_changed || stainProfile_changed || loadedFile_changed ) {
+	if ( pipeline_changed || display_changed || output_changed || stainProfile_changed || loadedFile_changed ) {
         //Check whether the user wants to write to image files, that the field is not blank,
         //and that the file can be created or written to
         std::string outputFilePath;
@@ -310,10 +604,16 @@ void StainAnalysis::run() {
                 m_outputText.sendText(ss.str());
                 return;
             }
+            //Whole slide images are only written as TIFF
+            if ((m_saveFileFormat == SaveFormatWholeSlide) && (m_saveFileExtensionText.at(extensionIndex).compare("tif") != 0)) {
+                m_outputText.sendText("A whole slide image must be saved with the extension tif. Choose a correct file type and try again.");
+                return;
+            }
 
             //Check whether the output image as specified will have more pixels than the given threshold
             double estPixels = EstimateOutputImageSize();
-            bool largeOutputFlag = (estPixels > m_pixelWarningThreshold) ? true : false;
+            //Whole slide images are streamed tile by tile, so their size is not limited by memory
+            bool largeOutputFlag = ((estPixels > m_pixelWarningThreshold) && (m_saveFileFormat != SaveFormatWholeSlide)) ? true : false;
             std::string estStorageSize = EstimateImageStorageSize(estPixels);
             std::stringstream fileSaveUpdate;
             if (largeOutputFlag) {
@@ -339,17 +639,40 @@ void StainAnalysis::run() {
         //A previous version included an "intermediate result" here, to display
         //a blurry temporary image (rather than just black) while calculations proceeded
 
+        //Detect the tissue before it is used by the report and the saved images
+        if (m_restrictToTissue == true) {
+            buildTissueMask();
+        }
+
 		// Update the output text report
 		if (false == askedToStop()) {
 			std::string report = generateCompleteReport(chosenStainProfile);
             //If an output file should be written and the algorithm ran successfully, save images
             if (m_saveSeparatedImage == true) {
-                //Save the result as a flat image file
-                bool saveResult = SaveFlatImageToFile(outputFilePath);
+                //Separate all stains in one pass if requested and the profile has more than one stain
+                const int numStains = ((nullptr != m_colorDeconvolution_kernel) && (nullptr != m_colorDeconvolution_kernel->GetPlan()))
+                    ? m_colorDeconvolution_kernel->GetPlan()->GetNumberOfStains() : 0;
+                std::vector<std::string> savedFilePaths(1, outputFilePath);
+                bool saveResult = false;
+                if ((m_saveAllStains == true) && (numStains > 1)) {
+                    savedFilePaths = getAllStainsFilePaths(outputFilePath, chosenStainProfile);
+                    saveResult = (m_saveFileFormat == SaveFormatWholeSlide)
+                        ? SaveAllStainsToWholeSlideFiles(savedFilePaths)
+                        : SaveAllStainsToFlatFiles(savedFilePaths);
+                }
+                else {
+                    //Save the result as a whole slide image or a flat image file
+                    saveResult = (m_saveFileFormat == SaveFormatWholeSlide) 
+                        ? SaveWholeSlideImageToFile(outputFilePath) 
+                        : SaveFlatImageToFile(outputFilePath);
+                }
                 //Check whether saving was successful
                 std::stringstream ss;
                 if (saveResult) {
-                    ss << std::endl << "Stain-separated image saved as " << outputFilePath << std::endl;
+                    for (auto it = savedFilePaths.begin(); it != savedFilePaths.end(); ++it) {
+                        ss << std::endl << "Stain-separated image saved as " << (*it);
+                    }
+                    ss << std::endl;
                     report.append(ss.str());
                 }
                 else {
@@ -358,46 +681,85 @@ void StainAnalysis::run() {
                 }
             }
 
+            //Estimate stain vectors from the image, and save them as a profile
+            if (m_estimateStainVectors != 0) {
+                if (m_estimationReport.empty()) {
+                    m_estimationReport = estimateStainProfile(chosenStainProfile);
+                    m_estimationSaveReport.clear();
+                }
+                if (m_estimationSaveReport.empty()) {
+                    m_estimationSaveReport = saveEstimatedProfile();
+                }
+                report.append(m_estimationReport).append(m_estimationSaveReport);
+            }
+
             //Finally, send the report to the results window
             m_outputText.sendText(report);
+
+            //Compute the tiles most likely to be displayed next while the user looks at these
+            if ((nullptr != m_viewportPredictor) && (nullptr != m_colorDeconvolution_factory)) {
+                DisplayRegion region = m_displayArea;
+                ViewportPredictor::View view = { region.source_region.x(), region.source_region.y(),
+                    region.source_region.width(), region.source_region.height(), 
+                    getDisplayResolution(image(), m_displayArea) };
+                m_tilePrefetcher.Start(m_colorDeconvolution_factory, m_viewportPredictor->Observe(view), m_viewportPredictor);
+            }
 		}
 	}//end if UI changes
 
 	// Ensure we run again after an abort
-	// a small kludge that causes buildPipeline() to return TRUE
+	// a small kludge that causes buildPipeline() to return TRUE.
+	// The output stage is rebuilt; cached stain quantities are kept.
 	if (askedToStop()) {
+        m_stainOutput_factory.reset();
         m_colorDeconvolution_factory.reset();
 	}
 }//end run
 
 bool StainAnalysis::buildPipeline(std::shared_ptr<StainProfile> chosenStainProfile, bool somethingChanged) {
     using namespace image::tile;
-    bool pipeline_changed = false;
 
     // Get source image properties
     auto source_factory = image()->getFactory();
-    auto source_color = source_factory->getColorSpace();
-
-    //Set this one to change the stain profile
-    double conv_matrix[9] = { 0.0 };
-
-    bool doProcessing = false;
-    if ( pipeline_changed || somethingChanged
-         || m_regionToProcess.isChanged()
-         || m_stainSeparationAlgorithm.isChanged() 
-         || m_stainVectorProfile.isChanged() 
-         || m_stainResultType.isChanged()
-         || m_stainToDisplay.isChanged() 
-         || m_applyDisplayThreshold.isChanged() 
-         || m_displayThreshold.isChanged() 
-         || m_displayArea.isChanged()
-         || m_saveSeparatedImage.isChanged()
-         || m_saveFileFormat.isChanged()
-         || m_saveFileAs.isChanged()
-         || (nullptr == m_colorDeconvolution_factory) )
-    {
+    //The kernels report the slide's tile size once they have processed a tile;
+    //until then the caches are sized for TileCacheBudget::DefaultTileSize
+    const std::array<int, 2> tileSize = { m_tileCacheBudget->GetTileWidth(), m_tileCacheBudget->GetTileHeight() };
+    const bool tileSizeChanged = (tileSize != m_cacheTileSize);
+
+    //Dependency graph of the display pipeline: each parameter that affects pixel values is an input of
+    //one stage, and rebuilding a stage rebuilds every stage after it. The display area and the file
+    //saving options do not affect pixel values, so they rebuild nothing.
+    const std::pair<bool, PipelineStage> stageInputs[] = {
+        { somethingChanged,                         QUANTITY_STAGE },
+        { m_stainSeparationAlgorithm.isChanged(),   QUANTITY_STAGE },
+        { m_stainVectorProfile.isChanged(),         QUANTITY_STAGE },
+        { m_stainToDisplay.isChanged(),             QUANTITY_STAGE },
+        { m_useLookupTable.isChanged(),             QUANTITY_STAGE },
+        { tileSizeChanged,                          QUANTITY_STAGE },
+        { m_stainResultType.isChanged(),            OUTPUT_STAGE },
+        { m_applyDisplayThreshold.isChanged(),      OUTPUT_STAGE },
+        { m_displayThreshold.isChanged(),           OUTPUT_STAGE },
+        { (nullptr == m_stainOutput_factory),       OUTPUT_STAGE },
+        { m_regionToProcess.isChanged(),            REGION_STAGE },
+        { (nullptr == m_colorDeconvolution_factory), REGION_STAGE }
+    };
+    int firstStage = NUM_PIPELINE_STAGES;
+    for (auto it = std::begin(stageInputs); it != std::end(stageInputs); ++it) {
+        if (it->first && (it->second < firstStage)) {
+            firstStage = it->second;
+        }
+    }
+    //Count the stages kept with their caches
+    for (int stage = 0; stage < firstStage; stage++) {
+        m_stageRetainCount[stage]++;
+    }
+    if (firstStage == NUM_PIPELINE_STAGES) {
+        return false;
+    }
+
+    if (firstStage <= OUTPUT_STAGE) {
         //Choose value from the enumeration in ColorDeconvolution
-        image::tile::ColorDeconvolution::DisplayOptions DisplayOption;
+        image::tile::ColorDeconvolution::DisplayOptions DisplayOption = image::tile::ColorDeconvolution::DisplayOptions::STAIN1;
         switch (m_stainToDisplay)
         {
         case 0:
@@ -414,32 +776,85 @@ bool StainAnalysis::buildPipeline(std::shared_ptr<StainProfile> chosenStainProfi
         }
 
         //Kernel is affected by the display threshold settings, and choice of stain quantity or colour image
-        auto colorDeconvolution_kernel =
-            std::make_shared<image::tile::ColorDeconvolution>(DisplayOption, chosenStainProfile, 
-                m_applyDisplayThreshold, m_displayThreshold, m_stainResultType);
+        auto deconvolutionPlan = std::make_shared<const DeconvolutionPlan>(chosenStainProfile,
+            static_cast<int>(DisplayOption), m_applyDisplayThreshold, m_displayThreshold, m_stainResultType);
+        std::shared_ptr<image::tile::ColorDeconvolution> colorDeconvolution_kernel;
+        if (m_useLookupTable == true) {
+            //Rebuild the tables only if the plan's output differs from the one they were built for
+            if ((nullptr == m_deconvolutionLUT) || !m_deconvolutionLUT->GetPlan()->IsEquivalentTo(*deconvolutionPlan)) {
+                m_deconvolutionLUT = std::make_shared<const DeconvolutionLUT>(deconvolutionPlan);
+            }
+            colorDeconvolution_kernel = std::make_shared<image::tile::ColorDeconvolution>(m_deconvolutionLUT, m_tileCacheBudget);
+        }
+        else {
+            //Release the tables when they are not used
+            m_deconvolutionLUT.reset();
+            colorDeconvolution_kernel = std::make_shared<image::tile::ColorDeconvolution>(deconvolutionPlan, m_tileCacheBudget);
+        }
 
-        // Create a Factory for the composition of these Kernels
-        auto non_cached_factory =
-            std::make_shared<FilterFactory>(source_factory, colorDeconvolution_kernel);
+        m_colorDeconvolution_kernel = colorDeconvolution_kernel;
+
+        //Without lookup tables, stain separation runs in two stages: the stain quantities are computed
+        //and cached once, and the threshold and output type only change how they are mapped to the output
+        auto quantityMap = (m_useLookupTable == true) ? nullptr : std::make_shared<const StainQuantityMap>(deconvolutionPlan);
+        const bool twoStage = (nullptr != quantityMap) && quantityMap->IsValid();
+        //The cache budget is in bytes: each cache holds as many tiles as fit in its share,
+        //half of the budget each if the quantities are cached too
+        const int outputBytesPerPixel = deconvolutionPlan->GetGrayscaleQuantityOnly() ? 1 : 4;
+        const double outputShare = twoStage ? 0.5 : 1.0;
+        std::shared_ptr<Factory> non_cached_factory;
+        if (twoStage) {
+            //Keep the cached quantities unless the matrix, the displayed stain or the tile size changed,
+            //even if a quantity stage input (such as the profile selection) was touched
+            if ((nullptr == m_stainQuantity_factory) || (nullptr == m_stainQuantityPlan) || tileSizeChanged
+                || !m_stainQuantityPlan->HasSameQuantitiesAs(*deconvolutionPlan)) {
+                auto quantity_factory = std::make_shared<FilterFactory>(source_factory,
+                    std::make_shared<image::tile::StainQuantity>(deconvolutionPlan, m_tileCacheBudget));
+                const int quantityTiles = m_tileCacheBudget->GetTileCount(1.0 - outputShare, 2);
+                m_stainQuantity_factory = std::make_shared<Cache>(quantity_factory, RecentCachePolicy(quantityTiles));
+                m_stainQuantityPlan = deconvolutionPlan;
+                m_stageBuildCount[QUANTITY_STAGE]++;
+            }
+            else if (firstStage == QUANTITY_STAGE) {
+                m_stageRetainCount[QUANTITY_STAGE]++;
+            }
+            non_cached_factory = std::make_shared<FilterFactory>(m_stainQuantity_factory,
+                std::make_shared<image::tile::StainQuantityMapping>(quantityMap));
+            m_stainQuantityMap = quantityMap;
+        }
+        else {
+            //Release the cached quantities when they are not used
+            m_stainQuantity_factory.reset();
+            m_stainQuantityPlan.reset();
+            m_stainQuantityMap.reset();
+            // Create a Factory for the composition of these Kernels
+            non_cached_factory = std::make_shared<FilterFactory>(source_factory, colorDeconvolution_kernel);
+            //The single-stage kernel (lookup table or single-stain) is the quantity stage, and was just recreated
+            if (firstStage == QUANTITY_STAGE) {
+                m_stageBuildCount[QUANTITY_STAGE]++;
+            }
+        }
 
         // Wrap resulting Factory in a Cache for speedy results
-        m_colorDeconvolution_factory =
-            std::make_shared<Cache>(non_cached_factory, RecentCachePolicy(30));
-
-        pipeline_changed = true;
-    }//end if parameter values changed
+        const int outputTiles = m_tileCacheBudget->GetTileCount(outputShare, outputBytesPerPixel);
+        m_stainOutput_factory = std::make_shared<Cache>(non_cached_factory, RecentCachePolicy(outputTiles));
+        m_cacheTileSize = tileSize;
+        m_stageBuildCount[OUTPUT_STAGE]++;
+    }//end if pixel values changed
 
     // Constrain processing to the region of interest provided, if set
     std::shared_ptr<GraphicItemBase> region = m_regionToProcess;
-    if (pipeline_changed && (nullptr != region)) {
-        // Constrain the output of the pipeline to the region of interest provided
-        auto constrained_factory = std::make_shared<RegionFactory>(m_colorDeconvolution_factory, region->graphic());
-
-        // Wrap resulting Factory in a Cache for speedy results
-        m_colorDeconvolution_factory = std::make_shared<Cache>(constrained_factory, RecentCachePolicy(30));
+    if (nullptr != region) {
+        // Constrain the output of the pipeline to the region of interest provided.
+        // Clearing pixels outside the region is cheap, so the output is not cached a second time.
+        m_colorDeconvolution_factory = std::make_shared<RegionFactory>(m_stainOutput_factory, region->graphic());
     }
+    else {
+        m_colorDeconvolution_factory = m_stainOutput_factory;
+    }
+    m_stageBuildCount[REGION_STAGE]++;
 
-    return pipeline_changed;
+    return true;
 }//end buildPipeline
 
 ///Define the open file dialog options outside of init
@@ -474,6 +889,28 @@ sedeen::file::FileDialogOptions StainAnalysis::defineSaveFileDialogOptions() {
     return theOptions;
 }//end defineSaveFileDialogOptions
 
+///Define the save file dialog options of an estimated stain profile outside of init
+sedeen::file::FileDialogOptions StainAnalysis::defineProfileSaveFileDialogOptions() {
+    sedeen::file::FileDialogOptions theOptions;
+    theOptions.caption = "Save estimated stain vector profile as...";
+    sedeen::file::FileDialogFilter theDialogFilter;
+    theDialogFilter.name = "Stain Vector Profile (*.xml)";
+    theDialogFilter.extensions.push_back("xml");
+    theOptions.filters.push_back(theDialogFilter);
+    return theOptions;
+}//end defineProfileSaveFileDialogOptions
+
+///Define the open file dialog options of a region list outside of init
+sedeen::file::FileDialogOptions StainAnalysis::defineRegionFileDialogOptions(const std::string &caption) {
+    sedeen::file::FileDialogOptions theOptions;
+    theOptions.caption = caption;
+    sedeen::file::FileDialogFilter theDialogFilter;
+    theDialogFilter.name = "Region List (*.csv)";
+    theDialogFilter.extensions.push_back("csv");
+    theOptions.filters.push_back(theDialogFilter);
+    return theOptions;
+}//end defineRegionFileDialogOptions
+
 ///Access the member file dialog parameter, load into member stain profile
 bool StainAnalysis::LoadStainProfileFromFileDialog() {
     //Get the full path file name from the file dialog parameter
@@ -504,6 +941,27 @@ bool StainAnalysis::LoadStainProfileFromFileDialog() {
     return false;
 }//end LoadStainProfileFromFileDialog
 
+std::shared_ptr<const RegionList> StainAnalysis::LoadRegionListFromFileDialog(OpenFileDialogParameter &fileParameter, std::string &errorMessage) {
+    errorMessage.clear();
+    sedeen::algorithm::parameter::OpenFileDialog::DataType fileDialogDataType = fileParameter;
+    if (fileDialogDataType.empty()) {
+        return nullptr;
+    }
+    const std::string theFile = fileDialogDataType.at(0).getFilename();
+    if (!StainProfile::checkFile(theFile, "r")) {
+        errorMessage = "the file does not exist or cannot be read.";
+        return nullptr;
+    }
+    auto regionList = std::make_shared<const RegionList>(theFile);
+    if (!regionList->IsValid()) {
+        errorMessage = (regionList->GetErrorLine() > 0)
+            ? ("line " + std::to_string(regionList->GetErrorLine()) + " is not a label followed by the x and y of two or more vertices.")
+            : "the file could not be opened.";
+        return nullptr;
+    }
+    return regionList;
+}//end LoadRegionListFromFileDialog
+
 double StainAnalysis::EstimateOutputImageSize() {
     //Has a region of interest been set?
     bool roiSet = m_regionToProcess.isUserDefined();
@@ -560,10 +1018,8 @@ bool StainAnalysis::SaveFlatImageToFile(const std::string &p) {
     //Supported extensions are : .tif, .png, .bmp, .gif, .jpg
     std::string outFilePath = p;
     bool imageSaved = false;
-    //Access the output from the output factory
-    auto outputFactory = m_colorDeconvolution_factory;
-    auto compositor = std::make_unique<image::tile::Compositor>(outputFactory);
     sedeen::image::RawImage outputImage;
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
 
     //Has a region of interest been set?
     bool roiSet = m_regionToProcess.isUserDefined();
@@ -571,13 +1027,24 @@ bool StainAnalysis::SaveFlatImageToFile(const std::string &p) {
     //If a region of interest has been set, constrain output to that area
     if (roiSet && theRegion != nullptr) {
         Rect rect = containingRect(theRegion->graphic());
-        //If an ROI is set, output the highest resolution (level 0)
-        outputImage = compositor->getImage(0, rect);
+        //If an ROI is set, output the highest resolution (level 0), bypassing the display caches
+        if (nullptr != tissueMask) {
+            //Only the chunks with tissue are separated
+            outputImage = compositeTissue(createScanFactory(), rect, *tissueMask);
+        }
+        else {
+            auto compositor = std::make_unique<image::tile::Compositor>(createScanFactory());
+            outputImage = compositor->getImage(0, rect);
+        }
     }
     else { 
-        //No region of interest set. Constrain to display area
+        //No region of interest set. Constrain to display area, whose tiles are likely to be cached
+        auto compositor = std::make_unique<image::tile::Compositor>(m_colorDeconvolution_factory);
         DisplayRegion region = m_displayArea;
         outputImage = compositor->getImage(region.source_region, region.output_size);
+        if (nullptr != tissueMask) {
+            clearGlass(*tissueMask, region.source_region, outputImage);
+        }
     }
     //Save the outputImage to a file at the given location
     imageSaved = outputImage.save(outFilePath);
@@ -585,6 +1052,586 @@ bool StainAnalysis::SaveFlatImageToFile(const std::string &p) {
     return imageSaved; 
 }//end SaveFlatImageToFile
 
+bool StainAnalysis::SaveWholeSlideImageToFile(const std::string &p) {
+    //Every tile is read once, so the display caches are bypassed
+    auto outputFactory = createScanFactory();
+    if (nullptr == outputFactory) {
+        return false;
+    }
+    //Save the bounding rectangle of the region of interest, or the full slide, at the highest resolution (level 0)
+    Rect rect(Point(0, 0), getDimensions(image(), 0));
+    bool roiSet = m_regionToProcess.isUserDefined();
+    std::shared_ptr<GraphicItemBase> theRegion = m_regionToProcess;
+    if (roiSet && theRegion != nullptr) {
+        rect = containingRect(theRegion->graphic());
+    }
+    //Grayscale quantity images are written with one channel, stain colour images as RGB
+    const int channels = (outputFactory->getColorSpace().channelCount() > 1) ? 3 : 1;
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+
+    //Tiles are requested from several threads; each composites its tile with its own Compositor
+    auto tileSource = [&](int x, int y, int width, int height, unsigned char *dst, int rowStride) -> bool {
+        if (askedToStop()) {
+            return false;
+        }
+        const Rect tileRect(Point(rect.x() + x, rect.y() + y), Size(width, height));
+        //Tiles of glass are written as zeros without separating them
+        if ((nullptr != tissueMask) && !tissueMask->IntersectsTissue(tileRect.x(), tileRect.y(), width, height)) {
+            clearGlass(*tissueMask, tileRect, channels, dst, rowStride);
+            return true;
+        }
+        image::tile::Compositor compositor(outputFactory);
+        image::RawImage tile = compositor.getImage(0, tileRect);
+        if (!copyTileToBuffer(tile, nullptr, width, height, channels, dst, rowStride)) {
+            return false;
+        }
+        if (nullptr != tissueMask) {
+            clearGlass(*tissueMask, tileRect, channels, dst, rowStride);
+        }
+        return true;
+    };
+
+    TiledTIFFWriter writer(rect.width(), rect.height(), channels);
+    return writer.Write(p, tileSource);
+}//end SaveWholeSlideImageToFile
+
+bool StainAnalysis::SaveAllStainsToFlatFiles(const std::vector<std::string> &paths) {
+    if ((nullptr == m_colorDeconvolution_kernel) || paths.empty()) {
+        return false;
+    }
+    //Composite the source once, with the same region and size as SaveFlatImageToFile
+    auto sourceCompositor = std::make_unique<image::tile::Compositor>(image()->getFactory());
+    std::shared_ptr<image::tile::Factory> maskFactory = createRegionMaskFactory();
+    image::RawImage sourceImage, maskImage;
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+    Rect sourceRect;
+    bool roiSet = m_regionToProcess.isUserDefined();
+    std::shared_ptr<GraphicItemBase> theRegion = m_regionToProcess;
+    if (roiSet && theRegion != nullptr) {
+        Rect rect = containingRect(theRegion->graphic());
+        sourceRect = rect;
+        sourceImage = sourceCompositor->getImage(0, rect);
+        if (nullptr != maskFactory) {
+            maskImage = image::tile::Compositor(maskFactory).getImage(0, rect);
+        }
+    }
+    else {
+        DisplayRegion region = m_displayArea;
+        sourceRect = region.source_region;
+        sourceImage = sourceCompositor->getImage(region.source_region, region.output_size);
+    }
+
+    //Separate every stain in one pass over the source pixels, each as the display would show it
+    std::vector<image::RawImage> stainImages = separateAllStains(sourceImage, createAllStainsRowFunctions());
+    if (stainImages.size() < paths.size()) {
+        return false;
+    }
+    bool imagesSaved = true;
+    for (size_t i = 0; i < paths.size(); i++) {
+        image::RawImage &stainImage = stainImages.at(i);
+        //Clear the pixels outside the region of interest, as the RegionFactory does in the display pipeline
+        if ((nullptr != maskFactory) && (maskImage.width() >= stainImage.width()) && (maskImage.height() >= stainImage.height())) {
+            const int channelCount = stainImage.colorSpace().channelCount();
+            for (int y = 0; y < stainImage.height(); y++) {
+                for (int x = 0; x < stainImage.width(); x++) {
+                    if (maskImage.at(x, y, 0).as<int>() == 0) {
+                        for (int c = 0; c < channelCount; c++) {
+                            stainImage.setValue(x, y, c, 0);
+                        }
+                    }
+                }
+            }
+        }
+        if (nullptr != tissueMask) {
+            clearGlass(*tissueMask, sourceRect, stainImage);
+        }
+        imagesSaved = stainImage.save(paths.at(i)) && imagesSaved;
+    }
+    return imagesSaved;
+}//end SaveAllStainsToFlatFiles
+
+bool StainAnalysis::SaveAllStainsToWholeSlideFiles(const std::vector<std::string> &paths) {
+    if ((nullptr == m_colorDeconvolution_kernel) || paths.empty()) {
+        return false;
+    }
+    auto sourceFactory = image()->getFactory();
+    std::shared_ptr<image::tile::Factory> maskFactory = createRegionMaskFactory();
+    //Save the bounding rectangle of the region of interest, or the full slide, at the highest resolution (level 0)
+    Rect rect(Point(0, 0), getDimensions(image(), 0));
+    bool roiSet = m_regionToProcess.isUserDefined();
+    std::shared_ptr<GraphicItemBase> theRegion = m_regionToProcess;
+    if (roiSet && theRegion != nullptr) {
+        rect = containingRect(theRegion->graphic());
+    }
+    std::shared_ptr<const DeconvolutionPlan> plan = m_colorDeconvolution_kernel->GetPlan();
+    if (nullptr == plan) {
+        return false;
+    }
+    //Grayscale quantity images are written with one channel, stain colour images as RGB
+    const int channels = plan->GetGrayscaleQuantityOnly() ? 1 : 3;
+    const size_t numFiles = paths.size();
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+    //Each stain is separated as the display would show it; the tables are built once for all tiles
+    const std::vector<StainRowFunction> rowFunctions = createAllStainsRowFunctions();
+
+    //Each source tile is composited and separated once, and gives one tile of every file
+    auto tileSource = [&](int x, int y, int width, int height, unsigned char *const *dst, int rowStride) -> bool {
+        if (askedToStop()) {
+            return false;
+        }
+        const Rect tileRect(Point(rect.x() + x, rect.y() + y), Size(width, height));
+        //Tiles of glass are written as zeros without separating them
+        if ((nullptr != tissueMask) && !tissueMask->IntersectsTissue(tileRect.x(), tileRect.y(), width, height)) {
+            for (size_t i = 0; i < numFiles; i++) {
+                clearGlass(*tissueMask, tileRect, channels, dst[i], rowStride);
+            }
+            return true;
+        }
+        image::RawImage sourceTile = image::tile::Compositor(sourceFactory).getImage(0, tileRect);
+        image::RawImage maskTile;
+        if (nullptr != maskFactory) {
+            maskTile = image::tile::Compositor(maskFactory).getImage(0, tileRect);
+        }
+        std::vector<image::RawImage> stainTiles = separateAllStains(sourceTile, rowFunctions);
+        if (stainTiles.size() < numFiles) {
+            return false;
+        }
+        for (size_t i = 0; i < numFiles; i++) {
+            if (!copyTileToBuffer(stainTiles.at(i), (nullptr != maskFactory) ? &maskTile : nullptr, 
+                width, height, channels, dst[i], rowStride)) {
+                return false;
+            }
+            if (nullptr != tissueMask) {
+                clearGlass(*tissueMask, tileRect, channels, dst[i], rowStride);
+            }
+        }
+        return true;
+    };
+
+    TiledTIFFWriter writer(rect.width(), rect.height(), channels);
+    return writer.Write(paths, tileSource);
+}//end SaveAllStainsToWholeSlideFiles
+
+std::string StainAnalysis::estimateStainProfile(std::shared_ptr<StainProfile> theProfile) {
+    using namespace image::tile;
+    //Nothing is saved unless this estimate succeeds
+    m_estimatedProfile.reset();
+    m_estimatedCSVRow.clear();
+    if (m_estimateStainVectors == EstimateRegions) {
+        return estimateStainProfileFromRegions(theProfile);
+    }
+    //Sampling parameters from the chosen profile, where it has them
+    long long numPixels = (nullptr != theProfile) ? theProfile->GetSeparationAlgorithmNumPixelsParameter() : -1;
+    numPixels = (numPixels > 0) ? numPixels : ODSampleReservoir::DefaultCapacity;
+    double odThreshold = (nullptr != theProfile) ? theProfile->GetSeparationAlgorithmThresholdParameter() : -1.0;
+    odThreshold = (odThreshold >= 0.0) ? odThreshold : ODSampleReservoir::DefaultODThreshold;
+    double percentile = (nullptr != theProfile) ? theProfile->GetSeparationAlgorithmPercentileParameter() : -1.0;
+    percentile = (percentile >= 0.0) ? percentile : MacenkoEstimator::DefaultPercentile;
+    double sparsity = (nullptr != theProfile) ? theProfile->GetSeparationAlgorithmSparsityParameter() : -1.0;
+    sparsity = (sparsity >= 0.0) ? sparsity : NMFEstimator::DefaultSparsity;
+    int iterations = (nullptr != theProfile) ? theProfile->GetSeparationAlgorithmIterationsParameter() : -1;
+    iterations = (iterations > 0) ? iterations : NMFEstimator::DefaultMaxIterations;
+
+    //The bounding rectangle of the region of interest, or the whole slide
+    auto fullDimensions = getDimensions(image(), 0);
+    Rect rect(Point(0, 0), fullDimensions);
+    std::shared_ptr<GraphicItemBase> roi = m_regionToProcess;
+    if (m_regionToProcess.isUserDefined() && (nullptr != roi)) {
+        rect = containingRect(roi->graphic());
+    }
+    //The coarsest level with enough pixels in the region that the sample is not most of them
+    int level = 0;
+    for (int l = getNumResolutionLevels(image()) - 1; l >= 0; l--) {
+        auto levelDimensions = getDimensions(image(), l);
+        const double levelPixels = static_cast<double>(rect.width()) * rect.height()
+            * levelDimensions.width() / fullDimensions.width() * levelDimensions.height() / fullDimensions.height();
+        if (levelPixels >= static_cast<double>(EstimationPixelsPerSample) * numPixels) {
+            level = l;
+            break;
+        }
+    }
+    auto levelDimensions = getDimensions(image(), level);
+    int downsample = (levelDimensions.width() > 0) ? (fullDimensions.width() / levelDimensions.width()) : 1;
+    downsample = (downsample < 1) ? 1 : downsample;
+
+    //Each thread samples its own chunks; the samples merge to the same pixels for any number of threads
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+    TiledRegionScan scan(image()->getFactory(), createRegionMaskFactory(), tissueMask);
+    ODSampleReservoir sample = scan.Scan(rect, level, 512 * downsample, ODSampleReservoir(numPixels, odThreshold));
+
+    std::ostringstream ss;
+    auto estimatedProfile = std::make_shared<StainProfile>();
+    bool estimated = false;
+    if (m_estimateStainVectors == EstimateNMF) {
+        ss << std::endl << "Stain vectors estimated by sparse non-negative matrix factorization" << std::endl;
+        //The stains of the chosen profile are refined, and keep their names and order
+        const int numStains = (nullptr != theProfile) ? theProfile->GetNumberOfStainComponents() : 0;
+        double profileVectors[9] = { 0.0 };
+        std::vector<std::array<double, 3>> initialVectors;
+        std::vector<std::string> stainNames;
+        if ((numStains >= 2) && (numStains <= 3) && theProfile->GetNormalizedProfilesAsDoubleArray(profileVectors)) {
+            const std::string profileNames[3] = { theProfile->GetNameOfStainOne(), 
+                theProfile->GetNameOfStainTwo(), theProfile->GetNameOfStainThree() };
+            for (int k = 0; k < numStains; k++) {
+                initialVectors.push_back({ profileVectors[3 * k], profileVectors[3 * k + 1], profileVectors[3 * k + 2] });
+                stainNames.push_back(profileNames[k]);
+            }
+        }
+        if (initialVectors.empty()) {
+            ss << "The chosen stain profile must have two or three stains to start from." << std::endl;
+            return ss.str();
+        }
+        NMFEstimator estimator(sample, initialVectors, sparsity, iterations);
+        estimated = estimator.WriteToProfile(*estimatedProfile, "NMF estimate", stainNames);
+        ss << "(" << estimator.GetIterations() << " iterations, " << (estimator.HasConverged() ? "converged" : "stopped before converging")
+            << ", sparsity " << estimator.GetSparsity() << ", starting from the chosen profile)" << std::endl;
+    }
+    else {
+        ss << std::endl << "Stain vectors estimated by Macenko decomposition" << std::endl;
+        MacenkoEstimator estimator(sample, percentile);
+        estimated = estimator.WriteToProfile(*estimatedProfile, "Macenko estimate");
+        if (estimated) {
+            ss << "(" << static_cast<int>(std::round(estimator.GetAngleBetweenStains() * 180.0 / std::acos(-1.0))) 
+                << " degrees between the stains, from the " << estimator.GetPercentile() << " and " 
+                << (100.0 - estimator.GetPercentile()) << " percentile directions)" << std::endl;
+        }
+    }
+    ss << "(" << sample.GetNumberOfSamples() << " pixels sampled from " << sample.GetCandidateCount() 
+        << " with OD sum of at least " << odThreshold << ", of " << sample.GetPixelCount() 
+        << ((nullptr != tissueMask) ? " tissue" : "") << " pixels read at resolution level " << level << ")" << std::endl;
+    if (!estimated) {
+        ss << "Too few pixels are above the OD threshold to estimate the stain vectors. Choose a larger region, or a profile with a lower threshold." << std::endl;
+        return ss.str();
+    }
+    reportEstimatedProfile(*estimatedProfile, "", ss);
+    m_estimatedProfile = estimatedProfile;
+    return ss.str();
+}//end estimateStainProfile
+
+std::string StainAnalysis::estimateStainProfileFromRegions(std::shared_ptr<StainProfile> theProfile) {
+    using namespace image::tile;
+    std::ostringstream ss;
+    ss << std::endl << "Stain vectors measured in the Stain ROIs (Region-of-Interest Selection)" << std::endl;
+    const int profileStains = (nullptr != theProfile) ? theProfile->GetNumberOfStainComponents() : 0;
+    if ((nullptr == m_stainRegionList) || (profileStains < 2)) {
+        ss << "Choose a Stain ROI File listing regions of each stain of the chosen profile." << std::endl;
+        return ss.str();
+    }
+    //The stain of each region, from its label: the number or the name of the stain in the profile
+    const std::string stainNames[3] = { theProfile->GetNameOfStainOne(), 
+        theProfile->GetNameOfStainTwo(), theProfile->GetNameOfStainThree() };
+    auto lowerCase = [](std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    };
+    std::vector<int> regionStain;
+    int regionsOfStain[3] = { 0, 0, 0 };
+    for (int r = 0; r < m_stainRegionList->GetNumberOfRegions(); r++) {
+        const std::string label = lowerCase(m_stainRegionList->GetRegion(r).label);
+        int stain = -1;
+        for (int s = 0; s < profileStains; s++) {
+            if ((label == std::to_string(s + 1)) || (!stainNames[s].empty() && (label == lowerCase(stainNames[s])))) {
+                stain = s;
+                break;
+            }
+        }
+        if (stain < 0) {
+            ss << "The label \"" << m_stainRegionList->GetRegion(r).label << "\" of Stain ROI " << (r + 1) 
+                << " is not the number or name of a stain of the chosen profile." << std::endl;
+            return ss.str();
+        }
+        regionStain.push_back(stain);
+        regionsOfStain[stain]++;
+    }
+    const int numStains = (regionsOfStain[2] > 0) ? 3 : 2;
+    if ((regionsOfStain[0] == 0) || (regionsOfStain[1] == 0)) {
+        ss << "Choose a Stain ROI File listing regions of each stain of the chosen profile: stains 1 and 2, and stain 3 for a three-stain profile." << std::endl;
+        return ss.str();
+    }
+    long long numPixels = theProfile->GetSeparationAlgorithmNumPixelsParameter();
+    numPixels = (numPixels > 0) ? numPixels : ODSampleReservoir::DefaultCapacity;
+    double odThreshold = theProfile->GetSeparationAlgorithmThresholdParameter();
+    odThreshold = (odThreshold >= 0.0) ? odThreshold : ODSampleReservoir::DefaultODThreshold;
+
+    //All the regions of all the stains are read in one pass, at full resolution; chunks no region overlaps are not read
+    RegionBatchPlan batchPlan(m_stainRegionList->GetBoundingBoxes(), 512);
+    std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+    TiledRegionScan scan(image()->getFactory(), nullptr, tissueMask);
+    std::vector<ODSampleReservoir> regionSamples = scan.ScanRegions(batchPlan, *m_stainRegionList, 0, ODSampleReservoir(numPixels, odThreshold));
+
+    //The sample of a stain is taken from the pixels of all its regions
+    std::vector<ODSampleReservoir> stainSamples(numStains, ODSampleReservoir(numPixels, odThreshold));
+    for (size_t r = 0; r < regionSamples.size(); r++) {
+        stainSamples.at(regionStain.at(r)).Merge(regionSamples[r]);
+    }
+    RegionStainEstimator estimator(stainSamples);
+    auto estimatedProfile = std::make_shared<StainProfile>();
+    const bool estimated = estimator.WriteToProfile(*estimatedProfile, "ROI estimate", 
+        std::vector<std::string>(stainNames, stainNames + 3));
+
+    ss << "(" << batchPlan.GetNumberOfRegions() << " regions read from " << batchPlan.GetChunks().size() 
+        << " chunks at full resolution; the " << static_cast<int>(std::round(100.0 * estimator.GetTrimFraction()))
+        << "% of pixels farthest from each stain's mean direction are left out)" << std::endl;
+    for (int s = 0; s < numStains; s++) {
+        ss << "(" << stainSamples[s].GetNumberOfSamples() << " pixels of stain " << (s + 1) << " sampled from " 
+            << stainSamples[s].GetCandidateCount() << " with OD sum of at least " << odThreshold << ", of " 
+            << stainSamples[s].GetPixelCount() << ((nullptr != tissueMask) ? " tissue" : "") << " pixels)" << std::endl;
+    }
+    if (!estimated) {
+        ss << "Too few pixels of a stain are above the OD threshold to measure its vector. Choose larger regions, or a profile with a lower threshold." << std::endl;
+        return ss.str();
+    }
+    reportEstimatedProfile(*estimatedProfile, estimator.GetCSVRow(), ss);
+    m_estimatedProfile = estimatedProfile;
+    m_estimatedCSVRow = estimator.GetCSVRow();
+    return ss.str();
+}//end estimateStainProfileFromRegions
+
+void StainAnalysis::reportEstimatedProfile(StainProfile &estimatedProfile, const std::string &csvRow, std::ostream &report) const {
+    const std::string stainNames[3] = { estimatedProfile.GetNameOfStainOne(), 
+        estimatedProfile.GetNameOfStainTwo(), estimatedProfile.GetNameOfStainThree() };
+    const std::array<double, 3> stainVectors[3] = { estimatedProfile.GetStainOneRGB(), 
+        estimatedProfile.GetStainTwoRGB(), estimatedProfile.GetStainThreeRGB() };
+    report << std::fixed << std::setprecision(3);
+    for (int s = 0; s < estimatedProfile.GetNumberOfStainComponents(); s++) {
+        report << std::left << std::setw(14) << stainNames[s] << "R: " << stainVectors[s][0] 
+            << ", G: " << stainVectors[s][1] << ", B: " << stainVectors[s][2] << std::endl;
+    }
+    if (!csvRow.empty()) {
+        report << csvRow << std::endl;
+    }
+}//end reportEstimatedProfile
+
+std::string StainAnalysis::saveEstimatedProfile() {
+    //There is nothing to save if the last estimate failed
+    if (nullptr == m_estimatedProfile) {
+        return "";
+    }
+    std::ostringstream report;
+    //Save the profile, if a file has been chosen
+    sedeen::algorithm::parameter::SaveFileDialog::DataType fileDialogDataType = this->m_saveEstimatedProfileAs;
+    const std::string profilePath = fileDialogDataType.getFilename();
+    if (profilePath.empty()) {
+        report << "Choose a file in Save Estimated Profile As... to save these vectors as a stain profile." << std::endl;
+        return report.str();
+    }
+    if (StainProfile::checkFile(profilePath, "w") && m_estimatedProfile->writeStainProfile(profilePath)) {
+        report << "Estimated stain profile saved as " << profilePath << std::endl;
+    }
+    else {
+        report << "Saving the estimated stain profile failed. Please check the file name and directory permissions." << std::endl;
+        return report.str();
+    }
+    if (!m_estimatedCSVRow.empty()) {
+        //The row is saved next to the profile, in a file of its own, so no other stains file is overwritten
+        const std::filesystem::path csvPath = std::filesystem::path(profilePath).replace_extension(".csv");
+        std::ofstream csvFile(csvPath.string(), std::ios::out | std::ios::trunc);
+        csvFile << m_estimatedCSVRow;
+        csvFile.close();
+        if (csvFile.fail()) {
+            report << "Saving the stain vectors to " << csvPath.string() << " failed." << std::endl;
+        }
+        else {
+            report << "Stain vectors saved as a row of " << csvPath.string() << std::endl;
+        }
+    }
+    return report.str();
+}//end saveEstimatedProfile
+
+std::vector<std::string> StainAnalysis::getAllStainsFilePaths(const std::string &p, std::shared_ptr<StainProfile> theProfile) const {
+    namespace fs = std::filesystem; //an alias
+    std::vector<std::string> stainNames;
+    stainNames.push_back(theProfile->GetNameOfStainOne());
+    stainNames.push_back(theProfile->GetNameOfStainTwo());
+    stainNames.push_back(theProfile->GetNameOfStainThree());
+    const int numStains = theProfile->GetNumberOfStainComponents();
+
+    fs::path filePath(p);
+    const fs::path parentPath = filePath.parent_path();
+    const std::string stem = filePath.stem().string();
+    const std::string ext = filePath.extension().string();
+    std::vector<std::string> paths;
+    for (int i = 0; (i < numStains) && (i < 3); i++) {
+        //Use the stain name if it is set, keeping only characters that are safe in a file name
+        std::string suffix;
+        for (auto it = stainNames.at(i).begin(); it != stainNames.at(i).end(); ++it) {
+            suffix.push_back(std::isalnum(static_cast<unsigned char>(*it)) ? (*it) : '_');
+        }
+        if (suffix.empty()) {
+            suffix = "stain" + std::to_string(i + 1);
+        }
+        paths.push_back((parentPath / (stem + "_" + suffix + ext)).string());
+    }
+    return paths;
+}//end getAllStainsFilePaths
+
+std::shared_ptr<image::tile::Factory> StainAnalysis::createRegionMaskFactory() const {
+    if (!m_regionToProcess.isUserDefined()) {
+        return nullptr;
+    }
+    std::shared_ptr<GraphicItemBase> roi = m_regionToProcess;
+    return createRegionMaskFactory(roi);
+}//end createRegionMaskFactory
+
+std::shared_ptr<image::tile::Factory> StainAnalysis::createRegionMaskFactory(std::shared_ptr<GraphicItemBase> roi) const {
+    using namespace image::tile;
+    if (nullptr == roi) {
+        return nullptr;
+    }
+    //Every pixel of the mask kernel output is 255; the RegionFactory clears those outside the region
+    auto unmasked_factory = std::make_shared<FilterFactory>(image()->getFactory(), std::make_shared<RegionMaskKernel>());
+    return std::make_shared<RegionFactory>(unmasked_factory, roi->graphic());
+}//end createRegionMaskFactory
+
+std::shared_ptr<image::tile::Factory> StainAnalysis::createScanFactory() const {
+    using namespace image::tile;
+    if (nullptr == m_colorDeconvolution_kernel) {
+        return nullptr;
+    }
+    //The stages of the display pipeline, without its caches
+    std::shared_ptr<Factory> scan_factory;
+    if ((nullptr != m_stainQuantityMap) && (nullptr != m_stainQuantityPlan)) {
+        auto quantity_factory = std::make_shared<FilterFactory>(image()->getFactory(),
+            std::make_shared<image::tile::StainQuantity>(m_stainQuantityPlan));
+        scan_factory = std::make_shared<FilterFactory>(quantity_factory, 
+            std::make_shared<image::tile::StainQuantityMapping>(m_stainQuantityMap));
+    }
+    else {
+        scan_factory = std::make_shared<FilterFactory>(image()->getFactory(), m_colorDeconvolution_kernel);
+    }
+    std::shared_ptr<GraphicItemBase> region = m_regionToProcess;
+    if (nullptr != region) {
+        scan_factory = std::make_shared<RegionFactory>(scan_factory, region->graphic());
+    }
+    return scan_factory;
+}//end createScanFactory
+
+std::vector<StainAnalysis::StainRowFunction> StainAnalysis::createAllStainsRowFunctions() const {
+    std::vector<StainRowFunction> rowFunctions;
+    std::shared_ptr<const DeconvolutionPlan> plan = (nullptr != m_colorDeconvolution_kernel) 
+        ? m_colorDeconvolution_kernel->GetPlan() : nullptr;
+    if ((nullptr == plan) || !plan->IsValid() || (plan->GetNumberOfStains() < 2)) {
+        return rowFunctions;
+    }
+    std::shared_ptr<const DeconvolutionLUT> displayLUT = m_colorDeconvolution_kernel->GetLUT();
+    const int numStains = plan->GetNumberOfStains();
+    for (int stain = 0; stain < numStains; stain++) {
+        //The plan of the display with this stain selected; the tables of the displayed stain are reused
+        const bool isDisplayed = (stain == plan->GetDisplayStain());
+        auto stainPlan = isDisplayed ? plan : std::make_shared<const DeconvolutionPlan>(plan->GetStainMatrix(), numStains,
+            stain, plan->GetApplyThreshold(), plan->GetThreshold(), plan->GetGrayscaleQuantityOnly());
+        if (nullptr != m_stainQuantityMap) {
+            auto quantityMap = isDisplayed ? m_stainQuantityMap : std::make_shared<const StainQuantityMap>(stainPlan);
+            rowFunctions.push_back([quantityMap](const unsigned char *src, int srcChannels, int width, unsigned char *dst) {
+                quantityMap->SeparateRow(src, srcChannels, width, dst);
+            });
+        }
+        else if (nullptr != displayLUT) {
+            auto lut = isDisplayed ? displayLUT : std::make_shared<const DeconvolutionLUT>(stainPlan);
+            rowFunctions.push_back([lut](const unsigned char *src, int srcChannels, int width, unsigned char *dst) {
+                lut->SeparateRow(src, srcChannels, width, dst);
+            });
+        }
+        else {
+            rowFunctions.push_back([stainPlan](const unsigned char *src, int srcChannels, int width, unsigned char *dst) {
+                stainPlan->SeparateRow(src, srcChannels, width, dst);
+            });
+        }
+    }
+    return rowFunctions;
+}//end createAllStainsRowFunctions
+
+std::vector<image::RawImage> StainAnalysis::separateAllStains(const image::RawImage &source, 
+    const std::vector<StainRowFunction> &rowFunctions) const {
+    std::vector<image::RawImage> outputImages;
+    if (rowFunctions.empty() || (nullptr == m_colorDeconvolution_kernel) || (nullptr == m_colorDeconvolution_kernel->GetPlan())) {
+        return outputImages;
+    }
+    const int width = source.width();
+    const int height = source.height();
+    //The row functions write the plan's output channels: one for grayscale quantities, else RGBA
+    const ColorSpace colorSpace(m_colorDeconvolution_kernel->GetPlan()->GetGrayscaleQuantityOnly() 
+        ? ColorModel::Grayscale : ColorModel::RGBA, ChannelType::UInt8);
+    const int outChannels = colorSpace.channelCount();
+    std::vector<unsigned char*> dst;
+    for (size_t i = 0; i < rowFunctions.size(); i++) {
+        outputImages.push_back(image::RawImage(Size(width, height), colorSpace));
+        dst.push_back(image::rawPixels(outputImages.back()));
+    }
+    //Fast path: contiguous interleaved UInt8 rows; otherwise each row is copied to a UInt8 RGB buffer first
+    const bool contiguous = image::isInterleavedUInt8(source);
+    const int srcChannels = contiguous ? source.colorSpace().channelCount() : 3;
+    std::vector<unsigned char> row(contiguous ? 0 : 3 * width);
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = nullptr;
+        if (contiguous) {
+            src = image::rawPixels(source) + static_cast<size_t>(y) * width * srcChannels;
+        }
+        else {
+            for (int x = 0; x < width; x++) {
+                row[3 * x    ] = static_cast<unsigned char>(source.at(x, y, 0).as<int>());
+                row[3 * x + 1] = static_cast<unsigned char>(source.at(x, y, 1).as<int>());
+                row[3 * x + 2] = static_cast<unsigned char>(source.at(x, y, 2).as<int>());
+            }
+            src = row.data();
+        }
+        for (size_t i = 0; i < rowFunctions.size(); i++) {
+            rowFunctions[i](src, srcChannels, width, dst[i] + static_cast<size_t>(y) * width * outChannels);
+        }
+    }
+    return outputImages;
+}//end separateAllStains
+
+bool StainAnalysis::buildTissueMask() {
+    if (nullptr != m_tissueMask) {
+        return true;
+    }
+    //The coarsest level that is still detailed enough to find small pieces of tissue
+    int level = 0;
+    for (int l = getNumResolutionLevels(image()) - 1; l >= 0; l--) {
+        auto levelDimensions = getDimensions(image(), l);
+        if (std::max(levelDimensions.width(), levelDimensions.height()) >= TissueMaskMinimumSize) {
+            level = l;
+            break;
+        }
+    }
+    auto fullDimensions = getDimensions(image(), 0);
+    image::RawImage lowResolution = image::tile::Compositor(image()->getFactory()).getImage(level, Rect(Point(0, 0), fullDimensions));
+    const int width = lowResolution.width();
+    const int height = lowResolution.height();
+    if ((width < 1) || (height < 1) || (lowResolution.colorSpace().channelCount() < 3)) {
+        return false;
+    }
+
+    //The mask reads interleaved 8-bit RGB(A) pixels
+    const unsigned char *pixels = nullptr;
+    int channels = 3;
+    std::vector<unsigned char> rgbPixels;
+    if (image::isInterleavedUInt8(lowResolution, 3)) {
+        pixels = image::rawPixels(lowResolution);
+        channels = lowResolution.colorSpace().channelCount();
+    }
+    else {
+        rgbPixels.resize(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    rgbPixels[(static_cast<size_t>(y) * width + x) * 3 + c] = static_cast<unsigned char>(lowResolution.at(x, y, c).as<int>());
+                }
+            }
+        }
+        pixels = rgbPixels.data();
+    }
+    m_tissueMask = std::make_shared<const TissueMask>(pixels, width, height, channels,
+        static_cast<double>(fullDimensions.width()) / width, static_cast<double>(fullDimensions.height()) / height);
+    m_tissueMaskLevel = level;
+    return true;
+}//end buildTissueMask
+
+std::shared_ptr<const TissueMask> StainAnalysis::activeTissueMask() const {
+    return (m_restrictToTissue == true) ? m_tissueMask : nullptr;
+}//end activeTissueMask
+
 const std::string StainAnalysis::getExtension(const std::string &p) {
     namespace fs = std::filesystem; //an alias
     const std::string errorVal = std::string(); //empty
@@ -623,10 +1670,44 @@ std::string StainAnalysis::generateCompleteReport(std::shared_ptr<StainProfile>
     std::ostringstream ss;
     ss << generatePixelFractionReport();
     ss << std::endl;
+    if (m_thresholdSweep != 0) {
+        ss << generateThresholdSweepReport(theProfile);
+        ss << std::endl;
+    }
+    if (m_stainStatistics == true) {
+        ss << generateStainStatisticsReport(theProfile);
+        ss << std::endl;
+    }
+    if ((nullptr != m_batchRegionList) && (m_batchRegionList->GetNumberOfRegions() > 0)) {
+        ss << generateRegionBatchReport(theProfile);
+        ss << std::endl;
+    }
     ss << generateStainProfileReport(theProfile);
+    ss << std::endl;
+    ss << generatePipelineReport();
     return ss.str();
 }//end generateCompleteReport
 
+std::string StainAnalysis::generatePipelineReport() const {
+    //How many times each stage of the display pipeline was rebuilt, or kept with its cache
+    const std::string stageNames[NUM_PIPELINE_STAGES] = { "stain quantities", "output", "region" };
+    std::ostringstream ss;
+    ss << "Tile cache budget: " << (m_tileCacheBudget->GetBudgetBytes() / (1024 * 1024)) << " MB, for "
+        << m_cacheTileSize[0] << " x " << m_cacheTileSize[1] << " pixel tiles" << std::endl;
+    if ((nullptr != m_viewportPredictor) && m_viewportPredictor->IsEnabled()) {
+        ss << "Prefetched tiles: " << std::fixed << std::setprecision(1) 
+            << 100.0 * m_viewportPredictor->GetHitRate() << " % of newly shown tiles ("
+            << m_viewportPredictor->GetHitChunkCount() << " / " << m_viewportPredictor->GetRequestedChunkCount() << "), "
+            << 100.0 * m_viewportPredictor->GetAccuracy() << " % of " 
+            << m_viewportPredictor->GetPrefetchedChunkCount() << " prefetched tiles shown" << std::endl;
+    }
+    ss << "Pipeline stages rebuilt / kept:" << std::endl;
+    for (int stage = 0; stage < NUM_PIPELINE_STAGES; stage++) {
+        ss << "  " << stageNames[stage] << ": " << m_stageBuildCount[stage] << " / " << m_stageRetainCount[stage] << std::endl;
+    }
+    return ss.str();
+}//end generatePipelineReport
+
 std::string StainAnalysis::generateStainProfileReport(std::shared_ptr<StainProfile> theProfile) const
 {
     //I think using assert is a little too strong here. Use different error handling.
@@ -733,68 +1814,262 @@ std::string StainAnalysis::generatePixelFractionReport() const {
 
 	using namespace image::tile;
 
-	// Get image from the output factory
-	auto compositor = std::make_unique<Compositor>(m_colorDeconvolution_factory);
+	//With a region of interest, the pipeline output is zero outside the region,
+	//and a mask of the region restricts the total to pixels inside the polygon
+	Rect rect;
+	int level = 0, chunkSize = 1;
+	getCountingRegion(rect, level, chunkSize);
+	std::shared_ptr<Factory> mask_factory = createRegionMaskFactory();
 
-	DisplayRegion region = m_displayArea;
-	auto output_image = compositor->getImage(region.source_region, region.output_size);
-
-    //Check the ColorSpace of output_image to get the number of channels
-    ColorSpace outputColorSpace = output_image.colorSpace();
-    //The values of interest for the channelCount are 1 or 3, force to those options
-    int channelCount = outputColorSpace.channelCount() > 1 ? 3 : 1;
-
-	// Get image from the input factory
-	auto compositorsource = std::make_unique<Compositor>(image()->getFactory());
-	auto input_image = compositorsource->getImage(region.source_region, region.output_size);
-
-	if (m_regionToProcess.isUserDefined()) {
-		std::shared_ptr<GraphicItemBase> roi = m_regionToProcess;
-		auto display_resolution = getDisplayResolution(image(), m_displayArea);
-		Rect rect = containingRect(roi->graphic());
-		output_image = compositor->getImage(rect, region.output_size);
-	}
+	//Restricted to tissue, chunks of glass are skipped and the total is the tissue area
+	std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+	TiledPixelCounter counter(m_colorDeconvolution_factory, mask_factory, tissueMask);
+	TiledPixelCounter::Counts counts = counter.Count(rect, level, chunkSize);
 
-	// Determine number of pixels above threshold
-    //Try to count quickly, taking RGB components into account
-    unsigned int totalNumPixels = output_image.width()*output_image.height();
-    std::vector<unsigned short> pixelSetArray(totalNumPixels,0);
-    int iWidth = output_image.width();
-    int jHeight = output_image.height();
-    int i, j = 0;
-	#pragma omp parallel
-    {
-        #pragma omp for private(i) private(j) //collapse(2) is not available in Visual Studio 2017
-        for (i = 0; i < iWidth; ++i) {
-            for (j = 0; j < jHeight; ++j) {
-                //This relies on implicit conversion from boolean operators to integers 0/1
-                //Use a ternary conditional operator to choose how many channels to consider
-                pixelSetArray[i*jHeight + j] = (channelCount == 1)
-                    ? (false || output_image.at(i, j, 0).as<uint8_t>()) //grayscale output image
-                    : (   output_image.at(i, j, 0).as<uint8_t>()        //RGB+ output image
-                       || output_image.at(i, j, 1).as<uint8_t>()
-                       || output_image.at(i, j, 2).as<uint8_t>() );
-            }
-        }
-    }
-    //Using accumulate means no need for comparison operations to 0/1
-    int numPixels = std::accumulate(pixelSetArray.begin(), pixelSetArray.end(), 0);
-    double coveredFraction = ((double)numPixels) / ((double)totalNumPixels);
+	long long numPixels = counts.covered;
+	long long totalNumPixels = counts.total;
+	double coveredFraction = (totalNumPixels > 0) ? ((double)numPixels) / ((double)totalNumPixels) : 0.0;
 
 	// Calculate results
 	std::ostringstream ss;
 	ss << std::left << std::setfill(' ') << std::setw(20);
     //ss << "The absolute number of covered pixels is: " << numPixels << std::endl;
     //ss << "The absolute number of ROI pixels is: " << totalNumPixels << std::endl;
-    ss << "Percent of processed region covered by" << std::endl; 
+    if (nullptr != tissueMask) {
+        ss << "Percent of tissue in processed region covered by" << std::endl;
+    }
+    else {
+        ss << "Percent of processed region covered by" << std::endl;
+    }
     ss << "stain, above the displayed threshold : ";
 	ss << std::fixed << std::setprecision(3) << coveredFraction*100  << " %" << std::endl;
     //Show the numerator and denominator of the pixel fraction
-    ss << "stained / total pixels: ";
+    ss << ((nullptr != tissueMask) ? "stained / tissue pixels: " : "stained / total pixels: ");
     ss << numPixels << " / " << totalNumPixels << std::endl;
+    if (nullptr != tissueMask) {
+        ss << "Tissue detected on resolution level " << m_tissueMaskLevel << ": " 
+            << std::setprecision(1) << 100.0 * tissueMask->GetTissueFraction() << " % of the slide" << std::endl;
+    }
+    else if (m_restrictToTissue == true) {
+        ss << "Tissue could not be detected; the whole region was processed" << std::endl;
+    }
 
 	return ss.str();
 }//end generatePixelFractionReport
 
+void StainAnalysis::getCountingRegion(Rect &rect, int &level, int &chunkSize) const {
+	//Count at the resolution level shown in the display area
+	DisplayRegion region = m_displayArea;
+	level = getDisplayResolution(image(), m_displayArea);
+	rect = region.source_region;
+	//The bounding rectangle of the region of interest, if one is set
+	std::shared_ptr<GraphicItemBase> roi = m_regionToProcess;
+	if (m_regionToProcess.isUserDefined() && (nullptr != roi)) {
+		rect = containingRect(roi->graphic());
+	}
+
+	//Chunks of about 512x512 pixels at the counted level, each composited and counted by one thread
+	auto fullDimensions = getDimensions(image(), 0);
+	auto levelDimensions = getDimensions(image(), level);
+	int downsample = (levelDimensions.width() > 0) ? (fullDimensions.width() / levelDimensions.width()) : 1;
+	downsample = (downsample < 1) ? 1 : downsample;
+	chunkSize = 512 * downsample;
+}//end getCountingRegion
+
+std::string StainAnalysis::generateThresholdSweepReport(std::shared_ptr<StainProfile> theProfile) const {
+	std::shared_ptr<const DeconvolutionPlan> plan = (nullptr != m_colorDeconvolution_kernel) 
+		? m_colorDeconvolution_kernel->GetPlan() : nullptr;
+	if ((nullptr == plan) || (nullptr == theProfile)) {
+		return "Error accessing the stain separation plan. Cannot generate threshold sweep report.";
+	}
+	using namespace image::tile;
+
+	//One pass over the source pixels of the same region as the pixel fraction report
+	Rect rect;
+	int level = 0, chunkSize = 1;
+	getCountingRegion(rect, level, chunkSize);
+	std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+	TiledRegionScan scan(image()->getFactory(), createRegionMaskFactory(), tissueMask);
+	ThresholdSweep sweep = scan.Scan(rect, level, chunkSize, ThresholdSweep(plan, m_displayThresholdMaxVal));
+	if (!sweep.IsValid()) {
+		return "The stain separation plan is not valid. Cannot generate threshold sweep report.";
+	}
+
+	const std::string stainNames[3] = { theProfile->GetNameOfStainOne(), 
+		theProfile->GetNameOfStainTwo(), theProfile->GetNameOfStainThree() };
+	const int numStains = sweep.GetNumberOfStains();
+	std::vector<double> thresholds;
+	if (m_thresholdSweep == ThresholdSweepCurve) {
+		//Every threshold on the grid, up to the last one with stained pixels
+		int lastBin = 0;
+		for (int s = 0; s < numStains; s++) {
+			const std::vector<long long> &histogram = sweep.GetHistogram(s);
+			for (int k = sweep.GetNumberOfBins(); k > lastBin; k--) {
+				if (histogram[k] > 0) {
+					lastBin = k;
+					break;
+				}
+			}
+		}
+		for (int k = 0; k <= lastBin; k++) {
+			thresholds.push_back(k * sweep.GetBinWidth());
+		}
+	}
+	else {
+		for (int k = 1; k <= 20; k++) {
+			thresholds.push_back(0.05 * k);
+		}
+	}
+
+	std::ostringstream ss;
+	ss << ((nullptr != tissueMask) ? "Percent of tissue in processed region above each OD threshold" 
+		: "Percent of processed region above each OD threshold") << std::endl;
+	ss << "(" << sweep.GetTotalCount() << " pixels counted once for all thresholds)" << std::endl;
+	ss << std::left << std::setw(14) << "OD threshold";
+	for (int s = 0; s < numStains; s++) {
+		ss << std::setw(14) << (stainNames[s].empty() ? ("Stain " + std::to_string(s + 1)) : stainNames[s]);
+	}
+	ss << std::endl;
+	for (auto it = thresholds.begin(); it != thresholds.end(); ++it) {
+		ss << std::fixed << std::setprecision(2) << std::setw(14) << (*it);
+		for (int s = 0; s < numStains; s++) {
+			std::ostringstream cell;
+			cell << std::fixed << std::setprecision(3) << 100.0 * sweep.GetFractionAbove(s, *it) << " %";
+			ss << std::setw(14) << cell.str();
+		}
+		ss << std::endl;
+	}
+	//Thresholds suggested by the shape of each stain's histogram
+	ss << std::setw(14) << "Otsu";
+	for (int s = 0; s < numStains; s++) {
+		ss << std::setw(14) << sweep.GetOtsuThreshold(s);
+	}
+	ss << std::endl << std::setw(14) << "Triangle";
+	for (int s = 0; s < numStains; s++) {
+		ss << std::setw(14) << sweep.GetTriangleThreshold(s);
+	}
+	ss << std::endl;
+	return ss.str();
+}//end generateThresholdSweepReport
+
+std::string StainAnalysis::generateStainStatisticsReport(std::shared_ptr<StainProfile> theProfile) const {
+	std::shared_ptr<const DeconvolutionPlan> plan = (nullptr != m_colorDeconvolution_kernel) 
+		? m_colorDeconvolution_kernel->GetPlan() : nullptr;
+	if ((nullptr == plan) || (nullptr == theProfile)) {
+		return "Error accessing the stain separation plan. Cannot generate stain statistics report.";
+	}
+	using namespace image::tile;
+
+	//One pass over the source pixels of the same region as the pixel fraction report;
+	//the per-thread sums are integers, so the result does not depend on the number of threads
+	Rect rect;
+	int level = 0, chunkSize = 1;
+	getCountingRegion(rect, level, chunkSize);
+	std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+	TiledRegionScan scan(image()->getFactory(), createRegionMaskFactory(), tissueMask);
+	StainStatistics statistics = scan.Scan(rect, level, chunkSize, StainStatistics(plan));
+	if (!statistics.IsValid()) {
+		return "The stain separation plan is not valid. Cannot generate stain statistics report.";
+	}
+
+	const std::string stainNames[3] = { theProfile->GetNameOfStainOne(), 
+		theProfile->GetNameOfStainTwo(), theProfile->GetNameOfStainThree() };
+	const int numStains = statistics.GetNumberOfStains();
+	std::ostringstream ss;
+	ss << ((nullptr != tissueMask) ? "Stain OD statistics of the tissue in processed region" 
+		: "Stain OD statistics of processed region") << " (" << statistics.GetPixelCount() << " pixels)" << std::endl;
+	ss << std::left << std::setw(18) << "";
+	for (int s = 0; s < numStains; s++) {
+		ss << std::setw(14) << (stainNames[s].empty() ? ("Stain " + std::to_string(s + 1)) : stainNames[s]);
+	}
+	ss << std::endl << std::fixed;
+	//One row per statistic, one column per stain
+	auto writeRow = [&](const std::string &label, const int &precision, std::function<double(int)> value) {
+		ss << std::setw(18) << label << std::setprecision(precision);
+		for (int s = 0; s < numStains; s++) {
+			ss << std::setw(14) << value(s);
+		}
+		ss << std::endl;
+	};
+	writeRow("Mean OD", 4, [&](int s) { return statistics.GetMeanOD(s); });
+	writeRow("Integrated OD", 1, [&](int s) { return statistics.GetIntegratedOD(s); });
+	//The percentile parameter of the profile, if it has one, is added with its complement
+	std::vector<double> percentiles = { 5.0, 25.0, 50.0, 75.0, 95.0 };
+	const double profilePercentile = theProfile->GetSeparationAlgorithmPercentileParameter();
+	if ((profilePercentile > 0.0) && (profilePercentile < 50.0)) {
+		percentiles.insert(percentiles.begin(), profilePercentile);
+		percentiles.push_back(100.0 - profilePercentile);
+	}
+	for (size_t p = 0; p < percentiles.size(); p++) {
+		std::ostringstream label;
+		label << "OD percentile " << percentiles[p];
+		writeRow(label.str(), 3, [&](int s) { return statistics.GetPercentile(s, percentiles[p]); });
+	}
+	const std::string intensityNames[StainStatistics::NUM_INTENSITY_CLASSES] = { "% negative", "% weak", "% moderate", "% strong" };
+	for (int i = StainStatistics::NEGATIVE; i < StainStatistics::NUM_INTENSITY_CLASSES; i++) {
+		const StainStatistics::IntensityClass intensity = static_cast<StainStatistics::IntensityClass>(i);
+		writeRow(intensityNames[i], 3, [&](int s) { return statistics.GetIntensityPercent(s, intensity); });
+	}
+	writeRow("H-score", 1, [&](int s) { return statistics.GetHScore(s); });
+	ss << "Intensity classes are OD above " << std::setprecision(2)
+		<< statistics.GetIntensityThreshold(StainStatistics::WEAK) << " (weak), "
+		<< statistics.GetIntensityThreshold(StainStatistics::MODERATE) << " (moderate) and "
+		<< statistics.GetIntensityThreshold(StainStatistics::STRONG) << " (strong)" << std::endl;
+	ss << "Percentiles are within " << std::setprecision(1) << 100.0 * QuantileSketch::GetRelativeError() 
+		<< "% of the exact value (" << std::setprecision(4) << QuantileSketch::MinValue / 2.0 << " OD below " << QuantileSketch::MinValue << " OD)" << std::endl;
+	return ss.str();
+}//end generateStainStatisticsReport
+
+std::string StainAnalysis::generateRegionBatchReport(std::shared_ptr<StainProfile> theProfile) const {
+	std::shared_ptr<const DeconvolutionPlan> plan = (nullptr != m_colorDeconvolution_kernel) 
+		? m_colorDeconvolution_kernel->GetPlan() : nullptr;
+	if ((nullptr == plan) || !plan->IsValid() || (nullptr == theProfile)) {
+		return "Error accessing the stain separation plan. Cannot generate batch region report.";
+	}
+	using namespace image::tile;
+
+	//Measured at the same resolution level as the pixel fraction report
+	Rect displayRect;
+	int level = 0, chunkSize = 1;
+	getCountingRegion(displayRect, level, chunkSize);
+	RegionBatchPlan batchPlan(m_batchRegionList->GetBoundingBoxes(), chunkSize);
+	std::shared_ptr<const TissueMask> tissueMask = activeTissueMask();
+	TiledRegionScan scan(image()->getFactory(), nullptr, tissueMask);
+	std::vector<RegionMeasurements> measurements = scan.ScanRegions(batchPlan, *m_batchRegionList, level, RegionMeasurements(plan));
+
+	const std::string stainNames[3] = { theProfile->GetNameOfStainOne(), 
+		theProfile->GetNameOfStainTwo(), theProfile->GetNameOfStainThree() };
+	const int numStains = plan->GetNumberOfStains();
+	const int displayStain = plan->GetDisplayStain();
+	const double threshold = plan->GetApplyThreshold() ? plan->GetThreshold() : -1.0;
+	auto stainName = [&](int s) { return stainNames[s].empty() ? ("Stain " + std::to_string(s + 1)) : stainNames[s]; };
+
+	std::ostringstream ss;
+	ss << "Batch ROIs: " << batchPlan.GetNumberOfRegions() << " regions measured from " << batchPlan.GetChunks().size() 
+		<< " chunks (" << batchPlan.GetSeparateChunkCount() << " if measured one at a time)" << std::endl;
+	ss << "Percent stained is " << stainName(displayStain) << " above the displayed threshold"
+		<< ((nullptr != tissueMask) ? ", of the tissue in each region" : "") << std::endl;
+	//One row per region, by its label: its pixels, the stained percentage, and the mean OD and H-score of each stain
+	ss << std::left << std::setw(16) << "ROI" << std::setw(22) << "Position (x, y)" << std::setw(12) << "Pixels" << std::setw(12) << "% stained";
+	for (int s = 0; s < numStains; s++) {
+		ss << std::setw(18) << (stainName(s) + " OD") << std::setw(18) << (stainName(s) + " H-score");
+	}
+	ss << std::endl << std::fixed;
+	for (int r = 0; r < batchPlan.GetNumberOfRegions(); r++) {
+		const RegionMeasurements &m = measurements.at(r);
+		const RegionBatchPlan::Box &box = batchPlan.GetRegion(r);
+		const std::string position = "(" + std::to_string(box.x) + ", " + std::to_string(box.y) + ")";
+		const std::string &label = m_batchRegionList->GetRegion(r).label;
+		ss << std::setw(16) << (label.empty() ? std::to_string(r + 1) : label) << std::setw(22) << position << std::setw(12) << m.statistics.GetPixelCount()
+			<< std::setw(12) << std::setprecision(3) << 100.0 * m.sweep.GetFractionAbove(displayStain, threshold);
+		for (int s = 0; s < numStains; s++) {
+			ss << std::setw(18) << std::setprecision(4) << m.statistics.GetMeanOD(s)
+				<< std::setw(18) << std::setprecision(1) << m.statistics.GetHScore(s);
+		}
+		ss << std::endl;
+	}
+	return ss.str();
+}//end generateRegionBatchReport
+
 } // namespace algorithm
 } // namespace sedeen
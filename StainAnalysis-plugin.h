@@ -37,11 +37,26 @@
 #include <Windows.h>
 #include <fstream>
 #include <filesystem> //Requires C++17
+#include <array>
+#include <functional>
 
 //Plugin headers
 #include "StainProfile.h"
 #include "ODThresholdKernel.h"
 #include "ColorDeconvolutionKernel.h"
+#include "StainQuantityKernel.h"
+#include "TiledPixelCounter.h"
+#include "TileCacheBudget.h"
+#include "TilePrefetcher.h"
+#include "TissueMask.h"
+#include "TiledRegionScan.h"
+#include "ThresholdSweep.h"
+#include "StainStatistics.h"
+#include "ODSampleReservoir.h"
+#include "MacenkoEstimator.h"
+#include "NMFEstimator.h"
+#include "RegionStainEstimator.h"
+#include "RegionList.h"
 
 namespace sedeen {
 namespace tile {
@@ -67,7 +82,8 @@ private:
     virtual void init(const image::ImageHandle& image);
     virtual void run();
 
-	/// Creates the Color Deconvolution pipeline with a cache
+	/// Creates the Color Deconvolution pipeline with a cache, rebuilding only
+	/// the stages (see PipelineStage) whose inputs have changed
 	//
 	/// \return 
 	/// TRUE if the pipeline has changed since the call to this function, FALSE
@@ -80,8 +96,17 @@ private:
     ///Define the save file dialog options outside of init
     sedeen::file::FileDialogOptions defineSaveFileDialogOptions();
 
+    ///Define the save file dialog options of an estimated stain profile outside of init
+    sedeen::file::FileDialogOptions defineProfileSaveFileDialogOptions();
+
+    ///Define the open file dialog options of a region list outside of init
+    sedeen::file::FileDialogOptions defineRegionFileDialogOptions(const std::string &caption);
+
     ///Access the member file dialog parameter, if possible load the stain profile, return true on success
     bool LoadStainProfileFromFileDialog();
+    ///Read the region list chosen in a file dialog parameter. Returns nullptr, with an empty
+    ///message if no file is chosen, or with the reason in errorMessage if it cannot be read
+    std::shared_ptr<const RegionList> LoadRegionListFromFileDialog(OpenFileDialogParameter &fileParameter, std::string &errorMessage);
 
     ///Get the expected number of pixels to be saved in an output file.
     double EstimateOutputImageSize();
@@ -90,6 +115,46 @@ private:
 
     ///Save the separated image to a TIF/PNG/BMP/GIF/JPG flat format file
     bool SaveFlatImageToFile(const std::string &p);
+    ///Stream the separated ROI or full slide to a tiled pyramidal BigTIFF file, one tile at a time
+    bool SaveWholeSlideImageToFile(const std::string &p);
+    ///Save every stain of the profile to its own flat image file, separating the source image once
+    bool SaveAllStainsToFlatFiles(const std::vector<std::string> &paths);
+    ///Stream every stain of the profile to its own tiled pyramidal BigTIFF file, separating each source tile once
+    bool SaveAllStainsToWholeSlideFiles(const std::vector<std::string> &paths);
+    ///Estimate stain vectors from a sample of the pixels of the ROI or whole slide, keep them as the
+    ///last estimated profile, and report them
+    std::string estimateStainProfile(std::shared_ptr<StainProfile>);
+    ///Estimate the vector of each stain from the ROIs chosen for it, reading only the tiles they overlap,
+    ///and keep them as the last estimated profile with a row of a stains CSV file
+    std::string estimateStainProfileFromRegions(std::shared_ptr<StainProfile>);
+    ///Add the vectors of an estimated profile, and a non-empty CSV row of them, to a report
+    void reportEstimatedProfile(StainProfile &estimatedProfile, const std::string &csvRow, std::ostream &report) const;
+    ///Save the last estimated profile if a file has been chosen, and its CSV row if it has one,
+    ///to a .csv file of the same name; return a report of what was saved
+    std::string saveEstimatedProfile();
+    ///Insert the name of each stain in the profile before the extension of the given file path
+    std::vector<std::string> getAllStainsFilePaths(const std::string &p, std::shared_ptr<StainProfile>) const;
+
+    ///A factory that is non-zero inside the region of interest and zero outside it, or nullptr if no region is set
+    std::shared_ptr<image::tile::Factory> createRegionMaskFactory() const;
+    ///A factory that is non-zero inside the given region and zero outside it, or nullptr if the region is null
+    std::shared_ptr<image::tile::Factory> createRegionMaskFactory(std::shared_ptr<GraphicItemBase> roi) const;
+    ///An uncached factory with the same kernels, and so the same output, as m_colorDeconvolution_factory, for reading
+    ///large areas once (such as saving at full resolution) without evicting the tiles of the display from the caches
+    std::shared_ptr<image::tile::Factory> createScanFactory() const;
+
+    ///Row separation of one stain: interleaved UInt8 source row, its channel count, width, output row
+    typedef std::function<void(const unsigned char*, int, int, unsigned char*)> StainRowFunction;
+    ///The row separation of each stain of the profile as the display pipeline would show that stain: mapped
+    ///quantities in the two-stage pipeline, otherwise the lookup tables or the plan's row kernel. Empty for a single stain.
+    std::vector<StainRowFunction> createAllStainsRowFunctions() const;
+    ///Separate every stain of a source image with the row functions, one image per stain in the display's colour space
+    std::vector<image::RawImage> separateAllStains(const image::RawImage &source, const std::vector<StainRowFunction> &rowFunctions) const;
+
+    ///Detect the tissue on a low resolution level of the image, once per slide; return false if it cannot be detected
+    bool buildTissueMask();
+    ///The tissue mask if the user chose to restrict processing to tissue and it has been built, or nullptr
+    std::shared_ptr<const TissueMask> activeTissueMask() const;
 
     ///Given a full file path as a string, identify if there is an extension and return it
     const std::string getExtension(const std::string &p);
@@ -105,8 +170,46 @@ private:
     std::string generateParameterMapReport(std::map<std::string, std::string>) const;
     ///Create a text report stating what fraction of the processing area is covered by the filtered output
     std::string generatePixelFractionReport(void) const;
+    ///Create a text report of the fraction of the processing area above each of a list of OD thresholds, for every stain
+    std::string generateThresholdSweepReport(std::shared_ptr<StainProfile>) const;
+    ///Create a text report of the OD statistics and H-score of every stain over the processing area
+    std::string generateStainStatisticsReport(std::shared_ptr<StainProfile>) const;
+    ///Create a text table of the stained fraction and statistics of each of the batch regions, measured in one traversal
+    std::string generateRegionBatchReport(std::shared_ptr<StainProfile>) const;
+    ///The rectangle (full resolution coordinates), resolution level and chunk size at which pixels are counted
+    void getCountingRegion(Rect &rect, int &level, int &chunkSize) const;
+    ///Create a text report of how many times each pipeline stage was rebuilt or kept
+    std::string generatePipelineReport(void) const;
+
+public:
+    ///Stages of the display pipeline, in order. Each stage is cached, and rebuilding
+    ///a stage rebuilds every stage after it.
+    enum PipelineStage {
+        QUANTITY_STAGE, //stain quantities (or the lookup table kernel) from the source image
+        OUTPUT_STAGE,   //thresholded RGBA or grayscale output
+        REGION_STAGE,   //output constrained to the region of interest (not cached)
+        NUM_PIPELINE_STAGES
+    };
+    ///Number of times a pipeline stage has been built
+    inline long long GetStageBuildCount(const PipelineStage &stage) const { return m_stageBuildCount.at(stage); }
+    ///Number of times a pipeline stage and its cache have been kept when the pipeline was updated
+    inline long long GetStageRetainCount(const PipelineStage &stage) const { return m_stageRetainCount.at(stage); }
 
 private:
+    ///Index of the whole slide image option in the save file format list
+    static const int SaveFormatWholeSlide = 1;
+    ///Indices of the threshold sweep options
+    static const int ThresholdSweepList = 1;
+    static const int ThresholdSweepCurve = 2;
+    ///Long side in pixels of the coarsest resolution level the tissue mask is built from, at least
+    static const int TissueMaskMinimumSize = 1024;
+    ///Indices of the options in the stain vector estimation list
+    static const int EstimateMacenko = 1;
+    static const int EstimateNMF = 2;
+    static const int EstimateRegions = 3;
+    ///Pixels of the region read per sampled pixel, at least, when choosing the level to estimate stain vectors from
+    static const int EstimationPixelsPerSample = 8;
+
     ///Names of the default stain profile files
     inline static const std::string HematoxylinPEosinSampleFilename()     { return "defaultprofiles/HematoxylinPEosinSample.xml"; }
     inline static const std::string HematoxylinPEosinFromRJFilename()     { return "defaultprofiles/HematoxylinPEosinFromRJ.xml"; }
@@ -128,6 +231,7 @@ private:
     OptionParameter m_stainSeparationAlgorithm;
     OptionParameter m_stainVectorProfile;
     GraphicItemParameter m_regionToProcess; //single output region
+    OpenFileDialogParameter m_batchRegionFile; //regions measured together, such as the cores of a tissue microarray
 
     ///Result type is whether to show stain quantity in grayscale, or re-colour with the stain vectors
     OptionParameter m_stainResultType;
@@ -135,21 +239,76 @@ private:
     BoolParameter m_applyDisplayThreshold;
     /// User defined Threshold value.
     algorithm::DoubleParameter m_displayThreshold;
+    ///User choice whether to report the stained fraction for a list of thresholds, or every threshold
+    OptionParameter m_thresholdSweep;
+    ///User choice whether to report the OD statistics of every stain
+    BoolParameter m_stainStatistics;
+    ///User choice whether to precompute the separated output for every RGB colour
+    BoolParameter m_useLookupTable;
+    ///User choice whether to skip the glass when saving images and counting pixels
+    BoolParameter m_restrictToTissue;
 
     ///User choice whether to save the chosen separated image as output
     BoolParameter m_saveSeparatedImage;
     ///Choose what format to write the separated images in
     OptionParameter m_saveFileFormat;
+    ///User choice whether to save every stain of the profile, each to its own file, in one pass
+    BoolParameter m_saveAllStains;
     ///User choice of file name stem and type
     SaveFileDialogParameter m_saveFileAs;
 
+    ///User choice of a method to estimate stain vectors from the image
+    OptionParameter m_estimateStainVectors;
+    ///User choice of the file to save the estimated stain profile to
+    SaveFileDialogParameter m_saveEstimatedProfileAs;
+    ///Regions stained with only one stain of the chosen profile, to estimate that stain's vector from
+    OpenFileDialogParameter m_stainRegionFile;
+
     /// The output result
     ImageResult m_result;			
     TextResult m_outputText;
     std::string m_report;
+    ///The report of the last stain vector estimation, empty when its inputs have changed since
+    std::string m_estimationReport;
+    ///The report of saving the last estimate, empty when the file to save it to has changed since
+    std::string m_estimationSaveReport;
+    ///The last estimated stain profile and its CSV row, kept to save to a new file without estimating again
+    std::shared_ptr<StainProfile> m_estimatedProfile;
+    std::string m_estimatedCSVRow;
 
     /// The image factory after color deconvolution
     std::shared_ptr<image::tile::Factory> m_colorDeconvolution_factory;
+    /// A kernel for the current plan, used directly to separate all stains at once
+    std::shared_ptr<image::tile::ColorDeconvolution> m_colorDeconvolution_kernel;
+    /// Cached quantities of the displayed stain, before the threshold and output type are applied
+    std::shared_ptr<image::tile::Factory> m_stainQuantity_factory;
+    /// The plan m_stainQuantity_factory was built from
+    std::shared_ptr<const DeconvolutionPlan> m_stainQuantityPlan;
+    /// Map of the cached quantities to the output, or nullptr if the display is separated in a single stage
+    std::shared_ptr<const StainQuantityMap> m_stainQuantityMap;
+    /// Cached output of the stain separation, before the region of interest is applied
+    std::shared_ptr<image::tile::Factory> m_stainOutput_factory;
+    /// Number of times each pipeline stage was built, or kept with its cache
+    std::array<long long, NUM_PIPELINE_STAGES> m_stageBuildCount;
+    std::array<long long, NUM_PIPELINE_STAGES> m_stageRetainCount;
+    ///Lookup tables of the current kernel, kept so that they are rebuilt only when the plan changes
+    std::shared_ptr<const DeconvolutionLUT> m_deconvolutionLUT;
+    ///Memory budget of the tile caches, shared by the cached pipeline stages; the kernels report the tile size to it
+    std::shared_ptr<TileCacheBudget> m_tileCacheBudget;
+    ///Tile width and height the caches were sized for
+    std::array<int, 2> m_cacheTileSize;
+    ///Predicts the next viewports from the display area, and counts how many of their tiles were prefetched
+    std::shared_ptr<ViewportPredictor> m_viewportPredictor;
+    ///Computes the predicted tiles in the background, between runs
+    image::tile::TilePrefetcher m_tilePrefetcher;
+    ///Tissue of the current slide, or nullptr if it has not been detected yet
+    std::shared_ptr<const TissueMask> m_tissueMask;
+    ///Resolution level the tissue mask was built from
+    int m_tissueMaskLevel;
+    ///The batch regions, read again when another file is chosen, or nullptr if there is none
+    std::shared_ptr<const RegionList> m_batchRegionList;
+    ///The Stain ROIs, labelled with the stain of each, or nullptr if there is no file
+    std::shared_ptr<const RegionList> m_stainRegionList;
 
     //std::ofstream log_file;
 
@@ -160,6 +319,8 @@ private:
     std::vector<std::string> m_stainVectorProfileOptions;
     std::vector<std::string> m_stainResultTypeOptions;
     std::vector<std::string> m_stainToDisplayOptions;
+    std::vector<std::string> m_thresholdSweepOptions;
+    std::vector<std::string> m_estimateStainVectorsOptions;
     std::vector<std::string> m_saveFileFormatOptions;
     std::vector<std::string> m_saveFileExtensionText;
     const double m_displayThresholdDefaultVal;
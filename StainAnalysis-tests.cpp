@@ -0,0 +1,697 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+///Unit tests of the colour deconvolution core, without the Sedeen SDK.
+///Each test is run by name, e.g. StainAnalysis-tests deconvolution_rows, and returns
+///non-zero on failure; with no name, every test is run.
+
+#include "StainProfile.h"
+#include "StainVectorMath.h"
+#include "SmallMatrix3x3.h"
+#include "DeconvolutionPlan.h"
+#include "StainQuantityMap.h"
+#include "ODConversion.h"
+#include "ColorDeconvolutionSIMD.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/qvm/vec.hpp>
+#include <boost/qvm/mat.hpp>
+#include <boost/qvm/vec_access.hpp>
+#include <boost/qvm/mat_access.hpp>
+#include <boost/qvm/vec_operations.hpp>
+#include <boost/qvm/mat_operations.hpp>
+#include <boost/qvm/vec_mat_operations.hpp>
+#include <boost/qvm/map_mat_mat.hpp>
+
+#include <cmrc/cmrc.hpp>
+CMRC_DECLARE(stain);
+
+namespace {
+    ///Default profiles embedded in the plugin
+    const std::vector<std::string> ProfileFiles = {
+        "defaultprofiles/HematoxylinPEosinFromRJ.xml",
+        "defaultprofiles/HematoxylinPDABFromRJ.xml",
+        "defaultprofiles/HematoxylinPEosinPDABFromRJ.xml",
+        "defaultprofiles/HematoxylinPEosinSample.xml" };
+
+    ///Read a stain profile embedded in the resources; returns nullptr on failure
+    std::shared_ptr<StainProfile> loadEmbeddedProfile(const std::string &path) {
+        auto const fs = cmrc::stain::get_filesystem();
+        if (!fs.is_file(path)) {
+            return nullptr;
+        }
+        auto const file = fs.open(path);
+        auto theProfile = std::make_shared<StainProfile>();
+        return theProfile->readStainProfile(file.begin(), file.size()) ? theProfile : nullptr;
+    }//end loadEmbeddedProfile
+
+    ///A minimal interleaved UInt8 image, with the per-pixel at/setValue accessors of RawImage
+    class ReferenceImage {
+    public:
+        ReferenceImage(int width, int height, int channels) : m_width(width), m_height(height), 
+            m_channels(channels), m_pixels(static_cast<size_t>(width) * height * channels, 0) {}
+        inline int width() const { return m_width; }
+        inline int height() const { return m_height; }
+        inline int channels() const { return m_channels; }
+        inline int at(int x, int y, int c) const { return m_pixels[index(x, y, c)]; }
+        inline void setValue(int x, int y, int c, int value) { m_pixels[index(x, y, c)] = static_cast<unsigned char>(value); }
+        inline unsigned char* row(int y) { return m_pixels.data() + static_cast<size_t>(y) * m_width * m_channels; }
+        inline const unsigned char* row(int y) const { return m_pixels.data() + static_cast<size_t>(y) * m_width * m_channels; }
+    private:
+        inline size_t index(int x, int y, int c) const { return (static_cast<size_t>(y) * m_width + x) * m_channels + c; }
+        int m_width;
+        int m_height;
+        int m_channels;
+        std::vector<unsigned char> m_pixels;
+    };
+
+    ///Every combination of the channel values 0, 3, ..., 255, one pixel each; blue varies fastest.
+    ///An extra (alpha) channel, if any, is filled with a pattern that the separation must ignore.
+    ReferenceImage makeRGBGrid(const int &channels) {
+        const int step = 3;
+        const int n = 255 / step + 1;
+        ReferenceImage grid(n, n * n, channels);
+        for (int y = 0; y < grid.height(); y++) {
+            for (int x = 0; x < grid.width(); x++) {
+                grid.setValue(x, y, 0, (y / n) * step);
+                grid.setValue(x, y, 1, (y % n) * step);
+                grid.setValue(x, y, 2, x * step);
+                for (int c = 3; c < channels; c++) {
+                    grid.setValue(x, y, c, (x * 7 + y) & 255);
+                }
+            }
+        }
+        return grid;
+    }//end makeRGBGrid
+
+    ///The separation of one pixel as the kernel computed it before the plan existed: all three stains,
+    ///from the profile's matrix and its inverse, thresholding each stain's OD sum
+    void referenceSeparateColorsForPixel(const double (&pixelOD)[3], double (&RGB_sep)[9], double (&outQuant)[3],
+        const double (&stainVec_matrix)[9], const double (&inverse_matrix)[9], bool applyThreshold, double threshold) {
+        double stainQuantity[3] = { 0.0 };
+        StainVectorMath::Multiply3x3MatrixAndVector(inverse_matrix, pixelOD, stainQuantity);
+        for (int i = 0; i < 3; i++) {
+            stainQuantity[i] = (stainQuantity[i] > 0.0) ? stainQuantity[i] : 0.0;
+            double OD_scaled[3];
+            OD_scaled[0] = stainQuantity[i] * stainVec_matrix[i * 3];
+            OD_scaled[1] = stainQuantity[i] * stainVec_matrix[i * 3 + 1];
+            OD_scaled[2] = stainQuantity[i] * stainVec_matrix[i * 3 + 2];
+            const double OD_sum = OD_scaled[0] + OD_scaled[1] + OD_scaled[2];
+            const bool isAboveThreshold = applyThreshold ? (OD_sum > threshold) : true;
+            for (int c = 0; c < 3; c++) {
+                RGB_sep[i * 3 + c] = isAboveThreshold ? ODConversion::ConvertODtoRGB(OD_scaled[c]) : 0.0;
+            }
+            outQuant[i] = isAboveThreshold ? stainQuantity[i] : 0.0;
+        }
+    }//end referenceSeparateColorsForPixel
+
+    ///The per-pixel separation loop of the kernel: one output image per stain, grayscale quantity or RGBA colour
+    std::vector<ReferenceImage> referenceSeparateStains(const ReferenceImage &source, const double (&stainVec_matrix)[9],
+        int numStains, bool applyThreshold, double threshold, bool grayscaleOnly, double grayscaleNormFactor) {
+        double noZeroRowsMatrix[9] = { 0.0 };
+        StainVectorMath::ConvertZeroRowsToUnitary(stainVec_matrix, noZeroRowsMatrix);
+        double inverse_matrix[9] = { 0.0 };
+        StainVectorMath::Compute3x3MatrixInverse(noZeroRowsMatrix, inverse_matrix);
+        ODConversion converter;
+
+        std::vector<ReferenceImage> outputImages(numStains, ReferenceImage(source.width(), source.height(), grayscaleOnly ? 1 : 4));
+        for (int j = 0; j < source.width() * source.height(); j++) {
+            const int x = j % source.width();
+            const int y = j / source.width();
+            double pixelOD[3];
+            pixelOD[0] = converter.LookupRGBtoOD(source.at(x, y, 0));
+            pixelOD[1] = converter.LookupRGBtoOD(source.at(x, y, 1));
+            pixelOD[2] = converter.LookupRGBtoOD(source.at(x, y, 2));
+            double RGB_sep[9] = { 0.0 };
+            double stainQuant[3] = { 0.0 };
+            referenceSeparateColorsForPixel(pixelOD, RGB_sep, stainQuant, stainVec_matrix, inverse_matrix, applyThreshold, threshold);
+            for (int i = 0; i < numStains; i++) {
+                if (grayscaleOnly) {
+                    int sq = static_cast<int>(stainQuant[i] * grayscaleNormFactor);
+                    outputImages[i].setValue(x, y, 0, (sq > 255) ? 255 : sq);
+                }
+                else {
+                    outputImages[i].setValue(x, y, 0, static_cast<int>(RGB_sep[i * 3]));
+                    outputImages[i].setValue(x, y, 1, static_cast<int>(RGB_sep[i * 3 + 1]));
+                    outputImages[i].setValue(x, y, 2, static_cast<int>(RGB_sep[i * 3 + 2]));
+                    outputImages[i].setValue(x, y, 3, 255);
+                }
+            }
+        }
+        return outputImages;
+    }//end referenceSeparateStains
+
+    ///The per-pixel loop of the kernel for single-stain profiles: keep the pixels whose total OD is above the threshold
+    ReferenceImage referenceThresholdOnly(const ReferenceImage &source, bool applyThreshold, double threshold) {
+        ODConversion converter;
+        ReferenceImage outputImage(source.width(), source.height(), 4);
+        for (int j = 0; j < source.width() * source.height(); j++) {
+            const int x = j % source.width();
+            const int y = j / source.width();
+            const int R = source.at(x, y, 0);
+            const int G = source.at(x, y, 1);
+            const int B = source.at(x, y, 2);
+            const double OD_sum = converter.LookupRGBtoOD(R) + converter.LookupRGBtoOD(G) + converter.LookupRGBtoOD(B);
+            const bool isAboveThreshold = applyThreshold ? (OD_sum > threshold) : true;
+            outputImage.setValue(x, y, 0, isAboveThreshold ? R : 0);
+            outputImage.setValue(x, y, 1, isAboveThreshold ? G : 0);
+            outputImage.setValue(x, y, 2, isAboveThreshold ? B : 0);
+            outputImage.setValue(x, y, 3, 255);
+        }
+        return outputImage;
+    }//end referenceThresholdOnly
+
+    ///Count the bytes of a row path output that differ from the reference, and describe the first one
+    long long compareImages(const ReferenceImage &expected, const ReferenceImage &actual, const std::string &what) {
+        long long mismatches = 0;
+        for (int y = 0; y < expected.height(); y++) {
+            for (int x = 0; x < expected.width(); x++) {
+                for (int c = 0; c < expected.channels(); c++) {
+                    if (expected.at(x, y, c) == actual.at(x, y, c)) {
+                        continue;
+                    }
+                    if (mismatches == 0) {
+                        std::cerr << what << ": pixel (" << x << ", " << y << ") channel " << c << " is " 
+                            << actual.at(x, y, c) << ", expected " << expected.at(x, y, c) << std::endl;
+                    }
+                    mismatches++;
+                }
+            }
+        }
+        return mismatches;
+    }//end compareImages
+
+    ///The row paths of DeconvolutionPlan (double precision reference kernels) must write the same bytes
+    ///as the per-pixel loops, for every shipped profile, stain, output type and threshold setting
+    int testDeconvolutionRows() {
+        struct ThresholdSetting { bool apply; double threshold; };
+        const std::vector<ThresholdSetting> thresholdSettings = { { false, 0.2 }, { true, 0.2 }, { true, 0.6 } };
+        long long comparisons = 0;
+        long long mismatches = 0;
+        for (int srcChannels = 3; srcChannels <= 4; srcChannels++) {
+            const ReferenceImage source = makeRGBGrid(srcChannels);
+            const int width = source.width();
+            for (auto p = ProfileFiles.begin(); p != ProfileFiles.end(); ++p) {
+                std::shared_ptr<StainProfile> theProfile = loadEmbeddedProfile(*p);
+                double stainMatrix[9] = { 0.0 };
+                if ((nullptr == theProfile) || !theProfile->GetNormalizedProfilesAsDoubleArray(stainMatrix)) {
+                    std::cerr << "Could not read the embedded profile " << *p << std::endl;
+                    return 1;
+                }
+                const int numStains = theProfile->GetNumberOfStainComponents();
+                for (auto t = thresholdSettings.begin(); t != thresholdSettings.end(); ++t) {
+                    for (int grayscale = 0; grayscale <= 1; grayscale++) {
+                        const std::string setting = *p + ", " + std::to_string(srcChannels) + " channels, "
+                            + (t->apply ? ("threshold " + std::to_string(t->threshold)) : "no threshold")
+                            + (grayscale ? ", grayscale" : ", colour");
+                        const DeconvolutionPlan allStainsPlan(theProfile, 0, t->apply, t->threshold, grayscale != 0, false);
+                        const std::vector<ReferenceImage> expected = referenceSeparateStains(source, stainMatrix, numStains,
+                            t->apply, t->threshold, grayscale != 0, allStainsPlan.GetGrayscaleNormFactor());
+                        const int outChannels = allStainsPlan.GetOutputChannels();
+
+                        //One stain at a time, as separateStains writes it
+                        for (int stain = 0; stain < numStains; stain++) {
+                            const DeconvolutionPlan plan(theProfile, stain, t->apply, t->threshold, grayscale != 0, false);
+                            ReferenceImage actual(width, source.height(), outChannels);
+                            unsigned char background[4] = { 0, 0, 0, 0 };
+                            plan.SeparateQuantity(0.0, background);
+                            for (int y = 0; y < source.height(); y++) {
+                                plan.SeparateRow(source.row(y), srcChannels, width, actual.row(y));
+                                //A row judged to be background must separate to the background output
+                                if (plan.IsBackground(source.row(y), srcChannels, width)) {
+                                    for (int x = 0; x < width * outChannels; x++) {
+                                        mismatches += (actual.row(y)[x] != background[x % outChannels]) ? 1 : 0;
+                                    }
+                                }
+                            }
+                            mismatches += compareImages(expected[stain], actual, "SeparateRow, stain " + std::to_string(stain + 1) + ", " + setting);
+                            comparisons++;
+
+                            //The two-stage path (UInt16 quantities, then StainQuantityMap) that the display and the saved
+                            //images use: within 1 of SeparateRow, except pixels within one encoding step of the threshold
+                            const StainQuantityMap quantityMap(std::make_shared<const DeconvolutionPlan>(plan));
+                            const double stainSum = plan.GetStainMatrix()[stain * 3] + plan.GetStainMatrix()[stain * 3 + 1]
+                                + plan.GetStainMatrix()[stain * 3 + 2];
+                            const double thresholdTolerance = stainSum * 0.5 / plan.GetQuantityScale() + 1e-9;
+                            ReferenceImage twoStage(width, source.height(), outChannels);
+                            long long outOfBound = 0;
+                            for (int y = 0; y < source.height(); y++) {
+                                quantityMap.SeparateRow(source.row(y), srcChannels, width, twoStage.row(y));
+                                for (int x = 0; x < width; x++) {
+                                    const unsigned char *e = actual.row(y) + x * outChannels;
+                                    const unsigned char *a = twoStage.row(y) + x * outChannels;
+                                    const unsigned char *rgb = source.row(y) + x * srcChannels;
+                                    const double pixelOD[3] = { plan.LookupRGBtoOD(rgb[0]), plan.LookupRGBtoOD(rgb[1]), plan.LookupRGBtoOD(rgb[2]) };
+                                    const bool nearThreshold = t->apply 
+                                        && (std::fabs(plan.GetStainQuantity(pixelOD, stain) * stainSum - t->threshold) < thresholdTolerance);
+                                    for (int c = 0; c < outChannels; c++) {
+                                        outOfBound += ((std::abs(e[c] - a[c]) > 1) && !nearThreshold) ? 1 : 0;
+                                    }
+                                }
+                            }
+                            if (outOfBound > 0) {
+                                std::cerr << "StainQuantityMap::SeparateRow, stain " << (stain + 1) << ", " << setting 
+                                    << ": " << outOfBound << " values differ by more than 1" << std::endl;
+                            }
+                            mismatches += outOfBound;
+                            comparisons++;
+                        }
+
+                        //Every stain at once, as separateAllStains writes them
+                        std::vector<ReferenceImage> actual(numStains, ReferenceImage(width, source.height(), outChannels));
+                        for (int y = 0; y < source.height(); y++) {
+                            unsigned char *const dstRows[3] = { actual[0].row(y), 
+                                (numStains > 1) ? actual[1].row(y) : nullptr, 
+                                (numStains > 2) ? actual[2].row(y) : nullptr };
+                            allStainsPlan.SeparateRowAllStains(source.row(y), srcChannels, width, dstRows);
+                        }
+                        for (int stain = 0; stain < numStains; stain++) {
+                            mismatches += compareImages(expected[stain], actual[stain], "SeparateRowAllStains, stain " + std::to_string(stain + 1) + ", " + setting);
+                            comparisons++;
+                        }
+                    }
+
+                    //The first stain alone, as a single-stain profile is thresholded
+                    const double singleStainMatrix[9] = { stainMatrix[0], stainMatrix[1], stainMatrix[2], 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+                    const DeconvolutionPlan thresholdPlan(singleStainMatrix, 1, 0, t->apply, t->threshold, false, false);
+                    const ReferenceImage expected = referenceThresholdOnly(source, t->apply, t->threshold);
+                    ReferenceImage actual(width, source.height(), 4);
+                    for (int y = 0; y < source.height(); y++) {
+                        thresholdPlan.ThresholdRow(source.row(y), srcChannels, width, actual.row(y));
+                    }
+                    mismatches += compareImages(expected, actual, "ThresholdRow, " + *p + ", " + std::to_string(srcChannels) + " channels");
+                    comparisons++;
+
+                    //DisplayRow (the command line tool's path) must threshold a single-stain profile to RGBA
+                    //whatever the output type, and separate the displayed stain of the others
+                    for (int grayscale = 0; grayscale <= 1; grayscale++) {
+                        const DeconvolutionPlan singlePlan(singleStainMatrix, 1, 0, t->apply, t->threshold, grayscale != 0, false);
+                        const DeconvolutionPlan multiPlan(theProfile, numStains - 1, t->apply, t->threshold, grayscale != 0, false);
+                        const std::vector<ReferenceImage> expectedStains = referenceSeparateStains(source, stainMatrix, numStains,
+                            t->apply, t->threshold, grayscale != 0, multiPlan.GetGrayscaleNormFactor());
+                        if ((singlePlan.GetDisplayRowChannels() != 4) || (multiPlan.GetDisplayRowChannels() != multiPlan.GetOutputChannels())) {
+                            std::cerr << "DisplayRow: wrong channel count, " << *p << std::endl;
+                            mismatches++;
+                            continue;
+                        }
+                        ReferenceImage singleActual(width, source.height(), 4);
+                        ReferenceImage multiActual(width, source.height(), multiPlan.GetOutputChannels());
+                        for (int y = 0; y < source.height(); y++) {
+                            singlePlan.DisplayRow(source.row(y), srcChannels, width, singleActual.row(y));
+                            multiPlan.DisplayRow(source.row(y), srcChannels, width, multiActual.row(y));
+                        }
+                        const std::string setting = *p + ", " + std::to_string(srcChannels) + " channels" + (grayscale ? ", grayscale" : ", colour");
+                        mismatches += compareImages(expected, singleActual, "DisplayRow, single stain, " + setting);
+                        mismatches += compareImages(expectedStains[numStains - 1], multiActual, "DisplayRow, stain " + std::to_string(numStains) + ", " + setting);
+                        comparisons += 2;
+                    }
+                }
+            }
+        }
+        std::cout << "deconvolution_rows: " << comparisons << " images compared, " << mismatches << " bytes differ" << std::endl;
+        return (mismatches == 0) ? 0 : 1;
+    }//end testDeconvolutionRows
+
+    ///Every float32 row kernel that this CPU can run must stay within the error bound documented in
+    ///ColorDeconvolutionSIMD.h over all 2^24 RGB inputs: each output channel within 1 of the double precision
+    ///reference, except pixels whose OD sum is within 1e-5 of the threshold, and fewer than 0.001% of the
+    ///channel values different, for every shipped profile and stain at a 0.2 threshold
+    int testSIMDKernels() {
+        const ColorDeconvolutionSIMD::RowFunction rowFunctions[4] = { &ColorDeconvolutionSIMD::SeparateRowScalar,
+            &ColorDeconvolutionSIMD::SeparateRowSSE41, &ColorDeconvolutionSIMD::SeparateRowAVX2, &ColorDeconvolutionSIMD::SeparateRowAVX512 };
+        const int bestInstructionSet = static_cast<int>(ColorDeconvolutionSIMD::DetectInstructionSet());
+        const double threshold = 0.2;
+        const double thresholdTolerance = 1e-5;
+        const double maxDifferentFraction = 1e-5;
+        //One row per red and green value, blue varies along the row
+        const int width = 256;
+        const int height = 256 * 256;
+        std::vector<unsigned char> cube(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                unsigned char *p = cube.data() + (static_cast<size_t>(y) * width + x) * 3;
+                p[0] = static_cast<unsigned char>(y >> 8);
+                p[1] = static_cast<unsigned char>(y & 255);
+                p[2] = static_cast<unsigned char>(x);
+            }
+        }
+
+        int failures = 0;
+        for (auto p = ProfileFiles.begin(); p != ProfileFiles.end(); ++p) {
+            std::shared_ptr<StainProfile> theProfile = loadEmbeddedProfile(*p);
+            if (nullptr == theProfile) {
+                std::cerr << "Could not read the embedded profile " << *p << std::endl;
+                return 1;
+            }
+            const int numStains = theProfile->GetNumberOfStainComponents();
+            for (int stain = 0; stain < numStains; stain++) {
+                for (int grayscale = 0; grayscale <= 1; grayscale++) {
+                    const DeconvolutionPlan reference(theProfile, stain, true, threshold, grayscale != 0, false);
+                    const DeconvolutionPlan vectorPlan(theProfile, stain, true, threshold, grayscale != 0, true);
+                    const ColorDeconvolutionSIMD::Params &params = vectorPlan.GetSIMDParams(stain);
+                    const int outChannels = reference.GetOutputChannels();
+                    const double stainSum = reference.GetStainMatrix()[stain * 3] + reference.GetStainMatrix()[stain * 3 + 1]
+                        + reference.GetStainMatrix()[stain * 3 + 2];
+                    for (int is = ColorDeconvolutionSIMD::SCALAR; is <= bestInstructionSet; is++) {
+                        long long differentValues = 0;
+                        long long outOfBound = 0;
+#pragma omp parallel for reduction(+:differentValues,outOfBound)
+                        for (int y = 0; y < height; y++) {
+                            const unsigned char *src = cube.data() + static_cast<size_t>(y) * width * 3;
+                            unsigned char expected[width * 4];
+                            unsigned char actual[width * 4];
+                            reference.SeparateRow(src, 3, width, expected);
+                            rowFunctions[is](params, src, 3, width, actual);
+                            for (int x = 0; x < width; x++) {
+                                const unsigned char *e = expected + x * outChannels;
+                                const unsigned char *a = actual + x * outChannels;
+                                const double pixelOD[3] = { reference.LookupRGBtoOD(src[3 * x]),
+                                    reference.LookupRGBtoOD(src[3 * x + 1]), reference.LookupRGBtoOD(src[3 * x + 2]) };
+                                const bool nearThreshold = std::fabs(reference.GetStainQuantity(pixelOD, stain) * stainSum - threshold) < thresholdTolerance;
+                                for (int c = 0; c < outChannels; c++) {
+                                    const int difference = std::abs(static_cast<int>(e[c]) - static_cast<int>(a[c]));
+                                    differentValues += (difference != 0) ? 1 : 0;
+                                    outOfBound += ((difference > 1) && !nearThreshold) ? 1 : 0;
+                                }
+                            }
+                        }
+                        const double differentFraction = static_cast<double>(differentValues)
+                            / (static_cast<double>(width) * height * outChannels);
+                        const bool failed = (outOfBound != 0) || (differentFraction >= maxDifferentFraction);
+                        std::cout << "simd_kernels: " << ColorDeconvolutionSIMD::GetInstructionSetName(static_cast<ColorDeconvolutionSIMD::InstructionSet>(is))
+                            << ", " << *p << ", stain " << stain + 1 << (grayscale ? ", grayscale: " : ", colour: ")
+                            << differentFraction * 100.0 << "% of values differ, " << outOfBound << " by more than 1"
+                            << (failed ? " FAILED" : "") << std::endl;
+                        failures += failed ? 1 : 0;
+                    }
+                }
+            }
+        }
+        return (failures == 0) ? 0 : 1;
+    }//end testSIMDKernels
+
+    ///A row of a stain matrix, as StainVectorMath bundled them before SmallMatrix3x3
+    typedef std::array<double, 3> Row;
+
+    std::vector<Row> referenceBundleRows(const double (&m)[9]) {
+        return { Row({ m[0], m[1], m[2] }), Row({ m[3], m[4], m[5] }), Row({ m[6], m[7], m[8] }) };
+    }//end referenceBundleRows
+
+    double referenceNorm(const Row &row) {
+        return std::sqrt(std::inner_product(row.begin(), row.end(), row.begin(), 0.0));
+    }//end referenceNorm
+
+    void referenceUnbundleRows(const std::vector<Row> &rows, double (&m)[9]) {
+        for (int x = 0; x < 9; x++) {
+            m[x] = rows[x / 3][x % 3];
+        }
+    }//end referenceUnbundleRows
+
+    void referenceMake3x3MatrixUnitary(const double (&inputMat)[9], double (&unitaryMat)[9]) {
+        std::vector<Row> rows = referenceBundleRows(inputMat);
+        for (auto it = rows.begin(); it != rows.end(); ++it) {
+            const double norm = referenceNorm(*it);
+            if (norm >= 10.0*ODConversion::GetODMinValue()) {
+                for (auto p = it->begin(); p != it->end(); ++p) {
+                    *p = *p / norm;
+                }
+            }
+        }
+        referenceUnbundleRows(rows, unitaryMat);
+    }//end referenceMake3x3MatrixUnitary
+
+    void referenceConvertZeroRowsToUnitary(const double (&inputMat)[9], double (&unitaryMat)[9], const double (&replacementVals)[3]) {
+        std::vector<Row> rows = referenceBundleRows(inputMat);
+        Row unitaryRow = { replacementVals[0], replacementVals[1], replacementVals[2] };
+        const double replacementNorm = referenceNorm(unitaryRow);
+        if (replacementNorm != 0.0) {
+            for (auto p = unitaryRow.begin(); p != unitaryRow.end(); ++p) {
+                *p = *p / replacementNorm;
+            }
+        }
+        for (auto it = rows.begin(); it != rows.end(); ++it) {
+            if (referenceNorm(*it) < 10.0*ODConversion::GetODMinValue()) {
+                *it = unitaryRow;
+            }
+        }
+        referenceUnbundleRows(rows, unitaryMat);
+    }//end referenceConvertZeroRowsToUnitary
+
+    std::array<bool, 3> referenceRowSumZeroCheck(const double (&inputMat)[9]) {
+        const std::vector<Row> rows = referenceBundleRows(inputMat);
+        std::array<bool, 3> returnVals;
+        for (int i = 0; i < 3; i++) {
+            const double rowSum = std::accumulate(rows[i].begin(), rows[i].end(), 0.0);
+            returnVals[i] = (std::abs(rowSum) < ODConversion::GetODMinValue()) && (referenceNorm(rows[i]) > 0.0);
+        }
+        return returnVals;
+    }//end referenceRowSumZeroCheck
+
+    void referenceMultiply3x3MatrixAndVector(const double (&inputMat)[9], const double (&inputVec)[3], double (&outputVec)[3]) {
+        double reshapedMatrix[3][3] = { 0.0 };
+        for (int x = 0; x < 9; x++) {
+            reshapedMatrix[x / 3][x % 3] = inputMat[x];
+        }
+        boost::qvm::mat<double, 3, 3> inputQVMMatrix = boost::qvm::mref(reshapedMatrix);
+        boost::qvm::vec<double, 3> inputQVMVector;
+        boost::qvm::A<0>(inputQVMVector) = inputVec[0];
+        boost::qvm::A<1>(inputQVMVector) = inputVec[1];
+        boost::qvm::A<2>(inputQVMVector) = inputVec[2];
+        boost::qvm::vec<double, 3> outputQVMVector = inputQVMMatrix * inputQVMVector;
+        outputVec[0] = boost::qvm::A<0>(outputQVMVector);
+        outputVec[1] = boost::qvm::A<1>(outputQVMVector);
+        outputVec[2] = boost::qvm::A<2>(outputQVMVector);
+    }//end referenceMultiply3x3MatrixAndVector
+
+    ///The comparisons SortStainVectors passed to std::sort, including the non-strict >= of the descending order
+    bool referenceAscending(const Row a, const Row b) {
+        double prec = 1e-3;
+        double aSum = std::abs(std::accumulate(a.begin(), a.end(), 0.0));
+        double bSum = std::abs(std::accumulate(b.begin(), b.end(), 0.0));
+        if (aSum < prec) { return false; }
+        if (bSum < prec) { return true; }
+        if (std::abs(a[0] - b[0]) > prec) { return a[0] < b[0]; }
+        else if (std::abs(a[1] - b[1]) > prec) { return a[1] < b[1]; }
+        else { return a[2] < b[2]; }
+    }//end referenceAscending
+
+    bool referenceDescending(const Row a, const Row b) {
+        double prec = 1e-3;
+        double aSum = std::abs(std::accumulate(a.begin(), a.end(), 0.0));
+        double bSum = std::abs(std::accumulate(b.begin(), b.end(), 0.0));
+        if (aSum < prec) { return false; }
+        if (bSum < prec) { return true; }
+        if (std::abs(a[0] - b[0]) > prec) { return a[0] > b[0]; }
+        else if (std::abs(a[1] - b[1]) > prec) { return a[1] > b[1]; }
+        else { return a[2] >= b[2]; }
+    }//end referenceDescending
+
+    void referenceSortStainVectors(const double (&inputMat)[9], double (&outputMat)[9], const int &sortOrder) {
+        std::vector<Row> rows = referenceBundleRows(inputMat);
+        if (sortOrder == StainVectorMath::SortOrder::ASCENDING) {
+            std::sort(rows.begin(), rows.end(), referenceAscending);
+        }
+        else if (sortOrder == StainVectorMath::SortOrder::DESCENDING) {
+            std::sort(rows.begin(), rows.end(), referenceDescending);
+        }
+        else {
+            return;
+        }
+        referenceUnbundleRows(rows, outputMat);
+    }//end referenceSortStainVectors
+
+    //The compile-time forms of SmallMatrix3x3
+    constexpr double ConstantMatrix[9] = { 1.0, 2.0, 3.0, 0.0, 1.0, 4.0, 5.0, 6.0, 0.0 };
+    static_assert(SmallMatrix3x3::Determinant(ConstantMatrix) == 1.0, "Determinant");
+    static_assert(SmallMatrix3x3::RowSum(ConstantMatrix, 1) == 5.0, "RowSum");
+    static_assert(!SmallMatrix3x3::RowSumsNearZero(ConstantMatrix, 1e-6)[0], "RowSumsNearZero");
+    constexpr double constantProduct() {
+        double v[3] = { 1.0, 1.0, 1.0 }, out[3] = {};
+        SmallMatrix3x3::MultiplyVector(ConstantMatrix, v, out);
+        return out[2];
+    }
+    static_assert(constantProduct() == 11.0, "MultiplyVector");
+    constexpr double constantSort() {
+        double out[9] = {};
+        SmallMatrix3x3::SortRows(ConstantMatrix, out, [](const double *a, const double *b) { return a[0] < b[0]; });
+        return out[0] + 10.0 * out[3];
+    }
+    static_assert(constantSort() == 10.0, "SortRows");
+
+    ///StainVectorMath must give bitwise the same results as before it was built on SmallMatrix3x3, for random
+    ///matrices with rows of zeros, tiny rows, rows that sum to zero and rows that nearly tie in the sort.
+    ///SortRows must put rows in the same order as std::sort, even with the non-strict descending comparison.
+    int testStainVectorMath() {
+        long long comparisons = 0;
+        long long mismatches = 0;
+        auto compare = [&](const double *expected, const double *actual, const int &n, const std::string &what) {
+            comparisons++;
+            if (std::memcmp(expected, actual, n * sizeof(double)) != 0) {
+                if (mismatches == 0) {
+                    std::cerr << what << " differs from the reference" << std::endl;
+                }
+                mismatches++;
+            }
+        };
+
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+        std::uniform_int_distribution<int> pickRow(0, 7);
+        for (int it = 0; it < 100000; it++) {
+            double m[9];
+            for (int k = 0; k < 9; k++) {
+                m[k] = uniform(rng);
+            }
+            for (int r = 0; r < 3; r++) {
+                const int kind = pickRow(rng);
+                for (int c = 0; c < 3; c++) {
+                    if (kind == 0) { m[3 * r + c] = 0.0; } //zero
+                    else if (kind == 1) { m[3 * r + c] *= 1e-6; } //tiny
+                    else if ((kind == 2) && (c == 2)) { m[3 * r + 2] = -(m[3 * r] + m[3 * r + 1]); } //zero sum
+                    else if ((kind == 3) && (r > 0)) { m[3 * r + c] = m[c] + uniform(rng) * 1e-3; } //near tie with the first row
+                    else if (kind == 4) { m[3 * r + c] = std::abs(m[3 * r + c]); }
+                }
+            }
+            double expected[9], actual[9];
+            const double v[3] = { uniform(rng), uniform(rng), uniform(rng) };
+            const double replacement[3] = { uniform(rng), uniform(rng), uniform(rng) };
+            referenceMake3x3MatrixUnitary(m, expected);
+            StainVectorMath::Make3x3MatrixUnitary(m, actual);
+            compare(expected, actual, 9, "Make3x3MatrixUnitary");
+            const double ones[3] = { 1.0, 1.0, 1.0 };
+            referenceConvertZeroRowsToUnitary(m, expected, ones);
+            StainVectorMath::ConvertZeroRowsToUnitary(m, actual);
+            compare(expected, actual, 9, "ConvertZeroRowsToUnitary");
+            referenceConvertZeroRowsToUnitary(m, expected, replacement);
+            StainVectorMath::ConvertZeroRowsToUnitary(m, actual, replacement);
+            compare(expected, actual, 9, "ConvertZeroRowsToUnitary with replacement values");
+            comparisons++;
+            if (referenceRowSumZeroCheck(m) != StainVectorMath::RowSumZeroCheck(m)) {
+                std::cerr << "RowSumZeroCheck differs from the reference" << std::endl;
+                mismatches++;
+            }
+            double expectedVec[3], actualVec[3];
+            referenceMultiply3x3MatrixAndVector(m, v, expectedVec);
+            StainVectorMath::Multiply3x3MatrixAndVector(m, v, actualVec);
+            compare(expectedVec, actualVec, 3, "Multiply3x3MatrixAndVector");
+            for (int order = 0; order < 3; order++) {
+                //An unknown order leaves the output unchanged
+                std::fill(expected, expected + 9, -7.0);
+                std::fill(actual, actual + 9, -7.0);
+                referenceSortStainVectors(m, expected, order);
+                StainVectorMath::SortStainVectors(m, actual, order);
+                compare(expected, actual, 9, "SortStainVectors, order " + std::to_string(order));
+            }
+        }
+
+        //Every ordered choice of three rows from a pool of zero, zero-sum, duplicate and nearly tied rows.
+        //Ties within the tolerance are not transitive (0.6500 ~ 0.6508 ~ 0.6516), so the order depends on each step.
+        const std::vector<Row> pool = {
+            { 0.0, 0.0, 0.0 }, { 0.5, -0.25, -0.25 }, { 0.65, 0.70, 0.29 }, { 0.65, 0.70, 0.29 },
+            { 0.6505, 0.70, 0.29 }, { 0.65, 0.7005, 0.29 }, { 0.65, 0.70, 0.2905 }, { 0.65, 0.70, 0.2895 },
+            { 0.6495, 0.7009, 0.28 }, { 0.6508, 0.69, 0.29 }, { 0.6516, 0.71, 0.29 }, { 0.6516, 0.69, 0.29 }, { 0.65, 0.71, 0.29 },
+            { 0.07, 0.99, 0.11 }, { 0.27, 0.57, 0.78 }, { 0.0004, 0.0003, 0.0002 } };
+        const int n = static_cast<int>(pool.size());
+        for (int a = 0; a < n; a++) {
+            for (int b = 0; b < n; b++) {
+                for (int c = 0; c < n; c++) {
+                    const double m[9] = { pool[a][0], pool[a][1], pool[a][2], pool[b][0], pool[b][1], pool[b][2], pool[c][0], pool[c][1], pool[c][2] };
+                    double expected[9], actual[9];
+                    referenceSortStainVectors(m, expected, StainVectorMath::SortOrder::ASCENDING);
+                    SmallMatrix3x3::SortRows(m, actual, [](const double *x, const double *y) {
+                        return referenceAscending(Row({ x[0], x[1], x[2] }), Row({ y[0], y[1], y[2] })); });
+                    compare(expected, actual, 9, "SortRows, ascending");
+                    referenceSortStainVectors(m, expected, StainVectorMath::SortOrder::DESCENDING);
+                    SmallMatrix3x3::SortRows(m, actual, [](const double *x, const double *y) {
+                        return referenceDescending(Row({ x[0], x[1], x[2] }), Row({ y[0], y[1], y[2] })); });
+                    compare(expected, actual, 9, "SortRows, descending");
+                    StainVectorMath::SortStainVectors(m, actual, StainVectorMath::SortOrder::DESCENDING);
+                    compare(expected, actual, 9, "SortStainVectors, descending");
+                    referenceSortStainVectors(m, expected, StainVectorMath::SortOrder::ASCENDING);
+                    StainVectorMath::SortStainVectors(m, actual, StainVectorMath::SortOrder::ASCENDING);
+                    compare(expected, actual, 9, "SortStainVectors, ascending");
+                }
+            }
+        }
+
+        //Equal keys with a distinct tag: the order of ties shows each step of the sort
+        for (int k = 0; k < 27; k++) {
+            const double m[9] = { static_cast<double>(k % 3), 0.0, 0.0, static_cast<double>((k / 3) % 3), 1.0, 0.0, 
+                static_cast<double>(k / 9), 2.0, 0.0 };
+            std::vector<Row> rows = referenceBundleRows(m);
+            std::vector<Row> nonStrictRows = rows;
+            std::sort(rows.begin(), rows.end(), [](const Row &x, const Row &y) { return x[0] < y[0]; });
+            std::sort(nonStrictRows.begin(), nonStrictRows.end(), [](const Row &x, const Row &y) { return x[0] >= y[0]; });
+            double expected[9], actual[9];
+            referenceUnbundleRows(rows, expected);
+            SmallMatrix3x3::SortRows(m, actual, [](const double *x, const double *y) { return x[0] < y[0]; });
+            compare(expected, actual, 9, "SortRows, strict comparison with ties");
+            referenceUnbundleRows(nonStrictRows, expected);
+            SmallMatrix3x3::SortRows(m, actual, [](const double *x, const double *y) { return x[0] >= y[0]; });
+            compare(expected, actual, 9, "SortRows, non-strict comparison with ties");
+        }
+
+        std::cout << "stain_vector_math: " << comparisons << " results compared, " << mismatches << " differ" << std::endl;
+        return (mismatches == 0) ? 0 : 1;
+    }//end testStainVectorMath
+}
+
+int main(int argc, char *argv[]) {
+    const std::vector<std::pair<std::string, std::function<int()>>> tests = {
+        { "deconvolution_rows", testDeconvolutionRows },
+        { "simd_kernels", testSIMDKernels },
+        { "stain_vector_math", testStainVectorMath } };
+    const std::string name = (argc > 1) ? argv[1] : "";
+    int failures = 0;
+    bool found = false;
+    for (auto it = tests.begin(); it != tests.end(); ++it) {
+        if (name.empty() || (name == it->first)) {
+            found = true;
+            failures += (it->second() == 0) ? 0 : 1;
+        }
+    }
+    if (!found) {
+        std::cerr << "Usage: " << argv[0] << " [test name]" << std::endl << "Tests:";
+        for (auto it = tests.begin(); it != tests.end(); ++it) {
+            std::cerr << " " << it->first;
+        }
+        std::cerr << std::endl;
+        return 2;
+    }
+    return (failures == 0) ? 0 : 1;
+}//end main
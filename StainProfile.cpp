@@ -1247,3 +1247,45 @@ bool StainProfile::SetSeparationAlgorithmHistogramBinsParameter(const int& p) {
     return this->SetSingleSeparationAlgorithmParameter(type, ss.str());
 }//end SetSeparationAlgorithmHistogramBinsParameter
 
+const double StainProfile::GetSeparationAlgorithmSparsityParameter() const {
+    std::string type = this->pTypeSparsity();
+    std::string oss = this->GetSingleSeparationAlgorithmParameter(type);
+    double outVal(-1.); //Set error value here
+    //Convert oss to double, if possible. Catch all exceptions (invalid_argument and out_of_range)
+    try {
+        outVal = std::stod(oss);
+    }
+    catch (...) {
+        //No additional actions required
+    }
+    return outVal;
+}//end GetSeparationAlgorithmSparsityParameter
+
+bool StainProfile::SetSeparationAlgorithmSparsityParameter(const double& p) {
+    std::string type = this->pTypeSparsity();
+    std::stringstream ss;
+    ss << p;
+    return this->SetSingleSeparationAlgorithmParameter(type, ss.str());
+}//end SetSeparationAlgorithmSparsityParameter
+
+const int StainProfile::GetSeparationAlgorithmIterationsParameter() const {
+    std::string type = this->pTypeIterations();
+    std::string oss = this->GetSingleSeparationAlgorithmParameter(type);
+    int outVal(-1); //Set error value here
+    //Convert oss to int, if possible. Catch all exceptions (invalid_argument and out_of_range)
+    try {
+        outVal = std::stoi(oss);
+    }
+    catch (...) {
+        //No additional actions required
+    }
+    return outVal;
+}//end GetSeparationAlgorithmIterationsParameter
+
+bool StainProfile::SetSeparationAlgorithmIterationsParameter(const int& p) {
+    std::string type = this->pTypeIterations();
+    std::stringstream ss;
+    ss << p;
+    return this->SetSingleSeparationAlgorithmParameter(type, ss.str());
+}//end SetSeparationAlgorithmIterationsParameter
+
@@ -127,7 +127,7 @@ public:
     const int GetVectorIndexFromName(const std::string &name, const std::vector<std::string> &vec) const;
 
     ///General method for retrieving a name from a given vector at a given index, protected from range errors.
-    const std::string StainProfile::GetValueFromStringVector(const int &index, const std::vector<std::string> &vec) const;
+    const std::string GetValueFromStringVector(const int &index, const std::vector<std::string> &vec) const;
 
     ///Request the list of possible stain analysis model names from the class (presently one option)
     const std::vector<std::string> GetStainAnalysisModelOptions() const;
@@ -227,6 +227,16 @@ public:
     ///Set/Get the SeparationAlgorithm HistogramBins parameter
     bool SetSeparationAlgorithmHistogramBinsParameter(const int& p);
 
+    ///Set/Get the SeparationAlgorithm Sparsity parameter
+    const double GetSeparationAlgorithmSparsityParameter() const;
+    ///Set/Get the SeparationAlgorithm Sparsity parameter
+    bool SetSeparationAlgorithmSparsityParameter(const double& p);
+
+    ///Set/Get the SeparationAlgorithm Iterations parameter
+    const int GetSeparationAlgorithmIterationsParameter() const;
+    ///Set/Get the SeparationAlgorithm Iterations parameter
+    bool SetSeparationAlgorithmIterationsParameter(const int& p);
+
 public:
     //XML tag strings
     //The root tag and one attribute
@@ -257,6 +267,8 @@ public:
     static inline const char* pTypeThreshold() { return "threshold"; }
     static inline const char* pTypePercentile() { return "percentile"; }
     static inline const char* pTypeHistoBins() { return "histo-bins"; }
+    static inline const char* pTypeSparsity() { return "sparsity"; }
+    static inline const char* pTypeIterations() { return "iterations"; }
 
 private:
     ///Build the XMLDocument data structure
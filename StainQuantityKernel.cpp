@@ -0,0 +1,145 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "StainQuantityKernel.h"
+#include "ImagePixelAccess.h"
+#include "SharedConstantTiles.h"
+
+#include <vector>
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    StainQuantity::StainQuantity(std::shared_ptr<const DeconvolutionPlan> thePlan,
+        std::shared_ptr<TileCacheBudget> cacheBudget /*= nullptr*/) :
+        m_outputColorSpace(ColorModel::Grayscale, ChannelType::UInt16),
+        m_plan(thePlan),
+        m_cacheBudget(cacheBudget)
+    {
+    }//end constructor
+
+    StainQuantity::~StainQuantity() {
+    }//end destructor
+
+    RawImage StainQuantity::doProcessData(const RawImage &source) {
+        sedeen::Size imageSize = source.size();
+        if (m_cacheBudget != nullptr) {
+            m_cacheBudget->ObserveTile(imageSize.width(), imageSize.height());
+        }
+        RawImage outputImage(imageSize, m_outputColorSpace);
+        if ((m_plan == nullptr) || !m_plan->IsValid()) {
+            outputImage.fill(0);
+            return outputImage;
+        }
+        const DeconvolutionPlan &plan = *m_plan;
+        const int width = imageSize.width();
+        unsigned short *dst = reinterpret_cast<unsigned short*>(rawPixels(outputImage));
+
+        //Fast path: contiguous interleaved UInt8 rows, direct stores
+        if (isInterleavedUInt8(source)) {
+            const int srcChannels = source.colorSpace().channelCount();
+            const unsigned char *src = rawPixels(source);
+            for (int y = 0; y < imageSize.height(); y++) {
+                plan.QuantityRow(src + y * width * srcChannels, srcChannels, width, dst + y * width);
+            }
+            return outputImage;
+        }
+
+        //Fallback for other channel types or layouts: copy each row to a UInt8 RGB buffer first
+        std::vector<unsigned char> row(3 * width);
+        for (int y = 0; y < imageSize.height(); y++) {
+            for (int x = 0; x < width; x++) {
+                row[3 * x    ] = static_cast<unsigned char>(source.at(x, y, 0).as<int>());
+                row[3 * x + 1] = static_cast<unsigned char>(source.at(x, y, 1).as<int>());
+                row[3 * x + 2] = static_cast<unsigned char>(source.at(x, y, 2).as<int>());
+            }
+            plan.QuantityRow(row.data(), 3, width, dst + y * width);
+        }
+        return outputImage;
+    }//end doProcessData
+
+    const ColorSpace& StainQuantity::doGetColorSpace() const {
+        return m_outputColorSpace;
+    }//end doGetColorSpace
+
+    StainQuantityMapping::StainQuantityMapping(std::shared_ptr<const StainQuantityMap> theMap) :
+        m_outputColorSpace(ColorModel::RGBA, ChannelType::UInt8),
+        m_map(theMap)
+    {
+        if ((m_map != nullptr) && (m_map->GetOutputChannels() == 1)) {
+            m_outputColorSpace = ColorSpace(ColorModel::Grayscale, ChannelType::UInt8);
+        }
+    }//end constructor
+
+    StainQuantityMapping::~StainQuantityMapping() {
+    }//end destructor
+
+    RawImage StainQuantityMapping::doProcessData(const RawImage &source) {
+        sedeen::Size imageSize = source.size();
+        const bool contiguous = isInterleavedUInt16(source, 1) && (source.colorSpace().channelCount() == 1);
+        //Glass below the threshold: return the shared background tile without allocating
+        if (contiguous && (m_map != nullptr) && m_map->IsValid()
+            && m_map->IsBackground(reinterpret_cast<const unsigned short*>(rawPixels(source)),
+                static_cast<long long>(imageSize.width()) * imageSize.height())) {
+            return SharedConstantTiles::Get(imageSize, m_outputColorSpace, m_map->GetBackgroundPixel());
+        }
+
+        RawImage outputImage(imageSize, m_outputColorSpace);
+        if ((m_map == nullptr) || !m_map->IsValid()) {
+            outputImage.fill(0);
+            return outputImage;
+        }
+        const int width = imageSize.width();
+        const int outChannels = m_map->GetOutputChannels();
+        unsigned char *dst = rawPixels(outputImage);
+
+        //Fast path: contiguous interleaved UInt16 quantities
+        if (contiguous) {
+            const unsigned short *src = reinterpret_cast<const unsigned short*>(rawPixels(source));
+            for (int y = 0; y < imageSize.height(); y++) {
+                m_map->MapRow(src + y * width, width, dst + y * width * outChannels);
+            }
+            return outputImage;
+        }
+
+        //Fallback for other layouts
+        std::vector<unsigned short> row(width);
+        for (int y = 0; y < imageSize.height(); y++) {
+            for (int x = 0; x < width; x++) {
+                row[x] = static_cast<unsigned short>(source.at(x, y, 0).as<int>());
+            }
+            m_map->MapRow(row.data(), width, dst + y * width * outChannels);
+        }
+        return outputImage;
+    }//end doProcessData
+
+    const ColorSpace& StainQuantityMapping::doGetColorSpace() const {
+        return m_outputColorSpace;
+    }//end doGetColorSpace
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
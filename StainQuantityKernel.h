@@ -0,0 +1,98 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_IMAGE_FILTER_KERNELS_STAINQUANTITY_H
+#define SEDEEN_SRC_IMAGE_FILTER_KERNELS_STAINQUANTITY_H
+
+#include "Global.h"
+#include "Geometry.h"
+#include "Image.h"
+#include "image/filter/Kernel.h"
+#include "global/ColorSpace.h"
+
+#include <memory>
+
+//Plugin includes
+#include "DeconvolutionPlan.h"
+#include "StainQuantityMap.h"
+#include "TileCacheBudget.h"
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    /// \ingroup algorithm_kernels
+    /// First stage of the two-stage colour deconvolution: outputs the quantity of the
+    /// plan's displayed stain at each pixel, as UInt16 grayscale (see DeconvolutionPlan::QuantityRow).
+    /// Does not depend on the threshold or the output type, so its tiles can stay cached
+    /// while those are changed.
+    class PATHCORE_IMAGE_API StainQuantity : public Kernel {
+    public:
+        /// Creates a stain quantity Kernel from a compiled plan, which may be shared with other kernels.
+        /// If a cache budget is given, the size of every source tile is reported to it.
+        explicit StainQuantity(std::shared_ptr<const DeconvolutionPlan> thePlan,
+            std::shared_ptr<TileCacheBudget> cacheBudget = nullptr);
+        virtual ~StainQuantity();
+
+        ///Get the compiled deconvolution plan used by this kernel
+        std::shared_ptr<const DeconvolutionPlan> GetPlan() const { return m_plan; }
+
+    private:
+        /// \cond INTERNAL
+        virtual RawImage doProcessData(const RawImage &source);
+        virtual const ColorSpace& doGetColorSpace() const;
+
+        ColorSpace m_outputColorSpace;
+        std::shared_ptr<const DeconvolutionPlan> m_plan;
+        std::shared_ptr<TileCacheBudget> m_cacheBudget;
+        /// \endcond
+    };
+
+    /// \ingroup algorithm_kernels
+    /// Second stage of the two-stage colour deconvolution: maps the UInt16 stain quantities
+    /// from a StainQuantity kernel to the thresholded RGBA or grayscale output, with one table read per pixel.
+    class PATHCORE_IMAGE_API StainQuantityMapping : public Kernel {
+    public:
+        /// Creates a mapping Kernel from a quantity map, which may be shared with other kernels
+        explicit StainQuantityMapping(std::shared_ptr<const StainQuantityMap> theMap);
+        virtual ~StainQuantityMapping();
+
+        ///Get the quantity map used by this kernel
+        std::shared_ptr<const StainQuantityMap> GetMap() const { return m_map; }
+
+    private:
+        /// \cond INTERNAL
+        virtual RawImage doProcessData(const RawImage &source);
+        virtual const ColorSpace& doGetColorSpace() const;
+
+        ColorSpace m_outputColorSpace;
+        std::shared_ptr<const StainQuantityMap> m_map;
+        /// \endcond
+    };
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
+#endif
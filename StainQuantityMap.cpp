@@ -0,0 +1,113 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "StainQuantityMap.h"
+
+#include <algorithm>
+#include <cstring>
+
+StainQuantityMap::StainQuantityMap(std::shared_ptr<const DeconvolutionPlan> thePlan)
+    : m_isValid(false),
+    m_plan(thePlan),
+    m_outputChannels(1),
+    m_backgroundLimit(-1)
+{
+    if ((m_plan == nullptr) || !m_plan->IsValid()) {
+        return;
+    }
+    //Single-stain profiles are thresholded on the RGB source, not separated
+    const int numStains = m_plan->GetNumberOfStains();
+    const int displayStain = m_plan->GetDisplayStain();
+    if ((numStains < 2) || (numStains > 3) || (displayStain < 0) || (displayStain > 2)) {
+        return;
+    }
+    const DeconvolutionPlan &plan = *m_plan;
+    m_outputChannels = plan.GetOutputChannels();
+    const int numEntries = DeconvolutionPlan::MaxEncodedQuantity + 1;
+    const double scale = plan.GetQuantityScale();
+    m_table.resize(numEntries * m_outputChannels);
+    unsigned char *table = m_table.data();
+#pragma omp parallel for
+    for (int e = 0; e < numEntries; e++) {
+        const double stainQuantity = (scale > 0.0) ? (e / scale) : 0.0;
+        plan.SeparateQuantity(stainQuantity, table + e * m_outputChannels);
+    }
+    //Low quantities (below the threshold, or too small to change the output) all give the output of quantity 0
+    m_backgroundLimit = 0;
+    while ((m_backgroundLimit < numEntries - 1) 
+        && (std::memcmp(table + (m_backgroundLimit + 1) * m_outputChannels, table, m_outputChannels) == 0)) {
+        m_backgroundLimit++;
+    }
+    m_isValid = true;
+}//end constructor
+
+StainQuantityMap::~StainQuantityMap() {
+}//end destructor
+
+void StainQuantityMap::MapRow(const unsigned short *src, const int &width, unsigned char *dst) const {
+    const unsigned char *table = m_table.data();
+    if (m_outputChannels == 1) {
+        for (int x = 0; x < width; x++) {
+            dst[x] = table[src[x]];
+        }
+        return;
+    }
+    //RGBA: one 4-byte copy per pixel
+    for (int x = 0; x < width; x++) {
+        std::memcpy(dst + 4 * x, table + 4 * src[x], 4);
+    }
+}//end MapRow
+
+void StainQuantityMap::SeparateRow(const unsigned char *src, const int &srcChannels, 
+    const int &width, unsigned char *dst) const {
+    //The quantities are encoded one block of pixels at a time, in a buffer on the stack
+    const int blockSize = 256;
+    unsigned short quantities[blockSize];
+    for (int x = 0; x < width; x += blockSize) {
+        const int count = std::min(blockSize, width - x);
+        m_plan->QuantityRow(src + x * srcChannels, srcChannels, count, quantities);
+        MapRow(quantities, count, dst + x * m_outputChannels);
+    }
+}//end SeparateRow
+
+bool StainQuantityMap::IsBackground(const unsigned short *src, const long long &count) const {
+    if (m_backgroundLimit < 0) {
+        return false;
+    }
+    const unsigned short limit = static_cast<unsigned short>(m_backgroundLimit);
+    //The maximum of each block is a quick test; tissue usually fails in the first block
+    const long long blockSize = 4096;
+    for (long long first = 0; first < count; first += blockSize) {
+        const long long last = ((count - first) < blockSize) ? count : (first + blockSize);
+        unsigned short blockMax = 0;
+        for (long long i = first; i < last; i++) {
+            blockMax = (src[i] > blockMax) ? src[i] : blockMax;
+        }
+        if (blockMax > limit) {
+            return false;
+        }
+    }
+    return true;
+}//end IsBackground
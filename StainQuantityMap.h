@@ -0,0 +1,80 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_STAINQUANTITYMAP_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_STAINQUANTITYMAP_H
+
+#include <memory>
+#include <vector>
+
+#include "DeconvolutionPlan.h"
+
+///The output of a DeconvolutionPlan for each UInt16-encoded quantity of the displayed stain
+///(see DeconvolutionPlan::QuantityRow). The threshold and the output type (grayscale quantity
+///or RGBA stain colour) only affect this map, so changing them re-maps cached quantities
+///instead of deconvolving the RGB source again.
+///
+///Each output is computed from the encoded quantity, which is within 0.5/GetQuantityScale()
+///of the exact quantity: an output channel can differ from DeconvolutionPlan::SeparateRow by 1,
+///and pixels within that distance of the threshold may be classified differently.
+///Immutable once built, so it can be shared by kernels, tiles and threads.
+class StainQuantityMap
+{
+public:
+    ///Build the map for a plan. Check IsValid() before use.
+    explicit StainQuantityMap(std::shared_ptr<const DeconvolutionPlan> thePlan);
+    ///destructor
+    ~StainQuantityMap();
+
+    ///True if the plan is valid and separates two or three stains
+    inline bool IsValid() const { return m_isValid; }
+    ///The plan the map was built from
+    inline std::shared_ptr<const DeconvolutionPlan> GetPlan() const { return m_plan; }
+    ///Number of UInt8 channels written per output pixel: 1 for grayscale quantity, 4 for RGBA
+    inline int GetOutputChannels() const { return m_outputChannels; }
+
+    ///Map a row of encoded quantities to GetOutputChannels() bytes per pixel in dst
+    void MapRow(const unsigned short *src, const int &width, unsigned char *dst) const;
+    ///Separate a row of interleaved UInt8 pixels with srcChannels (3 or more) channels as the two-stage
+    ///pipeline does: the plan's QuantityRow, then MapRow. Writes GetOutputChannels() bytes per pixel to dst.
+    void SeparateRow(const unsigned char *src, const int &srcChannels, const int &width, unsigned char *dst) const;
+
+    ///Largest encoded quantity up to which every quantity maps to the output of quantity 0, or -1 if the map is not valid
+    inline int GetBackgroundLimit() const { return m_backgroundLimit; }
+    ///The output of quantity 0 (GetOutputChannels() bytes): the background, below the threshold
+    inline const unsigned char* GetBackgroundPixel() const { return m_table.data(); }
+    ///True if every one of count encoded quantities maps to the background pixel
+    bool IsBackground(const unsigned short *src, const long long &count) const;
+
+private:
+    bool m_isValid;
+    std::shared_ptr<const DeconvolutionPlan> m_plan;
+    int m_outputChannels;
+    int m_backgroundLimit;
+    ///Output pixel for every encoded quantity, m_outputChannels bytes per entry
+    std::vector<unsigned char> m_table;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "StainStatistics.h"
+
+#include <cmath>
+
+const double StainStatistics::DefaultMaxOD = 3.0;
+const double StainStatistics::DefaultWeakOD = 0.2;
+const double StainStatistics::DefaultModerateOD = 0.4;
+const double StainStatistics::DefaultStrongOD = 0.6;
+
+StainStatistics::StainStatistics(std::shared_ptr<const DeconvolutionPlan> thePlan, const double &weakOD /*= DefaultWeakOD*/,
+    const double &moderateOD /*= DefaultModerateOD*/, const double &strongOD /*= DefaultStrongOD*/, 
+    const double &maxOD /*= DefaultMaxOD*/)
+    : m_isValid(false),
+    m_plan(thePlan),
+    m_numStains(0),
+    m_numBins((maxOD > 0.0) ? static_cast<int>(std::ceil(maxOD * BinsPerOD - 1e-6)) : 1),
+    m_pixelCount(0)
+{
+    //Each threshold is at least the one below it
+    m_intensityThresholds[NEGATIVE] = 0.0;
+    m_intensityThresholds[WEAK] = weakOD;
+    m_intensityThresholds[MODERATE] = (moderateOD > weakOD) ? moderateOD : weakOD;
+    m_intensityThresholds[STRONG] = (strongOD > m_intensityThresholds[MODERATE]) ? strongOD : m_intensityThresholds[MODERATE];
+    for (int s = 0; s < 3; s++) {
+        m_quantitySums[s] = 0;
+        for (int i = 0; i < NUM_INTENSITY_CLASSES; i++) {
+            m_intensityCounts[s][i] = 0;
+        }
+    }
+    if ((m_plan == nullptr) || !m_plan->IsValid()) {
+        return;
+    }
+    m_numStains = m_plan->GetNumberOfStains();
+    m_numStains = (m_numStains > 3) ? 3 : ((m_numStains < 0) ? 0 : m_numStains);
+    m_sketches.assign(m_numStains, QuantileSketch());
+    m_isValid = true;
+}//end constructor
+
+StainStatistics::~StainStatistics() {
+}//end destructor
+
+double StainStatistics::GetIntensityThreshold(const IntensityClass &intensity) const {
+    return ((intensity >= NEGATIVE) && (intensity < NUM_INTENSITY_CLASSES)) ? m_intensityThresholds[intensity] : 0.0;
+}//end GetIntensityThreshold
+
+void StainStatistics::AddRow(const unsigned char *src, const int &srcChannels, const int &width,
+    const unsigned char *mask /*= nullptr*/) {
+    if (!m_isValid) {
+        return;
+    }
+    const DeconvolutionPlan &plan = *m_plan;
+    const double weakOD = m_intensityThresholds[WEAK];
+    const double moderateOD = m_intensityThresholds[MODERATE];
+    const double strongOD = m_intensityThresholds[STRONG];
+    for (int x = 0; x < width; x++) {
+        if ((mask != nullptr) && (mask[x] == 0)) {
+            continue;
+        }
+        const unsigned char *p = src + x * srcChannels;
+        const double pixelOD[3] = { plan.LookupRGBtoOD(p[0]), plan.LookupRGBtoOD(p[1]), plan.LookupRGBtoOD(p[2]) };
+        for (int s = 0; s < m_numStains; s++) {
+            const double quantity = plan.GetStainQuantity(pixelOD, s);
+            m_quantitySums[s] += static_cast<long long>(quantity * QuantityScale + 0.5);
+            m_sketches[s].Add(quantity);
+            //The thresholds are in increasing order, so the class is the number of them exceeded
+            const int intensity = static_cast<int>(quantity > weakOD) + static_cast<int>(quantity > moderateOD)
+                + static_cast<int>(quantity > strongOD);
+            m_intensityCounts[s][intensity]++;
+        }
+        m_pixelCount++;
+    }
+}//end AddRow
+
+void StainStatistics::Merge(const StainStatistics &other) {
+    if (!m_isValid || !other.m_isValid || (other.m_numStains != m_numStains) || (other.m_numBins != m_numBins)) {
+        return;
+    }
+    for (int s = 0; s < m_numStains; s++) {
+        m_quantitySums[s] += other.m_quantitySums[s];
+        m_sketches[s].Merge(other.m_sketches[s]);
+        for (int i = 0; i < NUM_INTENSITY_CLASSES; i++) {
+            m_intensityCounts[s][i] += other.m_intensityCounts[s][i];
+        }
+    }
+    m_pixelCount += other.m_pixelCount;
+}//end Merge
+
+double StainStatistics::GetIntegratedOD(const int &stain) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains)) {
+        return 0.0;
+    }
+    return static_cast<double>(m_quantitySums[stain]) / static_cast<double>(QuantityScale);
+}//end GetIntegratedOD
+
+double StainStatistics::GetMeanOD(const int &stain) const {
+    return (m_pixelCount > 0) ? GetIntegratedOD(stain) / static_cast<double>(m_pixelCount) : 0.0;
+}//end GetMeanOD
+
+double StainStatistics::GetPercentile(const int &stain, const double &percent) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains) || (m_pixelCount == 0)) {
+        return 0.0;
+    }
+    return m_sketches[stain].GetPercentile(percent);
+}//end GetPercentile
+
+long long StainStatistics::GetIntensityCount(const int &stain, const IntensityClass &intensity) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains) || (intensity < NEGATIVE) || (intensity >= NUM_INTENSITY_CLASSES)) {
+        return 0;
+    }
+    return m_intensityCounts[stain][intensity];
+}//end GetIntensityCount
+
+double StainStatistics::GetIntensityPercent(const int &stain, const IntensityClass &intensity) const {
+    return (m_pixelCount > 0) ? 100.0 * GetIntensityCount(stain, intensity) / static_cast<double>(m_pixelCount) : 0.0;
+}//end GetIntensityPercent
+
+double StainStatistics::GetHScore(const int &stain) const {
+    return GetIntensityPercent(stain, WEAK) + 2.0 * GetIntensityPercent(stain, MODERATE) 
+        + 3.0 * GetIntensityPercent(stain, STRONG);
+}//end GetHScore
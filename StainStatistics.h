@@ -0,0 +1,124 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_STAINSTATISTICS_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_STAINSTATISTICS_H
+
+#include <memory>
+#include <vector>
+
+#include "DeconvolutionPlan.h"
+#include "QuantileSketch.h"
+
+///Quantitative statistics of the stain quantities (the optical density of each stain, before any
+///threshold) of every stain of a plan, accumulated from rows of pixels as they are read: the mean and
+///integrated OD, percentiles and a histogram, and the fraction of pixels of negative, weak, moderate and
+///strong intensity, from which an H-score is computed. Percentiles and the histogram are read from a
+///QuantileSketch of each stain, so percentiles are within 1/128 of the exact value rather than rounded to bins.
+///
+///Sums are kept as integers, with quantities in fixed point, so accumulators for parts of an image
+///can be merged in any order (for example, one per thread) and always give the same result.
+class StainStatistics
+{
+public:
+    ///Intensity classes of a pixel, from its stain quantity
+    enum IntensityClass {
+        NEGATIVE,  //at or below the weak threshold
+        WEAK,      //above the weak threshold
+        MODERATE,  //above the moderate threshold
+        STRONG,    //above the strong threshold
+        NUM_INTENSITY_CLASSES
+    };
+    ///Number of histogram bins per unit of OD
+    static const int BinsPerOD = 100;
+    ///Top of the histogram by default; the last bin also holds larger quantities
+    static const double DefaultMaxOD;
+    ///Default OD thresholds of the weak, moderate and strong intensity classes
+    static const double DefaultWeakOD;
+    static const double DefaultModerateOD;
+    static const double DefaultStrongOD;
+    ///Fixed point scale of the summed quantities
+    static const long long QuantityScale = 1LL << 20;
+
+public:
+    ///Accumulate the stains of a plan, with the given intensity class thresholds
+    explicit StainStatistics(std::shared_ptr<const DeconvolutionPlan> thePlan, const double &weakOD = DefaultWeakOD,
+        const double &moderateOD = DefaultModerateOD, const double &strongOD = DefaultStrongOD, const double &maxOD = DefaultMaxOD);
+    ///destructor
+    ~StainStatistics();
+
+    ///True if the plan is valid
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of stains with statistics
+    inline int GetNumberOfStains() const { return m_numStains; }
+    ///Number of pixels accumulated
+    inline long long GetPixelCount() const { return m_pixelCount; }
+    ///Width of a histogram bin in OD units
+    inline double GetBinWidth() const { return 1.0 / BinsPerOD; }
+    ///Histogram of a stain's quantities, read from its QuantileSketch: bin 0 holds the pixels without the stain,
+    ///bin k the quantities in ((k-1)*w, k*w], and the last bin also the quantities above the top of the histogram.
+    ///A quantity within the sketch's relative error (1/128) of a bin edge may be counted in the bin next to it.
+    inline std::vector<long long> GetHistogram(const int &stain) const {
+        return m_sketches.at(stain).GetHistogram(m_numBins, m_numBins * GetBinWidth());
+    }
+    ///OD threshold above which a pixel is in an intensity class (0 for NEGATIVE)
+    double GetIntensityThreshold(const IntensityClass &intensity) const;
+
+    ///Add a row of interleaved UInt8 pixels with srcChannels (3 or more) channels;
+    ///if mask is not null, only pixels where it is non-zero are added
+    void AddRow(const unsigned char *src, const int &srcChannels, const int &width, const unsigned char *mask = nullptr);
+    ///Add the counts and sums of another accumulator of the same plan and settings
+    void Merge(const StainStatistics &other);
+
+    ///Sum of the quantities of a stain over the pixels
+    double GetIntegratedOD(const int &stain) const;
+    ///Mean quantity of a stain (0 if no pixels were added)
+    double GetMeanOD(const int &stain) const;
+    ///Smallest quantity of a stain at or below which at least the given percentage (0 to 100) of them are,
+    ///within the error bounds of QuantileSketch
+    double GetPercentile(const int &stain, const double &percent) const;
+    ///Quantile sketch of a stain's quantities, from which percentiles and histograms of any bin count are read
+    inline const QuantileSketch& GetQuantileSketch(const int &stain) const { return m_sketches.at(stain); }
+    ///Number of pixels in an intensity class for a stain
+    long long GetIntensityCount(const int &stain, const IntensityClass &intensity) const;
+    ///Percentage of the pixels in an intensity class for a stain
+    double GetIntensityPercent(const int &stain, const IntensityClass &intensity) const;
+    ///H-score of a stain: percent weak + 2 x percent moderate + 3 x percent strong, from 0 to 300
+    double GetHScore(const int &stain) const;
+
+private:
+    bool m_isValid;
+    std::shared_ptr<const DeconvolutionPlan> m_plan;
+    int m_numStains;
+    int m_numBins;
+    double m_intensityThresholds[NUM_INTENSITY_CLASSES];
+    long long m_pixelCount;
+    ///Per stain: sum of the fixed point quantities, quantile sketch and intensity class counts
+    long long m_quantitySums[3];
+    std::vector<QuantileSketch> m_sketches;
+    long long m_intensityCounts[3][NUM_INTENSITY_CLASSES];
+};
+
+#endif
@@ -31,6 +31,8 @@
 #include <numeric>
 #include <algorithm>
 
+#include "SmallMatrix3x3.h"
+
 ///A class with static methods to operate on stain vectors
 class StainVectorMath
 {
@@ -57,7 +59,7 @@ public:
     ///Check whether rows of the given matrix sum to zero, but do not have all zero values
     static std::array<bool, 3> RowSumZeroCheck(const double (&inputMat)[9]);
 
-    ///Multiply a 3x3 matrix and a 3x1 vector to produce a 3x1 vector
+    ///Multiply a 3x3 matrix and a 3x1 vector to produce a 3x1 vector (see SmallMatrix3x3::MultiplyBatch for many vectors)
     static void Multiply3x3MatrixAndVector(const double (&inputMat)[9], const double (&inputVec)[3], double (&outputVec)[3]);
 
     ///Sort a 9-element stain vector profile according to R, G, and B values, in ascending or descending order depending on the third argument value.
@@ -67,7 +69,7 @@ public:
     template<class Ty, std::size_t N> 
     static std::array<Ty, N> NormalizeArray(std::array<Ty, N> arr) {
         std::array<Ty, N> out;
-        Ty norm = Norm<std::array<Ty, N>::iterator, Ty>(arr.begin(), arr.end());
+        Ty norm = Norm<typename std::array<Ty, N>::iterator, Ty>(arr.begin(), arr.end());
         //Check if the norm is zero. Return the input array if so.
         //Compare against C++11 zero initialization of the type Ty
         //Also check if the input container is empty
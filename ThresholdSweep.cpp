@@ -0,0 +1,197 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "ThresholdSweep.h"
+
+#include <cmath>
+
+const double ThresholdSweep::DefaultMaxOD = 3.0;
+
+ThresholdSweep::ThresholdSweep(std::shared_ptr<const DeconvolutionPlan> thePlan, const double &maxOD /*= DefaultMaxOD*/)
+    : m_isValid(false),
+    m_plan(thePlan),
+    m_numStains(0),
+    m_numBins((maxOD > 0.0) ? static_cast<int>(std::ceil(maxOD * BinsPerOD - 1e-6)) : 1),
+    m_totalCount(0)
+{
+    m_stainSums[0] = m_stainSums[1] = m_stainSums[2] = 0.0;
+    if ((m_plan == nullptr) || !m_plan->IsValid()) {
+        return;
+    }
+    m_numStains = m_plan->GetNumberOfStains();
+    m_numStains = (m_numStains > 3) ? 3 : ((m_numStains < 0) ? 0 : m_numStains);
+    const DeconvolutionPlan::Matrix9 &stainMatrix = m_plan->GetStainMatrix();
+    for (int s = 0; s < m_numStains; s++) {
+        m_stainSums[s] = stainMatrix[s * 3] + stainMatrix[s * 3 + 1] + stainMatrix[s * 3 + 2];
+    }
+    m_histograms.assign(m_numStains, std::vector<long long>(m_numBins + 1, 0));
+    m_isValid = true;
+}//end constructor
+
+ThresholdSweep::~ThresholdSweep() {
+}//end destructor
+
+void ThresholdSweep::AddRow(const unsigned char *src, const int &srcChannels, const int &width, 
+    const unsigned char *mask /*= nullptr*/) {
+    if (!m_isValid) {
+        return;
+    }
+    const DeconvolutionPlan &plan = *m_plan;
+    long long *histograms[3] = { nullptr, nullptr, nullptr };
+    for (int s = 0; s < m_numStains; s++) {
+        histograms[s] = m_histograms[s].data();
+    }
+    const double maxBin = static_cast<double>(m_numBins);
+    for (int x = 0; x < width; x++) {
+        if ((mask != nullptr) && (mask[x] == 0)) {
+            continue;
+        }
+        const unsigned char *p = src + x * srcChannels;
+        const double pixelOD[3] = { plan.LookupRGBtoOD(p[0]), plan.LookupRGBtoOD(p[1]), plan.LookupRGBtoOD(p[2]) };
+        for (int s = 0; s < m_numStains; s++) {
+            //Bin k holds the OD sums in ((k-1)/BinsPerOD, k/BinsPerOD]
+            const double position = std::ceil(plan.GetStainQuantity(pixelOD, s) * m_stainSums[s] * BinsPerOD);
+            const int bin = (position <= 0.0) ? 0 : ((position >= maxBin) ? m_numBins : static_cast<int>(position));
+            histograms[s][bin]++;
+        }
+        m_totalCount++;
+    }
+}//end AddRow
+
+void ThresholdSweep::Merge(const ThresholdSweep &other) {
+    if (!m_isValid || !other.m_isValid || (other.m_numStains != m_numStains) || (other.m_numBins != m_numBins)) {
+        return;
+    }
+    for (int s = 0; s < m_numStains; s++) {
+        for (int k = 0; k <= m_numBins; k++) {
+            m_histograms[s][k] += other.m_histograms[s][k];
+        }
+    }
+    m_totalCount += other.m_totalCount;
+}//end Merge
+
+long long ThresholdSweep::GetCountAbove(const int &stain, const double &threshold) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains)) {
+        return 0;
+    }
+    //Thresholds are rounded down to the grid, allowing for their decimal representation
+    if (threshold < 0.0) {
+        return m_totalCount;
+    }
+    const double position = std::floor(threshold * BinsPerOD + 1e-6);
+    const int first = (position >= m_numBins) ? m_numBins : static_cast<int>(position) + 1;
+    long long count = 0;
+    const std::vector<long long> &histogram = m_histograms[stain];
+    for (int k = first; k <= m_numBins; k++) {
+        count += histogram[k];
+    }
+    return count;
+}//end GetCountAbove
+
+double ThresholdSweep::GetFractionAbove(const int &stain, const double &threshold) const {
+    return (m_totalCount > 0) ? static_cast<double>(GetCountAbove(stain, threshold)) / static_cast<double>(m_totalCount) : 0.0;
+}//end GetFractionAbove
+
+std::vector<double> ThresholdSweep::GetCumulativeCurve(const int &stain) const {
+    std::vector<double> curve;
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains)) {
+        return curve;
+    }
+    curve.resize(m_numBins + 1, 0.0);
+    const std::vector<long long> &histogram = m_histograms[stain];
+    long long above = 0;
+    for (int k = m_numBins; k >= 0; k--) {
+        curve[k] = (m_totalCount > 0) ? static_cast<double>(above) / static_cast<double>(m_totalCount) : 0.0;
+        above += histogram[k];
+    }
+    return curve;
+}//end GetCumulativeCurve
+
+double ThresholdSweep::GetOtsuThreshold(const int &stain) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains) || (m_totalCount == 0)) {
+        return 0.0;
+    }
+    const std::vector<long long> &histogram = m_histograms[stain];
+    const double total = static_cast<double>(m_totalCount);
+    double totalMoment = 0.0;
+    for (int k = 0; k <= m_numBins; k++) {
+        totalMoment += static_cast<double>(k) * histogram[k];
+    }
+    //Pixels in bins 0 to k are below the threshold k*w, the rest above it
+    double below = 0.0, belowMoment = 0.0, bestVariance = -1.0;
+    int bestBin = 0;
+    for (int k = 0; k < m_numBins; k++) {
+        below += histogram[k];
+        belowMoment += static_cast<double>(k) * histogram[k];
+        const double above = total - below;
+        if ((below <= 0.0) || (above <= 0.0)) {
+            continue;
+        }
+        const double meanDifference = belowMoment / below - (totalMoment - belowMoment) / above;
+        const double variance = below * above * meanDifference * meanDifference;
+        if (variance > bestVariance) {
+            bestVariance = variance;
+            bestBin = k;
+        }
+    }
+    return bestBin * GetBinWidth();
+}//end GetOtsuThreshold
+
+double ThresholdSweep::GetTriangleThreshold(const int &stain) const {
+    if (!m_isValid || (stain < 0) || (stain >= m_numStains) || (m_totalCount == 0)) {
+        return 0.0;
+    }
+    const std::vector<long long> &histogram = m_histograms[stain];
+    int peak = 0, lowest = -1, highest = 0;
+    for (int k = 0; k <= m_numBins; k++) {
+        if (histogram[k] > histogram[peak]) {
+            peak = k;
+        }
+        if (histogram[k] > 0) {
+            lowest = (lowest < 0) ? k : lowest;
+            highest = k;
+        }
+    }
+    //The line runs from the peak to the end of the longer tail; the threshold is at the
+    //bin farthest below it, and the pixels above that bin are stained
+    const int end = ((highest - peak) >= (peak - lowest)) ? highest : lowest;
+    if (end == peak) {
+        return peak * GetBinWidth();
+    }
+    const double dx = static_cast<double>(end - peak);
+    const double dy = static_cast<double>(histogram[end] - histogram[peak]);
+    const int step = (end > peak) ? 1 : -1;
+    int bestBin = peak;
+    double bestDistance = 0.0;
+    for (int k = peak + step; k != end; k += step) {
+        //Proportional to the distance of (k, histogram[k]) from the line, positive below it
+        const double distance = (dy * (k - peak) - dx * static_cast<double>(histogram[k] - histogram[peak])) * step;
+        if (distance > bestDistance) {
+            bestDistance = distance;
+            bestBin = k;
+        }
+    }
+    return bestBin * GetBinWidth();
+}//end GetTriangleThreshold
@@ -0,0 +1,100 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_THRESHOLDSWEEP_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_THRESHOLDSWEEP_H
+
+#include <memory>
+#include <vector>
+
+#include "DeconvolutionPlan.h"
+
+///Histograms of the OD sum of each stain of a plan (the value compared with the OD threshold),
+///accumulated in one pass over the pixels of a region. The fraction of pixels above any threshold
+///on the histogram grid, and so the whole cumulative curve, is then read without separating the
+///region again, and a threshold can be suggested from the shape of the histogram.
+///
+///Bin 0 holds the pixels with no stain; bin k (1 to GetNumberOfBins()) holds the OD sums in
+///((k-1)*w, k*w], where w is GetBinWidth(); the last bin also holds the OD sums above the maximum.
+///The count above a threshold on the grid is exact, up to OD sums within rounding of it.
+///Accumulators for parts of a region can be merged in any order with the same result.
+class ThresholdSweep
+{
+public:
+    ///Number of bins per unit of OD, giving the step of the OD threshold slider
+    static const int BinsPerOD = 100;
+    ///Largest OD threshold on the grid by default, the maximum of the OD threshold slider
+    static const double DefaultMaxOD;
+
+public:
+    ///Accumulate the stains of a plan, on a grid of thresholds from 0 to maxOD
+    explicit ThresholdSweep(std::shared_ptr<const DeconvolutionPlan> thePlan, const double &maxOD = DefaultMaxOD);
+    ///destructor
+    ~ThresholdSweep();
+
+    ///True if the plan is valid
+    inline bool IsValid() const { return m_isValid; }
+    ///Number of stains with a histogram
+    inline int GetNumberOfStains() const { return m_numStains; }
+    ///Number of bins above bin 0
+    inline int GetNumberOfBins() const { return m_numBins; }
+    ///Width of a bin in OD units
+    inline double GetBinWidth() const { return 1.0 / BinsPerOD; }
+    ///Number of pixels accumulated
+    inline long long GetTotalCount() const { return m_totalCount; }
+    ///Histogram of a stain, GetNumberOfBins() + 1 counts
+    inline const std::vector<long long>& GetHistogram(const int &stain) const { return m_histograms.at(stain); }
+
+    ///Add a row of interleaved UInt8 pixels with srcChannels (3 or more) channels;
+    ///if mask is not null, only pixels where it is non-zero are added
+    void AddRow(const unsigned char *src, const int &srcChannels, const int &width, const unsigned char *mask = nullptr);
+    ///Add the counts of another accumulator of the same plan and grid
+    void Merge(const ThresholdSweep &other);
+
+    ///Number of pixels whose OD sum of the stain is above the threshold, rounded down to the grid
+    long long GetCountAbove(const int &stain, const double &threshold) const;
+    ///Fraction of the pixels whose OD sum of the stain is above the threshold (0 if none were added)
+    double GetFractionAbove(const int &stain, const double &threshold) const;
+    ///Fraction above each threshold k*GetBinWidth() of the grid, for k from 0 to GetNumberOfBins()
+    std::vector<double> GetCumulativeCurve(const int &stain) const;
+
+    ///Threshold on the grid that maximizes the between-class variance of the histogram (Otsu)
+    double GetOtsuThreshold(const int &stain) const;
+    ///Threshold on the grid farthest from the line joining the peak of the histogram to the end of
+    ///its longer tail (triangle method), suited to a large peak of unstained pixels
+    double GetTriangleThreshold(const int &stain) const;
+
+private:
+    bool m_isValid;
+    std::shared_ptr<const DeconvolutionPlan> m_plan;
+    int m_numStains;
+    int m_numBins;
+    ///Sum of the stain vector components of each stain: the OD sum of a stain is its quantity times this
+    double m_stainSums[3];
+    long long m_totalCount;
+    std::vector<std::vector<long long>> m_histograms;
+};
+
+#endif
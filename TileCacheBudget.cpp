@@ -0,0 +1,90 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "TileCacheBudget.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+const char *const TileCacheBudget::EnvironmentVariable = "STAIN_ANALYSIS_TILE_CACHE_MB";
+
+namespace {
+    ///Raise an atomic value to candidate if it is lower
+    void raiseTo(std::atomic<int> &value, const int &candidate) {
+        int current = value.load(std::memory_order_relaxed);
+        while ((candidate > current) && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+        }
+    }//end raiseTo
+}
+
+TileCacheBudget::TileCacheBudget(const long long &budgetBytes /*= DefaultBudgetMB * 1024 * 1024*/)
+    : m_budgetBytes((budgetBytes > 0) ? budgetBytes : 0),
+    m_tileWidth(0),
+    m_tileHeight(0)
+{
+}//end constructor
+
+TileCacheBudget::~TileCacheBudget() {
+}//end destructor
+
+std::shared_ptr<TileCacheBudget> TileCacheBudget::FromEnvironment() {
+    const char *value = std::getenv(EnvironmentVariable);
+    if (value != nullptr) {
+        char *end = nullptr;
+        const long long budgetMB = std::strtoll(value, &end, 10);
+        //Ignore values that are not a positive whole number of megabytes
+        if ((end != value) && (*end == '\0') && (budgetMB > 0)) {
+            return std::make_shared<TileCacheBudget>(budgetMB * 1024 * 1024);
+        }
+    }
+    return std::make_shared<TileCacheBudget>();
+}//end FromEnvironment
+
+void TileCacheBudget::ObserveTile(const int &width, const int &height) {
+    raiseTo(m_tileWidth, width);
+    raiseTo(m_tileHeight, height);
+}//end ObserveTile
+
+int TileCacheBudget::GetTileWidth() const {
+    const int width = m_tileWidth.load(std::memory_order_relaxed);
+    return (width > 0) ? width : DefaultTileSize;
+}//end GetTileWidth
+
+int TileCacheBudget::GetTileHeight() const {
+    const int height = m_tileHeight.load(std::memory_order_relaxed);
+    return (height > 0) ? height : DefaultTileSize;
+}//end GetTileHeight
+
+int TileCacheBudget::GetTileCount(const double &share, const int &bytesPerPixel) const {
+    const long long tileBytes = static_cast<long long>(GetTileWidth()) 
+        * GetTileHeight() * std::max(bytesPerPixel, 1);
+    const double clampedShare = std::min(std::max(share, 0.0), 1.0);
+    const double numTiles = clampedShare * static_cast<double>(m_budgetBytes) / static_cast<double>(tileBytes);
+    if (numTiles >= static_cast<double>(std::numeric_limits<int>::max())) {
+        return std::numeric_limits<int>::max();
+    }
+    return std::max(static_cast<int>(numTiles), static_cast<int>(MinimumTiles));
+}//end GetTileCount
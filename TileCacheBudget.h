@@ -0,0 +1,79 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILECACHEBUDGET_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILECACHEBUDGET_H
+
+#include <atomic>
+#include <memory>
+
+///A memory budget in bytes for the tile caches of the display pipeline, converted to
+///a number of tiles for each cache from the size of its tiles. The budget is read from
+///the environment variable STAIN_ANALYSIS_TILE_CACHE_MB, so that it can be set per
+///deployment, and shared between the caches in proportion to the given shares.
+///The tile size is that of the slide: the kernels report each tile they process with
+///ObserveTile, and caches are sized for the largest tile seen.
+class TileCacheBudget
+{
+public:
+    ///Budget used if the environment variable is not set or not valid
+    static const long long DefaultBudgetMB = 256;
+    ///Name of the environment variable holding the budget in megabytes
+    static const char *const EnvironmentVariable;
+    ///Edge length of a cached tile in pixels, until a tile has been observed
+    static const int DefaultTileSize = 256;
+    ///Fewest tiles a cache is given, so that a small budget still covers a viewport
+    static const int MinimumTiles = 8;
+
+public:
+    ///Budget in bytes
+    explicit TileCacheBudget(const long long &budgetBytes = DefaultBudgetMB * 1024 * 1024);
+    ///destructor
+    ~TileCacheBudget();
+
+    ///Budget from the environment variable, or the default budget
+    static std::shared_ptr<TileCacheBudget> FromEnvironment();
+
+    ///Budget in bytes
+    inline long long GetBudgetBytes() const { return m_budgetBytes; }
+
+    ///Record the size of a tile processed by the pipeline; may be called from several threads at once
+    void ObserveTile(const int &width, const int &height);
+    ///Width of the widest tile observed, or DefaultTileSize if none has been
+    int GetTileWidth() const;
+    ///Height of the tallest tile observed, or DefaultTileSize if none has been
+    int GetTileHeight() const;
+
+    ///Number of tiles of GetTileWidth() x GetTileHeight() pixels of bytesPerPixel bytes that fit in
+    ///the given share (0 to 1) of the budget, and at least MinimumTiles
+    int GetTileCount(const double &share, const int &bytesPerPixel) const;
+
+private:
+    long long m_budgetBytes;
+    std::atomic<int> m_tileWidth;
+    std::atomic<int> m_tileHeight;
+};
+
+#endif
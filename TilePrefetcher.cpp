@@ -0,0 +1,85 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "TilePrefetcher.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    TilePrefetcher::TilePrefetcher() :
+        m_stop(false)
+    {
+    }//end constructor
+
+    TilePrefetcher::~TilePrefetcher() {
+        Stop();
+    }//end destructor
+
+    void TilePrefetcher::Start(std::shared_ptr<Factory> factory, const std::vector<ViewportPredictor::View> &chunks,
+        std::shared_ptr<ViewportPredictor> predictor) {
+        Stop();
+        if ((factory == nullptr) || chunks.empty()) {
+            return;
+        }
+        m_stop = false;
+        m_thread = std::thread(&TilePrefetcher::Prefetch, this, factory, chunks, predictor);
+    }//end Start
+
+    void TilePrefetcher::Stop() {
+        m_stop = true;
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }//end Stop
+
+    void TilePrefetcher::Prefetch(std::shared_ptr<Factory> factory, std::vector<ViewportPredictor::View> chunks,
+        std::shared_ptr<ViewportPredictor> predictor) {
+#ifdef _WIN32
+        //Leave the processors to the display first
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif
+        Compositor compositor(factory);
+        for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+            if (m_stop) {
+                return;
+            }
+            //The result is discarded: computing it puts the tiles in the factory's cache
+            const Rect rect(Point(static_cast<int>(it->x), static_cast<int>(it->y)),
+                Size(static_cast<int>(it->width), static_cast<int>(it->height)));
+            compositor.getImage(it->level, rect);
+            if (predictor != nullptr) {
+                predictor->MarkPrefetched(*it);
+            }
+        }
+    }//end Prefetch
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
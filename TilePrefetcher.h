@@ -0,0 +1,76 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEPREFETCHER_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEPREFETCHER_H
+
+#include "Global.h"
+#include "Geometry.h"
+#include "Image.h"
+#include "image/tile/Factory.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//Plugin includes
+#include "ViewportPredictor.h"
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    /// Computes predicted chunks of a factory's output on a low priority background thread,
+    /// so that they are in the factory's cache before they are displayed. Prefetching is
+    /// stopped between chunks as soon as Stop is called, so that requests for the
+    /// displayed tiles do not wait for it.
+    class TilePrefetcher {
+    public:
+        TilePrefetcher();
+        /// Stops prefetching
+        ~TilePrefetcher();
+
+        /// Stop any prefetching in progress, then start computing the chunks in order,
+        /// marking each in the predictor once it is done
+        void Start(std::shared_ptr<Factory> factory, const std::vector<ViewportPredictor::View> &chunks,
+            std::shared_ptr<ViewportPredictor> predictor);
+        /// Stop prefetching and wait for the chunk being computed
+        void Stop();
+
+    private:
+        /// Body of the background thread
+        void Prefetch(std::shared_ptr<Factory> factory, std::vector<ViewportPredictor::View> chunks,
+            std::shared_ptr<ViewportPredictor> predictor);
+
+    private:
+        std::thread m_thread;
+        std::atomic<bool> m_stop;
+    };
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
+#endif
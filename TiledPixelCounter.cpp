@@ -0,0 +1,178 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "TiledPixelCounter.h"
+#include "ImagePixelAccess.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    RegionMaskKernel::RegionMaskKernel() :
+        m_outputColorSpace(ColorModel::Grayscale, ChannelType::UInt8)
+    {
+    }//end constructor
+
+    RegionMaskKernel::~RegionMaskKernel() {
+    }//end destructor
+
+    RawImage RegionMaskKernel::doProcessData(const RawImage &source) {
+        RawImage outputImage(source.size(), m_outputColorSpace);
+        outputImage.fill(255);
+        return outputImage;
+    }//end doProcessData
+
+    const ColorSpace& RegionMaskKernel::doGetColorSpace() const {
+        return m_outputColorSpace;
+    }
+
+    TiledPixelCounter::TiledPixelCounter(std::shared_ptr<Factory> output, 
+        std::shared_ptr<Factory> mask /*= nullptr*/, std::shared_ptr<const TissueMask> tissue /*= nullptr*/) :
+        m_output(output),
+        m_mask(mask),
+        m_tissue(tissue)
+    {
+    }//end constructor
+
+    TiledPixelCounter::~TiledPixelCounter() {
+    }//end destructor
+
+    TiledPixelCounter::Counts TiledPixelCounter::Count(const Rect &region, const int &level, const int &chunkSize) const {
+        Counts counts = { 0, 0 };
+        if ((m_output == nullptr) || (chunkSize < 1) || (region.width() < 1) || (region.height() < 1)) {
+            return counts;
+        }
+        const int chunkColumns = (region.width() + chunkSize - 1) / chunkSize;
+        const int chunkRows = (region.height() + chunkSize - 1) / chunkSize;
+        const int numChunks = chunkColumns * chunkRows;
+
+        //Each thread composites its own chunks and keeps its own counts; they are summed at the end
+        long long covered = 0, total = 0;
+#pragma omp parallel reduction(+:covered,total)
+        {
+            Compositor outputCompositor(m_output);
+            std::unique_ptr<Compositor> maskCompositor;
+            if (m_mask != nullptr) {
+                maskCompositor = std::make_unique<Compositor>(m_mask);
+            }
+            std::vector<unsigned char> tissueTile;
+#pragma omp for schedule(dynamic)
+            for (int c = 0; c < numChunks; c++) {
+                const int x = region.x() + (c % chunkColumns) * chunkSize;
+                const int y = region.y() + (c / chunkColumns) * chunkSize;
+                const int w = std::min(chunkSize, region.x() + region.width() - x);
+                const int h = std::min(chunkSize, region.y() + region.height() - y);
+                const Rect chunk(Point(x, y), Size(w, h));
+                //A chunk of glass has no pixels to count
+                if ((m_tissue != nullptr) && !m_tissue->IntersectsTissue(x, y, w, h)) {
+                    continue;
+                }
+
+                RawImage outputTile = outputCompositor.getImage(level, chunk);
+                const unsigned char *tissuePixels = nullptr;
+                if ((m_tissue != nullptr) && (outputTile.width() > 0) && (outputTile.height() > 0)) {
+                    tissueTile.resize(static_cast<size_t>(outputTile.width()) * outputTile.height());
+                    m_tissue->GetTileMask(x, y, outputTile.width(), outputTile.height(),
+                        static_cast<double>(w) / outputTile.width(), static_cast<double>(h) / outputTile.height(), tissueTile.data());
+                    tissuePixels = tissueTile.data();
+                }
+                Counts chunkCounts;
+                if (maskCompositor != nullptr) {
+                    RawImage maskTile = maskCompositor->getImage(level, chunk);
+                    chunkCounts = CountTile(outputTile, &maskTile, tissuePixels);
+                }
+                else {
+                    chunkCounts = CountTile(outputTile, nullptr, tissuePixels);
+                }
+                covered += chunkCounts.covered;
+                total += chunkCounts.total;
+            }
+        }
+        counts.covered = covered;
+        counts.total = total;
+        return counts;
+    }//end Count
+
+    TiledPixelCounter::Counts TiledPixelCounter::CountTile(const RawImage &output, const RawImage *mask, 
+        const unsigned char *tissue /*= nullptr*/) {
+        Counts counts = { 0, 0 };
+        //Only the colour channels are considered: 1 for a grayscale image, 3 otherwise
+        const int channelCount = (output.colorSpace().channelCount() > 1) ? 3 : 1;
+        int width = output.width();
+        int height = output.height();
+        if (mask != nullptr) {
+            width = std::min(width, mask->width());
+            height = std::min(height, mask->height());
+        }
+
+        //Fast path: contiguous interleaved UInt8 rows
+        const bool fastMask = (mask == nullptr) || isInterleavedUInt8(*mask, 1);
+        if (isInterleavedUInt8(output, channelCount) && fastMask) {
+            const int outputStride = output.width() * output.colorSpace().channelCount();
+            const int outputStep = output.colorSpace().channelCount();
+            const unsigned char *outputPixels = rawPixels(output);
+            const unsigned char *maskPixels = (mask != nullptr) ? rawPixels(*mask) : nullptr;
+            const int maskStride = (mask != nullptr) ? mask->width() * mask->colorSpace().channelCount() : 0;
+            const int maskStep = (mask != nullptr) ? mask->colorSpace().channelCount() : 0;
+            for (int y = 0; y < height; y++) {
+                const unsigned char *p = outputPixels + y * outputStride;
+                const unsigned char *m = (maskPixels != nullptr) ? maskPixels + y * maskStride : nullptr;
+                const unsigned char *t = (tissue != nullptr) ? tissue + y * output.width() : nullptr;
+                for (int x = 0; x < width; x++, p += outputStep) {
+                    if (((m != nullptr) && (m[x * maskStep] == 0)) || ((t != nullptr) && (t[x] == 0))) {
+                        continue;
+                    }
+                    counts.total++;
+                    counts.covered += (channelCount == 1) ? (p[0] != 0) : ((p[0] | p[1] | p[2]) != 0);
+                }
+            }
+            return counts;
+        }
+
+        //Fallback for other channel types or layouts
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                if ((mask != nullptr) && (mask->at(x, y, 0).as<int>() == 0)) {
+                    continue;
+                }
+                if ((tissue != nullptr) && (tissue[y * output.width() + x] == 0)) {
+                    continue;
+                }
+                counts.total++;
+                counts.covered += (channelCount == 1)
+                    ? (output.at(x, y, 0).as<int>() != 0)
+                    : ((output.at(x, y, 0).as<int>() != 0)
+                       || (output.at(x, y, 1).as<int>() != 0)
+                       || (output.at(x, y, 2).as<int>() != 0));
+            }
+        }
+        return counts;
+    }//end CountTile
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
@@ -0,0 +1,97 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDPIXELCOUNTER_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDPIXELCOUNTER_H
+
+#include "Global.h"
+#include "Geometry.h"
+#include "Image.h"
+#include "image/filter/Kernel.h"
+#include "image/tile/Factory.h"
+#include "global/ColorSpace.h"
+#include "TissueMask.h"
+
+#include <memory>
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    /// Outputs a grayscale image with every pixel set to 255.
+    /// Wrapped in a RegionFactory, it gives a mask of the pixels inside the region.
+    class PATHCORE_IMAGE_API RegionMaskKernel : public Kernel {
+    public:
+        RegionMaskKernel();
+        virtual ~RegionMaskKernel();
+
+    private:
+        /// \cond INTERNAL
+        virtual RawImage doProcessData(const RawImage &source);
+        virtual const ColorSpace& doGetColorSpace() const;
+
+        ColorSpace m_outputColorSpace;
+        /// \endcond
+    };
+
+    /// Counts the non-zero (covered) pixels in the output of a factory, one chunk of
+    /// the region at a time in parallel, without compositing the whole region.
+    /// If a mask factory is given, only pixels where the mask is non-zero are counted,
+    /// so the total is exact for a polygonal region rather than its bounding rectangle.
+    /// If a tissue mask is given, only tissue pixels are counted, and chunks without
+    /// tissue are skipped without compositing them.
+    class TiledPixelCounter {
+    public:
+        /// Number of covered pixels and total number of pixels counted
+        struct Counts {
+            long long covered;
+            long long total;
+        };
+
+    public:
+        /// \param output factory whose pixels are counted as covered if any colour channel is non-zero
+        /// \param mask optional factory, non-zero inside the region to count
+        /// \param tissue optional tissue mask of the slide, restricting the count to tissue
+        TiledPixelCounter(std::shared_ptr<Factory> output, std::shared_ptr<Factory> mask = nullptr,
+            std::shared_ptr<const TissueMask> tissue = nullptr);
+        ~TiledPixelCounter();
+
+        /// Count the pixels of a rectangle (in full resolution coordinates) at the given resolution level,
+        /// in square chunks chunkSize full resolution pixels wide
+        Counts Count(const Rect &region, const int &level, const int &chunkSize) const;
+
+        /// Count the covered pixels of one output tile, within the mask tile if it is not null,
+        /// and where tissue (one byte per output pixel, non-zero for tissue) is non-zero if it is not null
+        static Counts CountTile(const RawImage &output, const RawImage *mask, const unsigned char *tissue = nullptr);
+
+    private:
+        std::shared_ptr<Factory> m_output;
+        std::shared_ptr<Factory> m_mask;
+        std::shared_ptr<const TissueMask> m_tissue;
+    };
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
+#endif
@@ -0,0 +1,116 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "TiledRegionScan.h"
+#include "ImagePixelAccess.h"
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    TiledRegionScan::TiledRegionScan(std::shared_ptr<Factory> source,
+        std::shared_ptr<Factory> mask /*= nullptr*/, std::shared_ptr<const TissueMask> tissue /*= nullptr*/) :
+        m_source(source),
+        m_mask(mask),
+        m_tissue(tissue)
+    {
+    }//end constructor
+
+    TiledRegionScan::~TiledRegionScan() {
+    }//end destructor
+
+    bool TiledRegionScan::ReadChunk(Compositor &sourceCompositor, Compositor *maskCompositor, const Rect &chunkRect,
+        const int &level, Chunk &chunk) const {
+        //A chunk of glass has no pixels to add
+        if ((m_tissue != nullptr) && !m_tissue->IntersectsTissue(chunkRect.x(), chunkRect.y(), chunkRect.width(), chunkRect.height())) {
+            return false;
+        }
+        chunk.source = sourceCompositor.getImage(level, chunkRect);
+        chunk.width = chunk.source.width();
+        chunk.height = chunk.source.height();
+        if ((chunk.width < 1) || (chunk.height < 1) || (chunk.source.colorSpace().channelCount() < 3)) {
+            return false;
+        }
+
+        //Fast path: contiguous interleaved UInt8 rows are read in place
+        if (isInterleavedUInt8(chunk.source, 3)) {
+            chunk.pixels = rawPixels(chunk.source);
+            chunk.channels = chunk.source.colorSpace().channelCount();
+        }
+        else {
+            //Fallback for other channel types or layouts
+            chunk.channels = 3;
+            chunk.converted.resize(static_cast<size_t>(chunk.width) * chunk.height * 3);
+            for (int y = 0; y < chunk.height; y++) {
+                for (int x = 0; x < chunk.width; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        chunk.converted[(static_cast<size_t>(y) * chunk.width + x) * 3 + c] 
+                            = static_cast<unsigned char>(chunk.source.at(x, y, c).as<int>());
+                    }
+                }
+            }
+            chunk.pixels = chunk.converted.data();
+        }
+
+        //The pixels to add: tissue, within the region
+        chunk.mask.assign(static_cast<size_t>(chunk.width) * chunk.height, 255);
+        if (m_tissue != nullptr) {
+            m_tissue->GetTileMask(chunkRect.x(), chunkRect.y(), chunk.width, chunk.height,
+                static_cast<double>(chunkRect.width()) / chunk.width, static_cast<double>(chunkRect.height()) / chunk.height,
+                chunk.mask.data());
+        }
+        if (maskCompositor != nullptr) {
+            std::vector<unsigned char> combined;
+            CombineMask(chunk, maskCompositor->getImage(level, chunkRect), combined);
+            chunk.mask.swap(combined);
+        }
+        return true;
+    }//end ReadChunk
+
+    bool TiledRegionScan::CombineMask(const Chunk &chunk, const RawImage &maskTile, std::vector<unsigned char> &combined) {
+        combined.assign(chunk.mask.begin(), chunk.mask.end());
+        bool any = false;
+        const bool fastMask = isInterleavedUInt8(maskTile, 1);
+        const unsigned char *maskPixels = fastMask ? rawPixels(maskTile) : nullptr;
+        const int maskStep = maskTile.colorSpace().channelCount();
+        for (int y = 0; y < chunk.height; y++) {
+            unsigned char *m = combined.data() + static_cast<size_t>(y) * chunk.width;
+            for (int x = 0; x < chunk.width; x++) {
+                if (m[x] == 0) {
+                    continue;
+                }
+                const bool inside = (x < maskTile.width()) && (y < maskTile.height()) && (fastMask
+                    ? (maskPixels[(static_cast<size_t>(y) * maskTile.width() + x) * maskStep] != 0)
+                    : (maskTile.at(x, y, 0).as<int>() != 0));
+                m[x] = inside ? 255 : 0;
+                any = any || inside;
+            }
+        }
+        return any;
+    }//end CombineMask
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
@@ -0,0 +1,179 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDREGIONSCAN_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDREGIONSCAN_H
+
+#include "Global.h"
+#include "Geometry.h"
+#include "Image.h"
+#include "image/tile/Factory.h"
+#include "TissueMask.h"
+#include "RegionBatchPlan.h"
+#include "RegionList.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace sedeen {
+namespace image {
+namespace tile {
+
+    /// Reads the source pixels of a region one chunk at a time, in parallel, and adds them to one
+    /// accumulator per thread; the accumulators are merged when the region has been read. Only the
+    /// pixels where the mask factory (if given) is non-zero and that are tissue (if a tissue mask is
+    /// given) are added, and chunks without tissue are not read at all.
+    ///
+    /// An Accumulator is copyable and has the methods
+    /// AddRow(const unsigned char *src, int srcChannels, int width, const unsigned char *mask), given
+    /// interleaved UInt8 pixels and one byte per pixel that is zero for pixels to leave out, and
+    /// Merge(const Accumulator &other). Its result should not depend on the order of the merges.
+    class TiledRegionScan {
+    public:
+        /// The pixels of one chunk, as interleaved UInt8 rows, and which of them to add
+        struct Chunk {
+            RawImage source;
+            std::vector<unsigned char> converted;
+            const unsigned char *pixels;
+            int channels;
+            int width;
+            int height;
+            std::vector<unsigned char> mask;
+        };
+
+    public:
+        /// \param source factory of the RGB source image
+        /// \param mask optional factory, non-zero inside the region to read
+        /// \param tissue optional tissue mask of the slide, restricting the pixels read to tissue
+        TiledRegionScan(std::shared_ptr<Factory> source, std::shared_ptr<Factory> mask = nullptr,
+            std::shared_ptr<const TissueMask> tissue = nullptr);
+        ~TiledRegionScan();
+
+        /// Add the pixels of a rectangle (in full resolution coordinates) at the given resolution level
+        /// to copies of empty, in square chunks chunkSize full resolution pixels wide, and merge them
+        template <class Accumulator>
+        Accumulator Scan(const Rect &region, const int &level, const int &chunkSize, const Accumulator &empty) const {
+            Accumulator result(empty);
+            if ((m_source == nullptr) || (chunkSize < 1) || (region.width() < 1) || (region.height() < 1)) {
+                return result;
+            }
+            const int chunkColumns = (region.width() + chunkSize - 1) / chunkSize;
+            const int chunkRows = (region.height() + chunkSize - 1) / chunkSize;
+            const int numChunks = chunkColumns * chunkRows;
+#pragma omp parallel
+            {
+                Accumulator local(empty);
+                Compositor sourceCompositor(m_source);
+                std::unique_ptr<Compositor> maskCompositor;
+                if (m_mask != nullptr) {
+                    maskCompositor = std::make_unique<Compositor>(m_mask);
+                }
+                Chunk chunk;
+#pragma omp for schedule(dynamic)
+                for (int c = 0; c < numChunks; c++) {
+                    const int x = region.x() + (c % chunkColumns) * chunkSize;
+                    const int y = region.y() + (c / chunkColumns) * chunkSize;
+                    const int w = std::min(chunkSize, region.x() + region.width() - x);
+                    const int h = std::min(chunkSize, region.y() + region.height() - y);
+                    if (!ReadChunk(sourceCompositor, maskCompositor.get(), Rect(Point(x, y), Size(w, h)), level, chunk)) {
+                        continue;
+                    }
+                    for (int j = 0; j < chunk.height; j++) {
+                        local.AddRow(chunk.pixels + static_cast<size_t>(j) * chunk.width * chunk.channels, chunk.channels,
+                            chunk.width, chunk.mask.data() + static_cast<size_t>(j) * chunk.width);
+                    }
+                }
+#pragma omp critical
+                result.Merge(local);
+            }
+            return result;
+        }
+
+        /// Add the pixels of many regions at the given resolution level to one copy of empty per region,
+        /// reading each chunk of the plan once. The plan is of the bounding boxes of the regions, and a
+        /// pixel is added to every region whose polygon contains its centre. The mask factory given to
+        /// the constructor, if any, is not used.
+        template <class Accumulator>
+        std::vector<Accumulator> ScanRegions(const RegionBatchPlan &plan, const RegionList &regions,
+            const int &level, const Accumulator &empty) const {
+            const int numRegions = plan.GetNumberOfRegions();
+            std::vector<Accumulator> results(numRegions, empty);
+            if ((m_source == nullptr) || (regions.GetNumberOfRegions() < numRegions)) {
+                return results;
+            }
+            const std::vector<RegionBatchPlan::Chunk> &chunks = plan.GetChunks();
+            const int numChunks = static_cast<int>(chunks.size());
+#pragma omp parallel
+            {
+                std::vector<Accumulator> local(numRegions, empty);
+                Compositor sourceCompositor(m_source);
+                Chunk chunk;
+                std::vector<unsigned char> regionMask;
+                //Chunks are taken in plan order, so the threads read neighbouring chunks at the same time
+#pragma omp for schedule(dynamic)
+                for (int c = 0; c < numChunks; c++) {
+                    const RegionBatchPlan::Box &box = chunks[c].box;
+                    const Rect chunkRect(Point(static_cast<int>(box.x), static_cast<int>(box.y)), 
+                        Size(static_cast<int>(box.width), static_cast<int>(box.height)));
+                    if (!ReadChunk(sourceCompositor, nullptr, chunkRect, level, chunk)) {
+                        continue;
+                    }
+                    for (auto r = chunks[c].regions.begin(); r != chunks[c].regions.end(); ++r) {
+                        regionMask.assign(chunk.mask.begin(), chunk.mask.end());
+                        if (!regions.ClearOutside(*r, static_cast<double>(box.x), static_cast<double>(box.y), chunk.width, chunk.height,
+                            static_cast<double>(box.width) / chunk.width, static_cast<double>(box.height) / chunk.height, regionMask.data())) {
+                            continue;
+                        }
+                        for (int j = 0; j < chunk.height; j++) {
+                            local[*r].AddRow(chunk.pixels + static_cast<size_t>(j) * chunk.width * chunk.channels, chunk.channels,
+                                chunk.width, regionMask.data() + static_cast<size_t>(j) * chunk.width);
+                        }
+                    }
+                }
+#pragma omp critical
+                for (int r = 0; r < numRegions; r++) {
+                    results[r].Merge(local[r]);
+                }
+            }
+            return results;
+        }
+
+        /// Read one chunk; return false if it has no pixels to add
+        bool ReadChunk(Compositor &sourceCompositor, Compositor *maskCompositor, const Rect &chunkRect,
+            const int &level, Chunk &chunk) const;
+        /// The pixels of a chunk to add that are also non-zero in a mask tile; return false if there are none
+        static bool CombineMask(const Chunk &chunk, const RawImage &maskTile, std::vector<unsigned char> &combined);
+
+    private:
+        std::shared_ptr<Factory> m_source;
+        std::shared_ptr<Factory> m_mask;
+        std::shared_ptr<const TissueMask> m_tissue;
+    };
+
+} // namespace tile
+} // namespace image
+} // namespace sedeen
+#endif
@@ -0,0 +1,390 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#include "TiledTIFFWriter.h"
+
+namespace {
+    //TIFF field types
+    const unsigned short TIFF_SHORT = 3;
+    const unsigned short TIFF_LONG = 4;
+    const unsigned short TIFF_LONG8 = 16;
+    //TIFF tags, in the ascending order they must appear in a directory
+    const unsigned short TAG_NEW_SUBFILE_TYPE = 254;
+    const unsigned short TAG_IMAGE_WIDTH = 256;
+    const unsigned short TAG_IMAGE_LENGTH = 257;
+    const unsigned short TAG_BITS_PER_SAMPLE = 258;
+    const unsigned short TAG_COMPRESSION = 259;
+    const unsigned short TAG_PHOTOMETRIC = 262;
+    const unsigned short TAG_SAMPLES_PER_PIXEL = 277;
+    const unsigned short TAG_PLANAR_CONFIGURATION = 284;
+    const unsigned short TAG_TILE_WIDTH = 322;
+    const unsigned short TAG_TILE_LENGTH = 323;
+    const unsigned short TAG_TILE_OFFSETS = 324;
+    const unsigned short TAG_TILE_BYTE_COUNTS = 325;
+    const unsigned short COMPRESSION_PACKBITS = 32773;
+
+    ///Append an unsigned integer of the given number of bytes in little-endian order
+    void appendLittleEndian(std::vector<unsigned char> &buffer, unsigned long long value, const int &bytes) {
+        for (int b = 0; b < bytes; b++) {
+            buffer.push_back(static_cast<unsigned char>(value & 0xFF));
+            value >>= 8;
+        }
+    }
+
+    ///Append a BigTIFF directory entry; values of up to 8 bytes are stored in the entry itself
+    void appendEntry(std::vector<unsigned char> &buffer, const unsigned short &tag, const unsigned short &type,
+        const unsigned long long &count, const unsigned long long &valueOrOffset) {
+        appendLittleEndian(buffer, tag, 2);
+        appendLittleEndian(buffer, type, 2);
+        appendLittleEndian(buffer, count, 8);
+        appendLittleEndian(buffer, valueOrOffset, 8);
+    }
+}
+
+TiledTIFFWriter::TiledTIFFWriter(const int &width, const int &height, const int &channels, const int &tileSize /*= 256*/)
+    : m_width(width),
+    m_height(height),
+    m_channels(channels),
+    m_tileSize(tileSize),
+    m_blockLevel(0),
+    m_source(nullptr),
+    m_failed(false)
+{
+    //Halve the image until a level fits in a single tile
+    Level level;
+    level.width = (m_width > 0) ? m_width : 1;
+    level.height = (m_height > 0) ? m_height : 1;
+    while (true) {
+        level.tilesAcross = (level.width + m_tileSize - 1) / m_tileSize;
+        level.tilesDown = (level.height + m_tileSize - 1) / m_tileSize;
+        m_levels.push_back(level);
+        if ((level.tilesAcross == 1) && (level.tilesDown == 1)) {
+            break;
+        }
+        level.width = (level.width + 1) / 2;
+        level.height = (level.height + 1) / 2;
+    }
+    const int topLevel = GetNumberOfLevels() - 1;
+    m_blockLevel = (topLevel < 3) ? topLevel : 3;
+}//end constructor
+
+TiledTIFFWriter::~TiledTIFFWriter() {
+}//end destructor
+
+bool TiledTIFFWriter::Write(const std::string &path, const TileSource &source) {
+    const MultiTileSource singleSource = [&source](int x, int y, int width, int height, unsigned char *const *dst, int rowStride) {
+        return source(x, y, width, height, dst[0], rowStride);
+    };
+    return Write(std::vector<std::string>(1, path), singleSource);
+}//end Write
+
+bool TiledTIFFWriter::Write(const std::vector<std::string> &paths, const MultiTileSource &source) {
+    if (paths.empty() || (m_width < 1) || (m_height < 1) || (m_tileSize < 16) || (m_tileSize % 16 != 0)
+        || ((m_channels != 1) && (m_channels != 3))) {
+        return false;
+    }
+    //BigTIFF header: little-endian, version 43, 8-byte offsets; the first directory offset is written last
+    std::vector<unsigned char> header;
+    header.push_back('I');
+    header.push_back('I');
+    appendLittleEndian(header, 43, 2);
+    appendLittleEndian(header, 8, 2);
+    appendLittleEndian(header, 0, 2);
+    appendLittleEndian(header, 0, 8);
+
+    m_outputs.clear();
+    bool success = true;
+    for (auto pit = paths.begin(); pit != paths.end(); ++pit) {
+        std::unique_ptr<Output> output(new Output());
+        output->file.open(*pit, std::ios::out | std::ios::binary | std::ios::trunc);
+        success = success && output->file.is_open();
+        output->file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        output->fileOffset = header.size();
+        for (auto it = m_levels.begin(); it != m_levels.end(); ++it) {
+            const size_t numTiles = static_cast<size_t>(it->tilesAcross) * it->tilesDown;
+            output->tileOffsets.push_back(std::vector<unsigned long long>(numTiles, 0));
+            output->tileByteCounts.push_back(std::vector<unsigned long long>(numTiles, 0));
+        }
+        m_outputs.push_back(std::move(output));
+    }
+    m_source = &source;
+    m_failed = false;
+
+    //The single top level tile covers the whole image
+    Tile top;
+    success = success && BuildTile(GetNumberOfLevels() - 1, 0, 0, top) && !m_failed;
+    for (auto it = m_outputs.begin(); it != m_outputs.end(); ++it) {
+        success = success && WriteDirectories(**it);
+        (*it)->file.close();
+        success = success && !(*it)->file.fail();
+    }
+    m_outputs.clear();
+    m_source = nullptr;
+    return success;
+}//end Write
+
+bool TiledTIFFWriter::BuildTile(const int &level, const int &col, const int &row, Tile &out) {
+    if (level == m_blockLevel) {
+        return BuildBlock(col, row, out);
+    }
+    //Children in quadtree order, so only one branch of the pyramid is held in memory
+    Tile children[4];
+    for (int q = 0; q < 4; q++) {
+        const int childCol = 2 * col + (q & 1);
+        const int childRow = 2 * row + (q >> 1);
+        if (IsTileInLevel(level - 1, childCol, childRow)) {
+            if (!BuildTile(level - 1, childCol, childRow, children[q])) {
+                return false;
+            }
+        }
+    }
+    const Tile *const childPointers[4] = { &children[0], &children[1], &children[2], &children[3] };
+    DownsampleTile(childPointers, level, col, row, out);
+    return AppendTile(level, col, row, out);
+}//end BuildTile
+
+bool TiledTIFFWriter::BuildBlock(const int &col, const int &row, Tile &out) {
+    //Level 0 tiles under this block, fetched and compressed in parallel
+    int n = 1 << m_blockLevel;
+    std::vector<Tile> current(static_cast<size_t>(n) * n);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n * n; i++) {
+        const int c = col * n + (i % n);
+        const int r = row * n + (i / n);
+        if (m_failed || !IsTileInLevel(0, c, r)) {
+            continue;
+        }
+        if (!FetchTile(c, r, current[i]) || !AppendTile(0, c, r, current[i])) {
+            m_failed = true;
+        }
+    }
+    //Each level of the block from the one below it, again in parallel
+    for (int level = 1; (level <= m_blockLevel) && !m_failed; level++) {
+        const int m = n / 2;
+        std::vector<Tile> next(static_cast<size_t>(m) * m);
+#pragma omp parallel for schedule(dynamic)
+        for (int j = 0; j < m * m; j++) {
+            const int c = col * m + (j % m);
+            const int r = row * m + (j / m);
+            if (m_failed || !IsTileInLevel(level, c, r)) {
+                continue;
+            }
+            const int cx = 2 * (j % m), cy = 2 * (j / m);
+            const Tile *const children[4] = { &current[cy * n + cx], &current[cy * n + cx + 1],
+                &current[(cy + 1) * n + cx], &current[(cy + 1) * n + cx + 1] };
+            DownsampleTile(children, level, c, r, next[j]);
+            if (!AppendTile(level, c, r, next[j])) {
+                m_failed = true;
+            }
+        }
+        current.swap(next);
+        n = m;
+    }
+    if (m_failed) {
+        return false;
+    }
+    out.swap(current[0]);
+    return true;
+}//end BuildBlock
+
+bool TiledTIFFWriter::FetchTile(const int &col, const int &row, Tile &out) {
+    const int x = col * m_tileSize;
+    const int y = row * m_tileSize;
+    const int w = (m_width - x < m_tileSize) ? (m_width - x) : m_tileSize;
+    const int h = (m_height - y < m_tileSize) ? (m_height - y) : m_tileSize;
+    out.resize(m_outputs.size());
+    std::vector<unsigned char*> dst(m_outputs.size());
+    for (size_t k = 0; k < m_outputs.size(); k++) {
+        out[k].assign(static_cast<size_t>(m_tileSize) * m_tileSize * m_channels, 0);
+        dst[k] = out[k].data();
+    }
+    return (*m_source)(x, y, w, h, dst.data(), m_tileSize * m_channels);
+}//end FetchTile
+
+void TiledTIFFWriter::DownsampleTile(const Tile *const (&children)[4], const int &level,
+    const int &col, const int &row, Tile &parent) const {
+    const int T = m_tileSize;
+    const int childWidth = m_levels[level - 1].width;
+    const int childHeight = m_levels[level - 1].height;
+    parent.resize(m_outputs.size());
+    for (size_t k = 0; k < m_outputs.size(); k++) {
+        parent[k].assign(static_cast<size_t>(T) * T * m_channels, 0);
+    }
+    for (int y = 0; y < T; y++) {
+        //Rows of the level below covered by this row, and which child tiles hold them
+        const int childY = 2 * (row * T + y);
+        const int qy = (2 * y) / T;
+        const int ly = 2 * y - qy * T;
+        for (int x = 0; x < T; x++) {
+            const int childX = 2 * (col * T + x);
+            const int qx = (2 * x) / T;
+            const int lx = 2 * x - qx * T;
+            const Tile &child = *children[qy * 2 + qx];
+            if (child.empty() || (childX >= childWidth) || (childY >= childHeight)) {
+                continue;
+            }
+            //Average only the samples inside the level below, so edges are not darkened by padding
+            const int nx = (childX + 1 < childWidth) ? 2 : 1;
+            const int ny = (childY + 1 < childHeight) ? 2 : 1;
+            const int count = nx * ny;
+            for (size_t k = 0; k < m_outputs.size(); k++) {
+                const unsigned char *src = child[k].data();
+                unsigned char *dst = parent[k].data() + (static_cast<size_t>(y) * T + x) * m_channels;
+                for (int c = 0; c < m_channels; c++) {
+                    int sum = 0;
+                    for (int dy = 0; dy < ny; dy++) {
+                        for (int dx = 0; dx < nx; dx++) {
+                            sum += src[(static_cast<size_t>(ly + dy) * T + lx + dx) * m_channels + c];
+                        }
+                    }
+                    dst[c] = static_cast<unsigned char>((sum + count / 2) / count);
+                }
+            }
+        }
+    }
+}//end DownsampleTile
+
+bool TiledTIFFWriter::AppendTile(const int &level, const int &col, const int &row, const Tile &tile) {
+    const int rowBytes = m_tileSize * m_channels;
+    const size_t index = static_cast<size_t>(row) * m_levels[level].tilesAcross + col;
+    bool success = true;
+    for (size_t k = 0; k < m_outputs.size(); k++) {
+        //Compress outside the lock; each row of the tile is packed separately
+        std::vector<unsigned char> compressed;
+        compressed.reserve(tile[k].size() + tile[k].size() / 64 + m_tileSize);
+        for (int y = 0; y < m_tileSize; y++) {
+            PackBitsEncode(tile[k].data() + static_cast<size_t>(y) * rowBytes, rowBytes, compressed);
+        }
+
+        Output &output = *m_outputs[k];
+        std::lock_guard<std::mutex> lock(output.fileMutex);
+        output.tileOffsets[level][index] = output.fileOffset;
+        output.tileByteCounts[level][index] = compressed.size();
+        output.file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+        output.fileOffset += compressed.size();
+        success = success && output.file.good();
+    }
+    return success;
+}//end AppendTile
+
+bool TiledTIFFWriter::WriteDirectories(Output &output) {
+    unsigned long long firstDirectoryOffset = 0;
+    unsigned long long previousNextOffsetPosition = 0;
+    for (int level = 0; level < GetNumberOfLevels(); level++) {
+        const Level &theLevel = m_levels[level];
+        const std::vector<unsigned long long> &tileOffsets = output.tileOffsets[level];
+        const std::vector<unsigned long long> &tileByteCounts = output.tileByteCounts[level];
+        const unsigned long long numTiles = tileOffsets.size();
+
+        //Offset and byte count arrays that do not fit in a directory entry are written before it
+        std::vector<unsigned char> buffer;
+        unsigned long long offsetsValue = tileOffsets[0];
+        unsigned long long byteCountsValue = tileByteCounts[0];
+        if (numTiles > 1) {
+            offsetsValue = output.fileOffset;
+            for (auto it = tileOffsets.begin(); it != tileOffsets.end(); ++it) {
+                appendLittleEndian(buffer, *it, 8);
+            }
+            byteCountsValue = output.fileOffset + buffer.size();
+            for (auto it = tileByteCounts.begin(); it != tileByteCounts.end(); ++it) {
+                appendLittleEndian(buffer, *it, 8);
+            }
+        }
+        //Directories start on a word boundary
+        if ((output.fileOffset + buffer.size()) % 2 != 0) {
+            buffer.push_back(0);
+        }
+        const unsigned long long directoryOffset = output.fileOffset + buffer.size();
+
+        //Bits per sample is 8 for each channel, stored in the entry itself (at most 3 shorts)
+        unsigned long long bitsPerSample = 0;
+        for (int c = 0; c < m_channels; c++) {
+            bitsPerSample |= 8ULL << (16 * c);
+        }
+        const int numEntries = 12;
+        appendLittleEndian(buffer, numEntries, 8);
+        appendEntry(buffer, TAG_NEW_SUBFILE_TYPE, TIFF_LONG, 1, (level == 0) ? 0 : 1); //1 is a reduced resolution image
+        appendEntry(buffer, TAG_IMAGE_WIDTH, TIFF_LONG, 1, theLevel.width);
+        appendEntry(buffer, TAG_IMAGE_LENGTH, TIFF_LONG, 1, theLevel.height);
+        appendEntry(buffer, TAG_BITS_PER_SAMPLE, TIFF_SHORT, m_channels, bitsPerSample);
+        appendEntry(buffer, TAG_COMPRESSION, TIFF_SHORT, 1, COMPRESSION_PACKBITS);
+        appendEntry(buffer, TAG_PHOTOMETRIC, TIFF_SHORT, 1, (m_channels == 1) ? 1 : 2); //MinIsBlack or RGB
+        appendEntry(buffer, TAG_SAMPLES_PER_PIXEL, TIFF_SHORT, 1, m_channels);
+        appendEntry(buffer, TAG_PLANAR_CONFIGURATION, TIFF_SHORT, 1, 1); //interleaved
+        appendEntry(buffer, TAG_TILE_WIDTH, TIFF_LONG, 1, m_tileSize);
+        appendEntry(buffer, TAG_TILE_LENGTH, TIFF_LONG, 1, m_tileSize);
+        appendEntry(buffer, TAG_TILE_OFFSETS, TIFF_LONG8, numTiles, offsetsValue);
+        appendEntry(buffer, TAG_TILE_BYTE_COUNTS, TIFF_LONG8, numTiles, byteCountsValue);
+        const unsigned long long nextOffsetPosition = output.fileOffset + buffer.size();
+        appendLittleEndian(buffer, 0, 8); //next directory, linked below
+
+        output.file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        output.fileOffset += buffer.size();
+
+        //Link this directory from the header or from the previous directory
+        if (level == 0) {
+            firstDirectoryOffset = directoryOffset;
+        }
+        else {
+            std::vector<unsigned char> link;
+            appendLittleEndian(link, directoryOffset, 8);
+            output.file.seekp(static_cast<std::streamoff>(previousNextOffsetPosition));
+            output.file.write(reinterpret_cast<const char*>(link.data()), link.size());
+            output.file.seekp(0, std::ios::end);
+        }
+        previousNextOffsetPosition = nextOffsetPosition;
+    }
+    std::vector<unsigned char> link;
+    appendLittleEndian(link, firstDirectoryOffset, 8);
+    output.file.seekp(8);
+    output.file.write(reinterpret_cast<const char*>(link.data()), link.size());
+    return output.file.good();
+}//end WriteDirectories
+
+void TiledTIFFWriter::PackBitsEncode(const unsigned char *src, const int &length, std::vector<unsigned char> &dst) {
+    int i = 0;
+    while (i < length) {
+        //A run of 3 or more identical bytes (at most 128) is written as a count and one byte
+        int run = 1;
+        while ((i + run < length) && (run < 128) && (src[i + run] == src[i])) {
+            run++;
+        }
+        if (run >= 3) {
+            dst.push_back(static_cast<unsigned char>(257 - run));
+            dst.push_back(src[i]);
+            i += run;
+            continue;
+        }
+        //Otherwise copy literal bytes (at most 128) up to the start of the next run
+        const int start = i;
+        while ((i < length) && (i - start < 128)) {
+            if ((i + 2 < length) && (src[i] == src[i + 1]) && (src[i] == src[i + 2])) {
+                break;
+            }
+            i++;
+        }
+        dst.push_back(static_cast<unsigned char>(i - start - 1));
+        dst.insert(dst.end(), src + start, src + i);
+    }
+}//end PackBitsEncode
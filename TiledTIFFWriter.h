@@ -0,0 +1,123 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDTIFFWRITER_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TILEDTIFFWRITER_H
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+///Writes an 8-bit grayscale or RGB image as a tiled, pyramidal BigTIFF file, with PackBits-compressed tiles.
+///Level 0 is followed by 2x2 box-filtered levels, each half the size of the one before, down to a single tile.
+///Tiles are requested from a TileSource and written in quadtree order, so that memory use depends only on
+///the tile size and the number of levels, not on the size of the image. Tiles are fetched, downsampled and
+///compressed in parallel (OpenMP); only the appends to the file are serialized. Several images of the
+///same size (for example, one per stain) can be written in the same traversal of the source.
+class TiledTIFFWriter
+{
+public:
+    ///Fill dst with the level 0 pixels of the region (x, y, width, height); rows of dst are rowStride bytes apart.
+    ///Called concurrently from several threads. Return false to abort writing.
+    typedef std::function<bool(int x, int y, int width, int height, unsigned char *dst, int rowStride)> TileSource;
+    ///As TileSource, but fills the same region of each of the images being written: dst[i] is the tile of image i
+    typedef std::function<bool(int x, int y, int width, int height, unsigned char *const *dst, int rowStride)> MultiTileSource;
+
+public:
+    ///Image size at level 0, number of channels (1 for grayscale or 3 for RGB), and tile width and height
+    TiledTIFFWriter(const int &width, const int &height, const int &channels, const int &tileSize = 256);
+    ///destructor
+    ~TiledTIFFWriter();
+
+    ///Number of pyramid levels that will be written, including level 0
+    inline int GetNumberOfLevels() const { return static_cast<int>(m_levels.size()); }
+    ///Width of a pyramid level in pixels
+    inline int GetLevelWidth(const int &level) const { return m_levels.at(level).width; }
+    ///Height of a pyramid level in pixels
+    inline int GetLevelHeight(const int &level) const { return m_levels.at(level).height; }
+
+    ///Write the pyramid to a file. Returns false if the file could not be written or the source aborted.
+    bool Write(const std::string &path, const TileSource &source);
+    ///Write one pyramid per path, with a single request to the source for each level 0 tile position
+    bool Write(const std::vector<std::string> &paths, const MultiTileSource &source);
+
+    ///Compress a row of bytes with the PackBits scheme (TIFF compression 32773), appending to dst
+    static void PackBitsEncode(const unsigned char *src, const int &length, std::vector<unsigned char> &dst);
+
+private:
+    ///Size and tile layout of one pyramid level
+    struct Level {
+        int width;
+        int height;
+        int tilesAcross;
+        int tilesDown;
+    };
+    ///One file being written, and where the tiles of each level were written in it
+    struct Output {
+        std::ofstream file;
+        std::mutex fileMutex;
+        unsigned long long fileOffset;
+        std::vector<std::vector<unsigned long long>> tileOffsets;
+        std::vector<std::vector<unsigned long long>> tileByteCounts;
+    };
+    ///Pixels of one tile of each output, tileSize rows of tileSize*channels bytes; empty if outside the image
+    typedef std::vector<std::vector<unsigned char>> Tile;
+
+    ///True if the tile exists at the level
+    inline bool IsTileInLevel(const int &level, const int &col, const int &row) const {
+        return (col < m_levels[level].tilesAcross) && (row < m_levels[level].tilesDown);
+    }
+
+    ///Produce and write a tile and everything below it in the pyramid, returning its pixels
+    bool BuildTile(const int &level, const int &col, const int &row, Tile &out);
+    ///Fetch all level 0 tiles under one tile of m_blockLevel in parallel, then write the levels up to m_blockLevel
+    bool BuildBlock(const int &col, const int &row, Tile &out);
+    ///Fetch one level 0 tile from the source; edge tiles are padded with zeros
+    bool FetchTile(const int &col, const int &row, Tile &out);
+    ///Average 2x2 pixels of the four child tiles (top-left, top-right, bottom-left, bottom-right) into a parent tile
+    void DownsampleTile(const Tile *const (&children)[4], const int &level, const int &col, const int &row, Tile &parent) const;
+    ///Compress a tile of each output and append it to its file (thread safe)
+    bool AppendTile(const int &level, const int &col, const int &row, const Tile &tile);
+    ///Write the offset and byte count arrays and the directory of each level, and link them from the header
+    bool WriteDirectories(Output &output);
+
+private:
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_tileSize;
+    ///Level whose tiles are built in one parallel block (at most 8x8 level 0 tiles)
+    int m_blockLevel;
+    std::vector<Level> m_levels;
+
+    const MultiTileSource *m_source;
+    std::vector<std::unique_ptr<Output>> m_outputs;
+    std::atomic<bool> m_failed;
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "TissueMask.h"
+#include "ODConversion.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double TissueMask::DefaultODThreshold = 0.15;
+
+TissueMask::TissueMask(const unsigned char *pixels, const int &width, const int &height, const int &channels,
+    const double &downsampleX, const double &downsampleY, const double &odThreshold /*= DefaultODThreshold*/)
+    : m_width((pixels != nullptr) && (channels >= 3) ? std::max(width, 0) : 0),
+    m_height((pixels != nullptr) && (channels >= 3) ? std::max(height, 0) : 0),
+    m_downsampleX((downsampleX > 0.0) ? downsampleX : 1.0),
+    m_downsampleY((downsampleY > 0.0) ? downsampleY : 1.0)
+{
+    const long long numCells = static_cast<long long>(m_width) * m_height;
+    m_bits.assign(static_cast<size_t>((numCells + 63) / 64), 0ULL);
+    if (numCells == 0) {
+        return;
+    }
+    ODConversion converter;
+    double lookupOD[256];
+    for (int i = 0; i < 256; i++) {
+        lookupOD[i] = converter.LookupRGBtoOD(i);
+    }
+
+    //Threshold the optical density sum of each pixel
+    std::vector<unsigned char> above(static_cast<size_t>(numCells), 0);
+    for (int row = 0; row < m_height; row++) {
+        const unsigned char *p = pixels + static_cast<long long>(row) * m_width * channels;
+        unsigned char *a = above.data() + static_cast<long long>(row) * m_width;
+        for (int col = 0; col < m_width; col++, p += channels) {
+            a[col] = (lookupOD[p[0]] + lookupOD[p[1]] + lookupOD[p[2]] > odThreshold) ? 1 : 0;
+        }
+    }
+    //Dilate by one cell
+    for (int row = 0; row < m_height; row++) {
+        const int r0 = std::max(row - 1, 0), r1 = std::min(row + 1, m_height - 1);
+        for (int col = 0; col < m_width; col++) {
+            const int c0 = std::max(col - 1, 0), c1 = std::min(col + 1, m_width - 1);
+            bool tissue = false;
+            for (int r = r0; (r <= r1) && !tissue; r++) {
+                for (int c = c0; (c <= c1) && !tissue; c++) {
+                    tissue = (above[static_cast<long long>(r) * m_width + c] != 0);
+                }
+            }
+            if (tissue) {
+                SetTissueCell(col, row);
+            }
+        }
+    }
+}//end constructor
+
+TissueMask::~TissueMask() {
+}//end destructor
+
+double TissueMask::GetTissueFraction() const {
+    const long long numCells = static_cast<long long>(m_width) * m_height;
+    if (numCells == 0) {
+        return 0.0;
+    }
+    long long count = 0;
+    for (auto it = m_bits.begin(); it != m_bits.end(); ++it) {
+        unsigned long long word = *it;
+        for (; word != 0; word &= word - 1) {
+            count++;
+        }
+    }
+    return static_cast<double>(count) / static_cast<double>(numCells);
+}//end GetTissueFraction
+
+bool TissueMask::IsTissue(const double &x, const double &y) const {
+    return IsTissueCell(static_cast<int>(std::floor(x / m_downsampleX)), static_cast<int>(std::floor(y / m_downsampleY)));
+}//end IsTissue
+
+bool TissueMask::IntersectsTissue(const double &x, const double &y, const double &width, const double &height) const {
+    if ((width <= 0.0) || (height <= 0.0)) {
+        return false;
+    }
+    //Cells that overlap the rectangle, clipped to the bitmap
+    const int col0 = std::max(static_cast<int>(std::floor(x / m_downsampleX)), 0);
+    const int row0 = std::max(static_cast<int>(std::floor(y / m_downsampleY)), 0);
+    const int col1 = std::min(static_cast<int>(std::ceil((x + width) / m_downsampleX)), m_width);
+    const int row1 = std::min(static_cast<int>(std::ceil((y + height) / m_downsampleY)), m_height);
+    for (int row = row0; row < row1; row++) {
+        for (int col = col0; col < col1; col++) {
+            if (IsTissueCell(col, row)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}//end IntersectsTissue
+
+void TissueMask::GetTileMask(const double &x, const double &y, const int &width, const int &height,
+    const double &scaleX, const double &scaleY, unsigned char *dst) const {
+    //Each pixel takes the cell under its centre
+    std::vector<int> cols(static_cast<size_t>(std::max(width, 0)));
+    for (int i = 0; i < width; i++) {
+        cols[i] = static_cast<int>(std::floor((x + (i + 0.5) * scaleX) / m_downsampleX));
+    }
+    for (int j = 0; j < height; j++) {
+        const int row = static_cast<int>(std::floor((y + (j + 0.5) * scaleY) / m_downsampleY));
+        unsigned char *d = dst + static_cast<long long>(j) * width;
+        for (int i = 0; i < width; i++) {
+            d[i] = IsTissueCell(cols[i], row) ? 255 : 0;
+        }
+    }
+}//end GetTileMask
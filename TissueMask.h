@@ -0,0 +1,97 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_TISSUEMASK_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_TISSUEMASK_H
+
+#include <cstddef>
+#include <vector>
+
+///A bitmap of the tissue in a slide, detected once on a low resolution level of the image.
+///A cell of the bitmap (one pixel of the low resolution level) is tissue if the sum of the
+///optical densities of its RGB channels is above a threshold, or if one of its eight neighbours
+///is, so that the edges of the tissue are not lost to the low resolution. Queries are made in
+///full resolution (level 0) coordinates, which lets whole-slide operations skip the tiles of glass.
+class TissueMask
+{
+public:
+    ///Optical density sum above which a low resolution pixel is tissue
+    static const double DefaultODThreshold;
+
+public:
+    ///Detect the tissue in an interleaved 8-bit RGB(A) image, which is the full resolution image
+    ///downsampled by downsampleX and downsampleY
+    TissueMask(const unsigned char *pixels, const int &width, const int &height, const int &channels,
+        const double &downsampleX, const double &downsampleY, const double &odThreshold = DefaultODThreshold);
+    ///destructor
+    ~TissueMask();
+
+    ///Width of the bitmap in cells
+    inline int GetWidth() const { return m_width; }
+    ///Height of the bitmap in cells
+    inline int GetHeight() const { return m_height; }
+    ///Number of full resolution pixels per cell, horizontally
+    inline double GetDownsampleX() const { return m_downsampleX; }
+    ///Number of full resolution pixels per cell, vertically
+    inline double GetDownsampleY() const { return m_downsampleY; }
+    ///Fraction of the cells that are tissue
+    double GetTissueFraction() const;
+    ///Size of the bitmap in bytes
+    inline size_t GetSizeInBytes() const { return m_bits.size() * sizeof(unsigned long long); }
+
+    ///True if the cell at (col, row) is tissue; cells outside the bitmap are not
+    inline bool IsTissueCell(const int &col, const int &row) const {
+        if ((col < 0) || (row < 0) || (col >= m_width) || (row >= m_height)) {
+            return false;
+        }
+        const long long i = static_cast<long long>(row) * m_width + col;
+        return ((m_bits[i >> 6] >> (i & 63)) & 1ULL) != 0;
+    }
+    ///True if the full resolution pixel (x, y) is in a tissue cell
+    bool IsTissue(const double &x, const double &y) const;
+    ///True if any cell overlapping the full resolution rectangle is tissue
+    bool IntersectsTissue(const double &x, const double &y, const double &width, const double &height) const;
+    ///Write 255 for tissue and 0 for glass to each pixel of a width x height tile, whose top-left
+    ///pixel is at full resolution (x, y) and whose pixels are scaleX x scaleY full resolution pixels
+    void GetTileMask(const double &x, const double &y, const int &width, const int &height,
+        const double &scaleX, const double &scaleY, unsigned char *dst) const;
+
+private:
+    ///Set the bit of a cell
+    inline void SetTissueCell(const int &col, const int &row) {
+        const long long i = static_cast<long long>(row) * m_width + col;
+        m_bits[i >> 6] |= (1ULL << (i & 63));
+    }
+
+private:
+    int m_width;
+    int m_height;
+    double m_downsampleX;
+    double m_downsampleY;
+    ///One bit per cell, row by row
+    std::vector<unsigned long long> m_bits;
+};
+
+#endif
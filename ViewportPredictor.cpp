@@ -0,0 +1,253 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#include "ViewportPredictor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+const double ViewportPredictor::DefaultLookahead = 1.0;
+const char *const ViewportPredictor::LookaheadVariable = "STAIN_ANALYSIS_PREFETCH_LOOKAHEAD";
+
+namespace {
+    ///Prefetched chunks that are not viewed are forgotten after this many, as they have likely left the cache
+    const size_t MaxRememberedChunks = 16384;
+    ///A move of more than this many viewport widths is a jump, not a pan
+    const double MaxPanViewports = 4.0;
+}
+
+ViewportPredictor::ViewportPredictor(const long long &imageWidth, const long long &imageHeight,
+    const std::vector<double> &levelDownsamples, const int &chunkSize /*= 512*/, const double &lookahead /*= DefaultLookahead*/)
+    : m_imageWidth(imageWidth),
+    m_imageHeight(imageHeight),
+    m_levelDownsamples(levelDownsamples),
+    m_chunkSize((chunkSize > 0) ? chunkSize : 512),
+    m_lookahead((lookahead > 0.0) ? lookahead : 0.0),
+    m_hasPrevious(false),
+    m_previous(),
+    m_velocityX(0.0),
+    m_velocityY(0.0),
+    m_requestedCount(0),
+    m_hitCount(0),
+    m_prefetchedCount(0)
+{
+    if (m_levelDownsamples.empty()) {
+        m_levelDownsamples.push_back(1.0);
+    }
+}//end constructor
+
+ViewportPredictor::~ViewportPredictor() {
+}//end destructor
+
+double ViewportPredictor::LookaheadFromEnvironment() {
+    const char *value = std::getenv(LookaheadVariable);
+    if (value != nullptr) {
+        char *end = nullptr;
+        const double lookahead = std::strtod(value, &end);
+        if ((end != value) && (*end == '\0') && (lookahead >= 0.0)) {
+            return lookahead;
+        }
+    }
+    return DefaultLookahead;
+}//end LookaheadFromEnvironment
+
+long long ViewportPredictor::ChunkSpan(const int &level) const {
+    const double downsample = m_levelDownsamples.at(level);
+    const long long span = static_cast<long long>(std::llround(m_chunkSize * downsample));
+    return (span > 0) ? span : 1;
+}//end ChunkSpan
+
+ViewportPredictor::ChunkIndex ViewportPredictor::IndexOf(const View &chunk) const {
+    const long long span = ChunkSpan(chunk.level);
+    return ChunkIndex(chunk.level, chunk.x / span, chunk.y / span);
+}//end IndexOf
+
+void ViewportPredictor::AppendChunks(const View &view, const double &centreX, const double &centreY,
+    std::set<ChunkIndex> &exclude, std::vector<View> &chunks) const {
+    if ((view.level < 0) || (view.level >= static_cast<int>(m_levelDownsamples.size()))) {
+        return;
+    }
+    //Clip to the image
+    const long long x0 = std::max(view.x, 0LL);
+    const long long y0 = std::max(view.y, 0LL);
+    const long long x1 = std::min(view.x + view.width, m_imageWidth);
+    const long long y1 = std::min(view.y + view.height, m_imageHeight);
+    if ((x1 <= x0) || (y1 <= y0)) {
+        return;
+    }
+    const long long span = ChunkSpan(view.level);
+    const size_t first = chunks.size();
+    for (long long row = y0 / span; row <= (y1 - 1) / span; row++) {
+        for (long long col = x0 / span; col <= (x1 - 1) / span; col++) {
+            if (!exclude.insert(ChunkIndex(view.level, col, row)).second) {
+                continue;
+            }
+            View chunk;
+            chunk.x = col * span;
+            chunk.y = row * span;
+            chunk.width = std::min(span, m_imageWidth - chunk.x);
+            chunk.height = std::min(span, m_imageHeight - chunk.y);
+            chunk.level = view.level;
+            chunks.push_back(chunk);
+        }
+    }
+    auto distance = [&](const View &c) {
+        const double dx = c.x + 0.5 * c.width - centreX;
+        const double dy = c.y + 0.5 * c.height - centreY;
+        return dx * dx + dy * dy;
+    };
+    std::stable_sort(chunks.begin() + first, chunks.end(), 
+        [&](const View &a, const View &b) { return distance(a) < distance(b); });
+}//end AppendChunks
+
+std::set<ViewportPredictor::ChunkIndex> ViewportPredictor::ChunksOf(const View &view) const {
+    std::set<ChunkIndex> indices;
+    std::vector<View> chunks;
+    AppendChunks(view, 0.0, 0.0, indices, chunks);
+    return indices;
+}//end ChunksOf
+
+std::vector<ViewportPredictor::View> ViewportPredictor::Observe(const View &view) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    //Count the chunks newly shown in this viewport, and those of them that were prefetched
+    std::set<ChunkIndex> exclude = ChunksOf(view);
+    for (auto it = exclude.begin(); it != exclude.end(); ++it) {
+        if (m_previousChunks.count(*it) == 0) {
+            m_requestedCount++;
+            m_hitCount += static_cast<long long>(m_prefetched.erase(*it));
+        }
+    }
+    m_previousChunks = exclude;
+
+    //Smooth the pan velocity over successive viewports at the same level; zooming or jumping resets it
+    const double centreX = view.x + 0.5 * view.width;
+    const double centreY = view.y + 0.5 * view.height;
+    if (m_hasPrevious && (m_previous.level == view.level)) {
+        const double dx = centreX - (m_previous.x + 0.5 * m_previous.width);
+        const double dy = centreY - (m_previous.y + 0.5 * m_previous.height);
+        if ((std::abs(dx) > MaxPanViewports * view.width) || (std::abs(dy) > MaxPanViewports * view.height)) {
+            m_velocityX = 0.0;
+            m_velocityY = 0.0;
+        }
+        else if ((m_velocityX == 0.0) && (m_velocityY == 0.0)) {
+            //The first step of a pan
+            m_velocityX = dx;
+            m_velocityY = dy;
+        }
+        else {
+            m_velocityX = 0.5 * m_velocityX + 0.5 * dx;
+            m_velocityY = 0.5 * m_velocityY + 0.5 * dy;
+        }
+    }
+    else {
+        m_velocityX = 0.0;
+        m_velocityY = 0.0;
+    }
+    m_hasPrevious = true;
+    m_previous = view;
+
+    std::vector<View> chunks;
+    if (!IsEnabled()) {
+        return chunks;
+    }
+    //Chunks already prefetched are not predicted again
+    exclude.insert(m_prefetched.begin(), m_prefetched.end());
+
+    //Pan: the viewport moved on by the velocity, one viewport step at a time up to the lookahead
+    if ((std::abs(m_velocityX) >= 1.0) || (std::abs(m_velocityY) >= 1.0)) {
+        const int steps = static_cast<int>(std::ceil(m_lookahead));
+        for (int s = 1; s <= steps; s++) {
+            const double k = std::min(static_cast<double>(s), m_lookahead);
+            View ahead = view;
+            ahead.x += static_cast<long long>(std::llround(k * m_velocityX));
+            ahead.y += static_cast<long long>(std::llround(k * m_velocityY));
+            AppendChunks(ahead, centreX, centreY, exclude, chunks);
+        }
+    }
+    //Zoom in: the centre of the viewport at the next finer level
+    const int numLevels = static_cast<int>(m_levelDownsamples.size());
+    if ((view.level > 0) && (view.level < numLevels)) {
+        const double ratio = m_levelDownsamples[view.level] / m_levelDownsamples[view.level - 1];
+        View finer = view;
+        finer.width = static_cast<long long>(view.width / ratio);
+        finer.height = static_cast<long long>(view.height / ratio);
+        finer.x = static_cast<long long>(centreX) - finer.width / 2;
+        finer.y = static_cast<long long>(centreY) - finer.height / 2;
+        finer.level = view.level - 1;
+        AppendChunks(finer, centreX, centreY, exclude, chunks);
+    }
+    //Zoom out: the surroundings of the viewport at the next coarser level
+    if ((view.level >= 0) && (view.level + 1 < numLevels)) {
+        const double ratio = m_levelDownsamples[view.level + 1] / m_levelDownsamples[view.level];
+        View coarser = view;
+        coarser.width = static_cast<long long>(view.width * ratio);
+        coarser.height = static_cast<long long>(view.height * ratio);
+        coarser.x = static_cast<long long>(centreX) - coarser.width / 2;
+        coarser.y = static_cast<long long>(centreY) - coarser.height / 2;
+        coarser.level = view.level + 1;
+        AppendChunks(coarser, centreX, centreY, exclude, chunks);
+    }
+
+    const size_t maxChunks = static_cast<size_t>(MaxChunksPerViewport * std::max(m_lookahead, 1.0));
+    if (chunks.size() > maxChunks) {
+        chunks.resize(maxChunks);
+    }
+    return chunks;
+}//end Observe
+
+void ViewportPredictor::MarkPrefetched(const View &chunk) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_prefetched.size() >= MaxRememberedChunks) {
+        m_prefetched.clear();
+    }
+    m_prefetched.insert(IndexOf(chunk));
+    m_prefetchedCount++;
+}//end MarkPrefetched
+
+long long ViewportPredictor::GetRequestedChunkCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_requestedCount;
+}//end GetRequestedChunkCount
+
+long long ViewportPredictor::GetHitChunkCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hitCount;
+}//end GetHitChunkCount
+
+long long ViewportPredictor::GetPrefetchedChunkCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_prefetchedCount;
+}//end GetPrefetchedChunkCount
+
+double ViewportPredictor::GetHitRate() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (m_requestedCount > 0) ? static_cast<double>(m_hitCount) / m_requestedCount : 0.0;
+}//end GetHitRate
+
+double ViewportPredictor::GetAccuracy() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (m_prefetchedCount > 0) ? static_cast<double>(m_hitCount) / m_prefetchedCount : 0.0;
+}//end GetAccuracy
@@ -0,0 +1,126 @@
+/*=============================================================================
+ *
+ *  Copyright (c) 2021 Sunnybrook Research Institute
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ *=============================================================================*/
+
+
+#ifndef SEDEEN_SRC_PLUGINS_STAINANALYSIS_VIEWPORTPREDICTOR_H
+#define SEDEEN_SRC_PLUGINS_STAINANALYSIS_VIEWPORTPREDICTOR_H
+
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <vector>
+
+///Predicts which chunks of a pyramidal image will be viewed next, so that they can be
+///computed before they are requested: the viewport moved on by its recent pan velocity,
+///and the viewport at the next finer and coarser resolution levels (zooming in or out).
+///Also measures how well the predictions work: the fraction of the chunks newly shown in each
+///viewport that had been prefetched, and the fraction of prefetched chunks that were viewed.
+///Does not depend on the Sedeen SDK. Safe to use from several threads.
+class ViewportPredictor
+{
+public:
+    ///A rectangle in level 0 pixel coordinates, shown or computed at a resolution level
+    struct View {
+        long long x;
+        long long y;
+        long long width;
+        long long height;
+        int level;
+    };
+
+    ///Lookahead used if STAIN_ANALYSIS_PREFETCH_LOOKAHEAD is not set or not valid
+    static const double DefaultLookahead;
+    ///Environment variable holding the lookahead, in viewports; 0 disables prefetching
+    static const char *const LookaheadVariable;
+    ///Most chunks predicted for one viewport, per viewport of lookahead
+    static const int MaxChunksPerViewport = 48;
+
+public:
+    ///Image size at level 0, the downsample factor of each resolution level (level 0 first),
+    ///the chunk size in pixels at each level, and how many viewports ahead to predict panning
+    ViewportPredictor(const long long &imageWidth, const long long &imageHeight, 
+        const std::vector<double> &levelDownsamples, const int &chunkSize = 512, const double &lookahead = DefaultLookahead);
+    ///destructor
+    ~ViewportPredictor();
+
+    ///Lookahead from the environment variable, or the default
+    static double LookaheadFromEnvironment();
+
+    ///True if predictions are made (the lookahead is positive)
+    inline bool IsEnabled() const { return m_lookahead > 0.0; }
+
+    ///Record the viewport now shown, counting its chunks that were prefetched, and return the chunks
+    ///to prefetch next, most likely first. Chunks of the viewport itself are not returned.
+    std::vector<View> Observe(const View &view);
+    ///Record that a chunk returned by Observe has been computed
+    void MarkPrefetched(const View &chunk);
+
+    ///Number of chunks of observed viewports that were not in the viewport before
+    long long GetRequestedChunkCount() const;
+    ///Number of those chunks that had been prefetched
+    long long GetHitChunkCount() const;
+    ///Number of chunks prefetched
+    long long GetPrefetchedChunkCount() const;
+    ///Fraction of the chunks newly shown in observed viewports that had been prefetched
+    double GetHitRate() const;
+    ///Fraction of prefetched chunks that were then viewed
+    double GetAccuracy() const;
+
+private:
+    ///Level, column and row of a chunk
+    typedef std::tuple<int, long long, long long> ChunkIndex;
+
+    ///Size of a chunk of a level in level 0 pixels
+    long long ChunkSpan(const int &level) const;
+    ///Append the chunks of the level that intersect a rectangle (clipped to the image), nearest to (centreX, centreY)
+    ///first, skipping any in exclude and adding the others to it
+    void AppendChunks(const View &view, const double &centreX, const double &centreY,
+        std::set<ChunkIndex> &exclude, std::vector<View> &chunks) const;
+    ///Indices of the chunks of a view
+    std::set<ChunkIndex> ChunksOf(const View &view) const;
+    ///Index of a chunk returned by AppendChunks
+    ChunkIndex IndexOf(const View &chunk) const;
+
+private:
+    long long m_imageWidth;
+    long long m_imageHeight;
+    std::vector<double> m_levelDownsamples;
+    int m_chunkSize;
+    double m_lookahead;
+
+    mutable std::mutex m_mutex;
+    bool m_hasPrevious;
+    View m_previous;
+    std::set<ChunkIndex> m_previousChunks;
+    ///Smoothed pan velocity of the viewport centre, in level 0 pixels per observation
+    double m_velocityX;
+    double m_velocityY;
+    ///Chunks prefetched and not yet viewed
+    std::set<ChunkIndex> m_prefetched;
+    long long m_requestedCount;
+    long long m_hitCount;
+    long long m_prefetchedCount;
+};
+
+#endif